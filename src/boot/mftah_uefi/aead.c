@@ -0,0 +1,335 @@
+#include "core/aead.h"
+#include "core/progress.h"
+#include "core/memory.h"
+#include "drivers/threading.h"
+
+
+
+STATIC CONST CHAR8 mAeadKeyLabel[] = "MFTAH-UEFI authenticated payload";
+
+
+/**
+ * A payload key, set up for the cipher its header names.
+ */
+typedef
+struct {
+    UINT32                              Cipher;
+    union {
+        struct AES_GCM_ctx              Gcm;
+        struct ChaCha20Poly1305         ChaCha;
+    };
+} AEAD_KEY;
+
+
+/**
+ * The segments of one payload. The BSP and every AP helping it pull segment
+ *  indices from 'NextSegment' until none are left.
+ */
+typedef
+struct {
+    CONST AEAD_KEY              *Key;
+    CONST MFTAH_AEAD_HEADER     *Header;
+    CONST UINT8                 *Tags;
+    UINT8                       *Ciphertext;
+    UINT32 VOLATILE             NextSegment;
+    UINT32 VOLATILE             DoneSegments;
+    UINT32 VOLATILE             FailedSegments;
+} AEAD_DECRYPT_JOB;
+
+
+
+/**
+ * Check the header fields against each other and against the file size.
+ */
+STATIC
+BOOLEAN
+EFIAPI
+AeadValidateHeader(IN CONST MFTAH_AEAD_HEADER *Header,
+                   IN UINT64 FileSize)
+{
+    UINT64 SegmentCount = 0;
+
+    if (
+        MFTAH_AEAD_SIGNATURE != Header->Signature
+        || MFTAH_AEAD_VERSION != Header->Version
+        || 0 == Header->PlaintextLength
+        || 0 != (Header->PlaintextLength % AES_BLOCKLEN)
+        || 0 != (Header->SegmentSize % AES_BLOCKLEN)
+        || Header->SegmentSize < MFTAH_AEAD_MIN_SEGMENT_SIZE
+        || Header->SegmentSize > MFTAH_AEAD_MAX_SEGMENT_SIZE
+        || Header->Cipher > MFTAH_AEAD_CIPHER_CHACHA20_POLY1305
+    ) {
+        return FALSE;
+    }
+
+    SegmentCount = (Header->PlaintextLength + Header->SegmentSize - 1) / Header->SegmentSize;
+
+    return SegmentCount == Header->SegmentCount
+        && FileSize == sizeof(MFTAH_AEAD_HEADER) + (SegmentCount * MFTAH_AEAD_TAG_LENGTH) + Header->PlaintextLength;
+}
+
+
+/**
+ * Derive the payload key from the password and set it up for the payload's cipher.
+ */
+STATIC
+VOID
+EFIAPI
+AeadInitializeKey(IN CONST MFTAH_AEAD_HEADER *Header,
+                  IN CONST UINT8 *Password,
+                  IN UINT8 PasswordLength,
+                  OUT AEAD_KEY *Context)
+{
+    UINT8 Message[sizeof(mAeadKeyLabel) + MFTAH_AEAD_SALT_LENGTH] = {0};
+    UINT8 Key[SIZE_OF_SHA_256_HASH] = {0};
+
+    CopyMem(Message, (VOID *)mAeadKeyLabel, sizeof(mAeadKeyLabel));
+    CopyMem(Message + sizeof(mAeadKeyLabel), (VOID *)Header->Salt, MFTAH_AEAD_SALT_LENGTH);
+
+    hmac_sha256(Password, PasswordLength, Message, sizeof(Message), Key);
+
+    Context->Cipher = Header->Cipher;
+    if (MFTAH_AEAD_CIPHER_CHACHA20_POLY1305 == Header->Cipher) {
+        chacha20_poly1305_init(&(Context->ChaCha), Key, chacha20_poly1305_simd_level());
+    } else {
+        AES_GCM_init(&(Context->Gcm), Key, AES_GCM_is_accelerated());
+    }
+
+    SetMem(Key, sizeof(Key), 0x00);
+}
+
+
+/**
+ * Build the IV of a segment, or of the header with MFTAH_AEAD_HEADER_INDEX.
+ */
+STATIC
+VOID
+EFIAPI
+AeadSegmentIv(IN CONST MFTAH_AEAD_HEADER *Header,
+              IN UINT64 Index,
+              OUT UINT8 *Iv)
+{
+    CopyMem(Iv, (VOID *)Header->NoncePrefix, MFTAH_AEAD_NONCE_PREFIX_LENGTH);
+
+    for (UINTN i = 0; i < sizeof(UINT64); ++i) {
+        Iv[MFTAH_AEAD_IV_LENGTH - 1 - i] = (UINT8)(Index >> (8 * i));
+    }
+}
+
+
+/**
+ * Authenticate and decrypt a buffer in place with the payload's cipher. Runs on the
+ *  BSP and on APs alike.
+ *
+ * @returns 0 if the tag matches, -1 otherwise.
+ */
+STATIC
+INT32
+EFIAPI
+AeadOpen(IN CONST AEAD_KEY *Key,
+         IN CONST UINT8 *Iv,
+         IN CONST UINT8 *Aad,
+         IN UINTN AadLength,
+         IN OUT UINT8 *Buffer,
+         IN UINTN Length,
+         IN CONST UINT8 *Tag)
+{
+    struct ChaCha20Poly1305 ChaCha;
+    INT32 Result = 0;
+
+    if (MFTAH_AEAD_CIPHER_AES_256_GCM == Key->Cipher) {
+        return AES_GCM_decrypt(&(Key->Gcm), Iv, Aad, AadLength, Buffer, Length, Tag);
+    }
+
+    /* The YMM state may not be enabled on this core even if the CPU has AVX2. */
+    CopyMem(&ChaCha, (VOID *)&(Key->ChaCha), sizeof(ChaCha));
+    if (CHACHA20_SIMD_AVX2 == ChaCha.simd && !MemoryAvx2Usable()) {
+        ChaCha.simd = CHACHA20_SIMD_SSE2;
+    }
+
+    Result = chacha20_poly1305_decrypt(&ChaCha, Iv, Aad, AadLength, Buffer, Length, Tag);
+
+    SetMem(&ChaCha, sizeof(ChaCha), 0x00);
+    return Result;
+}
+
+
+/**
+ * Authenticate and decrypt one segment in place. Runs on the BSP and on APs alike,
+ *  so it must not use any boot services.
+ */
+STATIC
+VOID
+EFIAPI
+AeadDecryptSegment(IN AEAD_DECRYPT_JOB *Job,
+                   IN UINT32 Segment)
+{
+    CONST MFTAH_AEAD_HEADER *Header = Job->Header;
+    UINT64 Offset = (UINT64)Segment * Header->SegmentSize;
+    UINT8 Iv[MFTAH_AEAD_IV_LENGTH] = {0};
+
+    AeadSegmentIv(Header, Segment, Iv);
+
+    if (0 != AeadOpen(Job->Key,
+                      Iv,
+                      (CONST UINT8 *)Header,
+                      MFTAH_AEAD_AAD_LENGTH,
+                      Job->Ciphertext + Offset,
+                      (UINTN)MIN((UINT64)Header->SegmentSize, Header->PlaintextLength - Offset),
+                      Job->Tags + ((UINT64)Segment * MFTAH_AEAD_TAG_LENGTH))
+    ) {
+        __sync_fetch_and_add(&(Job->FailedSegments), 1);
+    }
+
+    __sync_fetch_and_add(&(Job->DoneSegments), 1);
+}
+
+
+/**
+ * Take segments until none are left. This is what the helping APs run.
+ *
+ * @param[in]  Context  The AEAD_DECRYPT_JOB to work on.
+ */
+STATIC
+VOID
+EFIAPI
+AeadDecryptSegments(IN VOID *Context)
+{
+    AEAD_DECRYPT_JOB *Job = (AEAD_DECRYPT_JOB *)Context;
+    UINT32 Segment;
+
+    while ((Segment = __sync_fetch_and_add(&(Job->NextSegment), 1)) < Job->Header->SegmentCount) {
+        AeadDecryptSegment(Job, Segment);
+    }
+}
+
+
+BOOLEAN
+EFIAPI
+AeadIsPayload(IN CONST VOID *Buffer,
+              IN UINT64 Length)
+{
+    return Length >= sizeof(MFTAH_AEAD_HEADER)
+        && MFTAH_AEAD_SIGNATURE == ((CONST MFTAH_AEAD_HEADER *)Buffer)->Signature;
+}
+
+
+EFI_STATUS
+EFIAPI
+AeadCheckPassword(IN CONST MFTAH_AEAD_HEADER *Header,
+                  IN UINT64 FileSize,
+                  IN CONST UINT8 *Password,
+                  IN UINT8 PasswordLength)
+{
+    AEAD_KEY Key = {0};
+    UINT8 Iv[MFTAH_AEAD_IV_LENGTH] = {0};
+    INT32 Result = 0;
+
+    if (!AeadValidateHeader(Header, FileSize)) {
+        EFI_WARNINGLN(L"The authenticated payload header is malformed.");
+        return EFI_ABORTED;
+    }
+
+    AeadInitializeKey(Header, Password, PasswordLength, &Key);
+    AeadSegmentIv(Header, MFTAH_AEAD_HEADER_INDEX, Iv);
+
+    /* The header is sealed with an empty message: only its tag is checked. */
+    Result = AeadOpen(&Key, Iv, (CONST UINT8 *)Header, MFTAH_AEAD_AAD_LENGTH, NULL, 0, Header->HeaderTag);
+
+    SetMem(&Key, sizeof(Key), 0x00);
+
+    return 0 == Result ? EFI_SUCCESS : EFI_INVALID_PASSWORD;
+}
+
+
+EFI_STATUS
+EFIAPI
+AeadDecryptPayload(IN OUT UINT8 *Buffer,
+                   IN UINT64 FileSize,
+                   IN CONST UINT8 *Password,
+                   IN UINT8 PasswordLength,
+                   IN DECRYPT_IDLE_HOOK Idle OPTIONAL,
+                   IN VOID *IdleContext OPTIONAL,
+                   OUT UINT8 **RamdiskImage,
+                   OUT UINT64 *RamdiskLength)
+{
+    CONST MFTAH_AEAD_HEADER *Header = (CONST MFTAH_AEAD_HEADER *)Buffer;
+    AEAD_KEY Key = {0};
+    AEAD_DECRYPT_JOB Job = {0};
+    MFTAH_THREAD *Helpers = NULL;
+    UINTN HelperCount = 0, Started = 0;
+    UINT32 Segment;
+
+    if (!AeadIsPayload(Buffer, FileSize) || !AeadValidateHeader(Header, FileSize)) {
+        return EFI_ABORTED;
+    }
+
+    AeadInitializeKey(Header, Password, PasswordLength, &Key);
+
+    Job.Key = &Key;
+    Job.Header = Header;
+    Job.Tags = Buffer + sizeof(MFTAH_AEAD_HEADER);
+    Job.Ciphertext = Buffer + sizeof(MFTAH_AEAD_HEADER) + ((UINT64)Header->SegmentCount * MFTAH_AEAD_TAG_LENGTH);
+
+    DPRINTLN(L"-- Authenticated payload: (%u) segments of (%u) bytes, %s.",
+             Header->SegmentCount, Header->SegmentSize,
+             MFTAH_AEAD_CIPHER_AES_256_GCM == Key.Cipher
+                ? (Key.Gcm.accelerated ? L"AES-256-GCM with AES-NI" : L"AES-256-GCM in software")
+                : (CHACHA20_SIMD_AVX2 == Key.ChaCha.simd ? L"ChaCha20-Poly1305 with AVX2" : L"ChaCha20-Poly1305 with SSE2"));
+
+    /* Idle APs each take segments too; helpers which can't be started are simply not waited on. */
+    if (IsThreadingEnabled() && Header->SegmentCount > 1) {
+        HelperCount = MIN(MIN(GetThreadLimit(), (UINTN)(Header->SegmentCount - 1)), MFTAH_MAX_THREAD_COUNT);
+        if (HelperCount > 0) {
+            Helpers = (MFTAH_THREAD *)AllocateZeroPool(HelperCount * sizeof(MFTAH_THREAD));
+            if (NULL == Helpers) HelperCount = 0;
+        }
+    }
+
+    for (Started = 0; Started < HelperCount; ++Started) {
+        if (EFI_ERROR(CreateThread(AeadDecryptSegments, (VOID *)&Job, &(Helpers[Started])))) break;
+
+        if (EFI_ERROR(StartThread(&(Helpers[Started]), FALSE))) {
+            uefi_call_wrapper(BS->CloseEvent, 1, Helpers[Started].CompletionEvent);
+            break;
+        }
+    }
+
+    ProgressBegin();
+
+    /* While APs hold segments, the BSP would rather do the idle work (like reading
+        the next payload); it takes segments itself once there is none left. */
+    while (TRUE) {
+        ProgressUpdate(Job.DoneSegments, Header->SegmentCount);
+
+        if (Started > 0 && NULL != Idle && Idle(IdleContext)) continue;
+
+        Segment = __sync_fetch_and_add(&(Job.NextSegment), 1);
+        if (Segment >= Header->SegmentCount) break;
+
+        AeadDecryptSegment(&Job, Segment);
+    }
+
+    for (UINTN i = 0; i < Started; ++i) {
+        JoinThread(&(Helpers[i]));
+        uefi_call_wrapper(BS->CloseEvent, 1, Helpers[i].CompletionEvent);
+    }
+    if (NULL != Helpers) FreePool(Helpers);
+
+    ProgressUpdate(Header->SegmentCount, Header->SegmentCount);
+    ProgressEnd();
+
+    DPRINTLN(L"-- Decrypted the segments with (%u) helper processors.", Started);
+
+    SetMem(&Key, sizeof(Key), 0x00);
+
+    if (0 != Job.FailedSegments) {
+        EFI_WARNINGLN(L"(%u) segments of the authenticated payload failed authentication.", Job.FailedSegments);
+        return EFI_SECURITY_VIOLATION;
+    }
+
+    *RamdiskImage = Job.Ciphertext;
+    *RamdiskLength = Header->PlaintextLength;
+
+    return EFI_SUCCESS;
+}
@@ -0,0 +1,334 @@
+#include "core/arena.h"
+#include "core/memory.h"
+#include "core/util.h"
+#include "drivers/threading.h"
+
+
+
+ARENA gLoaderArena = { NULL, NULL, MFTAH_ARENA_SLAB_SIZE, 0 };
+
+
+#define ARENA_ALIGN(x) \
+    (((x) + (MFTAH_ARENA_ALIGNMENT - 1)) & ~((UINTN)(MFTAH_ARENA_ALIGNMENT - 1)))
+
+#define ARENA_SLAB_DATA(Slab) \
+    ((UINT8 *)(Slab) + sizeof(ARENA_SLAB))
+
+#define ARENA_BLOCK_OF(Pointer) \
+    ((ARENA_BLOCK *)((UINT8 *)(Pointer) - sizeof(ARENA_BLOCK)))
+
+/* Whether a block is the most recent one of a slab, which allows it to be resized in place. */
+#define ARENA_IS_TOP_BLOCK(Slab, Pointer) \
+    (NULL != (Slab) && ((UINT8 *)(Pointer) + ARENA_BLOCK_OF(Pointer)->Size) == (ARENA_SLAB_DATA(Slab) + (Slab)->Used))
+
+
+static
+inline
+VOID
+ArenaLock(IN ARENA *Arena)
+{
+    while (__sync_lock_test_and_set(&Arena->Lock, 1)) {
+        __asm__ __volatile__ ("pause");
+    }
+}
+
+
+static
+inline
+VOID
+ArenaUnlock(IN ARENA *Arena)
+{
+    __sync_lock_release(&Arena->Lock);
+}
+
+
+/**
+ * Reserve a new slab from the firmware. This is a boot service call.
+ *
+ * @param[in]  Size  The minimum size of the slab, including its header.
+ *
+ * @returns The new, empty slab, or NULL if no pages are available.
+ */
+static
+ARENA_SLAB *
+ArenaNewSlab(IN UINTN Size)
+{
+    EFI_STATUS Status;
+    EFI_PHYSICAL_ADDRESS Address = 0;
+    ARENA_SLAB *Slab;
+
+    Status = uefi_call_wrapper(
+        BS->AllocatePages,
+        4,
+        AllocateAnyPages,
+        EfiLoaderData,
+        EFI_SIZE_TO_PAGES(Size),
+        &Address
+    );
+    if (EFI_ERROR(Status)) {
+        return NULL;
+    }
+
+    Slab = (ARENA_SLAB *)(UINTN)Address;
+    Slab->Next = NULL;
+    Slab->Size = EFI_PAGES_TO_SIZE(EFI_SIZE_TO_PAGES(Size)) - sizeof(ARENA_SLAB);
+    Slab->Used = 0;
+
+    return Slab;
+}
+
+
+static
+inline
+VOID
+ArenaFreeSlab(IN ARENA_SLAB *Slab)
+{
+    uefi_call_wrapper(
+        BS->FreePages,
+        2,
+        (EFI_PHYSICAL_ADDRESS)(UINTN)Slab,
+        EFI_SIZE_TO_PAGES(Slab->Size + sizeof(ARENA_SLAB))
+    );
+}
+
+
+/**
+ * Carve a block out of a slab.
+ *
+ * @param[in]  Slab  The slab to bump. May be NULL.
+ * @param[in]  Size  The aligned size of the block.
+ *
+ * @returns The block's payload, or NULL if the slab is too full.
+ */
+static
+inline
+VOID *
+ArenaBump(IN ARENA_SLAB *Slab,
+          IN UINTN Size)
+{
+    ARENA_BLOCK *Block;
+
+    if (NULL == Slab || (Slab->Used + sizeof(ARENA_BLOCK) + Size) > Slab->Size) {
+        return NULL;
+    }
+
+    Block = (ARENA_BLOCK *)(ARENA_SLAB_DATA(Slab) + Slab->Used);
+    Block->Size  = Size;
+    Block->Flags = 0;
+
+    Slab->Used += sizeof(ARENA_BLOCK) + Size;
+    return (VOID *)(Block + 1);
+}
+
+
+EFI_STATUS
+EFIAPI
+ArenaCreate(OUT ARENA *Arena,
+            IN UINTN SlabSize)
+{
+    if (NULL == Arena || SlabSize <= (sizeof(ARENA_SLAB) + sizeof(ARENA_BLOCK))) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Arena->Large    = NULL;
+    Arena->SlabSize = SlabSize;
+    Arena->Lock     = 0;
+
+    Arena->Slabs = ArenaNewSlab(SlabSize);
+    if (NULL == Arena->Slabs) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+VOID *
+EFIAPI
+ArenaAllocate(IN ARENA *Arena,
+              IN UINTN Size)
+{
+    ARENA_SLAB *Slab;
+    VOID *Pointer = NULL;
+
+    Size = ARENA_ALIGN(MAX(Size, 1));
+
+    ArenaLock(Arena);
+
+    /* Only the BSP may reserve pages, so an arena never grows while on an AP. */
+    if (Size >= (Arena->SlabSize / 4)) {
+        if (!IsRunningOnBsp()) {
+            ArenaUnlock(Arena);
+            return NULL;
+        }
+
+        Slab = ArenaNewSlab(sizeof(ARENA_SLAB) + sizeof(ARENA_BLOCK) + Size);
+        if (NULL != Slab) {
+            Pointer = ArenaBump(Slab, Size);
+            ARENA_BLOCK_OF(Pointer)->Flags |= ARENA_BLOCK_LARGE;
+
+            Slab->Next = Arena->Large;
+            Arena->Large = Slab;
+        }
+
+        ArenaUnlock(Arena);
+        return Pointer;
+    }
+
+    Pointer = ArenaBump(Arena->Slabs, Size);
+    if (NULL == Pointer && IsRunningOnBsp()) {
+        Slab = ArenaNewSlab(Arena->SlabSize);
+        if (NULL != Slab) {
+            Slab->Next = Arena->Slabs;
+            Arena->Slabs = Slab;
+
+            Pointer = ArenaBump(Slab, Size);
+        }
+    }
+
+    ArenaUnlock(Arena);
+    return Pointer;
+}
+
+
+VOID *
+EFIAPI
+ArenaAllocateZero(IN ARENA *Arena,
+                  IN UINTN Size)
+{
+    VOID *Pointer = ArenaAllocate(Arena, Size);
+
+    if (NULL != Pointer) {
+        FastSetMem(Pointer, ARENA_BLOCK_OF(Pointer)->Size, 0x00);
+    }
+
+    return Pointer;
+}
+
+
+VOID *
+EFIAPI
+ArenaReallocate(IN ARENA *Arena,
+                IN VOID *Pointer OPTIONAL,
+                IN UINTN NewSize)
+{
+    ARENA_BLOCK *Block;
+    ARENA_SLAB *Slab;
+    VOID *NewPointer;
+
+    if (NULL == Pointer) {
+        return ArenaAllocate(Arena, NewSize);
+    }
+
+    Block = ARENA_BLOCK_OF(Pointer);
+    NewSize = ARENA_ALIGN(MAX(NewSize, 1));
+
+    ArenaLock(Arena);
+    Slab = Arena->Slabs;
+
+    if (0 == (Block->Flags & ARENA_BLOCK_LARGE) && ARENA_IS_TOP_BLOCK(Slab, Pointer)) {
+        /* The top block can move its end freely, as long as it stays inside the slab. */
+        if ((Slab->Used - Block->Size + NewSize) <= Slab->Size) {
+            Slab->Used = Slab->Used - Block->Size + NewSize;
+            Block->Size = NewSize;
+
+            ArenaUnlock(Arena);
+            return Pointer;
+        }
+    } else if (NewSize <= Block->Size) {
+        ArenaUnlock(Arena);
+        return Pointer;
+    }
+
+    ArenaUnlock(Arena);
+
+    NewPointer = ArenaAllocate(Arena, NewSize);
+    if (NULL == NewPointer) {
+        return NULL;
+    }
+
+    FastCopyMem(NewPointer, Pointer, MIN(Block->Size, NewSize));
+    ArenaFree(Arena, Pointer);
+
+    return NewPointer;
+}
+
+
+VOID
+EFIAPI
+ArenaFree(IN ARENA *Arena,
+          IN VOID *Pointer OPTIONAL)
+{
+    ARENA_BLOCK *Block;
+    ARENA_SLAB *Slab, **Link;
+
+    if (NULL == Pointer) {
+        return;
+    }
+
+    Block = ARENA_BLOCK_OF(Pointer);
+
+    ArenaLock(Arena);
+
+    /* Large blocks freed on an AP keep their pages until the BSP resets the arena. */
+    if (0 != (Block->Flags & ARENA_BLOCK_LARGE) && IsRunningOnBsp()) {
+        Slab = (ARENA_SLAB *)((UINT8 *)Block - sizeof(ARENA_SLAB));
+
+        for (Link = &Arena->Large; NULL != *Link; Link = &((*Link)->Next)) {
+            if (Slab == *Link) {
+                *Link = Slab->Next;
+                ArenaFreeSlab(Slab);
+                break;
+            }
+        }
+    } else if (ARENA_IS_TOP_BLOCK(Arena->Slabs, Pointer)) {
+        Arena->Slabs->Used -= sizeof(ARENA_BLOCK) + Block->Size;
+    }
+
+    ArenaUnlock(Arena);
+}
+
+
+VOID
+EFIAPI
+ArenaReset(IN ARENA *Arena)
+{
+    ARENA_SLAB *Slab, *Next;
+
+    ArenaLock(Arena);
+
+    for (Slab = Arena->Large; NULL != Slab; Slab = Next) {
+        Next = Slab->Next;
+        ArenaFreeSlab(Slab);
+    }
+    Arena->Large = NULL;
+
+    if (NULL != Arena->Slabs) {
+        for (Slab = Arena->Slabs->Next; NULL != Slab; Slab = Next) {
+            Next = Slab->Next;
+            ArenaFreeSlab(Slab);
+        }
+
+        Arena->Slabs->Next = NULL;
+        Arena->Slabs->Used = 0;
+    }
+
+    ArenaUnlock(Arena);
+}
+
+
+VOID
+EFIAPI
+ArenaDestroy(IN ARENA *Arena)
+{
+    ArenaReset(Arena);
+
+    ArenaLock(Arena);
+
+    if (NULL != Arena->Slabs) {
+        ArenaFreeSlab(Arena->Slabs);
+        Arena->Slabs = NULL;
+    }
+
+    ArenaUnlock(Arena);
+}
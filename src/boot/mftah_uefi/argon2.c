@@ -0,0 +1,396 @@
+/*
+ * Argon2id (version 0x13), as specified in RFC 9106.
+ */
+
+#include "crypto/argon2.h"
+#include "crypto/blake2b.h"
+
+
+
+#define ARGON2_PREHASH_LENGTH 64
+
+
+static inline
+void
+store32_le(uint8_t *p,
+           uint32_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+
+static inline
+uint64_t
+rotr64(uint64_t value,
+       unsigned int count)
+{
+    return (value >> count) | (value << (64 - count));
+}
+
+
+/*
+ * @brief Add a 32-bit little-endian value to a hash input.
+ */
+static
+void
+blake2b_update32(struct Blake2b *ctx,
+                 uint32_t value)
+{
+    uint8_t bytes[4];
+
+    store32_le(bytes, value);
+    blake2b_update(ctx, bytes, sizeof(bytes));
+}
+
+
+/*
+ * @brief The variable-length hash function H' of the RFC, over the concatenation of two inputs.
+ */
+static
+void
+argon2_hash_long(uint8_t *out,
+                 uint32_t out_len,
+                 const uint8_t *in1,
+                 size_t in1_len,
+                 const uint8_t *in2,
+                 size_t in2_len)
+{
+    struct Blake2b ctx;
+    uint8_t v[BLAKE2B_MAX_OUTPUT];
+    uint32_t remaining;
+
+    if (out_len <= BLAKE2B_MAX_OUTPUT) {
+        blake2b_init(&ctx, out_len);
+        blake2b_update32(&ctx, out_len);
+        blake2b_update(&ctx, in1, in1_len);
+        blake2b_update(&ctx, in2, in2_len);
+        blake2b_final(&ctx, out);
+        return;
+    }
+
+    /* V1 = H^64(LE32(T) || A); each following V is the hash of the one before. Only the first half of each is output. */
+    blake2b_init(&ctx, BLAKE2B_MAX_OUTPUT);
+    blake2b_update32(&ctx, out_len);
+    blake2b_update(&ctx, in1, in1_len);
+    blake2b_update(&ctx, in2, in2_len);
+    blake2b_final(&ctx, v);
+
+    for (int i = 0; i < BLAKE2B_MAX_OUTPUT / 2; ++i) out[i] = v[i];
+    out += BLAKE2B_MAX_OUTPUT / 2;
+    remaining = out_len - (BLAKE2B_MAX_OUTPUT / 2);
+
+    while (remaining > BLAKE2B_MAX_OUTPUT) {
+        blake2b(v, BLAKE2B_MAX_OUTPUT, v, BLAKE2B_MAX_OUTPUT);
+
+        for (int i = 0; i < BLAKE2B_MAX_OUTPUT / 2; ++i) out[i] = v[i];
+        out += BLAKE2B_MAX_OUTPUT / 2;
+        remaining -= BLAKE2B_MAX_OUTPUT / 2;
+    }
+
+    /* The last V is only as long as what's left, and output whole. */
+    blake2b(out, remaining, v, BLAKE2B_MAX_OUTPUT);
+}
+
+
+static inline
+uint64_t
+blamka(uint64_t x,
+       uint64_t y)
+{
+    return x + y + (2 * (uint64_t)(uint32_t)x * (uint64_t)(uint32_t)y);
+}
+
+
+#define ARGON2_G(a, b, c, d) \
+    do { \
+        a = blamka(a, b); d = rotr64(d ^ a, 32); \
+        c = blamka(c, d); b = rotr64(b ^ c, 24); \
+        a = blamka(a, b); d = rotr64(d ^ a, 16); \
+        c = blamka(c, d); b = rotr64(b ^ c, 63); \
+    } while (0)
+
+#define ARGON2_ROUND(v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15) \
+    do { \
+        ARGON2_G(v0, v4, v8,  v12); \
+        ARGON2_G(v1, v5, v9,  v13); \
+        ARGON2_G(v2, v6, v10, v14); \
+        ARGON2_G(v3, v7, v11, v15); \
+        ARGON2_G(v0, v5, v10, v15); \
+        ARGON2_G(v1, v6, v11, v12); \
+        ARGON2_G(v2, v7, v8,  v13); \
+        ARGON2_G(v3, v4, v9,  v14); \
+    } while (0)
+
+
+/*
+ * @brief The compression function G of the RFC: next = G(prev, ref), XORed into 'next' when 'with_xor' is set.
+ */
+static
+void
+argon2_fill_block(const argon2_block *prev,
+                  const argon2_block *ref,
+                  argon2_block *next,
+                  int with_xor)
+{
+    argon2_block r, z;
+    uint64_t *v = z.v;
+
+    for (int i = 0; i < ARGON2_QWORDS_IN_BLOCK; ++i) {
+        r.v[i] = prev->v[i] ^ ref->v[i];
+        z.v[i] = r.v[i];
+    }
+
+    /* The permutation P is applied to every row of 16 words, then to every column. */
+    for (int i = 0; i < 8; ++i) {
+        ARGON2_ROUND(v[16 * i],      v[16 * i + 1],  v[16 * i + 2],  v[16 * i + 3],
+                     v[16 * i + 4],  v[16 * i + 5],  v[16 * i + 6],  v[16 * i + 7],
+                     v[16 * i + 8],  v[16 * i + 9],  v[16 * i + 10], v[16 * i + 11],
+                     v[16 * i + 12], v[16 * i + 13], v[16 * i + 14], v[16 * i + 15]);
+    }
+
+    for (int i = 0; i < 8; ++i) {
+        ARGON2_ROUND(v[2 * i],       v[2 * i + 1],   v[2 * i + 16],  v[2 * i + 17],
+                     v[2 * i + 32],  v[2 * i + 33],  v[2 * i + 48],  v[2 * i + 49],
+                     v[2 * i + 64],  v[2 * i + 65],  v[2 * i + 80],  v[2 * i + 81],
+                     v[2 * i + 96],  v[2 * i + 97],  v[2 * i + 112], v[2 * i + 113]);
+    }
+
+    for (int i = 0; i < ARGON2_QWORDS_IN_BLOCK; ++i) {
+        next->v[i] = (with_xor ? next->v[i] : 0) ^ z.v[i] ^ r.v[i];
+    }
+}
+
+
+/*
+ * @brief Compute the next block of pseudo-random reference positions for data-independent addressing.
+ */
+static
+void
+argon2_next_addresses(argon2_block *address_block,
+                      argon2_block *input_block)
+{
+    static const argon2_block zero_block = {{0}};
+
+    ++(input_block->v[6]);
+    argon2_fill_block(&zero_block, input_block, address_block, 0);
+    argon2_fill_block(&zero_block, address_block, address_block, 0);
+}
+
+
+/*
+ * @brief Map a pseudo-random value to the reference block within a lane (the RFC's J1 mapping).
+ */
+static
+uint32_t
+argon2_index_alpha(const struct Argon2 *ctx,
+                   uint32_t pass,
+                   uint32_t slice,
+                   uint32_t index,
+                   uint32_t pseudo_rand,
+                   int same_lane)
+{
+    uint32_t reference_area_size;
+    uint64_t relative_position;
+    uint32_t start_position = 0;
+
+    if (0 == pass) {
+        if (0 == slice) {
+            reference_area_size = index - 1;
+        } else if (same_lane) {
+            reference_area_size = (slice * ctx->segment_length) + index - 1;
+        } else {
+            reference_area_size = (slice * ctx->segment_length) - ((0 == index) ? 1 : 0);
+        }
+    } else {
+        if (same_lane) {
+            reference_area_size = ctx->lane_length - ctx->segment_length + index - 1;
+        } else {
+            reference_area_size = ctx->lane_length - ctx->segment_length - ((0 == index) ? 1 : 0);
+        }
+    }
+
+    relative_position = pseudo_rand;
+    relative_position = (relative_position * relative_position) >> 32;
+    relative_position = reference_area_size - 1 - ((reference_area_size * relative_position) >> 32);
+
+    if (0 != pass && (ARGON2_SYNC_POINTS - 1) != slice) {
+        start_position = (slice + 1) * ctx->segment_length;
+    }
+
+    return (uint32_t)((start_position + relative_position) % ctx->lane_length);
+}
+
+
+uint32_t
+argon2_memory_blocks(uint32_t m_cost,
+                     uint32_t lanes)
+{
+    if (lanes < ARGON2_MIN_LANES || lanes > ARGON2_MAX_LANES) return 0;
+    if (m_cost < (2 * ARGON2_SYNC_POINTS * lanes)) return 0;
+
+    return (m_cost / (ARGON2_SYNC_POINTS * lanes)) * (ARGON2_SYNC_POINTS * lanes);
+}
+
+
+int
+argon2id_init(struct Argon2 *ctx,
+              void *memory,
+              uint32_t m_cost,
+              uint32_t t_cost,
+              uint32_t lanes,
+              uint32_t tag_length,
+              const void *pwd,
+              size_t pwd_len,
+              const void *salt,
+              size_t salt_len)
+{
+    struct Blake2b h;
+    uint8_t h0[ARGON2_PREHASH_LENGTH + 8];
+    uint8_t block[ARGON2_BLOCK_SIZE];
+
+    if (NULL == ctx || NULL == memory || 0 == t_cost || tag_length < ARGON2_MIN_TAG || salt_len < 8) return -1;
+
+    ctx->memory_blocks = argon2_memory_blocks(m_cost, lanes);
+    if (0 == ctx->memory_blocks) return -1;
+
+    ctx->memory = (argon2_block *)memory;
+    ctx->passes = t_cost;
+    ctx->lanes = lanes;
+    ctx->lane_length = ctx->memory_blocks / lanes;
+    ctx->segment_length = ctx->lane_length / ARGON2_SYNC_POINTS;
+    ctx->tag_length = tag_length;
+
+    /* H0 = H^64(p, T, m, t, v, y, P, S, K, X), with every length and number as LE32. */
+    blake2b_init(&h, ARGON2_PREHASH_LENGTH);
+    blake2b_update32(&h, lanes);
+    blake2b_update32(&h, tag_length);
+    blake2b_update32(&h, m_cost);
+    blake2b_update32(&h, t_cost);
+    blake2b_update32(&h, ARGON2_VERSION);
+    blake2b_update32(&h, ARGON2_TYPE_ID);
+    blake2b_update32(&h, (uint32_t)pwd_len);
+    blake2b_update(&h, pwd, pwd_len);
+    blake2b_update32(&h, (uint32_t)salt_len);
+    blake2b_update(&h, salt, salt_len);
+    blake2b_update32(&h, 0);
+    blake2b_update32(&h, 0);
+    blake2b_final(&h, h0);
+
+    /* B[i][0] = H'(H0 || LE32(0) || LE32(i)) and B[i][1] = H'(H0 || LE32(1) || LE32(i)). */
+    for (uint32_t lane = 0; lane < lanes; ++lane) {
+        for (uint32_t column = 0; column < 2; ++column) {
+            argon2_block *target = &(ctx->memory[(lane * ctx->lane_length) + column]);
+
+            store32_le(h0 + ARGON2_PREHASH_LENGTH, column);
+            store32_le(h0 + ARGON2_PREHASH_LENGTH + 4, lane);
+            argon2_hash_long(block, ARGON2_BLOCK_SIZE, h0, sizeof(h0), NULL, 0);
+
+            for (int i = 0; i < ARGON2_QWORDS_IN_BLOCK; ++i) {
+                const uint8_t *p = block + (i * 8);
+
+                target->v[i] = ((uint64_t)p[0])       | ((uint64_t)p[1] << 8)
+                             | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+                             | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40)
+                             | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(h0); ++i) h0[i] = 0;
+    for (size_t i = 0; i < sizeof(block); ++i) block[i] = 0;
+
+    return 0;
+}
+
+
+void
+argon2_fill_segment(const struct Argon2 *ctx,
+                    uint32_t pass,
+                    uint32_t slice,
+                    uint32_t lane)
+{
+    argon2_block address_block, input_block;
+    uint32_t starting_index = 0;
+    uint32_t curr_offset, prev_offset;
+    uint32_t ref_lane, ref_index;
+    uint64_t pseudo_rand;
+
+    /* Argon2id addresses independently of the data in the first half of the first pass only. */
+    int data_independent = (0 == pass && slice < (ARGON2_SYNC_POINTS / 2));
+
+    if (data_independent) {
+        for (int i = 0; i < ARGON2_QWORDS_IN_BLOCK; ++i) input_block.v[i] = 0;
+
+        input_block.v[0] = pass;
+        input_block.v[1] = lane;
+        input_block.v[2] = slice;
+        input_block.v[3] = ctx->memory_blocks;
+        input_block.v[4] = ctx->passes;
+        input_block.v[5] = ARGON2_TYPE_ID;
+    }
+
+    /* The first two blocks of each lane were filled by argon2id_init. */
+    if (0 == pass && 0 == slice) {
+        starting_index = 2;
+
+        if (data_independent) argon2_next_addresses(&address_block, &input_block);
+    }
+
+    curr_offset = (lane * ctx->lane_length) + (slice * ctx->segment_length) + starting_index;
+    prev_offset = (0 == (curr_offset % ctx->lane_length))
+        ? (curr_offset + ctx->lane_length - 1)
+        : (curr_offset - 1);
+
+    for (uint32_t i = starting_index; i < ctx->segment_length; ++i, ++curr_offset, ++prev_offset) {
+        if (1 == (curr_offset % ctx->lane_length)) {
+            prev_offset = curr_offset - 1;
+        }
+
+        if (data_independent) {
+            if (0 == (i % ARGON2_QWORDS_IN_BLOCK)) argon2_next_addresses(&address_block, &input_block);
+            pseudo_rand = address_block.v[i % ARGON2_QWORDS_IN_BLOCK];
+        } else {
+            pseudo_rand = ctx->memory[prev_offset].v[0];
+        }
+
+        ref_lane = (0 == pass && 0 == slice)
+            ? lane
+            : (uint32_t)((pseudo_rand >> 32) % ctx->lanes);
+
+        ref_index = argon2_index_alpha(ctx, pass, slice, i, (uint32_t)pseudo_rand, ref_lane == lane);
+
+        argon2_fill_block(&(ctx->memory[prev_offset]),
+                          &(ctx->memory[(ctx->lane_length * ref_lane) + ref_index]),
+                          &(ctx->memory[curr_offset]),
+                          0 != pass);
+    }
+}
+
+
+void
+argon2_final(const struct Argon2 *ctx,
+             uint8_t *tag)
+{
+    argon2_block c;
+    uint8_t bytes[ARGON2_BLOCK_SIZE];
+
+    /* C = the XOR of the last block of every lane; the tag is H'(C). */
+    for (int i = 0; i < ARGON2_QWORDS_IN_BLOCK; ++i) c.v[i] = 0;
+
+    for (uint32_t lane = 0; lane < ctx->lanes; ++lane) {
+        const argon2_block *last = &(ctx->memory[(lane * ctx->lane_length) + ctx->lane_length - 1]);
+
+        for (int i = 0; i < ARGON2_QWORDS_IN_BLOCK; ++i) c.v[i] ^= last->v[i];
+    }
+
+    for (int i = 0; i < ARGON2_QWORDS_IN_BLOCK; ++i) {
+        for (int b = 0; b < 8; ++b) bytes[(i * 8) + b] = (uint8_t)(c.v[i] >> (8 * b));
+    }
+
+    argon2_hash_long(tag, ctx->tag_length, bytes, sizeof(bytes), NULL, 0);
+
+    for (size_t i = 0; i < sizeof(bytes); ++i) bytes[i] = 0;
+}
@@ -0,0 +1,542 @@
+#include "core/batch.h"
+#include "core/loader.h"
+#include "core/util.h"
+#include "core/profiler.h"
+#include "core/handoff.h"
+#include "core/hotprofile.h"
+#include "core/progress.h"
+#include "core/aead.h"
+
+
+
+/**
+ * The batch currently being loaded. Decryptions nest: a payload's decryption is
+ *  started from inside the spin of the one before it, which keeps waiting on its
+ *  own workers (see SwitchDecryptionBatch) once the inner decryption returns.
+ */
+typedef
+struct {
+    BATCH_PAYLOAD   *Payloads;
+    UINTN           Count;
+    UINTN           Order[MFTAH_MAX_SELECTED_PAYLOADS];    /* Payload indices, smallest first. */
+    CONST UINT8     *Password;
+    UINT8           PasswordLength;
+    UINTN           DecryptDepth;
+    UINT64          DecryptedBytes;
+} BATCH_CONTEXT;
+
+STATIC BATCH_CONTEXT mBatch = {0};
+
+
+/**
+ * Whether any payload of the batch still needs to be read from the boot volume.
+ */
+STATIC
+BOOLEAN
+EFIAPI
+BatchHasPendingReads(VOID)
+{
+    for (UINTN i = 0; i < mBatch.Count; ++i) {
+        if (BatchPayloadQueued == mBatch.Payloads[i].State
+            || BatchPayloadReading == mBatch.Payloads[i].State
+        ) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+/**
+ * Find where the ramdisk of a payload will start in its file. The file handle is left at position 0.
+ *
+ * @param[in] Payload  The payload, whose size is known.
+ *
+ * @returns The offset of the ramdisk, or 0 if the header doesn't make sense.
+ */
+STATIC
+UINT64
+EFIAPI
+BatchRamdiskOffset(IN BATCH_PAYLOAD *Payload)
+{
+    UINT64 Offset = mftah_payload_header__sizeof();
+#if MFTAH_AEAD_PAYLOADS == 1
+    MFTAH_AEAD_HEADER Header = {0};
+    UINTN ReadSize = sizeof(MFTAH_AEAD_HEADER);
+
+    /* Only authenticated payloads have a header of varying length. It's checked properly later. */
+    if (!EFI_ERROR(uefi_call_wrapper(Payload->FileHandle->Read, 3, Payload->FileHandle, &ReadSize, &Header))
+        && AeadIsPayload(&Header, ReadSize)
+    ) {
+        Offset = sizeof(MFTAH_AEAD_HEADER) + ((UINT64)Header.SegmentCount * MFTAH_AEAD_TAG_LENGTH);
+    }
+
+    uefi_call_wrapper(Payload->FileHandle->SetPosition, 2, Payload->FileHandle, 0);
+#endif
+
+    return (Offset < Payload->FileSize) ? Offset : 0;
+}
+
+
+/**
+ * Allocate the buffer of a payload, such that its ramdisk starts on a MFTAH_RAMDISK_ALIGNMENT
+ *  boundary once it is decrypted in place and its pages run on to the next boundary after it.
+ *  The buffer is reserved memory, so neither the OS nor a chainloaded loader reuses it.
+ *
+ * @param[in,out] Payload  The payload, whose size is known. Its buffer fields are set.
+ *
+ * @retval EFI_SUCCESS           The buffer was allocated.
+ * @retval EFI_OUT_OF_RESOURCES  There isn't enough memory.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+BatchAllocateBuffer(IN OUT BATCH_PAYLOAD *Payload)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_PHYSICAL_ADDRESS Base = 0, Ramdisk = 0, First = 0, End = 0;
+    UINT64 Offset = BatchRamdiskOffset(Payload);
+    UINT64 RamdiskSpan = (Payload->FileSize - Offset + MFTAH_RAMDISK_ALIGNMENT - 1) & ~(MFTAH_RAMDISK_ALIGNMENT - 1);
+    UINTN Pages = EFI_SIZE_TO_PAGES(Offset + (MFTAH_RAMDISK_ALIGNMENT - 1) + RamdiskSpan);
+
+    /* Firmware only aligns allocations to pages, so take enough to find a boundary and give the rest back. */
+    Status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiReservedMemoryType, Pages, &Base);
+    if (EFI_ERROR(Status)) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    Ramdisk = (Base + Offset + MFTAH_RAMDISK_ALIGNMENT - 1) & ~(MFTAH_RAMDISK_ALIGNMENT - 1);
+    First = (Ramdisk - Offset) & ~((UINT64)EFI_PAGE_MASK);
+    End = Ramdisk + RamdiskSpan;
+
+    if (First > Base) {
+        uefi_call_wrapper(BS->FreePages, 2, Base, EFI_SIZE_TO_PAGES(First - Base));
+    }
+    if ((Base + EFI_PAGES_TO_SIZE(Pages)) > End) {
+        uefi_call_wrapper(BS->FreePages, 2, End, EFI_SIZE_TO_PAGES(Base + EFI_PAGES_TO_SIZE(Pages) - End));
+    }
+
+    Payload->BufferBase = First;
+    Payload->BufferPages = EFI_SIZE_TO_PAGES(End - First);
+    Payload->ReadBuffer = (UINT8 *)(UINTN)(Ramdisk - Offset);
+
+    DPRINTLN(L"---- The ramdisk of '%s' will start at '%llx'.", Payload->Name, Ramdisk);
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Read the next slice of a payload into its buffer.
+ *
+ * @param[in] Payload       The payload to continue reading.
+ * @param[in] Foreground    Whether the BSP has nothing else to do, in which case progress is shown.
+ */
+STATIC
+VOID
+EFIAPI
+BatchReadSlice(IN OUT BATCH_PAYLOAD *Payload,
+               IN BOOLEAN Foreground)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT64 SliceStart = Payload->BytesRead;
+    UINT64 SliceEnd = MIN(Payload->FileSize, Payload->BytesRead + MFTAH_BATCH_READ_SLICE_SIZE);
+    UINTN FileChunkSize = 0;
+
+    if (BatchPayloadQueued == Payload->State) {
+        if (Foreground) {
+            PRINTLN(L"\r\n-- Reading '%s' into memory at '%p'...", Payload->Name, Payload->ReadBuffer);
+            ProgressBegin();
+        }
+        DPRINTLN(L"---- Copying payload of size '0x%08llx' bytes into RAM at '%p'...", Payload->FileSize, Payload->ReadBuffer);
+
+        Payload->State = BatchPayloadReading;
+    }
+
+    ProfilerBegin(ProfilePhaseReadPayload);
+
+    while (Payload->BytesRead < SliceEnd) {
+        FileChunkSize = (UINTN)MIN((UINT64)MFTAH_RAMDISK_LOAD_BLOCK_SIZE, SliceEnd - Payload->BytesRead);
+
+        Status = uefi_call_wrapper(
+            Payload->FileHandle->Read,
+            3,
+            Payload->FileHandle,
+            &FileChunkSize,
+            (Payload->ReadBuffer + Payload->BytesRead)
+        );
+
+        /* Watch for errors reading the file handle, or a file shorter than it claimed. */
+        if (EFI_ERROR(Status) || 0 == FileChunkSize) {
+            Payload->Status = EFI_ERROR(Status) ? Status : EFI_END_OF_FILE;
+            Payload->State = BatchPayloadFailed;
+            break;
+        }
+
+        Payload->BytesRead += FileChunkSize;
+
+        if (Foreground) {
+            ProgressUpdate(Payload->BytesRead, Payload->FileSize);
+        }
+    }
+
+    ProfilerEnd(ProfilePhaseReadPayload, Payload->BytesRead - SliceStart);
+
+    if (BatchPayloadFailed == Payload->State) {
+        if (Foreground) ProgressEnd();
+        EFI_WARNINGLN(L"Failed to read the payload '%s' (%r).", Payload->Name, Payload->Status);
+    } else if (Payload->BytesRead == Payload->FileSize) {
+        Payload->State = BatchPayloadLoaded;
+
+        if (Foreground) {
+            /* Guarantee this prints out a final 100%. */
+            ProgressUpdate(Payload->FileSize, Payload->FileSize);
+            ProgressEnd();
+            PRINTLN(L"\r\n");
+        }
+    }
+}
+
+
+#if MFTAH_AEAD_PAYLOADS == 1
+STATIC BOOLEAN EFIAPI BatchIdle(IN VOID *Context);
+
+
+/**
+ * Authenticate and decrypt a fully loaded authenticated payload. Its segments are
+ *  authenticated as they are decrypted, so there's no separate pass to hash it; the
+ *  payload hash is taken over the header and the tag table, which commit to all of it.
+ *
+ * @param[in] Payload  The loaded payload.
+ */
+STATIC
+VOID
+EFIAPI
+BatchDecryptAuthenticated(IN OUT BATCH_PAYLOAD *Payload)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    PRINTLN(L"\r\n-- Authenticating and decrypting '%s'...", Payload->Name);
+    if (!BatchHasPendingReads()) {
+        PRINTLN(L"---- If you booted from external media, you may disconnect it now.");
+    }
+
+    if (0 == mBatch.DecryptDepth++) {
+        ProfilerBegin(ProfilePhaseDecrypt);
+    }
+
+    Status = AeadDecryptPayload(Payload->ReadBuffer,
+                                Payload->FileSize,
+                                mBatch.Password,
+                                mBatch.PasswordLength,
+                                BatchIdle,
+                                &mBatch,
+                                &(Payload->RamdiskImage),
+                                &(Payload->RamdiskLength));
+
+    mBatch.DecryptedBytes += Payload->FileSize;
+    if (0 == --mBatch.DecryptDepth) {
+        ProfilerEnd(ProfilePhaseDecrypt, mBatch.DecryptedBytes);
+        mBatch.DecryptedBytes = 0;
+    }
+
+    if (EFI_ERROR(Status)) {
+        EFI_WARNINGLN(L"Decrypting the authenticated payload failed (%r).", Status);
+        Payload->RamdiskImage = NULL;
+        Payload->RamdiskLength = 0;
+        Payload->Status = EFI_ABORTED;
+        Payload->State = BatchPayloadFailed;
+        return;
+    }
+
+    calc_sha_256(Payload->PayloadHash,
+                 Payload->ReadBuffer,
+                 (UINTN)(Payload->RamdiskImage - Payload->ReadBuffer));
+
+    Payload->Status = EFI_SUCCESS;
+    Payload->State = BatchPayloadDecrypted;
+}
+#endif
+
+
+/**
+ * Hash and decrypt a fully loaded payload. With threading, this returns once the
+ *  payload's own workers are done, which is usually after every payload queued
+ *  behind it has been read and started as well.
+ *
+ * @param[in] Payload  The loaded payload.
+ * @param[in] Batch    The decryption batch number to tag the payload's workers with.
+ */
+STATIC
+VOID
+EFIAPI
+BatchDecrypt(IN OUT BATCH_PAYLOAD *Payload,
+             IN UINTN Batch)
+{
+    mftah_status_t MftahStatus = MFTAH_SUCCESS;
+    VOID *PayloadBufferBase = NULL;
+    UINTN PreviousBatch = 0;
+
+    Payload->State = BatchPayloadDecrypting;
+
+#if MFTAH_AEAD_PAYLOADS == 1
+    if (AeadIsPayload(Payload->ReadBuffer, Payload->FileSize)) {
+        BatchDecryptAuthenticated(Payload);
+        return;
+    }
+#endif
+
+    /* Hash the loaded payload image for later. */
+    PRINTLN(L"\r\n-- Generating a loaded payload hash for '%s'.", Payload->Name);
+    ProfilerBegin(ProfilePhaseHashPayload);
+    MftahStatus = MFTAH->create_hash(MFTAH,
+                                   Payload->ReadBuffer,
+                                   Payload->FileSize,
+                                   Payload->PayloadHash,
+                                   NULL);
+    ProfilerEnd(ProfilePhaseHashPayload, Payload->FileSize);
+    if (MFTAH_ERROR(MftahStatus)) {
+        EFI_WARNINGLN(L"Failed to hash the loaded payload buffer...");
+        EFI_WARNINGLN(L"    Its payload hash EFI variable will not");
+        EFI_WARNINGLN(L"    be available at OS runtime.");
+    }
+
+    /* Create the payload object. */
+    DPRINTLN(L"-- Creating a full-size MFTAH payload object describing %u bytes.", Payload->FileSize);
+    Payload->Payload = (mftah_payload_t *)AllocateZeroPool(mftah_payload__sizeof());
+    if (NULL == Payload->Payload) {
+        Payload->Status = EFI_OUT_OF_RESOURCES;
+        Payload->State = BatchPayloadFailed;
+        return;
+    }
+
+    MftahStatus = MFTAH->create_payload(MFTAH,
+                                      Payload->ReadBuffer,
+                                      Payload->FileSize,
+                                      Payload->Payload,
+                                      NULL);
+    if (MFTAH_ERROR(MftahStatus)) {
+        EFI_WARNINGLN(L"Loading the MFTAH payload failed with code '%u'.", MftahStatus);
+        Payload->Status = EFI_ABORTED;
+        Payload->State = BatchPayloadFailed;
+        goto Label__BatchDecrypt__End;
+    }
+
+    /* Decrypt the ramdisk. We assume the created payload is indeed an encrypted MFTAH file here.
+        If it's not, then decryption will just return garbage or invalid responses and that's the
+        user's fault/ordeal. */
+    PRINTLN(L"-- Decrypting '%s'...", Payload->Name);
+    PRINTLN(L"---- This may take a few minutes.");
+    if (!BatchHasPendingReads()) {
+        PRINTLN(L"---- If you booted from external media, you may disconnect it now.");
+    }
+
+    /* The phase covers the wall time of all overlapping decryptions together. */
+    if (0 == mBatch.DecryptDepth++) {
+        ProfilerBegin(ProfilePhaseDecrypt);
+    }
+
+#if MFTAH_EARLY_HANDOFF == 1
+    /* Only the payload booted from (always batch 1) is finished by the kernel. */
+    if (1 == Batch) {
+        HandoffArm(Batch, Payload->ReadBuffer, Payload->FileSize);
+#if MFTAH_HOT_PROFILE == 1
+        /* Without a usable profile, the boot decrypts on demand and records a new one. */
+        HotProfileLoad(gOperatingPayload.VolumeHandle, Payload->PayloadHash, Payload->FileSize);
+#endif
+    }
+#endif
+
+    PreviousBatch = SwitchDecryptionBatch(Batch);
+    MftahStatus = MFTAH->decrypt(MFTAH,
+                               Payload->Payload,
+                               mBatch.Password,
+                               mBatch.PasswordLength,
+                               SpawnDecryptionWorker,
+                               UefiSpin);
+    SwitchDecryptionBatch(PreviousBatch);
+
+    mBatch.DecryptedBytes += Payload->FileSize;
+    if (0 == --mBatch.DecryptDepth) {
+        ProfilerEnd(ProfilePhaseDecrypt, mBatch.DecryptedBytes);
+        mBatch.DecryptedBytes = 0;
+    }
+
+    if (MFTAH_ERROR(MftahStatus)) {
+        EFI_WARNINGLN(L"Decrypting the MFTAH payload failed with code '%u'.", MftahStatus);
+        Payload->Status = EFI_ABORTED;
+        Payload->State = BatchPayloadFailed;
+        goto Label__BatchDecrypt__End;
+    }
+
+    /* The 'length' field of the header is a certain offset into the base of the decrypted payload. */
+    MftahStatus = MFTAH->get_buffer_base(MFTAH, Payload->Payload, &PayloadBufferBase);
+    if (MFTAH_ERROR(MftahStatus) || NULL == PayloadBufferBase) {
+        EFI_WARNINGLN(L"Getting the payload buffer base failed with code '%u'.", MftahStatus);
+        Payload->Status = EFI_ABORTED;
+        Payload->State = BatchPayloadFailed;
+        goto Label__BatchDecrypt__End;
+    }
+
+    /* The actual ramdisk starts after the payload header (buffer base). */
+    Payload->RamdiskImage = (UINT8 *)PayloadBufferBase + mftah_payload_header__sizeof();
+    /* The payload length is at a particular offset into the payload header. */
+    Payload->RamdiskLength = *((UINT64 *)((UINT8 *)PayloadBufferBase + 96));   /* TODO: No magic numbers pls & ty */
+
+    Payload->Status = EFI_SUCCESS;
+    Payload->State = BatchPayloadDecrypted;
+
+Label__BatchDecrypt__End:
+    /* The payload object only describes the buffer, which outlives it. */
+    FreePool(Payload->Payload);
+    Payload->Payload = NULL;
+}
+
+
+/**
+ * Keeps the BSP busy while decryption workers run: first by reading the next
+ *  payload, then by starting the decryption of any payload which is fully read.
+ */
+STATIC
+BOOLEAN
+EFIAPI
+BatchIdle(IN VOID *Context)
+{
+    BATCH_CONTEXT *Batch = (BATCH_CONTEXT *)Context;
+    BATCH_PAYLOAD *Payload = NULL;
+
+    for (UINTN i = 0; i < Batch->Count; ++i) {
+        Payload = &(Batch->Payloads[Batch->Order[i]]);
+
+        if (BatchPayloadQueued == Payload->State || BatchPayloadReading == Payload->State) {
+            BatchReadSlice(Payload, FALSE);
+            return TRUE;
+        }
+    }
+
+    for (UINTN i = 0; i < Batch->Count; ++i) {
+        Payload = &(Batch->Payloads[Batch->Order[i]]);
+
+        if (BatchPayloadLoaded == Payload->State) {
+            BatchDecrypt(Payload, Batch->Order[i] + 1);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+EFI_STATUS
+EFIAPI
+LoadAndDecryptBatch(IN OUT BATCH_PAYLOAD *Payloads,
+                    IN UINTN Count,
+                    IN CONST UINT8 *Password,
+                    IN CONST UINT8 PasswordLength)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    BATCH_PAYLOAD *Payload = NULL;
+    UINTN Swap = 0;
+
+    if (NULL == Payloads || 0 == Count || Count > MFTAH_MAX_SELECTED_PAYLOADS || NULL == Password) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    SetMem(&mBatch, sizeof(BATCH_CONTEXT), 0x00);
+    mBatch.Payloads = Payloads;
+    mBatch.Count = Count;
+    mBatch.Password = Password;
+    mBatch.PasswordLength = PasswordLength;
+
+    for (UINTN i = 0; i < Count; ++i) {
+        Payload = &(Payloads[i]);
+
+        Payload->State = BatchPayloadQueued;
+        Payload->BytesRead = 0;
+        Payload->ReadBuffer = NULL;
+
+        /* Read the file's size and do some sanity checks. */
+        DPRINTLN(L"-- Getting attributes of payload '%s'...", Payload->Name);
+        Payload->FileSize = FileSize(&(Payload->FileHandle));
+        DPRINTLN(L"---- Apparent payload size: %d bytes", Payload->FileSize);
+        if (0 == Payload->FileSize || 0 != (Payload->FileSize % AES_BLOCKLEN)) {
+            EFI_WARNINGLN(L"The MFTAH payload size is not aligned to the AES block size.");
+            Status = EFI_ABORTED;
+            goto Label__LoadAndDecryptBatch__End;
+        }
+
+        DPRINTLN(L"-- Allocating buffer of %d bytes.", Payload->FileSize);
+        Status = BatchAllocateBuffer(Payload);
+        if (EFI_ERROR(Status) || NULL == Payload->ReadBuffer) {
+            EFI_WARNINGLN(L"Not enough free memory available to allocate the ramdisk for '%s'.", Payload->Name);
+            Payload->ReadBuffer = NULL;
+            Status = EFI_OUT_OF_RESOURCES;
+            goto Label__LoadAndDecryptBatch__End;
+        }
+
+        mBatch.Order[i] = i;
+    }
+
+    /* Smallest first: the sooner the first decryption starts, the more reading it hides. */
+    for (UINTN i = 1; i < Count; ++i) {
+        for (UINTN j = i; j > 0 && Payloads[mBatch.Order[j]].FileSize < Payloads[mBatch.Order[j - 1]].FileSize; --j) {
+            Swap = mBatch.Order[j];
+            mBatch.Order[j] = mBatch.Order[j - 1];
+            mBatch.Order[j - 1] = Swap;
+        }
+    }
+
+    SetDecryptionIdleHook(BatchIdle, &mBatch);
+
+    for (UINTN i = 0; i < Count; ++i) {
+        Payload = &(Payloads[mBatch.Order[i]]);
+
+        while (BatchPayloadQueued == Payload->State || BatchPayloadReading == Payload->State) {
+            BatchReadSlice(Payload, TRUE);
+        }
+
+        /* Later payloads may have been decrypted already, while waiting on this one. */
+        if (BatchPayloadLoaded == Payload->State) {
+            BatchDecrypt(Payload, mBatch.Order[i] + 1);
+        }
+
+        if (BatchPayloadFailed == Payload->State) {
+            Status = Payload->Status;
+            break;
+        }
+    }
+
+    SetDecryptionIdleHook(NULL, NULL);
+
+    for (UINTN i = 0; i < Count && !EFI_ERROR(Status); ++i) {
+        if (BatchPayloadDecrypted != Payloads[i].State) {
+            Status = EFI_ERROR(Payloads[i].Status) ? Payloads[i].Status : EFI_ABORTED;
+        }
+    }
+
+Label__LoadAndDecryptBatch__End:
+    if (EFI_ERROR(Status)) {
+        for (UINTN i = 0; i < Count; ++i) {
+            BatchFreePayloadBuffer(&(Payloads[i]));
+            Payloads[i].RamdiskImage = NULL;
+            Payloads[i].RamdiskLength = 0;
+        }
+    }
+
+    return Status;
+}
+
+
+VOID
+EFIAPI
+BatchFreePayloadBuffer(IN OUT BATCH_PAYLOAD *Payload)
+{
+    if (NULL == Payload->ReadBuffer) {
+        return;
+    }
+
+    uefi_call_wrapper(BS->FreePages, 2, Payload->BufferBase, Payload->BufferPages);
+    Payload->ReadBuffer = NULL;
+    Payload->BufferBase = 0;
+    Payload->BufferPages = 0;
+}
@@ -0,0 +1,289 @@
+#!/usr/bin/env python3
+"""
+Headless end-to-end benchmark for the MFTAH-UEFI loader.
+
+For every requested payload size, a synthetic FAT ramdisk is built and encrypted
+ into a '.CROWS' payload with a known password. The loader and that payload are
+ put on a throwaway ESP image, which is booted in QEMU with OVMF for every
+ requested vCPU count. The password is typed over the serial console and the
+ boot profile table (see 'core/profiler.h') is scraped from the loader's output.
+
+The decrypted ramdisk chainloads the loader binary itself, which is enough to get
+ the profile printed right before 'StartImage'. QEMU is killed at that point.
+
+The MFTAH-CLI command line used for encryption has to be given with '--encrypt-cmd',
+ since it depends on the CLI version in use. It is a template whose '{cli}', '{input}',
+ '{output}' and '{password}' fields are filled in (already shell-quoted) for every
+ payload, and it must write the encrypted payload to '{output}'. For example:
+
+    make bench BENCH_ENCRYPT_CMD='{cli} -e -i {input} -o {output} -p {password}'
+
+Check the flags against 'mftah --help' of the CLI built from 'deps/MFTAH-CLI' first;
+ this benchmark has not yet been run against a pinned CLI version, so no reference
+ results are recorded alongside it.
+
+Results are written as JSON so runs can be compared against each other.
+"""
+
+import argparse
+import json
+import os
+import re
+import select
+import shlex
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+
+CANARY_FILE_NAME = 'CROWS.CANARY'
+PAYLOAD_FILE_NAME = 'BENCH.CROWS'
+PASSWORD_PROMPT = b'Enter the password for'
+PROFILE_TOTAL = re.compile(r'^\s*Total\s+(\d+)\.(\d+)\s*$')
+PROFILE_HEADER = re.compile(r'Boot profile \(TSC at (\d+) kHz\)')
+PROFILE_ROW = re.compile(r'^\s*(\w+)\s+(\d+)\s+(\d+)\.(\d+)\s+(\d+|-)\s*$')
+ANSI_ESCAPE = re.compile(rb'\x1b\[[0-9;?]*[A-Za-z]')
+
+
+def fail(message):
+    print(f'bench: {message}', file=sys.stderr)
+    sys.exit(1)
+
+
+def run(*command):
+    subprocess.run(command, check=True, stdout=subprocess.DEVNULL)
+
+
+def require_tools(*tools):
+    for tool in tools:
+        if shutil.which(tool) is None:
+            fail(f"required tool '{tool}' was not found in PATH")
+
+
+def make_fat_image(path, size_mib, files):
+    """Create a FAT32 image of the given size holding the '(host path, image path)' files."""
+    with open(path, 'wb') as image:
+        image.truncate(size_mib << 20)
+
+    run('mkfs.vfat', '-F', '32', '-n', 'MFTAHBENCH', path)
+
+    for host_path, image_path in files:
+        directory = os.path.dirname(image_path)
+        if directory:
+            parts = directory.split('/')
+            for depth in range(1, len(parts) + 1):
+                subprocess.run(['mmd', '-D', 's', '-i', path, '::' + '/'.join(parts[:depth])],
+                               stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        run('mcopy', '-o', '-i', path, host_path, '::' + image_path)
+
+
+def make_payload(workdir, args, size_mib):
+    """Build and encrypt a synthetic ramdisk of 'size_mib' MiB. Returns the payload's path."""
+    canary = os.path.join(workdir, CANARY_FILE_NAME)
+    with open(canary, 'w') as handle:
+        handle.write('MFTAH benchmark ramdisk\n')
+
+    # The rest of the ramdisk is filled with incompressible data, like a real root filesystem.
+    filler = os.path.join(workdir, 'FILLER.BIN')
+    filler_size = max(0, (size_mib << 20) - (8 << 20))
+    with open(filler, 'wb') as handle:
+        while filler_size > 0:
+            chunk = min(filler_size, 1 << 20)
+            handle.write(os.urandom(chunk))
+            filler_size -= chunk
+
+    ramdisk = os.path.join(workdir, 'ramdisk.img')
+    make_fat_image(ramdisk, size_mib, [
+        (canary, CANARY_FILE_NAME),
+        (args.efi, 'EFI/BOOT/BOOTX64.EFI'),
+        (filler, 'FILLER.BIN'),
+    ])
+    os.remove(filler)
+
+    payload = os.path.join(workdir, PAYLOAD_FILE_NAME)
+    command = args.encrypt_cmd.format(
+        cli=shlex.quote(args.mftah_cli),
+        input=shlex.quote(ramdisk),
+        output=shlex.quote(payload),
+        password=shlex.quote(args.password),
+    )
+    subprocess.run(command, shell=True, check=True, stdout=subprocess.DEVNULL)
+    os.remove(ramdisk)
+
+    if not os.path.isfile(payload):
+        fail(f"the encryption command did not produce '{payload}'")
+
+    return payload
+
+
+def make_esp(workdir, args, payload):
+    """Put the loader and the payload on a fresh ESP image. Returns the image's path."""
+    esp = os.path.join(workdir, 'esp.img')
+    esp_mib = (os.path.getsize(payload) >> 20) + 64
+
+    make_fat_image(esp, esp_mib, [
+        (args.efi, 'EFI/BOOT/BOOTX64.EFI'),
+        (payload, PAYLOAD_FILE_NAME),
+    ])
+
+    return esp
+
+
+def parse_profile(lines):
+    profile = {'tsc_khz': None, 'phases': {}, 'total_ms': None}
+
+    for line in lines:
+        match = PROFILE_HEADER.search(line)
+        if match:
+            profile['tsc_khz'] = int(match.group(1))
+            continue
+
+        match = PROFILE_TOTAL.match(line)
+        if match:
+            profile['total_ms'] = float(f'{match.group(1)}.{match.group(2)}')
+            continue
+
+        match = PROFILE_ROW.match(line)
+        if match:
+            name, runs, ms, frac, throughput = match.groups()
+            profile['phases'][name] = {
+                'runs': int(runs),
+                'ms': float(f'{ms}.{frac}'),
+                'mib_per_s': None if '-' == throughput else int(throughput),
+            }
+
+    return profile
+
+
+def boot(args, esp, vcpus):
+    """Boot the ESP once. Returns the parsed profile plus host-side wall clock times."""
+    command = [
+        args.qemu,
+        '-machine', 'q35,accel=' + args.accel,
+        '-cpu', 'max',
+        '-smp', str(vcpus),
+        '-m', str(args.memory),
+        '-nographic', '-no-reboot',
+        '-drive', f'if=pflash,format=raw,readonly=on,file={args.ovmf_code}',
+        '-drive', f'format=raw,file={esp}',
+        '-net', 'none',
+    ]
+
+    started = time.monotonic()
+    prompted = None
+    output = b''
+    lines = []
+
+    qemu = subprocess.Popen(command, stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT)
+    try:
+        while True:
+            if (time.monotonic() - started) > args.timeout:
+                fail(f'timed out after {args.timeout}s waiting on the loader ({vcpus} vCPUs)')
+
+            ready, _, _ = select.select([qemu.stdout], [], [], 0.5)
+            if not ready:
+                if qemu.poll() is not None:
+                    fail(f'QEMU exited early with code {qemu.returncode}')
+                continue
+
+            chunk = os.read(qemu.stdout.fileno(), 4096)
+            if not chunk:
+                fail('QEMU closed its console before the profile was printed')
+
+            output += ANSI_ESCAPE.sub(b'', chunk)
+
+            if prompted is None and PASSWORD_PROMPT in output:
+                prompted = time.monotonic()
+                qemu.stdin.write(args.password.encode() + b'\r')
+                qemu.stdin.flush()
+
+            *complete, output = output.split(b'\n')
+            complete = [line.decode(errors='replace').rstrip('\r') for line in complete]
+            lines += complete
+
+            if args.verbose:
+                for line in complete:
+                    print(line, file=sys.stderr)
+
+            if any(PROFILE_TOTAL.match(line) for line in complete):
+                break
+    finally:
+        qemu.kill()
+        qemu.wait()
+
+    finished = time.monotonic()
+
+    profile = parse_profile(lines)
+    profile['wall_s'] = {
+        'to_prompt': round(prompted - started, 3),
+        'unlock_to_chainload': round(finished - prompted, 3),
+    }
+
+    return profile
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('--efi', required=True, help='the MFTAH.EFI to benchmark, built with MFTAH_PRINT_PROFILE=1')
+    parser.add_argument('--sizes', default='64', help='space-separated payload sizes in MiB')
+    parser.add_argument('--vcpus', default='1', help='space-separated vCPU counts')
+    parser.add_argument('--runs', type=int, default=1, help='boots per size and vCPU count')
+    parser.add_argument('--password', default='benchmark')
+    parser.add_argument('--mftah-cli', default='mftah', help='path to the MFTAH-CLI binary')
+    parser.add_argument('--encrypt-cmd', required=True,
+                        help='payload encryption command template with {cli}, {input}, {output} and {password}')
+    parser.add_argument('--qemu', default='qemu-system-x86_64')
+    parser.add_argument('--accel', default='kvm:tcg')
+    parser.add_argument('--ovmf-code', default='/usr/share/OVMF/OVMF_CODE.fd')
+    parser.add_argument('--memory', type=int, default=0, help='guest RAM in MiB (default: scaled to the payload)')
+    parser.add_argument('--timeout', type=int, default=600, help='seconds to wait for one boot')
+    parser.add_argument('--output', default='-', help="where to write the JSON results ('-' for stdout)")
+    parser.add_argument('--verbose', action='store_true', help='echo the guest console to stderr')
+    args = parser.parse_args()
+
+    require_tools(args.qemu, 'mkfs.vfat', 'mcopy', 'mmd')
+    for path in (args.efi, args.ovmf_code):
+        if not os.path.isfile(path):
+            fail(f"'{path}' does not exist")
+
+    sizes = [int(size) for size in args.sizes.split()]
+    if any(size < 64 for size in sizes):
+        fail('payload sizes must be at least 64 MiB to hold a FAT32 filesystem')
+
+    vcpu_counts = [int(count) for count in args.vcpus.split()]
+    results = {'efi': os.path.abspath(args.efi), 'runs': []}
+
+    for size_mib in sizes:
+        with tempfile.TemporaryDirectory(prefix='mftah-bench-') as workdir:
+            payload = make_payload(workdir, args, size_mib)
+            esp = make_esp(workdir, args, payload)
+
+            # The encrypted image, the decrypted ramdisk and OVMF itself all have to fit.
+            memory = args.memory or max(1024, (size_mib * 3) + 512)
+
+            for vcpus in vcpu_counts:
+                for run_index in range(args.runs):
+                    print(f'bench: {size_mib} MiB, {vcpus} vCPUs, run {run_index + 1}/{args.runs}', file=sys.stderr)
+
+                    boot_args = argparse.Namespace(**vars(args))
+                    boot_args.memory = memory
+
+                    result = boot(boot_args, esp, vcpus)
+                    result.update({'size_mib': size_mib, 'vcpus': vcpus, 'run': run_index})
+                    results['runs'].append(result)
+
+    if '-' == args.output:
+        json.dump(results, sys.stdout, indent=2)
+        print()
+    else:
+        with open(args.output, 'w') as handle:
+            json.dump(results, handle, indent=2)
+            handle.write('\n')
+        print(f"bench: results written to '{args.output}'", file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
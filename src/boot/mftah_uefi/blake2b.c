@@ -0,0 +1,184 @@
+/*
+ * BLAKE2b, as specified in RFC 7693.
+ */
+
+#include "crypto/blake2b.h"
+
+
+
+static const uint64_t blake2b_iv[8] = {
+    0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL,
+    0x3C6EF372FE94F82BULL, 0xA54FF53A5F1D36F1ULL,
+    0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL,
+    0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL,
+};
+
+static const uint8_t blake2b_sigma[12][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+};
+
+
+
+static inline
+uint64_t
+rotr64(uint64_t value,
+       unsigned int count)
+{
+    return (value >> count) | (value << (64 - count));
+}
+
+
+static inline
+uint64_t
+load64_le(const uint8_t *p)
+{
+    return ((uint64_t)p[0])       | ((uint64_t)p[1] << 8)
+         | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+         | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40)
+         | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+
+#define BLAKE2B_G(a, b, c, d, x, y) \
+    do { \
+        a = a + b + (x); d = rotr64(d ^ a, 32); \
+        c = c + d;       b = rotr64(b ^ c, 24); \
+        a = a + b + (y); d = rotr64(d ^ a, 16); \
+        c = c + d;       b = rotr64(b ^ c, 63); \
+    } while (0)
+
+
+static
+void
+blake2b_compress(struct Blake2b *ctx,
+                 const uint8_t *block,
+                 int last)
+{
+    uint64_t m[16];
+    uint64_t v[16];
+
+    for (int i = 0; i < 16; ++i) m[i] = load64_le(block + (i * 8));
+
+    for (int i = 0; i < 8; ++i) {
+        v[i] = ctx->h[i];
+        v[i + 8] = blake2b_iv[i];
+    }
+
+    v[12] ^= ctx->t[0];
+    v[13] ^= ctx->t[1];
+    if (last) v[14] = ~v[14];
+
+    for (int r = 0; r < 12; ++r) {
+        const uint8_t *s = blake2b_sigma[r];
+
+        BLAKE2B_G(v[0], v[4], v[8],  v[12], m[s[0]],  m[s[1]]);
+        BLAKE2B_G(v[1], v[5], v[9],  v[13], m[s[2]],  m[s[3]]);
+        BLAKE2B_G(v[2], v[6], v[10], v[14], m[s[4]],  m[s[5]]);
+        BLAKE2B_G(v[3], v[7], v[11], v[15], m[s[6]],  m[s[7]]);
+        BLAKE2B_G(v[0], v[5], v[10], v[15], m[s[8]],  m[s[9]]);
+        BLAKE2B_G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+        BLAKE2B_G(v[2], v[7], v[8],  v[13], m[s[12]], m[s[13]]);
+        BLAKE2B_G(v[3], v[4], v[9],  v[14], m[s[14]], m[s[15]]);
+    }
+
+    for (int i = 0; i < 8; ++i) ctx->h[i] ^= v[i] ^ v[i + 8];
+}
+
+
+static inline
+void
+blake2b_increment(struct Blake2b *ctx,
+                  uint64_t amount)
+{
+    ctx->t[0] += amount;
+    if (ctx->t[0] < amount) ++(ctx->t[1]);
+}
+
+
+int
+blake2b_init(struct Blake2b *ctx,
+             size_t out_len)
+{
+    if (0 == out_len || out_len > BLAKE2B_MAX_OUTPUT) return -1;
+
+    for (int i = 0; i < 8; ++i) ctx->h[i] = blake2b_iv[i];
+
+    /* Parameter block: digest length, no key, fanout and depth of 1. */
+    ctx->h[0] ^= 0x01010000ULL | (uint64_t)out_len;
+
+    ctx->t[0] = ctx->t[1] = 0;
+    ctx->buffer_len = 0;
+    ctx->out_len = out_len;
+
+    return 0;
+}
+
+
+void
+blake2b_update(struct Blake2b *ctx,
+               const void *data,
+               size_t len)
+{
+    const uint8_t *in = (const uint8_t *)data;
+
+    while (len > 0) {
+        /* The last block is only compressed by blake2b_final, so never compress a full buffer early. */
+        if (BLAKE2B_BLOCK_SIZE == ctx->buffer_len) {
+            blake2b_increment(ctx, BLAKE2B_BLOCK_SIZE);
+            blake2b_compress(ctx, ctx->buffer, 0);
+            ctx->buffer_len = 0;
+        }
+
+        while (len > 0 && ctx->buffer_len < BLAKE2B_BLOCK_SIZE) {
+            ctx->buffer[ctx->buffer_len++] = *in++;
+            --len;
+        }
+    }
+}
+
+
+void
+blake2b_final(struct Blake2b *ctx,
+              uint8_t *out)
+{
+    blake2b_increment(ctx, ctx->buffer_len);
+
+    for (size_t i = ctx->buffer_len; i < BLAKE2B_BLOCK_SIZE; ++i) ctx->buffer[i] = 0;
+    blake2b_compress(ctx, ctx->buffer, 1);
+
+    for (size_t i = 0; i < ctx->out_len; ++i) {
+        out[i] = (uint8_t)(ctx->h[i / 8] >> (8 * (i % 8)));
+    }
+
+    /* Nothing of the state is needed anymore. */
+    for (int i = 0; i < 8; ++i) ctx->h[i] = 0;
+    for (int i = 0; i < BLAKE2B_BLOCK_SIZE; ++i) ctx->buffer[i] = 0;
+}
+
+
+int
+blake2b(uint8_t *out,
+        size_t out_len,
+        const void *data,
+        size_t len)
+{
+    struct Blake2b ctx;
+
+    if (0 != blake2b_init(&ctx, out_len)) return -1;
+
+    blake2b_update(&ctx, data, len);
+    blake2b_final(&ctx, out);
+
+    return 0;
+}
@@ -0,0 +1,193 @@
+#include "core/bootinfo.h"
+#include "core/handoff.h"
+#include "core/memory.h"
+#include "core/profiler.h"
+#include "core/util.h"
+#include "drivers/ramdisk.h"
+
+
+
+EFI_GUID gMftahBootInfoGuid = MFTAH_BOOTINFO_GUID;
+
+STATIC mftah_bootinfo_header *mBootInfo = NULL;
+
+/* The body of the boot profile entry, which is only filled in by BootInfoFinalize. */
+STATIC UINT8 *mBootInfoProfile = NULL;
+
+
+
+/**
+ * Append an entry to the table and return it. The space is already zeroed.
+ */
+STATIC
+VOID *
+EFIAPI
+BootInfoAppend(IN OUT UINT8 **Cursor,
+               IN UINT32 Type,
+               IN UINT32 Size)
+{
+    mftah_bootinfo_entry *Entry = (mftah_bootinfo_entry *)*Cursor;
+
+    Entry->type = Type;
+    Entry->size = Size;
+    ++(mBootInfo->entry_count);
+
+    *Cursor += MFTAH_BOOTINFO_ALIGN(Size);
+    return (VOID *)Entry;
+}
+
+
+STATIC
+VOID
+EFIAPI
+BootInfoAppendReservation(IN OUT UINT8 **Cursor,
+                          IN UINT64 Base,
+                          IN UINT64 Length,
+                          IN UINT32 Kind)
+{
+    mftah_bootinfo_reservation *Reservation = (mftah_bootinfo_reservation *)
+        BootInfoAppend(Cursor, MFTAH_BOOTINFO_RESERVATION, sizeof(mftah_bootinfo_reservation));
+
+    Reservation->base = Base;
+    Reservation->length = Length;
+    Reservation->kind = Kind;
+}
+
+
+STATIC
+VOID
+EFIAPI
+BootInfoUpdateChecksum(VOID)
+{
+    mBootInfo->checksum = 0;
+    mBootInfo->checksum = (UINT8)(0 - CalculateCheckSum8((UINT8 *)mBootInfo, mBootInfo->total_size));
+}
+
+
+EFI_STATUS
+EFIAPI
+BootInfoPublish(IN BATCH_PAYLOAD *Payloads,
+                IN UINTN PayloadCount,
+                IN UINT8 *LoadedLoaderHash)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    mftah_handoff_record *Handoff = (mftah_handoff_record *)(UINTN)HandoffRecordAddress();
+    EFI_PHYSICAL_ADDRESS TableBase = 0;
+    UINTN TablePages = 0;
+    UINT64 TableSize = 0;
+    UINT8 *Cursor = NULL;
+
+    mftah_bootinfo_ramdisk *Ramdisk;
+    mftah_bootinfo_hash *LoaderHash;
+    mftah_bootinfo_pointer *Pointer;
+    mftah_bootinfo_entry *Profile;
+
+    PRINTLN(L"-- Publishing the boot information table.");
+
+    TableSize = sizeof(mftah_bootinfo_header)
+        + (PayloadCount * MFTAH_BOOTINFO_ALIGN(sizeof(mftah_bootinfo_ramdisk)))
+        + MFTAH_BOOTINFO_ALIGN(sizeof(mftah_bootinfo_hash))
+        + MFTAH_BOOTINFO_ALIGN(sizeof(mftah_bootinfo_entry) + sizeof(MFTAH_BOOT_PROFILE))
+        + ((NULL != Handoff) ? MFTAH_BOOTINFO_ALIGN(sizeof(mftah_bootinfo_pointer)) : 0)
+        + ((PayloadCount + 1 + ((NULL != Handoff) ? 2 : 0)) * MFTAH_BOOTINFO_ALIGN(sizeof(mftah_bootinfo_reservation)))
+        + MFTAH_BOOTINFO_ALIGN(sizeof(mftah_bootinfo_entry));
+    TablePages = EFI_SIZE_TO_PAGES(TableSize);
+
+    Status = uefi_call_wrapper(BS->AllocatePages, 4,
+                               AllocateAnyPages, EfiReservedMemoryType, TablePages, &TableBase);
+    if (EFI_ERROR(Status)) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    mBootInfo = (mftah_bootinfo_header *)(UINTN)TableBase;
+    FastSetMem(mBootInfo, EFI_PAGES_TO_SIZE(TablePages), 0x00);
+
+    mBootInfo->signature = MFTAH_BOOTINFO_SIGNATURE;
+    mBootInfo->version = MFTAH_BOOTINFO_VERSION;
+    mBootInfo->header_size = sizeof(mftah_bootinfo_header);
+
+    Cursor = (UINT8 *)mBootInfo + sizeof(mftah_bootinfo_header);
+
+    for (UINTN i = 0; i < PayloadCount; ++i) {
+        Ramdisk = (mftah_bootinfo_ramdisk *)BootInfoAppend(&Cursor, MFTAH_BOOTINFO_RAMDISK, sizeof(mftah_bootinfo_ramdisk));
+        Ramdisk->index = (UINT32)i;
+        Ramdisk->flags = (0 == i)
+            ? (MFTAH_BOOTINFO_RAMDISK_BOOT | ((NULL != Handoff) ? MFTAH_BOOTINFO_RAMDISK_PARTIAL : 0))
+            : 0;
+        if (RAM_DISK_RELEASES_IMAGE(i)) {
+            Ramdisk->flags |= (1 == RAM_DISK_COMPRESS) ? MFTAH_BOOTINFO_RAMDISK_COMPRESSED : MFTAH_BOOTINFO_RAMDISK_DEDUP;
+        } else if (NULL != Payloads[i].ReadBuffer && MFTAH_RAMDISK_ALIGNMENT >= (2ULL << 20)) {
+            /* Only a payload buffer is padded out to the boundary after the ramdisk. */
+            Ramdisk->flags |= MFTAH_BOOTINFO_RAMDISK_ALIGNED;
+        }
+        Ramdisk->base = (UINT64)(UINTN)Payloads[i].RamdiskImage;
+        Ramdisk->length = Payloads[i].RamdiskLength;
+        CopyMem(Ramdisk->payload_hash, Payloads[i].PayloadHash, SIZE_OF_SHA_256_HASH);
+    }
+
+    LoaderHash = (mftah_bootinfo_hash *)BootInfoAppend(&Cursor, MFTAH_BOOTINFO_LOADER_HASH, sizeof(mftah_bootinfo_hash));
+    CopyMem(LoaderHash->hash, LoadedLoaderHash, SIZE_OF_SHA_256_HASH);
+
+    Profile = (mftah_bootinfo_entry *)BootInfoAppend(&Cursor,
+                                                      MFTAH_BOOTINFO_BOOT_PROFILE,
+                                                      sizeof(mftah_bootinfo_entry) + sizeof(MFTAH_BOOT_PROFILE));
+    mBootInfoProfile = (UINT8 *)Profile + sizeof(mftah_bootinfo_entry);
+
+    if (NULL != Handoff) {
+        Pointer = (mftah_bootinfo_pointer *)BootInfoAppend(&Cursor, MFTAH_BOOTINFO_HANDOFF, sizeof(mftah_bootinfo_pointer));
+        Pointer->address = (UINT64)(UINTN)Handoff;
+    }
+
+    /* A restored warm cache has no payload buffer, only the ramdisk itself. Ramdisks moved
+        into a compressed or deduplicating store release their payload buffers, and those
+        stores are hinted separately. */
+    for (UINTN i = 0; i < PayloadCount; ++i) {
+        if (RAM_DISK_RELEASES_IMAGE(i)) {
+            continue;
+        } else if (NULL != Payloads[i].ReadBuffer) {
+            BootInfoAppendReservation(&Cursor, Payloads[i].BufferBase,
+                                      EFI_PAGES_TO_SIZE(Payloads[i].BufferPages), MFTAH_RESERVATION_RAMDISK);
+        } else {
+            BootInfoAppendReservation(&Cursor, (UINT64)(UINTN)Payloads[i].RamdiskImage,
+                                      Payloads[i].RamdiskLength, MFTAH_RESERVATION_RAMDISK);
+        }
+    }
+
+    if (NULL != Handoff) {
+        BootInfoAppendReservation(&Cursor, (UINT64)(UINTN)Handoff, Handoff->record_size, MFTAH_RESERVATION_HANDOFF);
+        BootInfoAppendReservation(&Cursor, Handoff->kek_address, EFI_PAGE_SIZE, MFTAH_RESERVATION_HANDOFF);
+    }
+
+    BootInfoAppendReservation(&Cursor, (UINT64)TableBase, EFI_PAGES_TO_SIZE(TablePages), MFTAH_RESERVATION_BOOTINFO);
+
+    BootInfoAppend(&Cursor, MFTAH_BOOTINFO_END, sizeof(mftah_bootinfo_entry));
+
+    mBootInfo->total_size = (UINT32)(Cursor - (UINT8 *)mBootInfo);
+    BootInfoFinalize();
+
+    DPRINTLN(L"---- Boot information table at '%p': (%u) entries, (%u) bytes.",
+             mBootInfo, mBootInfo->entry_count, mBootInfo->total_size);
+
+    ERRCHECK_UEFI(BS->InstallConfigurationTable, 2, &gMftahBootInfoGuid, (VOID *)mBootInfo);
+
+    return EFI_SUCCESS;
+}
+
+
+VOID
+EFIAPI
+BootInfoFinalize(VOID)
+{
+    if (NULL == mBootInfo) return;
+
+    CopyMem(mBootInfoProfile, (VOID *)ProfilerGetRecord(), sizeof(MFTAH_BOOT_PROFILE));
+    BootInfoUpdateChecksum();
+}
+
+
+UINT64
+EFIAPI
+BootInfoTableAddress(VOID)
+{
+    return (UINT64)(UINTN)mBootInfo;
+}
@@ -0,0 +1,519 @@
+/*
+ * ChaCha20-Poly1305, as specified in RFC 8439.
+ */
+
+#include "crypto/chacha20poly1305.h"
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+
+
+#define CPUID_1_ECX_OSXSAVE     (1 << 27)
+#define CPUID_7_EBX_AVX2        (1 << 5)
+
+/* Keystream is produced and consumed a chunk at a time, so the ciphertext under it
+    is hashed and replaced while it is still in cache. */
+#define CHACHA20_CHUNK_LEN      (8 * CHACHA20_BLOCK_LEN)
+
+#define POLY1305_MASK44         0xfffffffffffULL
+#define POLY1305_MASK42         0x3ffffffffffULL
+
+typedef unsigned __int128 uint128_t;
+
+
+/*
+ * @brief The state of one Poly1305 computation, with 44-bit limbs.
+ */
+struct Poly1305 {
+    uint64_t r[3];
+    uint64_t h[3];
+    uint64_t pad[2];
+};
+
+
+
+static inline
+uint32_t
+load32_le(const uint8_t *p)
+{
+    return ((uint32_t)p[0]) | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static inline
+uint64_t
+load64_le(const uint8_t *p)
+{
+    return ((uint64_t)load32_le(p)) | ((uint64_t)load32_le(p + 4) << 32);
+}
+
+
+static inline
+void
+store32_le(uint8_t *p,
+           uint32_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+
+static inline
+void
+store64_le(uint8_t *p,
+           uint64_t value)
+{
+    store32_le(p, (uint32_t)value);
+    store32_le(p + 4, (uint32_t)(value >> 32));
+}
+
+
+static inline
+uint32_t
+rotl32(uint32_t value,
+       unsigned int count)
+{
+    return (value << count) | (value >> (32 - count));
+}
+
+
+
+/*****************************************************************************/
+/* Poly1305                                                                  */
+/*****************************************************************************/
+static
+void
+poly1305_init(struct Poly1305 *ctx,
+              const uint8_t *key)
+{
+    uint64_t t0 = load64_le(key), t1 = load64_le(key + 8);
+
+    /* r is clamped as it is split into limbs. */
+    ctx->r[0] = t0 & 0xffc0fffffffULL;
+    ctx->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+    ctx->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+
+    ctx->h[0] = ctx->h[1] = ctx->h[2] = 0;
+
+    ctx->pad[0] = load64_le(key + 16);
+    ctx->pad[1] = load64_le(key + 24);
+}
+
+
+/* Absorb whole 16-byte blocks. */
+static
+void
+poly1305_blocks(struct Poly1305 *ctx,
+                const uint8_t *data,
+                size_t length)
+{
+    const uint64_t r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2];
+    const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+    uint64_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2];
+    uint64_t t0, t1, c;
+    uint128_t d0, d1, d2;
+
+    for (; length >= 16; data += 16, length -= 16) {
+        t0 = load64_le(data);
+        t1 = load64_le(data + 8);
+
+        h0 += t0 & POLY1305_MASK44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & POLY1305_MASK44;
+        h2 += ((t1 >> 24) & POLY1305_MASK42) | (1ULL << 40);
+
+        d0 = ((uint128_t)h0 * r0) + ((uint128_t)h1 * s2) + ((uint128_t)h2 * s1);
+        d1 = ((uint128_t)h0 * r1) + ((uint128_t)h1 * r0) + ((uint128_t)h2 * s2);
+        d2 = ((uint128_t)h0 * r2) + ((uint128_t)h1 * r1) + ((uint128_t)h2 * r0);
+
+        c = (uint64_t)(d0 >> 44); h0 = (uint64_t)d0 & POLY1305_MASK44;
+        d1 += c;
+        c = (uint64_t)(d1 >> 44); h1 = (uint64_t)d1 & POLY1305_MASK44;
+        d2 += c;
+        c = (uint64_t)(d2 >> 42); h2 = (uint64_t)d2 & POLY1305_MASK42;
+        h0 += c * 5;
+        c = h0 >> 44; h0 &= POLY1305_MASK44;
+        h1 += c;
+    }
+
+    ctx->h[0] = h0;
+    ctx->h[1] = h1;
+    ctx->h[2] = h2;
+}
+
+
+/* Absorb a buffer, zero-padding it to a whole block as the AEAD construction does. */
+static
+void
+poly1305_update_padded(struct Poly1305 *ctx,
+                       const uint8_t *data,
+                       size_t length)
+{
+    uint8_t block[16] = {0};
+    size_t whole = length & ~(size_t)15;
+
+    poly1305_blocks(ctx, data, whole);
+
+    if (whole != length) {
+        for (size_t i = 0; i < (length - whole); ++i) block[i] = data[whole + i];
+        poly1305_blocks(ctx, block, sizeof(block));
+    }
+}
+
+
+static
+void
+poly1305_finish(struct Poly1305 *ctx,
+                uint8_t *tag)
+{
+    uint64_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2];
+    uint64_t g0, g1, g2, c, t0, t1;
+
+    /* Fully carry h. */
+    c = h1 >> 44; h1 &= POLY1305_MASK44;
+    h2 += c; c = h2 >> 42; h2 &= POLY1305_MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= POLY1305_MASK44;
+    h1 += c; c = h1 >> 44; h1 &= POLY1305_MASK44;
+    h2 += c; c = h2 >> 42; h2 &= POLY1305_MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= POLY1305_MASK44;
+    h1 += c;
+
+    /* Compute h - p, and keep it if it didn't underflow. */
+    g0 = h0 + 5; c = g0 >> 44; g0 &= POLY1305_MASK44;
+    g1 = h1 + c; c = g1 >> 44; g1 &= POLY1305_MASK44;
+    g2 = h2 + c - (1ULL << 42);
+
+    c = (g2 >> 63) - 1;
+    g0 &= c; g1 &= c; g2 &= c;
+    c = ~c;
+    h0 = (h0 & c) | g0;
+    h1 = (h1 & c) | g1;
+    h2 = (h2 & c) | g2;
+
+    /* h + s */
+    t0 = ctx->pad[0];
+    t1 = ctx->pad[1];
+
+    h0 += t0 & POLY1305_MASK44; c = h0 >> 44; h0 &= POLY1305_MASK44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & POLY1305_MASK44) + c; c = h1 >> 44; h1 &= POLY1305_MASK44;
+    h2 += ((t1 >> 24) & POLY1305_MASK42) + c; h2 &= POLY1305_MASK42;
+
+    store64_le(tag, h0 | (h1 << 44));
+    store64_le(tag + 8, (h1 >> 20) | (h2 << 24));
+
+    for (int i = 0; i < 3; ++i) ctx->r[i] = ctx->h[i] = 0;
+    ctx->pad[0] = ctx->pad[1] = 0;
+}
+
+
+
+/*****************************************************************************/
+/* ChaCha20 keystream kernels                                                */
+/*****************************************************************************/
+#define CHACHA20_QR(a, b, c, d) \
+    a += b; d = rotl32(d ^ a, 16); \
+    c += d; b = rotl32(b ^ c, 12); \
+    a += b; d = rotl32(d ^ a, 8);  \
+    c += d; b = rotl32(b ^ c, 7);
+
+
+static
+void
+chacha20_block_scalar(const uint32_t *state,
+                      uint8_t *out)
+{
+    uint32_t x[16];
+
+    for (int i = 0; i < 16; ++i) x[i] = state[i];
+
+    for (int i = 0; i < 10; ++i) {
+        CHACHA20_QR(x[0], x[4], x[8],  x[12]);
+        CHACHA20_QR(x[1], x[5], x[9],  x[13]);
+        CHACHA20_QR(x[2], x[6], x[10], x[14]);
+        CHACHA20_QR(x[3], x[7], x[11], x[15]);
+        CHACHA20_QR(x[0], x[5], x[10], x[15]);
+        CHACHA20_QR(x[1], x[6], x[11], x[12]);
+        CHACHA20_QR(x[2], x[7], x[8],  x[13]);
+        CHACHA20_QR(x[3], x[4], x[9],  x[14]);
+    }
+
+    for (int i = 0; i < 16; ++i) store32_le(out + (i * 4), x[i] + state[i]);
+}
+
+
+/* Each vector holds one state word of several consecutive blocks. */
+#define CHACHA20_ROTL_SSE2(v, n) \
+    _mm_or_si128(_mm_slli_epi32((v), (n)), _mm_srli_epi32((v), 32 - (n)))
+
+#define CHACHA20_QR_SSE2(a, b, c, d) \
+    a = _mm_add_epi32(a, b); d = CHACHA20_ROTL_SSE2(_mm_xor_si128(d, a), 16); \
+    c = _mm_add_epi32(c, d); b = CHACHA20_ROTL_SSE2(_mm_xor_si128(b, c), 12); \
+    a = _mm_add_epi32(a, b); d = CHACHA20_ROTL_SSE2(_mm_xor_si128(d, a), 8);  \
+    c = _mm_add_epi32(c, d); b = CHACHA20_ROTL_SSE2(_mm_xor_si128(b, c), 7);
+
+
+/* Four blocks at once, from the block counter in 'state'. */
+static
+void
+chacha20_blocks_sse2(const uint32_t *state,
+                     uint8_t *out)
+{
+    __m128i x[16], in[16], t0, t1, t2, t3;
+
+    for (int i = 0; i < 16; ++i) in[i] = _mm_set1_epi32((int)state[i]);
+    in[12] = _mm_add_epi32(in[12], _mm_set_epi32(3, 2, 1, 0));
+
+    for (int i = 0; i < 16; ++i) x[i] = in[i];
+
+    for (int i = 0; i < 10; ++i) {
+        CHACHA20_QR_SSE2(x[0], x[4], x[8],  x[12]);
+        CHACHA20_QR_SSE2(x[1], x[5], x[9],  x[13]);
+        CHACHA20_QR_SSE2(x[2], x[6], x[10], x[14]);
+        CHACHA20_QR_SSE2(x[3], x[7], x[11], x[15]);
+        CHACHA20_QR_SSE2(x[0], x[5], x[10], x[15]);
+        CHACHA20_QR_SSE2(x[1], x[6], x[11], x[12]);
+        CHACHA20_QR_SSE2(x[2], x[7], x[8],  x[13]);
+        CHACHA20_QR_SSE2(x[3], x[4], x[9],  x[14]);
+    }
+
+    /* Transpose each group of four words back into the four blocks. */
+    for (int g = 0; g < 4; ++g) {
+        t0 = _mm_add_epi32(x[(4 * g)],     in[(4 * g)]);
+        t1 = _mm_add_epi32(x[(4 * g) + 1], in[(4 * g) + 1]);
+        t2 = _mm_add_epi32(x[(4 * g) + 2], in[(4 * g) + 2]);
+        t3 = _mm_add_epi32(x[(4 * g) + 3], in[(4 * g) + 3]);
+
+        x[0] = _mm_unpacklo_epi32(t0, t1);
+        x[1] = _mm_unpacklo_epi32(t2, t3);
+        x[2] = _mm_unpackhi_epi32(t0, t1);
+        x[3] = _mm_unpackhi_epi32(t2, t3);
+
+        _mm_storeu_si128((__m128i *)(out + (0 * CHACHA20_BLOCK_LEN) + (16 * g)), _mm_unpacklo_epi64(x[0], x[1]));
+        _mm_storeu_si128((__m128i *)(out + (1 * CHACHA20_BLOCK_LEN) + (16 * g)), _mm_unpackhi_epi64(x[0], x[1]));
+        _mm_storeu_si128((__m128i *)(out + (2 * CHACHA20_BLOCK_LEN) + (16 * g)), _mm_unpacklo_epi64(x[2], x[3]));
+        _mm_storeu_si128((__m128i *)(out + (3 * CHACHA20_BLOCK_LEN) + (16 * g)), _mm_unpackhi_epi64(x[2], x[3]));
+    }
+}
+
+
+#define CHACHA20_ROTL_AVX2(v, n) \
+    _mm256_or_si256(_mm256_slli_epi32((v), (n)), _mm256_srli_epi32((v), 32 - (n)))
+
+/* The byte-aligned rotations are a single shuffle. */
+#define CHACHA20_ROT16_AVX2(v) \
+    _mm256_shuffle_epi8((v), _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2, \
+                                             13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2))
+#define CHACHA20_ROT8_AVX2(v) \
+    _mm256_shuffle_epi8((v), _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3, \
+                                             14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3))
+
+#define CHACHA20_QR_AVX2(a, b, c, d) \
+    a = _mm256_add_epi32(a, b); d = CHACHA20_ROT16_AVX2(_mm256_xor_si256(d, a));    \
+    c = _mm256_add_epi32(c, d); b = CHACHA20_ROTL_AVX2(_mm256_xor_si256(b, c), 12); \
+    a = _mm256_add_epi32(a, b); d = CHACHA20_ROT8_AVX2(_mm256_xor_si256(d, a));     \
+    c = _mm256_add_epi32(c, d); b = CHACHA20_ROTL_AVX2(_mm256_xor_si256(b, c), 7);
+
+
+/* Eight blocks at once, from the block counter in 'state'. */
+__attribute__((target("avx2")))
+static
+void
+chacha20_blocks_avx2(const uint32_t *state,
+                     uint8_t *out)
+{
+    __m256i x[16], in[16], t0, t1, t2, t3, u0, u1, u2, u3;
+
+    for (int i = 0; i < 16; ++i) in[i] = _mm256_set1_epi32((int)state[i]);
+    in[12] = _mm256_add_epi32(in[12], _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+
+    for (int i = 0; i < 16; ++i) x[i] = in[i];
+
+    for (int i = 0; i < 10; ++i) {
+        CHACHA20_QR_AVX2(x[0], x[4], x[8],  x[12]);
+        CHACHA20_QR_AVX2(x[1], x[5], x[9],  x[13]);
+        CHACHA20_QR_AVX2(x[2], x[6], x[10], x[14]);
+        CHACHA20_QR_AVX2(x[3], x[7], x[11], x[15]);
+        CHACHA20_QR_AVX2(x[0], x[5], x[10], x[15]);
+        CHACHA20_QR_AVX2(x[1], x[6], x[11], x[12]);
+        CHACHA20_QR_AVX2(x[2], x[7], x[8],  x[13]);
+        CHACHA20_QR_AVX2(x[3], x[4], x[9],  x[14]);
+    }
+
+    /* The unpacks transpose within each 128-bit half: the low halves end up
+        holding blocks 0-3 and the high halves blocks 4-7. */
+    for (int g = 0; g < 4; ++g) {
+        t0 = _mm256_add_epi32(x[(4 * g)],     in[(4 * g)]);
+        t1 = _mm256_add_epi32(x[(4 * g) + 1], in[(4 * g) + 1]);
+        t2 = _mm256_add_epi32(x[(4 * g) + 2], in[(4 * g) + 2]);
+        t3 = _mm256_add_epi32(x[(4 * g) + 3], in[(4 * g) + 3]);
+
+        u0 = _mm256_unpacklo_epi32(t0, t1);
+        u1 = _mm256_unpacklo_epi32(t2, t3);
+        u2 = _mm256_unpackhi_epi32(t0, t1);
+        u3 = _mm256_unpackhi_epi32(t2, t3);
+
+        t0 = _mm256_unpacklo_epi64(u0, u1);
+        t1 = _mm256_unpackhi_epi64(u0, u1);
+        t2 = _mm256_unpacklo_epi64(u2, u3);
+        t3 = _mm256_unpackhi_epi64(u2, u3);
+
+        _mm_storeu_si128((__m128i *)(out + (0 * CHACHA20_BLOCK_LEN) + (16 * g)), _mm256_castsi256_si128(t0));
+        _mm_storeu_si128((__m128i *)(out + (1 * CHACHA20_BLOCK_LEN) + (16 * g)), _mm256_castsi256_si128(t1));
+        _mm_storeu_si128((__m128i *)(out + (2 * CHACHA20_BLOCK_LEN) + (16 * g)), _mm256_castsi256_si128(t2));
+        _mm_storeu_si128((__m128i *)(out + (3 * CHACHA20_BLOCK_LEN) + (16 * g)), _mm256_castsi256_si128(t3));
+        _mm_storeu_si128((__m128i *)(out + (4 * CHACHA20_BLOCK_LEN) + (16 * g)), _mm256_extracti128_si256(t0, 1));
+        _mm_storeu_si128((__m128i *)(out + (5 * CHACHA20_BLOCK_LEN) + (16 * g)), _mm256_extracti128_si256(t1, 1));
+        _mm_storeu_si128((__m128i *)(out + (6 * CHACHA20_BLOCK_LEN) + (16 * g)), _mm256_extracti128_si256(t2, 1));
+        _mm_storeu_si128((__m128i *)(out + (7 * CHACHA20_BLOCK_LEN) + (16 * g)), _mm256_extracti128_si256(t3, 1));
+    }
+
+    _mm256_zeroupper();
+}
+
+
+/* Fill a chunk of keystream with the widest allowed kernel, advancing the counter. */
+static
+void
+chacha20_keystream_chunk(uint32_t *state,
+                         int simd,
+                         uint8_t *out)
+{
+    if (CHACHA20_SIMD_AVX2 == simd) {
+        chacha20_blocks_avx2(state, out);
+        state[12] += 8;
+    } else {
+        chacha20_blocks_sse2(state, out);
+        state[12] += 4;
+        chacha20_blocks_sse2(state, out + (4 * CHACHA20_BLOCK_LEN));
+        state[12] += 4;
+    }
+}
+
+
+
+/*****************************************************************************/
+/* AEAD construction                                                         */
+/*****************************************************************************/
+static
+void
+chacha20_poly1305_crypt(const struct ChaCha20Poly1305 *ctx,
+                        const uint8_t *nonce,
+                        const uint8_t *aad,
+                        size_t aad_len,
+                        uint8_t *buf,
+                        size_t length,
+                        int decrypt,
+                        uint8_t *tag)
+{
+    struct Poly1305 poly;
+    uint32_t state[16];
+    uint8_t keystream[CHACHA20_CHUNK_LEN];
+    uint8_t lengths[16];
+    size_t n;
+
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; ++i) state[4 + i] = ctx->key[i];
+    state[12] = 0;
+    state[13] = load32_le(nonce);
+    state[14] = load32_le(nonce + 4);
+    state[15] = load32_le(nonce + 8);
+
+    /* Block 0 keys Poly1305; the text starts at block 1. */
+    chacha20_block_scalar(state, keystream);
+    poly1305_init(&poly, keystream);
+    state[12] = 1;
+
+    poly1305_update_padded(&poly, aad, aad_len);
+
+    for (size_t offset = 0; offset < length; offset += n) {
+        n = (length - offset) < CHACHA20_CHUNK_LEN ? (length - offset) : CHACHA20_CHUNK_LEN;
+
+        chacha20_keystream_chunk(state, ctx->simd, keystream);
+
+        /* Poly1305 always runs over the ciphertext. */
+        if (decrypt) poly1305_update_padded(&poly, buf + offset, n);
+        for (size_t i = 0; i < n; ++i) buf[offset + i] ^= keystream[i];
+        if (!decrypt) poly1305_update_padded(&poly, buf + offset, n);
+    }
+
+    store64_le(lengths, (uint64_t)aad_len);
+    store64_le(lengths + 8, (uint64_t)length);
+    poly1305_blocks(&poly, lengths, sizeof(lengths));
+
+    poly1305_finish(&poly, tag);
+
+    for (size_t i = 0; i < sizeof(keystream); ++i) keystream[i] = 0;
+    for (int i = 0; i < 16; ++i) state[i] = 0;
+}
+
+
+
+/*****************************************************************************/
+/* Public functions:                                                         */
+/*****************************************************************************/
+int
+chacha20_poly1305_simd_level(void)
+{
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return CHACHA20_SIMD_SSE2;
+    }
+
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (0 == (ecx & CPUID_1_ECX_OSXSAVE)) {
+        return CHACHA20_SIMD_SSE2;
+    }
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (0 != (ebx & CPUID_7_EBX_AVX2)) ? CHACHA20_SIMD_AVX2 : CHACHA20_SIMD_SSE2;
+}
+
+
+void
+chacha20_poly1305_init(struct ChaCha20Poly1305 *ctx,
+                       const uint8_t *key,
+                       int simd)
+{
+    for (int i = 0; i < 8; ++i) ctx->key[i] = load32_le(key + (i * 4));
+    ctx->simd = simd;
+}
+
+
+void
+chacha20_poly1305_encrypt(const struct ChaCha20Poly1305 *ctx,
+                          const uint8_t *nonce,
+                          const uint8_t *aad,
+                          size_t aad_len,
+                          uint8_t *buf,
+                          size_t length,
+                          uint8_t *tag)
+{
+    chacha20_poly1305_crypt(ctx, nonce, aad, aad_len, buf, length, 0, tag);
+}
+
+
+int
+chacha20_poly1305_decrypt(const struct ChaCha20Poly1305 *ctx,
+                          const uint8_t *nonce,
+                          const uint8_t *aad,
+                          size_t aad_len,
+                          uint8_t *buf,
+                          size_t length,
+                          const uint8_t *tag)
+{
+    uint8_t computed[POLY1305_TAG_LEN];
+    uint8_t difference = 0;
+
+    chacha20_poly1305_crypt(ctx, nonce, aad, aad_len, buf, length, 1, computed);
+
+    /* Compare in constant time. */
+    for (int i = 0; i < POLY1305_TAG_LEN; ++i) difference |= computed[i] ^ tag[i];
+
+    return 0 == difference ? 0 : -1;
+}
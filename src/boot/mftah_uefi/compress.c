@@ -0,0 +1,291 @@
+#include "core/compress.h"
+#include "core/memory.h"
+
+
+
+/* Limits of the LZ4 block format. The last match must start 12 bytes and end
+    5 bytes before the end of the block, so that the block ends in literals. */
+#define COMPRESS_MIN_MATCH          4
+#define COMPRESS_LAST_LITERALS      5
+#define COMPRESS_MATCH_START_LIMIT  12
+#define COMPRESS_MAX_OFFSET         65535
+
+/* Lengths which don't fit into a token nibble continue in bytes of up to 255. */
+#define COMPRESS_RUN_MASK           15
+
+typedef UINT64 __attribute__((aligned(1), may_alias)) UNALIGNED_UINT64;
+typedef UINT32 __attribute__((aligned(1), may_alias)) UNALIGNED_UINT32;
+
+
+static
+inline
+UINT32
+CompressHash(IN UINT32 Sequence)
+{
+    return (Sequence * 2654435761U) >> (32 - COMPRESS_HASH_LOG);
+}
+
+
+/**
+ * Measure how far a match continues, eight bytes at a time.
+ *
+ * @param[in]  Ip     The position being matched.
+ * @param[in]  Match  The earlier position it matches, at least COMPRESS_MIN_MATCH bytes long.
+ * @param[in]  Stop   The position where every match must end.
+ *
+ * @returns The length of the match.
+ */
+static
+inline
+UINTN
+CompressMatchLength(IN CONST UINT8 *Ip,
+                    IN CONST UINT8 *Match,
+                    IN CONST UINT8 *Stop)
+{
+    UINTN Length = COMPRESS_MIN_MATCH;
+    UINT64 Difference;
+
+    while ((Ip + Length + sizeof(UINT64)) <= Stop) {
+        Difference = *(CONST UNALIGNED_UINT64 *)(Ip + Length) ^ *(CONST UNALIGNED_UINT64 *)(Match + Length);
+        if (0 != Difference) {
+            return Length + (__builtin_ctzll(Difference) >> 3);
+        }
+
+        Length += sizeof(UINT64);
+    }
+
+    while ((Ip + Length) < Stop && Ip[Length] == Match[Length]) {
+        Length++;
+    }
+
+    return Length;
+}
+
+
+static
+inline
+UINT8 *
+CompressWriteLength(IN UINT8 *Out,
+                    IN UINTN Length)
+{
+    while (Length >= 255) {
+        *Out++ = 255;
+        Length -= 255;
+    }
+
+    *Out++ = (UINT8)Length;
+    return Out;
+}
+
+
+static
+inline
+BOOLEAN
+DecompressReadLength(IN OUT CONST UINT8 **Ip,
+                     IN CONST UINT8 *IpEnd,
+                     IN OUT UINTN *Length)
+{
+    UINT8 Byte;
+
+    do {
+        if (*Ip >= IpEnd) {
+            return FALSE;
+        }
+
+        Byte = *((*Ip)++);
+        *Length += Byte;
+    } while (255 == Byte);
+
+    return TRUE;
+}
+
+
+UINTN
+EFIAPI
+CompressBlock(IN CONST UINT8 *Source,
+              IN UINTN SourceLength,
+              OUT UINT8 *Destination,
+              IN UINTN DestinationSize,
+              IN UINT32 *HashTable)
+{
+    CONST UINT8 *Ip = Source;
+    CONST UINT8 *Anchor = Source;
+    CONST UINT8 *End = Source + SourceLength;
+    CONST UINT8 *Match;
+    UINT8 *Out = Destination;
+    UINT8 *OutEnd = Destination + DestinationSize;
+    UINT8 *Token;
+    UINTN Literals, MatchLength, Offset;
+    UINT32 Sequence, Hash;
+
+    if (SourceLength > COMPRESS_MAX_BLOCK_SIZE) {
+        return 0;
+    }
+
+    /* Blocks too short to hold a match are written as a single run of literals. */
+    if (SourceLength > COMPRESS_MATCH_START_LIMIT) {
+        FastSetMem(HashTable, COMPRESS_HASH_ENTRIES * sizeof(UINT32), 0x00);
+
+        for (Ip++; Ip < (End - COMPRESS_MATCH_START_LIMIT); ) {
+            Sequence = *(CONST UNALIGNED_UINT32 *)Ip;
+            Hash = CompressHash(Sequence);
+            Match = Source + HashTable[Hash];
+            HashTable[Hash] = (UINT32)(Ip - Source);
+
+            /* Stale or colliding entries are simply a miss. Long misses speed up the scan. */
+            if ((UINTN)(Ip - Match) > COMPRESS_MAX_OFFSET || Sequence != *(CONST UNALIGNED_UINT32 *)Match) {
+                Ip += 1 + ((UINTN)(Ip - Anchor) >> 6);
+                continue;
+            }
+
+            /* Literals just before the match may belong to it too. */
+            while (Ip > Anchor && Match > Source && Ip[-1] == Match[-1]) {
+                Ip--;
+                Match--;
+            }
+
+            MatchLength = CompressMatchLength(Ip, Match, End - COMPRESS_LAST_LITERALS);
+            Literals = (UINTN)(Ip - Anchor);
+            Offset = (UINTN)(Ip - Match);
+
+            if ((Out + 1 + (Literals / 255 + 1) + Literals + 2 + (MatchLength / 255 + 1)) > OutEnd) {
+                return 0;
+            }
+
+            Token = Out++;
+            if (Literals >= COMPRESS_RUN_MASK) {
+                *Token = COMPRESS_RUN_MASK << 4;
+                Out = CompressWriteLength(Out, Literals - COMPRESS_RUN_MASK);
+            } else {
+                *Token = (UINT8)(Literals << 4);
+            }
+
+            FastCopyMem(Out, Anchor, Literals);
+            Out += Literals;
+
+            *Out++ = (UINT8)Offset;
+            *Out++ = (UINT8)(Offset >> 8);
+
+            if ((MatchLength - COMPRESS_MIN_MATCH) >= COMPRESS_RUN_MASK) {
+                *Token |= COMPRESS_RUN_MASK;
+                Out = CompressWriteLength(Out, MatchLength - COMPRESS_MIN_MATCH - COMPRESS_RUN_MASK);
+            } else {
+                *Token |= (UINT8)(MatchLength - COMPRESS_MIN_MATCH);
+            }
+
+            Ip += MatchLength;
+            Anchor = Ip;
+
+            /* Index a position inside the match, which the next probe would never see. */
+            if (Ip < (End - COMPRESS_MATCH_START_LIMIT)) {
+                HashTable[CompressHash(*(CONST UNALIGNED_UINT32 *)(Ip - 2))] = (UINT32)(Ip - 2 - Source);
+            }
+        }
+    }
+
+    /* The block always ends with a sequence of literals and no match. */
+    Literals = (UINTN)(End - Anchor);
+    if ((Out + 1 + (Literals / 255 + 1) + Literals) > OutEnd) {
+        return 0;
+    }
+
+    Token = Out++;
+    if (Literals >= COMPRESS_RUN_MASK) {
+        *Token = COMPRESS_RUN_MASK << 4;
+        Out = CompressWriteLength(Out, Literals - COMPRESS_RUN_MASK);
+    } else {
+        *Token = (UINT8)(Literals << 4);
+    }
+
+    FastCopyMem(Out, Anchor, Literals);
+    Out += Literals;
+
+    return (UINTN)(Out - Destination);
+}
+
+
+EFI_STATUS
+EFIAPI
+DecompressBlock(IN CONST UINT8 *Source,
+                IN UINTN SourceLength,
+                OUT UINT8 *Destination,
+                IN UINTN DestinationLength)
+{
+    CONST UINT8 *Ip = Source;
+    CONST UINT8 *IpEnd = Source + SourceLength;
+    CONST UINT8 *Match;
+    UINT8 *Op = Destination;
+    UINT8 *OpEnd = Destination + DestinationLength;
+    UINTN Length, Offset, Head;
+    UINT8 Token;
+
+    while (Ip < IpEnd) {
+        Token = *Ip++;
+
+        Length = Token >> 4;
+        if (COMPRESS_RUN_MASK == Length && !DecompressReadLength(&Ip, IpEnd, &Length)) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        if (Length > (UINTN)(IpEnd - Ip) || Length > (UINTN)(OpEnd - Op)) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        FastCopyMem(Op, Ip, Length);
+        Op += Length;
+        Ip += Length;
+
+        /* Only the last sequence has no match. */
+        if (Ip == IpEnd) {
+            break;
+        }
+
+        if ((IpEnd - Ip) < 2) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        Offset = (UINTN)Ip[0] | ((UINTN)Ip[1] << 8);
+        Ip += 2;
+        if (0 == Offset || Offset > (UINTN)(Op - Destination)) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        Length = Token & COMPRESS_RUN_MASK;
+        if (COMPRESS_RUN_MASK == Length && !DecompressReadLength(&Ip, IpEnd, &Length)) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        Length += COMPRESS_MIN_MATCH;
+        if (Length > (UINTN)(OpEnd - Op)) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        Match = Op - Offset;
+
+        /* Close matches overlap what they produce. Once a few bytes are out, the same
+            pattern also repeats at the first multiple of the offset which is at least
+            eight bytes back, and the rest can be copied in words from there. */
+        if (Offset < sizeof(UINT64)) {
+            Head = MIN(Length, 2 * sizeof(UINT64));
+            for (UINTN i = 0; i < Head; ++i) {
+                Op[i] = Match[i];
+            }
+
+            Op += Head;
+            Length -= Head;
+            Match = Op - (Offset * ((sizeof(UINT64) + Offset - 1) / Offset));
+        }
+
+        for (; Length >= sizeof(UINT64); Length -= sizeof(UINT64)) {
+            *(UNALIGNED_UINT64 *)Op = *(CONST UNALIGNED_UINT64 *)Match;
+            Op += sizeof(UINT64);
+            Match += sizeof(UINT64);
+        }
+
+        while (Length-- > 0) {
+            *Op++ = *Match++;
+        }
+    }
+
+    return (Op == OpEnd) ? EFI_SUCCESS : EFI_VOLUME_CORRUPTED;
+}
@@ -0,0 +1,389 @@
+#include "core/fwbench.h"
+#include "core/memory.h"
+#include "core/profiler.h"
+#include "drivers/threading.h"
+
+
+
+STATIC CONST CHAR16 *mWorkloadNames[FwBenchWorkloadMax] = {
+    L"Decrypt",
+    L"Hash",
+    L"Copy",
+};
+
+
+/**
+ * The share of the synthetic buffer one processor works through.
+ */
+typedef
+struct {
+    MFTAH_FWBENCH_WORKLOAD  Workload;
+    UINT8                   *Source;
+    UINT8                   *Destination;
+    UINT64                  Length;
+    struct AES_ctx          AesContext;
+    UINT8                   Digest[SIZE_OF_SHA_256_HASH];
+} FWBENCH_LANE;
+
+
+
+/**
+ * Run the workload of one lane. Runs on the BSP and on APs alike, so it must not
+ *  use any boot services.
+ *
+ * @param[in]  Context  The FWBENCH_LANE to work on.
+ */
+STATIC
+VOID
+EFIAPI
+FwBenchRunLane(IN VOID *Context)
+{
+    FWBENCH_LANE *Lane = (FWBENCH_LANE *)Context;
+
+    switch (Lane->Workload) {
+        case FwBenchDecrypt:
+            AES_CBC_decrypt_buffer(&(Lane->AesContext), Lane->Source, Lane->Length, NULL, NULL);
+            break;
+        case FwBenchHash:
+            calc_sha_256(Lane->Digest, Lane->Source, Lane->Length);
+            break;
+        case FwBenchCopy:
+            FastCopyMem(Lane->Destination, Lane->Source, Lane->Length);
+            break;
+        default:
+            break;
+    }
+}
+
+
+/**
+ * An AP procedure which does nothing, to time the dispatch itself.
+ */
+STATIC
+VOID
+EFIAPI
+FwBenchIdle(IN VOID *Context)
+{
+    (VOID)Context;
+}
+
+
+/**
+ * Fill the source buffer with a cheap pseudo-random pattern, so the hash and
+ *  decryption never see pages the firmware might handle specially.
+ */
+STATIC
+VOID
+EFIAPI
+FwBenchFill(IN UINT8 *Buffer,
+            IN UINT64 Length)
+{
+    UINT64 State = 0x9E3779B97F4A7C15ULL;
+    UINT64 *Words = (UINT64 *)Buffer;
+
+    for (UINT64 i = 0; i < (Length / sizeof(UINT64)); ++i) {
+        State ^= State << 13;
+        State ^= State >> 7;
+        State ^= State << 17;
+        Words[i] = State;
+    }
+}
+
+
+/**
+ * Split the buffer into lanes of a workload. Every lane but the last is a whole
+ *  number of AES blocks long, so each one can be decrypted on its own.
+ */
+STATIC
+VOID
+EFIAPI
+FwBenchPrepareLanes(IN FWBENCH_LANE *Lanes,
+                    IN UINTN LaneCount,
+                    IN MFTAH_FWBENCH_WORKLOAD Workload,
+                    IN UINT8 *Source,
+                    IN UINT8 *Destination,
+                    IN UINT64 Length)
+{
+    STATIC CONST UINT8 Key[AES_KEYLEN] = {
+        0x4D, 0x46, 0x54, 0x41, 0x48, 0x2D, 0x42, 0x45, 0x4E, 0x43, 0x48, 0x00, 0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13, 0x14,
+    };
+    UINT64 LaneLength = (Length / LaneCount) & ~((UINT64)AES_BLOCKLEN - 1);
+
+    for (UINTN i = 0; i < LaneCount; ++i) {
+        Lanes[i].Workload = Workload;
+        Lanes[i].Source = Source + (i * LaneLength);
+        Lanes[i].Destination = Destination + (i * LaneLength);
+        Lanes[i].Length = (i == (LaneCount - 1))
+            ? (Length - (i * LaneLength))
+            : LaneLength;
+
+        /* Key expansion is part of every decryption, but it happens once per payload chunk,
+            not once per byte; keep it out of the measurement like the loader's workers do. */
+        if (FwBenchDecrypt == Workload) {
+            AES_init_ctx_iv(&(Lanes[i].AesContext), Key, Key + AES_BLOCKLEN);
+        }
+    }
+}
+
+
+/**
+ * Measure how long it takes a number of APs to work through the whole buffer together.
+ *
+ * @param[in]   Lanes      One lane per AP.
+ * @param[in]   Threads    One thread per AP.
+ * @param[in]   LaneCount  How many APs to use.
+ * @param[out]  Ticks      Set to the TSC ticks from the first dispatch until the last AP finished.
+ *
+ * @retval EFI_SUCCESS           Every lane ran.
+ * @retval EFI_OUT_OF_RESOURCES  Not enough APs could be started.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+FwBenchRunOnAps(IN FWBENCH_LANE *Lanes,
+                IN MFTAH_THREAD *Threads,
+                IN UINTN LaneCount,
+                OUT UINT64 *Ticks)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINTN Started = 0;
+    UINT64 Begin = 0;
+
+    FastSetMem(Threads, LaneCount * sizeof(MFTAH_THREAD), 0x00);
+
+    Begin = ProfilerReadTicks();
+
+    for (Started = 0; Started < LaneCount; ++Started) {
+        Status = CreateThread(FwBenchRunLane, (VOID *)&(Lanes[Started]), &(Threads[Started]));
+        if (EFI_ERROR(Status)) break;
+
+        Status = StartThread(&(Threads[Started]), TRUE);
+        if (EFI_ERROR(Status)) {
+            uefi_call_wrapper(BS->CloseEvent, 1, Threads[Started].CompletionEvent);
+            break;
+        }
+    }
+
+    for (UINTN i = 0; i < Started; ++i) {
+        JoinThread(&(Threads[i]));
+    }
+
+    *Ticks = ProfilerReadTicks() - Begin;
+
+    for (UINTN i = 0; i < Started; ++i) {
+        uefi_call_wrapper(BS->CloseEvent, 1, Threads[i].CompletionEvent);
+    }
+
+    return (Started == LaneCount) ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES;
+}
+
+
+/**
+ * Find the average round trip of dispatching an empty procedure to one AP.
+ */
+STATIC
+UINT64
+EFIAPI
+FwBenchMeasureDispatch(IN FWBENCH_LANE *Lane)
+{
+    MFTAH_THREAD Thread = {0};
+    UINT64 Total = 0, Begin = 0;
+    UINTN Runs = 0;
+
+    for (Runs = 0; Runs < MFTAH_FIRMWARE_BENCHMARK_DISPATCHES; ++Runs) {
+        FastSetMem(&Thread, sizeof(MFTAH_THREAD), 0x00);
+
+        Begin = ProfilerReadTicks();
+
+        if (EFI_ERROR(CreateThread(FwBenchIdle, (VOID *)Lane, &Thread))) break;
+        if (EFI_ERROR(StartThread(&Thread, TRUE))) {
+            uefi_call_wrapper(BS->CloseEvent, 1, Thread.CompletionEvent);
+            break;
+        }
+        JoinThread(&Thread);
+
+        Total += ProfilerReadTicks() - Begin;
+        uefi_call_wrapper(BS->CloseEvent, 1, Thread.CompletionEvent);
+    }
+
+    return (0 == Runs) ? 0 : (Total / Runs);
+}
+
+
+/**
+ * Throughput in MiB/s of the whole buffer processed in a number of ticks, or 0 if unknown.
+ */
+STATIC
+UINT64
+EFIAPI
+FwBenchThroughput(IN UINT64 Ticks)
+{
+    UINT64 Microseconds = ProfilerTicksToMicroseconds(Ticks);
+
+    return (0 == Microseconds)
+        ? 0
+        : (((MFTAH_FIRMWARE_BENCHMARK_SIZE * 1000000) / Microseconds) >> 20);
+}
+
+
+STATIC
+VOID
+EFIAPI
+FwBenchPrintTable(IN CONST MFTAH_FWBENCH_RECORD *Record)
+{
+    CONST MFTAH_FWBENCH_ROW *Row;
+    CHAR16 Label[16] = {0};
+    UINT64 Scaling;
+
+    PRINTLN(L"\r\n-- Firmware benchmark: (%llu) MiB per run, TSC at (%llu) kHz.",
+            Record->BufferSize >> 20, Record->TscFrequency / 1000);
+    if (0 != Record->DispatchTicks) {
+        PRINTLN(L"    AP dispatch round trip: (%llu) us.", ProfilerTicksToMicroseconds(Record->DispatchTicks));
+    }
+
+    PRINTLN(L"    %-8s %10s %7s %10s %7s %10s %7s",
+            L"CPUs",
+            mWorkloadNames[FwBenchDecrypt], L"x",
+            mWorkloadNames[FwBenchHash], L"x",
+            mWorkloadNames[FwBenchCopy], L"x");
+
+    for (UINTN i = 0; i < Record->RowCount; ++i) {
+        Row = &(Record->Rows[i]);
+
+        if (0 == Row->Processors) {
+            StrCpy(Label, L"BSP");
+        } else {
+            SPrint(Label, sizeof(Label), L"%u AP%s", Row->Processors, (1 == Row->Processors) ? L"" : L"s");
+        }
+
+        Print(L"    %-8s", Label);
+
+        /* Scaling is relative to the BSP alone, in hundredths. */
+        for (UINTN w = 0; w < FwBenchWorkloadMax; ++w) {
+            Scaling = (0 == Row->Ticks[w]) ? 0 : ((Record->Rows[0].Ticks[w] * 100) / Row->Ticks[w]);
+            Print(L" %10llu %4llu.%02llu", FwBenchThroughput(Row->Ticks[w]), Scaling / 100, Scaling % 100);
+        }
+
+        PRINTLN(L"");
+    }
+
+    if (1 == Record->RowCount) {
+        PRINTLN(L"    %-8s unavailable; threading is off or no APs could be started.", L"APs");
+    }
+
+    PRINTLN(L"");
+}
+
+
+EFI_STATUS
+EFIAPI
+RunFirmwareBenchmark(VOID)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_PHYSICAL_ADDRESS BufferBase = 0;
+    UINTN BufferPages = EFI_SIZE_TO_PAGES(2 * MFTAH_FIRMWARE_BENCHMARK_SIZE);
+    UINT8 *Source = NULL;
+    UINT8 *Destination = NULL;
+    FWBENCH_LANE *Lanes = NULL;
+    MFTAH_THREAD *Helpers = NULL;
+    MFTAH_FWBENCH_RECORD *Record = NULL;
+    MFTAH_FWBENCH_ROW *Row = NULL;
+    UINTN ApCount = 0;
+
+    Record = (MFTAH_FWBENCH_RECORD *)AllocateZeroPool(sizeof(MFTAH_FWBENCH_RECORD));
+    Lanes = (FWBENCH_LANE *)AllocateZeroPool(MFTAH_MAX_THREAD_COUNT * sizeof(FWBENCH_LANE));
+    Helpers = (MFTAH_THREAD *)AllocateZeroPool(MFTAH_MAX_THREAD_COUNT * sizeof(MFTAH_THREAD));
+    if (NULL == Record || NULL == Lanes || NULL == Helpers) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto Label__RunFirmwareBenchmark__Done;
+    }
+
+    Status = uefi_call_wrapper(BS->AllocatePages, 4,
+                               AllocateAnyPages, EfiLoaderData, BufferPages, &BufferBase);
+    if (EFI_ERROR(Status)) {
+        EFI_WARNINGLN(L"-- Could not allocate (%llu) MiB for the benchmark (%r).",
+                      (2 * MFTAH_FIRMWARE_BENCHMARK_SIZE) >> 20, Status);
+        Status = EFI_OUT_OF_RESOURCES;
+        goto Label__RunFirmwareBenchmark__Done;
+    }
+
+    Source = (UINT8 *)(UINTN)BufferBase;
+    Destination = Source + MFTAH_FIRMWARE_BENCHMARK_SIZE;
+
+    PRINTLN(L"\r\nRunning the firmware benchmark. This can take a while...");
+
+    /* Touch every destination page once so the first copy doesn't pay for it alone. */
+    FastSetMem(Destination, MFTAH_FIRMWARE_BENCHMARK_SIZE, 0x00);
+    FwBenchFill(Source, MFTAH_FIRMWARE_BENCHMARK_SIZE);
+
+    Record->Signature = MFTAH_FIRMWARE_BENCHMARK_SIGNATURE;
+    Record->Version = MFTAH_FIRMWARE_BENCHMARK_VERSION;
+    Record->TscFrequency = ProfilerGetRecord()->TscFrequency;
+    Record->BufferSize = MFTAH_FIRMWARE_BENCHMARK_SIZE;
+    Record->WorkloadCount = FwBenchWorkloadMax;
+
+    /* The BSP alone. Decryption runs in place, so the buffer is just different noise afterwards. */
+    Row = &(Record->Rows[Record->RowCount++]);
+    for (UINTN w = 0; w < FwBenchWorkloadMax; ++w) {
+        UINT64 Begin;
+
+        FwBenchPrepareLanes(Lanes, 1, (MFTAH_FWBENCH_WORKLOAD)w, Source, Destination, MFTAH_FIRMWARE_BENCHMARK_SIZE);
+
+        Begin = ProfilerReadTicks();
+        FwBenchRunLane((VOID *)&(Lanes[0]));
+        Row->Ticks[w] = ProfilerReadTicks() - Begin;
+    }
+
+    ApCount = IsThreadingEnabled() ? MIN(GetThreadLimit(), MFTAH_MAX_THREAD_COUNT) : 0;
+    if (0 == ApCount) {
+        EFI_WARNINGLN(L"-- No application processors are available; only the BSP was measured.");
+    } else {
+        Record->DispatchTicks = FwBenchMeasureDispatch(&(Lanes[0]));
+    }
+
+    /* Then the same work, shared by ever more APs while the BSP only dispatches. */
+    for (UINTN n = 1; n <= ApCount; ++n) {
+        Row = &(Record->Rows[Record->RowCount]);
+        Row->Processors = (UINT32)n;
+
+        for (UINTN w = 0; w < FwBenchWorkloadMax; ++w) {
+            FwBenchPrepareLanes(Lanes, n, (MFTAH_FWBENCH_WORKLOAD)w, Source, Destination, MFTAH_FIRMWARE_BENCHMARK_SIZE);
+
+            Status = FwBenchRunOnAps(Lanes, Helpers, n, &(Row->Ticks[w]));
+            if (EFI_ERROR(Status)) break;
+        }
+
+        if (EFI_ERROR(Status)) {
+            EFI_WARNINGLN(L"-- Only (%u) APs could be started at once; stopping there.", n - 1);
+            Status = EFI_SUCCESS;
+            break;
+        }
+
+        ++(Record->RowCount);
+    }
+
+    FwBenchPrintTable(Record);
+
+    DPRINTLN(L"-- Setting benchmark variable '%s'.", MFTAH_FIRMWARE_BENCHMARK_VARIABLE);
+    Status = uefi_call_wrapper(
+        ST->RuntimeServices->SetVariable,
+        5,
+        MFTAH_FIRMWARE_BENCHMARK_VARIABLE,
+        &gXmitVendorGuid,
+        EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS,
+        __builtin_offsetof(MFTAH_FWBENCH_RECORD, Rows) + (Record->RowCount * sizeof(MFTAH_FWBENCH_ROW)),
+        Record
+    );
+    if (EFI_ERROR(Status)) {
+        EFI_WARNINGLN(L"-- Could not save the benchmark results (%r).", Status);
+    }
+
+Label__RunFirmwareBenchmark__Done:
+    if (0 != BufferBase) uefi_call_wrapper(BS->FreePages, 2, BufferBase, BufferPages);
+    if (NULL != Helpers) FreePool(Helpers);
+    if (NULL != Lanes) FreePool(Lanes);
+    if (NULL != Record) FreePool(Record);
+
+    return Status;
+}
@@ -0,0 +1,543 @@
+/*
+ * AES-256-GCM, as specified in NIST SP 800-38D.
+ */
+
+#include "crypto/gcm.h"
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+
+
+#define CPUID_1_ECX_PCLMULQDQ   (1 << 1)
+#define CPUID_1_ECX_SSSE3       (1 << 9)
+#define CPUID_1_ECX_SSE41       (1 << 19)
+#define CPUID_1_ECX_AES         (1 << 25)
+
+/* The GHASH reduction constants for each 4-bit remainder of the portable path. */
+static const uint64_t gcm_last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0,
+};
+
+
+
+static inline
+uint64_t
+load64_be(const uint8_t *p)
+{
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32)
+         | ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8)  | ((uint64_t)p[7]);
+}
+
+
+static inline
+void
+store64_be(uint8_t *p,
+           uint64_t value)
+{
+    for (int i = 7; i >= 0; --i) {
+        p[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+
+static inline
+void
+store32_be(uint8_t *p,
+           uint32_t value)
+{
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+
+static inline
+void
+xor_block(uint8_t *dst,
+          const uint8_t *src,
+          size_t length)
+{
+    for (size_t i = 0; i < length; ++i) dst[i] ^= src[i];
+}
+
+
+/* The final GHASH block: the lengths of the AAD and of the text, in bits. */
+static inline
+void
+gcm_length_block(uint8_t *block,
+                 size_t aad_len,
+                 size_t length)
+{
+    store64_be(block, (uint64_t)aad_len * 8);
+    store64_be(block + 8, (uint64_t)length * 8);
+}
+
+
+static inline
+void
+gcm_counter_block(uint8_t *block,
+                  const uint8_t *iv,
+                  uint32_t counter)
+{
+    for (int i = 0; i < AES_GCM_IV_LEN; ++i) block[i] = iv[i];
+    store32_be(block + AES_GCM_IV_LEN, counter);
+}
+
+
+
+/*****************************************************************************/
+/* Portable path: tiny-AES and a 4-bit table GHASH (Shoup's method).         */
+/*****************************************************************************/
+static
+void
+ghash_table_init(struct AES_GCM_ctx *ctx,
+                 const uint8_t *h)
+{
+    uint64_t vh = load64_be(h), vl = load64_be(h + 8);
+    uint32_t t;
+
+    ctx->hh[0] = ctx->hl[0] = 0;
+    ctx->hh[8] = vh;
+    ctx->hl[8] = vl;
+
+    for (int i = 4; i > 0; i >>= 1) {
+        t = (uint32_t)(vl & 1) * 0xe1000000U;
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ ((uint64_t)t << 32);
+        ctx->hh[i] = vh;
+        ctx->hl[i] = vl;
+    }
+
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; ++j) {
+            ctx->hh[i + j] = ctx->hh[i] ^ ctx->hh[j];
+            ctx->hl[i + j] = ctx->hl[i] ^ ctx->hl[j];
+        }
+    }
+}
+
+
+/* Y = Y * H */
+static
+void
+ghash_table_mult(const struct AES_GCM_ctx *ctx,
+                 uint8_t *y)
+{
+    uint8_t lo, hi, rem;
+    uint64_t zh, zl;
+
+    lo = y[15] & 0x0f;
+    zh = ctx->hh[lo];
+    zl = ctx->hl[lo];
+
+    for (int i = 15; i >= 0; --i) {
+        lo = y[i] & 0x0f;
+        hi = (y[i] >> 4) & 0x0f;
+
+        if (i != 15) {
+            rem = (uint8_t)(zl & 0x0f);
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ (gcm_last4[rem] << 48);
+            zh ^= ctx->hh[lo];
+            zl ^= ctx->hl[lo];
+        }
+
+        rem = (uint8_t)(zl & 0x0f);
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ (gcm_last4[rem] << 48);
+        zh ^= ctx->hh[hi];
+        zl ^= ctx->hl[hi];
+    }
+
+    store64_be(y, zh);
+    store64_be(y + 8, zl);
+}
+
+
+/* Absorb a buffer into Y, zero-padding its last block. */
+static
+void
+ghash_table_update(const struct AES_GCM_ctx *ctx,
+                   uint8_t *y,
+                   const uint8_t *data,
+                   size_t length)
+{
+    size_t n;
+
+    while (length > 0) {
+        n = length < AES_BLOCKLEN ? length : AES_BLOCKLEN;
+        xor_block(y, data, n);
+        ghash_table_mult(ctx, y);
+        data += n;
+        length -= n;
+    }
+}
+
+
+static
+void
+gcm_crypt_portable(const struct AES_GCM_ctx *ctx,
+                   const uint8_t *iv,
+                   const uint8_t *aad,
+                   size_t aad_len,
+                   uint8_t *buf,
+                   size_t length,
+                   int decrypt,
+                   uint8_t *tag)
+{
+    uint8_t y[AES_BLOCKLEN] = {0};
+    uint8_t keystream[AES_BLOCKLEN];
+    uint8_t block[AES_BLOCKLEN];
+    uint32_t counter = 2;
+    size_t n;
+
+    ghash_table_update(ctx, y, aad, aad_len);
+
+    /* Each block is hashed as ciphertext and (de)ciphered while it is in cache. */
+    for (size_t offset = 0; offset < length; offset += n, ++counter) {
+        n = (length - offset) < AES_BLOCKLEN ? (length - offset) : AES_BLOCKLEN;
+
+        gcm_counter_block(keystream, iv, counter);
+        AES_ECB_encrypt(&(ctx->aes), keystream);
+
+        if (decrypt) ghash_table_update(ctx, y, buf + offset, n);
+        xor_block(buf + offset, keystream, n);
+        if (!decrypt) ghash_table_update(ctx, y, buf + offset, n);
+    }
+
+    gcm_length_block(block, aad_len, length);
+    ghash_table_update(ctx, y, block, AES_BLOCKLEN);
+
+    gcm_counter_block(tag, iv, 1);
+    AES_ECB_encrypt(&(ctx->aes), tag);
+    xor_block(tag, y, AES_BLOCKLEN);
+
+    for (int i = 0; i < AES_BLOCKLEN; ++i) keystream[i] = block[i] = y[i] = 0;
+}
+
+
+
+/*****************************************************************************/
+/* Accelerated path: AES-NI counter mode and PCLMULQDQ GHASH.                */
+/*****************************************************************************/
+/* GHASH values are kept byte-reflected in registers, as in Intel's
+    "Carry-Less Multiplication and Its Usage for Computing the GCM Mode". */
+#define GCM_BSWAP_MASK \
+    _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+
+
+/* The unreduced 256-bit product of A and B, accumulated into LO:HI. */
+__attribute__((target("pclmul,sse4.1")))
+static inline
+void
+clmul_accumulate(__m128i a,
+                 __m128i b,
+                 __m128i *lo,
+                 __m128i *hi)
+{
+    __m128i t0 = _mm_clmulepi64_si128(a, b, 0x00);
+    __m128i t1 = _mm_clmulepi64_si128(a, b, 0x10);
+    __m128i t2 = _mm_clmulepi64_si128(a, b, 0x01);
+    __m128i t3 = _mm_clmulepi64_si128(a, b, 0x11);
+
+    t1 = _mm_xor_si128(t1, t2);
+    *lo = _mm_xor_si128(*lo, _mm_xor_si128(t0, _mm_slli_si128(t1, 8)));
+    *hi = _mm_xor_si128(*hi, _mm_xor_si128(t3, _mm_srli_si128(t1, 8)));
+}
+
+
+/* Reduce a 256-bit product modulo the GCM polynomial. Since the operands
+    are reflected, the product is first shifted left by one bit. */
+__attribute__((target("pclmul,sse4.1")))
+static inline
+__m128i
+clmul_reduce(__m128i lo,
+             __m128i hi)
+{
+    __m128i t7, t8, t9, t2, t4, t5;
+
+    t7 = _mm_srli_epi32(lo, 31);
+    t8 = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+
+    t9 = _mm_srli_si128(t7, 12);
+    t8 = _mm_slli_si128(t8, 4);
+    t7 = _mm_slli_si128(t7, 4);
+    lo = _mm_or_si128(lo, t7);
+    hi = _mm_or_si128(_mm_or_si128(hi, t8), t9);
+
+    t7 = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+    t8 = _mm_srli_si128(t7, 4);
+    t7 = _mm_slli_si128(t7, 12);
+    lo = _mm_xor_si128(lo, t7);
+
+    t2 = _mm_srli_epi32(lo, 1);
+    t4 = _mm_srli_epi32(lo, 2);
+    t5 = _mm_srli_epi32(lo, 7);
+    t2 = _mm_xor_si128(_mm_xor_si128(t2, t4), _mm_xor_si128(t5, t8));
+    lo = _mm_xor_si128(lo, t2);
+
+    return _mm_xor_si128(hi, lo);
+}
+
+
+__attribute__((target("pclmul,sse4.1")))
+static inline
+__m128i
+clmul_gfmul(__m128i a,
+            __m128i b)
+{
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+
+    clmul_accumulate(a, b, &lo, &hi);
+    return clmul_reduce(lo, hi);
+}
+
+
+/* Absorb a buffer into Y one block at a time, zero-padding its last block. */
+__attribute__((target("pclmul,ssse3,sse4.1")))
+static
+__m128i
+ghash_clmul_update(__m128i y,
+                   __m128i h,
+                   const uint8_t *data,
+                   size_t length)
+{
+    uint8_t block[AES_BLOCKLEN];
+    size_t n;
+
+    while (length > 0) {
+        n = length < AES_BLOCKLEN ? length : AES_BLOCKLEN;
+        for (size_t i = 0; i < AES_BLOCKLEN; ++i) block[i] = i < n ? data[i] : 0;
+
+        y = _mm_xor_si128(y, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)block), GCM_BSWAP_MASK));
+        y = clmul_gfmul(y, h);
+
+        data += n;
+        length -= n;
+    }
+
+    return y;
+}
+
+
+__attribute__((target("aes,sse4.1")))
+static inline
+__m128i
+aesni_encrypt_block(const __m128i *rk,
+                    __m128i block)
+{
+    block = _mm_xor_si128(block, rk[0]);
+    for (int r = 1; r < 14; ++r) block = _mm_aesenc_si128(block, rk[r]);
+    return _mm_aesenclast_si128(block, rk[14]);
+}
+
+
+__attribute__((target("aes,pclmul,ssse3,sse4.1")))
+static
+void
+gcm_crypt_accelerated(const struct AES_GCM_ctx *ctx,
+                      const uint8_t *iv,
+                      const uint8_t *aad,
+                      size_t aad_len,
+                      uint8_t *buf,
+                      size_t length,
+                      int decrypt,
+                      uint8_t *tag)
+{
+    const __m128i bswap = GCM_BSWAP_MASK;
+    __m128i rk[15];
+    __m128i h1, h2, h3, h4;
+    __m128i y = _mm_setzero_si128();
+    __m128i j0, c0, c1, c2, c3, k0, k1, k2, k3, lo, hi;
+    uint8_t block[AES_BLOCKLEN];
+    uint32_t counter = 2;
+    size_t offset = 0, n;
+
+    for (int i = 0; i < 15; ++i) rk[i] = _mm_loadu_si128((const __m128i *)(ctx->aes.RoundKey + (i * AES_BLOCKLEN)));
+
+    h1 = _mm_loadu_si128((const __m128i *)ctx->hpow[0]);
+    h2 = _mm_loadu_si128((const __m128i *)ctx->hpow[1]);
+    h3 = _mm_loadu_si128((const __m128i *)ctx->hpow[2]);
+    h4 = _mm_loadu_si128((const __m128i *)ctx->hpow[3]);
+
+    y = ghash_clmul_update(y, h1, aad, aad_len);
+
+    gcm_counter_block(block, iv, 0);
+    j0 = _mm_loadu_si128((const __m128i *)block);
+
+    /* Four counter blocks are ciphered at once, and their ciphertext is folded into Y
+        with H^4..H so only one reduction is needed for the four of them. */
+    for (; (length - offset) >= (4 * AES_BLOCKLEN); offset += (4 * AES_BLOCKLEN), counter += 4) {
+        k0 = _mm_insert_epi32(j0, (int)__builtin_bswap32(counter), 3);
+        k1 = _mm_insert_epi32(j0, (int)__builtin_bswap32(counter + 1), 3);
+        k2 = _mm_insert_epi32(j0, (int)__builtin_bswap32(counter + 2), 3);
+        k3 = _mm_insert_epi32(j0, (int)__builtin_bswap32(counter + 3), 3);
+
+        k0 = _mm_xor_si128(k0, rk[0]);
+        k1 = _mm_xor_si128(k1, rk[0]);
+        k2 = _mm_xor_si128(k2, rk[0]);
+        k3 = _mm_xor_si128(k3, rk[0]);
+        for (int r = 1; r < 14; ++r) {
+            k0 = _mm_aesenc_si128(k0, rk[r]);
+            k1 = _mm_aesenc_si128(k1, rk[r]);
+            k2 = _mm_aesenc_si128(k2, rk[r]);
+            k3 = _mm_aesenc_si128(k3, rk[r]);
+        }
+        k0 = _mm_aesenclast_si128(k0, rk[14]);
+        k1 = _mm_aesenclast_si128(k1, rk[14]);
+        k2 = _mm_aesenclast_si128(k2, rk[14]);
+        k3 = _mm_aesenclast_si128(k3, rk[14]);
+
+        c0 = _mm_loadu_si128((const __m128i *)(buf + offset));
+        c1 = _mm_loadu_si128((const __m128i *)(buf + offset + 16));
+        c2 = _mm_loadu_si128((const __m128i *)(buf + offset + 32));
+        c3 = _mm_loadu_si128((const __m128i *)(buf + offset + 48));
+
+        k0 = _mm_xor_si128(k0, c0);
+        k1 = _mm_xor_si128(k1, c1);
+        k2 = _mm_xor_si128(k2, c2);
+        k3 = _mm_xor_si128(k3, c3);
+
+        _mm_storeu_si128((__m128i *)(buf + offset), k0);
+        _mm_storeu_si128((__m128i *)(buf + offset + 16), k1);
+        _mm_storeu_si128((__m128i *)(buf + offset + 32), k2);
+        _mm_storeu_si128((__m128i *)(buf + offset + 48), k3);
+
+        /* GHASH always runs over the ciphertext. */
+        if (!decrypt) {
+            c0 = k0;
+            c1 = k1;
+            c2 = k2;
+            c3 = k3;
+        }
+
+        lo = hi = _mm_setzero_si128();
+        clmul_accumulate(_mm_xor_si128(y, _mm_shuffle_epi8(c0, bswap)), h4, &lo, &hi);
+        clmul_accumulate(_mm_shuffle_epi8(c1, bswap), h3, &lo, &hi);
+        clmul_accumulate(_mm_shuffle_epi8(c2, bswap), h2, &lo, &hi);
+        clmul_accumulate(_mm_shuffle_epi8(c3, bswap), h1, &lo, &hi);
+        y = clmul_reduce(lo, hi);
+    }
+
+    for (; offset < length; offset += n, ++counter) {
+        n = (length - offset) < AES_BLOCKLEN ? (length - offset) : AES_BLOCKLEN;
+
+        k0 = aesni_encrypt_block(rk, _mm_insert_epi32(j0, (int)__builtin_bswap32(counter), 3));
+        _mm_storeu_si128((__m128i *)block, k0);
+
+        if (decrypt) y = ghash_clmul_update(y, h1, buf + offset, n);
+        xor_block(buf + offset, block, n);
+        if (!decrypt) y = ghash_clmul_update(y, h1, buf + offset, n);
+    }
+
+    gcm_length_block(block, aad_len, length);
+    y = ghash_clmul_update(y, h1, block, AES_BLOCKLEN);
+
+    k0 = aesni_encrypt_block(rk, _mm_insert_epi32(j0, (int)__builtin_bswap32(1), 3));
+    _mm_storeu_si128((__m128i *)tag, _mm_xor_si128(k0, _mm_shuffle_epi8(y, bswap)));
+}
+
+
+__attribute__((target("aes,pclmul,ssse3,sse4.1")))
+static
+void
+gcm_init_accelerated(struct AES_GCM_ctx *ctx,
+                     const uint8_t *h)
+{
+    __m128i h1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)h), GCM_BSWAP_MASK);
+    __m128i hn = h1;
+
+    _mm_storeu_si128((__m128i *)ctx->hpow[0], h1);
+    for (int i = 1; i < 4; ++i) {
+        hn = clmul_gfmul(hn, h1);
+        _mm_storeu_si128((__m128i *)ctx->hpow[i], hn);
+    }
+}
+
+
+
+/*****************************************************************************/
+/* Public functions:                                                         */
+/*****************************************************************************/
+int
+AES_GCM_is_accelerated(void)
+{
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    const unsigned int required = CPUID_1_ECX_PCLMULQDQ | CPUID_1_ECX_SSSE3 | CPUID_1_ECX_SSE41 | CPUID_1_ECX_AES;
+
+    if (__get_cpuid_max(0, NULL) < 1) {
+        return 0;
+    }
+
+    __cpuid(1, eax, ebx, ecx, edx);
+    return required == (ecx & required);
+}
+
+
+void
+AES_GCM_init(struct AES_GCM_ctx *ctx,
+             const uint8_t *key,
+             int accelerated)
+{
+    uint8_t h[AES_BLOCKLEN] = {0};
+
+    AES_init_ctx_iv(&(ctx->aes), key, h);
+    AES_ECB_encrypt(&(ctx->aes), h);
+
+    ghash_table_init(ctx, h);
+
+    ctx->accelerated = accelerated;
+    if (accelerated) {
+        gcm_init_accelerated(ctx, h);
+    }
+
+    for (int i = 0; i < AES_BLOCKLEN; ++i) h[i] = 0;
+}
+
+
+void
+AES_GCM_encrypt(const struct AES_GCM_ctx *ctx,
+                const uint8_t *iv,
+                const uint8_t *aad,
+                size_t aad_len,
+                uint8_t *buf,
+                size_t length,
+                uint8_t *tag)
+{
+    if (ctx->accelerated) {
+        gcm_crypt_accelerated(ctx, iv, aad, aad_len, buf, length, 0, tag);
+    } else {
+        gcm_crypt_portable(ctx, iv, aad, aad_len, buf, length, 0, tag);
+    }
+}
+
+
+int
+AES_GCM_decrypt(const struct AES_GCM_ctx *ctx,
+                const uint8_t *iv,
+                const uint8_t *aad,
+                size_t aad_len,
+                uint8_t *buf,
+                size_t length,
+                const uint8_t *tag)
+{
+    uint8_t computed[AES_GCM_TAG_LEN];
+    uint8_t difference = 0;
+
+    if (ctx->accelerated) {
+        gcm_crypt_accelerated(ctx, iv, aad, aad_len, buf, length, 1, computed);
+    } else {
+        gcm_crypt_portable(ctx, iv, aad, aad_len, buf, length, 1, computed);
+    }
+
+    /* Compare in constant time. */
+    for (int i = 0; i < AES_GCM_TAG_LEN; ++i) difference |= computed[i] ^ tag[i];
+
+    return 0 == difference ? 0 : -1;
+}
@@ -0,0 +1,482 @@
+#include "core/handoff.h"
+#include "core/hotprofile.h"
+#include "core/memory.h"
+#include "core/util.h"
+#include "drivers/threading.h"
+
+#include <cpuid.h>
+
+
+
+/* The library splits a payload into one work order per thread, so this is plenty.
+    Work orders which don't fit are simply decrypted by the loader. */
+#define HANDOFF_MAX_EXTENTS (MFTAH_MAX_THREAD_COUNT * 4)
+
+/* CPUID.01H:ECX.RDRAND */
+#define CPUID_1_ECX_RDRAND  (1 << 30)
+#define RDRAND_RETRIES      10
+
+
+/**
+ * A deferred part of a work order, before it is cut into chunks.
+ */
+typedef
+struct {
+    UINT8       *Base;
+    UINT64      Length;
+    UINT8       Iv[MFTAH_HANDOFF_IV_LENGTH];
+} HANDOFF_EXTENT;
+
+
+/* The batch whose work is deferred. 0 is never a payload's batch, so it means "disarmed". */
+STATIC UINTN mHandoffBatch = 0;
+STATIC UINT8 *mHandoffBoundary = NULL;
+
+STATIC UINT8 mHandoffKey[MFTAH_HANDOFF_KEY_LENGTH] = {0};
+STATIC HANDOFF_EXTENT mHandoffExtents[HANDOFF_MAX_EXTENTS] = {0};
+STATIC UINTN mHandoffExtentCount = 0;
+
+STATIC mftah_handoff_record *mHandoffRecord = NULL;
+
+
+#define HANDOFF_BIT_TEST(Bitmap, Chunk) \
+    (0 != ((Bitmap)[(Chunk) / 64] & (1ULL << ((Chunk) % 64))))
+#define HANDOFF_BIT(Chunk) \
+    (1ULL << ((Chunk) % 64))
+
+
+/**
+ * Chunks which the loader decrypts before the handoff. The BSP and every AP helping
+ *  it pull indices into 'Order' from 'Next' until none are left.
+ */
+typedef
+struct {
+    mftah_handoff_chunk     *Chunks;
+    UINT64                  *Order;
+    UINT64                  Count;
+    UINT8                   Key[MFTAH_HANDOFF_KEY_LENGTH];
+    UINT64 VOLATILE         Next;
+} HANDOFF_HOT_JOB;
+
+
+
+/**
+ * Fill a buffer with random bytes for the key-encryption key. RDRAND is preferred;
+ *  without it, TSC jitter around short stalls is condensed with SHA-256.
+ */
+STATIC
+VOID
+EFIAPI
+HandoffRandomBytes(OUT UINT8 *Buffer,
+                   IN UINTN Length)
+{
+    UINT32 Eax = 0, Ebx = 0, Ecx = 0, Edx = 0;
+    UINT64 Value = 0, Samples[64] = {0};
+    UINT8 Digest[SIZE_OF_SHA_256_HASH] = {0};
+    UINT8 Ok = 0;
+
+    __cpuid(1, Eax, Ebx, Ecx, Edx);
+
+    for (UINTN i = 0; i < Length; i += sizeof(UINT64)) {
+        Ok = 0;
+        for (UINTN Retry = 0; 0 != (Ecx & CPUID_1_ECX_RDRAND) && Retry < RDRAND_RETRIES && !Ok; ++Retry) {
+            __asm__ __volatile__ ("rdrand %0; setc %1" : "=r"(Value), "=qm"(Ok));
+        }
+
+        if (!Ok) {
+            for (UINTN j = 0; j < (sizeof(Samples) / sizeof(Samples[0])); ++j) {
+                UINT32 Low, High;
+                __asm__ __volatile__ ("rdtsc" : "=a"(Low), "=d"(High));
+                Samples[j] = ((UINT64)High << 32) | Low;
+                uefi_call_wrapper(BS->Stall, 1, 1);
+            }
+
+            calc_sha_256(Digest, Samples, sizeof(Samples));
+            CopyMem(&Value, Digest, sizeof(UINT64));
+        }
+
+        CopyMem(Buffer + i, &Value, MIN(sizeof(UINT64), Length - i));
+    }
+
+    SetMem(Digest, sizeof(Digest), 0x00);
+    Value = 0;
+}
+
+
+/**
+ * Find the first chunk of the record which ends after an address. Chunks are sorted by base.
+ *
+ * @returns The index of the chunk, or the chunk count if there is none.
+ */
+STATIC
+UINT64
+EFIAPI
+HandoffFindChunk(IN CONST mftah_handoff_chunk *Chunks,
+                 IN UINT64 ChunkCount,
+                 IN UINT64 Address)
+{
+    UINT64 Low = 0, High = ChunkCount, Middle;
+
+    while (Low < High) {
+        Middle = Low + ((High - Low) / 2);
+
+        if ((Chunks[Middle].base + Chunks[Middle].length) <= Address) {
+            Low = Middle + 1;
+        } else {
+            High = Middle;
+        }
+    }
+
+    return Low;
+}
+
+
+/**
+ * Decrypt chunks of a job until none are left. Runs on the BSP and on APs alike,
+ *  so it must not use any boot services.
+ *
+ * @param[in]  Context  The HANDOFF_HOT_JOB to work on.
+ */
+STATIC
+VOID
+EFIAPI
+HandoffDecryptChunks(IN VOID *Context)
+{
+    HANDOFF_HOT_JOB *Job = (HANDOFF_HOT_JOB *)Context;
+    mftah_handoff_chunk *Chunk = NULL;
+    struct AES_ctx AesContext;
+    UINT64 Index;
+
+    while ((Index = __sync_fetch_and_add(&(Job->Next), 1)) < Job->Count) {
+        Chunk = &(Job->Chunks[Job->Order[Index]]);
+
+        AES_init_ctx_iv(&AesContext, Job->Key, Chunk->iv);
+        AES_CBC_decrypt_buffer(&AesContext, (UINT8 *)(UINTN)Chunk->base, Chunk->length, NULL, NULL);
+    }
+
+    SetMem(&AesContext, sizeof(struct AES_ctx), 0x00);
+}
+
+
+/**
+ * Decrypt the chunks which the hot profile names before the kernel gets the rest,
+ *  in the order they were first touched, on the BSP and every idle AP. Every chunk's
+ *  IV must already be in the chunk table, since this overwrites ciphertext.
+ *
+ * @param[in]  RamdiskImage   The base of the ramdisk.
+ * @param[in]  RamdiskLength  The size of the ramdisk.
+ *
+ * @returns How many chunks were decrypted.
+ */
+STATIC
+UINT64
+EFIAPI
+HandoffDecryptHot(IN UINT8 *RamdiskImage,
+                  IN UINT64 RamdiskLength)
+{
+    HANDOFF_HOT_JOB Job = {0};
+    CONST MFTAH_HOT_PROFILE_RUN *Runs = NULL;
+    MFTAH_THREAD *Helpers = NULL;
+    UINTN HelperCount = 0, Started = 0;
+    UINT64 *Claimed, *Done;
+    UINT64 ChunkCount = mHandoffRecord->chunk_count;
+    UINT64 Start, End;
+    UINT32 RunCount = 0;
+
+    Runs = HotProfileRuns(&RunCount);
+    if (NULL == Runs || 0 == RunCount) {
+        return 0;
+    }
+
+    Job.Chunks = (mftah_handoff_chunk *)((UINT8 *)mHandoffRecord + mHandoffRecord->chunk_table_offset);
+    Claimed = (UINT64 *)((UINT8 *)mHandoffRecord + mHandoffRecord->claimed_bitmap_offset);
+    Done = (UINT64 *)((UINT8 *)mHandoffRecord + mHandoffRecord->done_bitmap_offset);
+
+    Job.Order = (UINT64 *)AllocatePool(ChunkCount * sizeof(UINT64));
+    if (NULL == Job.Order) {
+        return 0;
+    }
+
+    /* The claimed bitmap keeps chunks named by several runs from being queued twice. */
+    for (UINT32 i = 0; i < RunCount; ++i) {
+        Start = (UINT64)Runs[i].FirstUnit * MFTAH_HOT_PROFILE_UNIT_SIZE;
+        End = MIN(Start + ((UINT64)Runs[i].UnitCount * MFTAH_HOT_PROFILE_UNIT_SIZE), RamdiskLength);
+        if (Start >= End) continue;
+
+        Start += (UINT64)(UINTN)RamdiskImage;
+        End += (UINT64)(UINTN)RamdiskImage;
+
+        for (UINT64 c = HandoffFindChunk(Job.Chunks, ChunkCount, Start);
+             c < ChunkCount && Job.Chunks[c].base < End;
+             ++c
+        ) {
+            if (HANDOFF_BIT_TEST(Claimed, c)) continue;
+
+            Claimed[c / 64] |= HANDOFF_BIT(c);
+            Job.Order[Job.Count++] = c;
+        }
+    }
+
+    CopyMem(Job.Key, mHandoffKey, MFTAH_HANDOFF_KEY_LENGTH);
+
+    /* Idle APs each take chunks too. Helpers which can't be started are simply not waited on. */
+    if (IsThreadingEnabled() && Job.Count > 1) {
+        HelperCount = MIN(MIN(GetThreadLimit(), (UINTN)(Job.Count - 1)), MFTAH_MAX_THREAD_COUNT);
+        if (HelperCount > 0) {
+            Helpers = (MFTAH_THREAD *)AllocateZeroPool(HelperCount * sizeof(MFTAH_THREAD));
+            if (NULL == Helpers) HelperCount = 0;
+        }
+
+        for (Started = 0; Started < HelperCount; ++Started) {
+            if (EFI_ERROR(CreateThread(HandoffDecryptChunks, (VOID *)&Job, &(Helpers[Started])))) break;
+
+            if (EFI_ERROR(StartThread(&(Helpers[Started]), FALSE))) {
+                uefi_call_wrapper(BS->CloseEvent, 1, Helpers[Started].CompletionEvent);
+                break;
+            }
+        }
+    }
+
+    HandoffDecryptChunks((VOID *)&Job);
+
+    for (UINTN i = 0; i < Started; ++i) {
+        JoinThread(&(Helpers[i]));
+        uefi_call_wrapper(BS->CloseEvent, 1, Helpers[i].CompletionEvent);
+    }
+    if (NULL != Helpers) FreePool(Helpers);
+
+    for (UINT64 i = 0; i < Job.Count; ++i) {
+        Done[Job.Order[i] / 64] |= HANDOFF_BIT(Job.Order[i]);
+    }
+    mHandoffRecord->chunks_done = Job.Count;
+
+    SetMem(Job.Key, sizeof(Job.Key), 0x00);
+    FreePool(Job.Order);
+
+    DPRINTLN(L"-- Decrypted (%llu) hot chunks with (%u) helper processors.", Job.Count, Started);
+    return Job.Count;
+}
+
+
+VOID
+EFIAPI
+HandoffArm(IN UINTN Batch,
+           IN UINT8 *PayloadBase,
+           IN UINT64 PayloadLength)
+{
+    if (PayloadLength <= MFTAH_EARLY_HANDOFF_PREFIX_SIZE) {
+        DPRINTLN(L"-- The payload fits in the early handoff prefix; nothing is deferred.");
+        return;
+    }
+
+    mHandoffBatch = Batch;
+    mHandoffBoundary = PayloadBase + MFTAH_EARLY_HANDOFF_PREFIX_SIZE;
+    mHandoffExtentCount = 0;
+
+    DPRINTLN(L"-- Deferring decryption beyond '%p' to the kernel.", mHandoffBoundary);
+}
+
+
+UINT64
+EFIAPI
+HandoffDeferWork(IN UINTN Batch,
+                 IN CONST mftah_work_order_t *WorkOrder,
+                 IN immutable_ref_t Sha256Key,
+                 IN immutable_ref_t InitializationVector)
+{
+    UINT8 *Location = (UINT8 *)(UINTN)WorkOrder->location;
+    UINT64 Length = WorkOrder->length;
+    UINT64 Keep = 0;
+    HANDOFF_EXTENT *Extent = NULL;
+
+    if (0 == mHandoffBatch || Batch != mHandoffBatch) return Length;
+    if ((Location + Length) <= mHandoffBoundary) return Length;
+    if (mHandoffExtentCount >= HANDOFF_MAX_EXTENTS) return Length;
+
+    /* The split must fall on a block boundary of the work order's own CBC chain. */
+    Keep = (Location >= mHandoffBoundary)
+        ? 0
+        : ((UINT64)(mHandoffBoundary - Location) & ~((UINT64)MFTAH_HANDOFF_IV_LENGTH - 1));
+
+    Extent = &(mHandoffExtents[mHandoffExtentCount++]);
+    Extent->Base = Location + Keep;
+    Extent->Length = Length - Keep;
+    CopyMem(Extent->Iv,
+            (0 == Keep) ? (VOID *)InitializationVector : (VOID *)(Extent->Base - MFTAH_HANDOFF_IV_LENGTH),
+            MFTAH_HANDOFF_IV_LENGTH);
+
+    CopyMem(mHandoffKey, (VOID *)Sha256Key, MFTAH_HANDOFF_KEY_LENGTH);
+
+    DPRINTLN(L"---- Deferred (%llu) bytes at '%p' to the kernel.", Extent->Length, Extent->Base);
+    return Keep;
+}
+
+
+EFI_STATUS
+EFIAPI
+HandoffPublish(IN UINT8 *RamdiskImage,
+               IN UINT64 RamdiskLength)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_PHYSICAL_ADDRESS RecordBase = 0, KekBase = 0;
+    mftah_handoff_chunk *Chunks = NULL;
+    UINT8 *Kek = NULL;
+    UINT64 ChunkCount = 0, RecordSize = 0, Chunk = 0;
+
+    if (0 == mHandoffExtentCount) {
+        return EFI_SUCCESS;
+    }
+
+    PRINTLN(L"Handing the rest of the payload decryption to the kernel...");
+
+    /* Work orders arrive in any order. Sorting them sorts the chunk table too, so chunks can be looked up. */
+    for (UINTN i = 1; i < mHandoffExtentCount; ++i) {
+        HANDOFF_EXTENT Extent = mHandoffExtents[i];
+        UINTN j = i;
+
+        for (; j > 0 && mHandoffExtents[j - 1].Base > Extent.Base; --j) {
+            mHandoffExtents[j] = mHandoffExtents[j - 1];
+        }
+        mHandoffExtents[j] = Extent;
+    }
+
+    for (UINTN i = 0; i < mHandoffExtentCount; ++i) {
+        ChunkCount += (mHandoffExtents[i].Length + MFTAH_HANDOFF_CHUNK_SIZE - 1) / MFTAH_HANDOFF_CHUNK_SIZE;
+    }
+
+    RecordSize = sizeof(mftah_handoff_record)
+        + (ChunkCount * sizeof(mftah_handoff_chunk))
+        + (2 * MFTAH_HANDOFF_BITMAP_SIZE(ChunkCount));
+
+    /* Reserved memory is reported as such to the kernel, so neither page is reused early. */
+    Status = uefi_call_wrapper(BS->AllocatePages, 4,
+                               AllocateAnyPages, EfiReservedMemoryType, EFI_SIZE_TO_PAGES(RecordSize), &RecordBase);
+    if (EFI_ERROR(Status)) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    Status = uefi_call_wrapper(BS->AllocatePages, 4,
+                               AllocateAnyPages, EfiReservedMemoryType, 1, &KekBase);
+    if (EFI_ERROR(Status)) {
+        uefi_call_wrapper(BS->FreePages, 2, RecordBase, EFI_SIZE_TO_PAGES(RecordSize));
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    mHandoffRecord = (mftah_handoff_record *)(UINTN)RecordBase;
+    FastSetMem(mHandoffRecord, EFI_PAGES_TO_SIZE(EFI_SIZE_TO_PAGES(RecordSize)), 0x00);
+
+    mHandoffRecord->signature = MFTAH_HANDOFF_SIGNATURE;
+    mHandoffRecord->version = MFTAH_HANDOFF_VERSION;
+    mHandoffRecord->record_size = RecordSize;
+    mHandoffRecord->ramdisk_base = (UINT64)(UINTN)RamdiskImage;
+    mHandoffRecord->ramdisk_length = RamdiskLength;
+    mHandoffRecord->chunk_count = ChunkCount;
+    mHandoffRecord->chunk_table_offset = sizeof(mftah_handoff_record);
+    mHandoffRecord->claimed_bitmap_offset = mHandoffRecord->chunk_table_offset + (ChunkCount * sizeof(mftah_handoff_chunk));
+    mHandoffRecord->done_bitmap_offset = mHandoffRecord->claimed_bitmap_offset + MFTAH_HANDOFF_BITMAP_SIZE(ChunkCount);
+
+    /* Every chunk after an extent's first one takes its IV from the ciphertext before it,
+        which is still intact since nothing past the prefix has been decrypted. */
+    Chunks = (mftah_handoff_chunk *)((UINT8 *)mHandoffRecord + mHandoffRecord->chunk_table_offset);
+    for (UINTN i = 0; i < mHandoffExtentCount; ++i) {
+        HANDOFF_EXTENT *Extent = &(mHandoffExtents[i]);
+
+        for (UINT64 Offset = 0; Offset < Extent->Length; Offset += MFTAH_HANDOFF_CHUNK_SIZE, ++Chunk) {
+            Chunks[Chunk].base = (UINT64)(UINTN)(Extent->Base + Offset);
+            Chunks[Chunk].length = MIN(MFTAH_HANDOFF_CHUNK_SIZE, Extent->Length - Offset);
+            CopyMem(Chunks[Chunk].iv,
+                    (0 == Offset) ? Extent->Iv : (Extent->Base + Offset - MFTAH_HANDOFF_IV_LENGTH),
+                    MFTAH_HANDOFF_IV_LENGTH);
+        }
+    }
+
+#if MFTAH_HOT_PROFILE == 1
+    /* Every IV is in the chunk table now, so hot chunks can be decrypted out of order. */
+    HandoffDecryptHot(RamdiskImage, RamdiskLength);
+#endif
+
+    Kek = (UINT8 *)(UINTN)KekBase;
+    SetMem(Kek, EFI_PAGE_SIZE, 0x00);
+    HandoffRandomBytes(Kek, MFTAH_HANDOFF_KEY_LENGTH);
+
+    for (UINTN i = 0; i < MFTAH_HANDOFF_KEY_LENGTH; ++i) {
+        mHandoffRecord->wrapped_key[i] = mHandoffKey[i] ^ Kek[i];
+    }
+    mHandoffRecord->kek_address = (UINT64)KekBase;
+    SetMem(mHandoffKey, sizeof(mHandoffKey), 0x00);
+
+    DPRINTLN(L"-- Handoff record at '%p': (%llu) chunks, (%llu) bytes.", mHandoffRecord, ChunkCount, RecordSize);
+
+    PRINTLN(L"-- Setting decryption handoff hint '__MFTAH_HANDOFF'.");
+    ERRCHECK_UEFI(
+        ST->RuntimeServices->SetVariable,
+        5,
+        L"__MFTAH_HANDOFF",
+        &gXmitVendorGuid,
+        EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+        sizeof(VOID *),
+        &mHandoffRecord
+    );
+
+    return EFI_SUCCESS;
+}
+
+
+UINT64
+EFIAPI
+HandoffRecordAddress(VOID)
+{
+    return (UINT64)(UINTN)mHandoffRecord;
+}
+
+
+VOID
+EFIAPI
+HandoffFaultIn(IN UINT64 Address,
+               IN UINT64 Length)
+{
+    mftah_handoff_chunk *Chunks;
+    UINT64 *Claimed, *Done;
+    UINT8 *Kek;
+    UINT8 Key[MFTAH_HANDOFF_KEY_LENGTH] = {0};
+    struct AES_ctx AesContext;
+    BOOLEAN HaveKey = FALSE;
+
+    if (NULL == mHandoffRecord || 0 == Length) {
+        return;
+    }
+
+    Chunks = (mftah_handoff_chunk *)((UINT8 *)mHandoffRecord + mHandoffRecord->chunk_table_offset);
+    Claimed = (UINT64 *)((UINT8 *)mHandoffRecord + mHandoffRecord->claimed_bitmap_offset);
+    Done = (UINT64 *)((UINT8 *)mHandoffRecord + mHandoffRecord->done_bitmap_offset);
+
+    for (UINT64 c = HandoffFindChunk(Chunks, mHandoffRecord->chunk_count, Address);
+         c < mHandoffRecord->chunk_count && Chunks[c].base < (Address + Length);
+         ++c
+    ) {
+        if (HANDOFF_BIT_TEST(Done, c)) continue;
+        if (0 != (__sync_fetch_and_or(&(Claimed[c / 64]), HANDOFF_BIT(c)) & HANDOFF_BIT(c))) continue;
+
+        /* The key is only ever kept wrapped, so unwrap it for as long as this takes. */
+        if (!HaveKey) {
+            Kek = (UINT8 *)(UINTN)mHandoffRecord->kek_address;
+            for (UINTN i = 0; i < MFTAH_HANDOFF_KEY_LENGTH; ++i) {
+                Key[i] = mHandoffRecord->wrapped_key[i] ^ Kek[i];
+            }
+            HaveKey = TRUE;
+        }
+
+        AES_init_ctx_iv(&AesContext, Key, Chunks[c].iv);
+        AES_CBC_decrypt_buffer(&AesContext, (UINT8 *)(UINTN)Chunks[c].base, Chunks[c].length, NULL, NULL);
+
+        __sync_fetch_and_or(&(Done[c / 64]), HANDOFF_BIT(c));
+        mHandoffRecord->chunks_done++;
+
+        DPRINTLN(L"---- Decrypted handoff chunk #%llu at '%p' on demand.", c, Chunks[c].base);
+    }
+
+    if (HaveKey) {
+        SetMem(Key, sizeof(Key), 0x00);
+        SetMem(&AesContext, sizeof(struct AES_ctx), 0x00);
+    }
+}
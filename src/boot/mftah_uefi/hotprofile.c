@@ -0,0 +1,335 @@
+#include "core/hotprofile.h"
+#include "core/memory.h"
+#include "core/util.h"
+
+
+
+/* The profile read from the boot volume, if any. */
+STATIC MFTAH_HOT_PROFILE *mHotProfileLoaded = NULL;
+
+/* The payload being booted, which the recording belongs to. */
+STATIC UINT8 mHotProfilePayloadHash[SIZE_OF_SHA_256_HASH] = {0};
+STATIC UINT64 mHotProfilePayloadFileSize = 0;
+
+/* The recording of this boot, and which of its units were touched or are in the loaded profile. */
+STATIC MFTAH_HOT_PROFILE *mHotProfile = NULL;
+STATIC UINT64 *mHotProfileTouched = NULL;
+STATIC UINT64 *mHotProfileKnown = NULL;
+STATIC UINT64 mHotProfileBase = 0;
+STATIC UINT64 mHotProfileLength = 0;
+STATIC UINT64 mHotProfileUnitCount = 0;
+
+/* How many recorded units the loaded profile didn't have. */
+STATIC UINT64 mHotProfileNewUnits = 0;
+
+
+#define HOT_PROFILE_BIT_TEST(Bitmap, Unit) \
+    (0 != ((Bitmap)[(Unit) / 64] & (1ULL << ((Unit) % 64))))
+#define HOT_PROFILE_BIT_SET(Bitmap, Unit) \
+    ((Bitmap)[(Unit) / 64] |= (1ULL << ((Unit) % 64)))
+
+
+
+/**
+ * Append a unit to the recording unless it was touched before. A unit right after
+ *  the last recorded one extends its run.
+ */
+STATIC
+VOID
+EFIAPI
+HotProfileTouch(IN UINT64 Unit)
+{
+    MFTAH_HOT_PROFILE_RUN *Last = NULL;
+
+    if (HOT_PROFILE_BIT_TEST(mHotProfileTouched, Unit)) return;
+    HOT_PROFILE_BIT_SET(mHotProfileTouched, Unit);
+
+    if (mHotProfile->RunCount > 0) {
+        Last = &(mHotProfile->Runs[mHotProfile->RunCount - 1]);
+    }
+
+    if (NULL != Last && ((UINT64)Last->FirstUnit + Last->UnitCount) == Unit) {
+        Last->UnitCount++;
+    } else if (mHotProfile->RunCount < MFTAH_HOT_PROFILE_MAX_RUNS) {
+        mHotProfile->Runs[mHotProfile->RunCount].FirstUnit = (UINT32)Unit;
+        mHotProfile->Runs[mHotProfile->RunCount].UnitCount = 1;
+        mHotProfile->RunCount++;
+    } else {
+        return;
+    }
+
+    if (!HOT_PROFILE_BIT_TEST(mHotProfileKnown, Unit)) {
+        mHotProfileNewUnits++;
+    }
+}
+
+
+EFI_STATUS
+EFIAPI
+HotProfileLoad(IN EFI_FILE_PROTOCOL *VolumeHandle,
+               IN CONST UINT8 *PayloadHash,
+               IN UINT64 PayloadFileSize)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL *ProfileHandle = NULL;
+    MFTAH_HOT_PROFILE *Profile = NULL;
+    UINTN ProfileSize = 0, ReadSize = 0;
+    UINT32 Crc32 = 0;
+
+    CopyMem(mHotProfilePayloadHash, (VOID *)PayloadHash, SIZE_OF_SHA_256_HASH);
+    mHotProfilePayloadFileSize = PayloadFileSize;
+
+    Status = uefi_call_wrapper(
+        VolumeHandle->Open, 5,
+        VolumeHandle,
+        &ProfileHandle,
+        (CHAR16 *)HotProfileFileName,
+        EFI_FILE_MODE_READ,
+        EFI_FILE_READ_ONLY | EFI_FILE_ARCHIVE | EFI_FILE_HIDDEN | EFI_FILE_SYSTEM
+    );
+    if (EFI_ERROR(Status)) {
+        DPRINTLN(L"-- No hot profile is present.");
+        return EFI_NOT_FOUND;
+    }
+
+    ProfileSize = FileSize(&ProfileHandle);
+    if (ProfileSize < MFTAH_HOT_PROFILE_HEADER_SIZE
+        || ProfileSize > sizeof(MFTAH_HOT_PROFILE)
+        || 0 != ((ProfileSize - MFTAH_HOT_PROFILE_HEADER_SIZE) % sizeof(MFTAH_HOT_PROFILE_RUN))
+    ) {
+        Status = EFI_VOLUME_CORRUPTED;
+        goto Label__HotProfileLoad__End;
+    }
+
+    Profile = (MFTAH_HOT_PROFILE *)AllocateZeroPool(sizeof(MFTAH_HOT_PROFILE));
+    if (NULL == Profile) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto Label__HotProfileLoad__End;
+    }
+
+    ReadSize = ProfileSize;
+    Status = uefi_call_wrapper(ProfileHandle->Read, 3, ProfileHandle, &ReadSize, Profile);
+    if (EFI_ERROR(Status) || ReadSize != ProfileSize) {
+        Status = EFI_VOLUME_CORRUPTED;
+        goto Label__HotProfileLoad__End;
+    }
+
+    if (MFTAH_HOT_PROFILE_SIGNATURE != Profile->Signature
+        || MFTAH_HOT_PROFILE_VERSION != Profile->Version
+        || MFTAH_HOT_PROFILE_UNIT_SIZE != Profile->UnitSize
+        || ProfileSize != (MFTAH_HOT_PROFILE_HEADER_SIZE + (Profile->RunCount * sizeof(MFTAH_HOT_PROFILE_RUN)))
+    ) {
+        Status = EFI_VOLUME_CORRUPTED;
+        goto Label__HotProfileLoad__End;
+    }
+
+    if (Profile->RunCount > 0) {
+        Status = uefi_call_wrapper(
+            BS->CalculateCrc32, 3,
+            Profile->Runs,
+            Profile->RunCount * sizeof(MFTAH_HOT_PROFILE_RUN),
+            &Crc32
+        );
+        if (EFI_ERROR(Status) || Crc32 != Profile->RunsCrc32) {
+            Status = EFI_VOLUME_CORRUPTED;
+            goto Label__HotProfileLoad__End;
+        }
+    }
+
+    /* A profile of an older build of the payload would only send the decryption astray. */
+    if (PayloadFileSize != Profile->PayloadFileSize
+        || 0 != CompareMem(Profile->PayloadHash, PayloadHash, SIZE_OF_SHA_256_HASH)
+    ) {
+        DPRINTLN(L"-- The hot profile was recorded for another payload.");
+        Status = EFI_NOT_FOUND;
+        goto Label__HotProfileLoad__End;
+    }
+
+    DPRINTLN(L"-- Loaded a hot profile of (%u) runs.", Profile->RunCount);
+    mHotProfileLoaded = Profile;
+    Profile = NULL;
+    Status = EFI_SUCCESS;
+
+Label__HotProfileLoad__End:
+    if (NULL != Profile) FreePool(Profile);
+    uefi_call_wrapper(ProfileHandle->Close, 1, ProfileHandle);
+
+    return Status;
+}
+
+
+CONST MFTAH_HOT_PROFILE_RUN *
+EFIAPI
+HotProfileRuns(OUT UINT32 *RunCount)
+{
+    if (NULL == mHotProfileLoaded) {
+        *RunCount = 0;
+        return NULL;
+    }
+
+    *RunCount = mHotProfileLoaded->RunCount;
+    return mHotProfileLoaded->Runs;
+}
+
+
+EFI_STATUS
+EFIAPI
+HotProfileStartRecording(IN UINT8 *RamdiskImage,
+                         IN UINT64 RamdiskLength)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINTN BitmapSize = 0;
+    UINT64 Unit = 0;
+
+    mHotProfileUnitCount = (RamdiskLength + MFTAH_HOT_PROFILE_UNIT_SIZE - 1) / MFTAH_HOT_PROFILE_UNIT_SIZE;
+    if (0 == mHotProfileUnitCount || mHotProfileUnitCount > 0xFFFFFFFFULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    BitmapSize = ((mHotProfileUnitCount + 63) / 64) * sizeof(UINT64);
+    mHotProfileTouched = (UINT64 *)AllocateZeroPool(BitmapSize);
+    mHotProfileKnown = (UINT64 *)AllocateZeroPool(BitmapSize);
+
+    /* The OS may read the recording, so it lives in memory which is reported as reserved. */
+    uefi_call_wrapper(BS->AllocatePool, 3, EfiReservedMemoryType, sizeof(MFTAH_HOT_PROFILE), (VOID **)&mHotProfile);
+    if (NULL == mHotProfile || NULL == mHotProfileTouched || NULL == mHotProfileKnown) {
+        if (NULL != mHotProfile) FreePool(mHotProfile);
+        if (NULL != mHotProfileTouched) FreePool(mHotProfileTouched);
+        if (NULL != mHotProfileKnown) FreePool(mHotProfileKnown);
+        mHotProfile = NULL;
+        mHotProfileTouched = mHotProfileKnown = NULL;
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    SetMem(mHotProfile, sizeof(MFTAH_HOT_PROFILE), 0x00);
+    mHotProfile->Signature = MFTAH_HOT_PROFILE_SIGNATURE;
+    mHotProfile->Version = MFTAH_HOT_PROFILE_VERSION;
+    mHotProfile->UnitSize = MFTAH_HOT_PROFILE_UNIT_SIZE;
+    mHotProfile->PayloadFileSize = mHotProfilePayloadFileSize;
+    CopyMem(mHotProfile->PayloadHash, mHotProfilePayloadHash, SIZE_OF_SHA_256_HASH);
+
+    for (UINT32 i = 0; NULL != mHotProfileLoaded && i < mHotProfileLoaded->RunCount; ++i) {
+        for (UINT32 j = 0; j < mHotProfileLoaded->Runs[i].UnitCount; ++j) {
+            Unit = (UINT64)mHotProfileLoaded->Runs[i].FirstUnit + j;
+            if (Unit >= mHotProfileUnitCount) break;
+
+            HOT_PROFILE_BIT_SET(mHotProfileKnown, Unit);
+        }
+    }
+
+    mHotProfileBase = (UINT64)(UINTN)RamdiskImage;
+    mHotProfileLength = RamdiskLength;
+
+    DPRINTLN(L"-- Recording the accesses to (%llu) ramdisk units.", mHotProfileUnitCount);
+
+    PRINTLN(L"-- Setting hot profile hint '__MFTAH_HOTPROFILE'.");
+    ERRCHECK_UEFI(
+        ST->RuntimeServices->SetVariable,
+        5,
+        L"__MFTAH_HOTPROFILE",
+        &gXmitVendorGuid,
+        EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+        sizeof(VOID *),
+        &mHotProfile
+    );
+
+    return EFI_SUCCESS;
+}
+
+
+VOID
+EFIAPI
+HotProfileRecord(IN UINT64 Address,
+                 IN UINT64 Length)
+{
+    UINT64 Start, End;
+
+    if (NULL == mHotProfile || 0 == Length) return;
+    if (Address >= (mHotProfileBase + mHotProfileLength) || (Address + Length) <= mHotProfileBase) return;
+
+    Start = MAX(Address, mHotProfileBase) - mHotProfileBase;
+    End = MIN(Address + Length, mHotProfileBase + mHotProfileLength) - mHotProfileBase;
+
+    for (UINT64 Unit = Start / MFTAH_HOT_PROFILE_UNIT_SIZE; Unit <= ((End - 1) / MFTAH_HOT_PROFILE_UNIT_SIZE); ++Unit) {
+        HotProfileTouch(Unit);
+    }
+}
+
+
+EFI_STATUS
+EFIAPI
+HotProfileSave(IN EFI_FILE_PROTOCOL *VolumeHandle)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL *ProfileHandle = NULL;
+    UINTN WriteSize = 0;
+    UINT64 Unit = 0;
+    UINT32 Crc32 = 0;
+
+    if (NULL == mHotProfile) {
+        return EFI_SUCCESS;
+    }
+
+    /* Whatever the loaded profile knew still comes after the recorded units. */
+    for (UINT32 i = 0; NULL != mHotProfileLoaded && i < mHotProfileLoaded->RunCount; ++i) {
+        for (UINT32 j = 0; j < mHotProfileLoaded->Runs[i].UnitCount; ++j) {
+            Unit = (UINT64)mHotProfileLoaded->Runs[i].FirstUnit + j;
+            if (Unit >= mHotProfileUnitCount) break;
+
+            HotProfileTouch(Unit);
+        }
+    }
+
+    /* Don't write to the boot volume on every boot. */
+    if (0 == mHotProfileNewUnits) {
+        DPRINTLN(L"-- The hot profile is unchanged.");
+        return EFI_SUCCESS;
+    }
+
+    Status = uefi_call_wrapper(
+        BS->CalculateCrc32, 3,
+        mHotProfile->Runs,
+        mHotProfile->RunCount * sizeof(MFTAH_HOT_PROFILE_RUN),
+        &Crc32
+    );
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    mHotProfile->RunsCrc32 = Crc32;
+
+    /* Delete any old profile first, since opening a file never truncates it. */
+    Status = uefi_call_wrapper(
+        VolumeHandle->Open, 5,
+        VolumeHandle,
+        &ProfileHandle,
+        (CHAR16 *)HotProfileFileName,
+        EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE,
+        0
+    );
+    if (!EFI_ERROR(Status)) {
+        uefi_call_wrapper(ProfileHandle->Delete, 1, ProfileHandle);
+    }
+
+    Status = uefi_call_wrapper(
+        VolumeHandle->Open, 5,
+        VolumeHandle,
+        &ProfileHandle,
+        (CHAR16 *)HotProfileFileName,
+        EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+        EFI_FILE_ARCHIVE
+    );
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    WriteSize = MFTAH_HOT_PROFILE_HEADER_SIZE + (mHotProfile->RunCount * sizeof(MFTAH_HOT_PROFILE_RUN));
+    Status = uefi_call_wrapper(ProfileHandle->Write, 3, ProfileHandle, &WriteSize, mHotProfile);
+    if (!EFI_ERROR(Status)) {
+        Status = uefi_call_wrapper(ProfileHandle->Flush, 1, ProfileHandle);
+    }
+
+    uefi_call_wrapper(ProfileHandle->Close, 1, ProfileHandle);
+
+    DPRINTLN(L"-- Saved a hot profile of (%u) runs with (%llu) new units.", mHotProfile->RunCount, mHotProfileNewUnits);
+    return Status;
+}
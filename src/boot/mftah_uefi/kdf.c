@@ -0,0 +1,286 @@
+#include "core/kdf.h"
+#include "core/memory.h"
+#include "core/profiler.h"
+#include "core/util.h"
+#include "drivers/threading.h"
+
+
+
+/**
+ * One slice of an Argon2 computation. The BSP and every AP helping it pull
+ *  lane indices from 'NextLane' until none are left.
+ */
+typedef
+struct {
+    CONST struct Argon2 *Argon2;
+    UINT32              Pass;
+    UINT32              Slice;
+    UINT32 VOLATILE     NextLane;
+} KDF_SLICE_JOB;
+
+
+
+/**
+ * Fill segments of a slice until none are left. Runs on the BSP and on APs alike,
+ *  so it must not use any boot services.
+ *
+ * @param[in]  Context  The KDF_SLICE_JOB to work on.
+ */
+STATIC
+VOID
+EFIAPI
+KdfFillLanes(IN VOID *Context)
+{
+    KDF_SLICE_JOB *Job = (KDF_SLICE_JOB *)Context;
+    UINT32 Lane;
+
+    while ((Lane = __sync_fetch_and_add(&(Job->NextLane), 1)) < Job->Argon2->lanes) {
+        argon2_fill_segment(Job->Argon2, Job->Pass, Job->Slice, Lane);
+    }
+}
+
+
+/**
+ * Fill every segment of one slice, on as many processors as there are lanes.
+ *
+ * @returns How many APs helped.
+ */
+STATIC
+UINTN
+EFIAPI
+KdfFillSlice(IN KDF_SLICE_JOB *Job,
+             IN MFTAH_THREAD *Helpers,
+             IN UINTN HelperCount)
+{
+    UINTN Started = 0;
+
+    Job->NextLane = 0;
+
+    for (Started = 0; Started < HelperCount; ++Started) {
+        if (EFI_ERROR(CreateThread(KdfFillLanes, (VOID *)Job, &(Helpers[Started])))) break;
+
+        if (EFI_ERROR(StartThread(&(Helpers[Started]), FALSE))) {
+            uefi_call_wrapper(BS->CloseEvent, 1, Helpers[Started].CompletionEvent);
+            break;
+        }
+    }
+
+    KdfFillLanes((VOID *)Job);
+
+    /* No segment of the next slice may start before every lane of this one is done. */
+    for (UINTN i = 0; i < Started; ++i) {
+        JoinThread(&(Helpers[i]));
+        uefi_call_wrapper(BS->CloseEvent, 1, Helpers[i].CompletionEvent);
+    }
+
+    return Started;
+}
+
+
+/**
+ * Sum the free conventional memory in the current memory map.
+ *
+ * @returns The free memory in bytes, or 0 if the map couldn't be read.
+ */
+STATIC
+UINT64
+EFIAPI
+KdfFreeMemory(VOID)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_MEMORY_DESCRIPTOR *Map = NULL;
+    EFI_MEMORY_DESCRIPTOR *Descriptor = NULL;
+    UINTN MapSize = 0, MapKey = 0, DescriptorSize = 0;
+    UINT32 DescriptorVersion = 0;
+    UINT64 FreeBytes = 0;
+
+    Status = uefi_call_wrapper(BS->GetMemoryMap, 5, &MapSize, NULL, &MapKey, &DescriptorSize, &DescriptorVersion);
+    if (EFI_BUFFER_TOO_SMALL != Status) {
+        return 0;
+    }
+
+    /* The allocation itself can add a descriptor or two. */
+    MapSize += 4 * DescriptorSize;
+    Map = (EFI_MEMORY_DESCRIPTOR *)AllocatePool(MapSize);
+    if (NULL == Map) {
+        return 0;
+    }
+
+    Status = uefi_call_wrapper(BS->GetMemoryMap, 5, &MapSize, Map, &MapKey, &DescriptorSize, &DescriptorVersion);
+    if (!EFI_ERROR(Status)) {
+        for (UINTN Offset = 0; Offset < MapSize; Offset += DescriptorSize) {
+            Descriptor = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)Map + Offset);
+
+            if (EfiConventionalMemory == Descriptor->Type) {
+                FreeBytes += EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages);
+            }
+        }
+    }
+
+    FreePool(Map);
+    return FreeBytes;
+}
+
+
+/**
+ * Read and validate the KDF parameter file.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+KdfLoadParameters(IN EFI_FILE_PROTOCOL *VolumeHandle,
+                  OUT MFTAH_KDF_PARAMETERS *Parameters)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL *ParametersHandle = NULL;
+    UINTN ReadSize = sizeof(MFTAH_KDF_PARAMETERS);
+
+    Status = uefi_call_wrapper(
+        VolumeHandle->Open, 5,
+        VolumeHandle,
+        &ParametersHandle,
+        (CHAR16 *)PasswordKdfFileName,
+        EFI_FILE_MODE_READ,
+        EFI_FILE_READ_ONLY | EFI_FILE_ARCHIVE | EFI_FILE_HIDDEN | EFI_FILE_SYSTEM
+    );
+    if (EFI_ERROR(Status)) {
+        DPRINTLN(L"-- No password KDF parameters are present.");
+        return EFI_NOT_FOUND;
+    }
+
+    if (sizeof(MFTAH_KDF_PARAMETERS) != FileSize(&ParametersHandle)) {
+        Status = EFI_UNSUPPORTED;
+    } else {
+        Status = uefi_call_wrapper(ParametersHandle->Read, 3, ParametersHandle, &ReadSize, Parameters);
+        if (EFI_ERROR(Status) || sizeof(MFTAH_KDF_PARAMETERS) != ReadSize) {
+            Status = EFI_UNSUPPORTED;
+        }
+    }
+
+    uefi_call_wrapper(ParametersHandle->Close, 1, ParametersHandle);
+
+    if (
+        EFI_ERROR(Status)
+        || MFTAH_KDF_SIGNATURE != Parameters->Signature
+        || MFTAH_KDF_VERSION != Parameters->Version
+        || MFTAH_KDF_ALGORITHM_ARGON2ID != Parameters->Algorithm
+        || 0 == Parameters->Passes
+        || Parameters->SaltLength < 8
+        || Parameters->SaltLength > MFTAH_KDF_MAX_SALT_LENGTH
+        || 0 == argon2_memory_blocks(Parameters->MemoryKiB, Parameters->Lanes)
+    ) {
+        return EFI_UNSUPPORTED;
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+EFI_STATUS
+EFIAPI
+KdfDerivePassword(IN EFI_FILE_PROTOCOL *VolumeHandle,
+                  IN OUT UINT8 *Password,
+                  IN OUT UINT8 *PasswordLength)
+{
+    STATIC CONST CHAR16 HexDigits[] = L"0123456789abcdef";
+
+    EFI_STATUS Status = EFI_SUCCESS;
+    MFTAH_KDF_PARAMETERS Parameters = {0};
+    struct Argon2 Argon2 = {0};
+    KDF_SLICE_JOB Job = {0};
+    MFTAH_THREAD *Helpers = NULL;
+    UINTN HelperCount = 0, Helped = 0;
+    EFI_PHYSICAL_ADDRESS MemoryBase = 0;
+    UINTN MemoryPages = 0;
+    UINT64 MemoryBytes = 0, FreeBytes = 0;
+    CHAR8 PasswordChar8[MFTAH_MAX_PW_LEN] = {0};
+    UINT8 PasswordLengthChar8 = 0;
+    UINT8 Tag[MFTAH_KDF_TAG_LENGTH] = {0};
+
+    Status = KdfLoadParameters(VolumeHandle, &Parameters);
+    if (EFI_ERROR(Status)) {
+        if (EFI_UNSUPPORTED == Status) {
+            EFI_WARNINGLN(L"The password KDF parameters in '%s' are not valid.", PasswordKdfFileName);
+        }
+        return Status;
+    }
+
+    MemoryBytes = (UINT64)argon2_memory_blocks(Parameters.MemoryKiB, Parameters.Lanes) * ARGON2_BLOCK_SIZE;
+    MemoryPages = EFI_SIZE_TO_PAGES(MemoryBytes);
+
+    FreeBytes = KdfFreeMemory();
+    if (MemoryBytes > ((FreeBytes / 100) * MFTAH_KDF_MAX_MEMORY_PERCENT)) {
+        EFI_WARNINGLN(L"The password KDF needs (%llu) MiB, but only (%llu) MiB may be used here.",
+                      MemoryBytes >> 20, ((FreeBytes / 100) * MFTAH_KDF_MAX_MEMORY_PERCENT) >> 20);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    Status = uefi_call_wrapper(BS->AllocatePages, 4,
+                               AllocateAnyPages, EfiLoaderData, MemoryPages, &MemoryBase);
+    if (EFI_ERROR(Status)) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    /* Idle APs each take lanes too; helpers which can't be started are simply not waited on. */
+    if (IsThreadingEnabled() && Parameters.Lanes > 1) {
+        HelperCount = MIN(MIN(GetThreadLimit(), (UINTN)(Parameters.Lanes - 1)), MFTAH_MAX_THREAD_COUNT);
+        if (HelperCount > 0) {
+            Helpers = (MFTAH_THREAD *)AllocateZeroPool(HelperCount * sizeof(MFTAH_THREAD));
+            if (NULL == Helpers) HelperCount = 0;
+        }
+    }
+
+    PRINTLN(L"Deriving the payload password (Argon2id: %u MiB, %u passes, %u lanes on %u processors)...",
+            (UINT32)(MemoryBytes >> 20), Parameters.Passes, Parameters.Lanes, HelperCount + 1);
+
+    ProfilerBegin(ProfilePhasePasswordKdf);
+
+    /* MFTAH only ever sees the low byte of each typed character, so the KDF does too. */
+    PasswordLengthChar8 = *PasswordLength / sizeof(CHAR16);
+    for (UINTN i = 0; i < PasswordLengthChar8; ++i) {
+        PasswordChar8[i] = (CHAR8)Password[i * sizeof(CHAR16)];
+    }
+
+    if (0 != argon2id_init(&Argon2, (VOID *)(UINTN)MemoryBase,
+                           Parameters.MemoryKiB, Parameters.Passes, Parameters.Lanes, MFTAH_KDF_TAG_LENGTH,
+                           PasswordChar8, PasswordLengthChar8,
+                           Parameters.Salt, Parameters.SaltLength)
+    ) {
+        EFI_WARNINGLN(L"The password KDF could not be started with the parameters in '%s'.", PasswordKdfFileName);
+        Status = EFI_UNSUPPORTED;
+        goto Label__KdfDerivePassword__End;
+    }
+
+    Job.Argon2 = &Argon2;
+    for (Job.Pass = 0; Job.Pass < Parameters.Passes; ++Job.Pass) {
+        for (Job.Slice = 0; Job.Slice < ARGON2_SYNC_POINTS; ++Job.Slice) {
+            Helped = MAX(Helped, KdfFillSlice(&Job, Helpers, HelperCount));
+        }
+    }
+
+    argon2_final(&Argon2, Tag);
+
+    ProfilerEnd(ProfilePhasePasswordKdf, MemoryBytes * Parameters.Passes);
+
+    DPRINTLN(L"-- Filled the KDF memory with up to (%u) helper processors.", Helped);
+
+    /* The derived password replaces the typed one, as hex digits. */
+    SetMem(Password, MFTAH_MAX_PW_LEN * sizeof(CHAR16), 0x00);
+    for (UINTN i = 0; i < MFTAH_KDF_TAG_LENGTH; ++i) {
+        ((CHAR16 *)Password)[(2 * i)]     = HexDigits[Tag[i] >> 4];
+        ((CHAR16 *)Password)[(2 * i) + 1] = HexDigits[Tag[i] & 0x0F];
+    }
+    *PasswordLength = (UINT8)(2 * MFTAH_KDF_TAG_LENGTH * sizeof(CHAR16));
+    Status = EFI_SUCCESS;
+
+Label__KdfDerivePassword__End:
+    /* Nothing derived from the password may stay behind. */
+    SetMem(Tag, sizeof(Tag), 0x00);
+    SetMem(PasswordChar8, sizeof(PasswordChar8), 0x00);
+    FastSetMem((VOID *)(UINTN)MemoryBase, EFI_PAGES_TO_SIZE(MemoryPages), 0x00);
+    uefi_call_wrapper(BS->FreePages, 2, MemoryBase, MemoryPages);
+
+    if (NULL != Helpers) FreePool(Helpers);
+
+    return Status;
+}
@@ -1,36 +1,199 @@
 #include "core/loader.h"
 #include "core/util.h"
 #include "core/input.h"
+#include "core/profiler.h"
+#include "core/fwbench.h"
+
+
+
+/* Set once an entry of the payload catalog didn't match the volume. */
+STATIC BOOLEAN mCatalogStale = FALSE;
+
+
+/**
+ * Whether a file name carries the payload extension, case-insensitively.
+ */
+STATIC
+BOOLEAN
+EFIAPI
+HasPayloadExtension(IN CONST CHAR16 *FileName)
+{
+    CHAR16 Slice[MFTAH_MAX_FILENAME_LENGTH + 1] = {0};
+    UINTN Length = StrLen(FileName);
+
+    /* The filename must be greater than the suffix pattern to check against. */
+    if (Length <= StrLen(BootPayloadExtensionPattern) || Length > MFTAH_MAX_FILENAME_LENGTH) {
+        return FALSE;
+    }
+
+    StrCpy(Slice, FileName + Length - StrLen(BootPayloadExtensionPattern));
+    StrUpr(Slice);
+
+    return 0 == StrCmp(BootPayloadExtensionPattern, Slice);
+}
+
+
+/**
+ * Read and validate the payload catalog in a single I/O.
+ *
+ * @param[in]  VolumeHandle  The root of the boot volume.
+ * @param[out] Payloads      Space for up to MFTAH_MAX_PAYLOADS descriptors.
+ * @param[out] Count         How many payloads the catalog lists.
+ *
+ * @retval EFI_SUCCESS           The catalog was loaded into 'Payloads'.
+ * @retval EFI_NOT_FOUND         There is no catalog, or it lists nothing.
+ * @retval EFI_VOLUME_CORRUPTED  The catalog is malformed.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+LoadPayloadCatalog(IN EFI_FILE_PROTOCOL *VolumeHandle,
+                   OUT DISCOVERED_PAYLOAD *Payloads,
+                   OUT UINTN *Count)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_FILE_PROTOCOL *CatalogHandle = NULL;
+
+    UINT8 *CatalogBuffer = NULL;
+    UINTN CatalogSize = 0, ReadSize = 0;
+    UINT32 Crc32 = 0;
+
+    MFTAH_CATALOG_HEADER *Header;
+    MFTAH_CATALOG_ENTRY *Entries;
+
+    *Count = 0;
+
+    Status = uefi_call_wrapper(
+        VolumeHandle->Open, 5,
+        VolumeHandle,
+        &CatalogHandle,
+        (CHAR16 *)PayloadCatalogFileName,
+        EFI_FILE_MODE_READ,
+        EFI_FILE_READ_ONLY | EFI_FILE_ARCHIVE | EFI_FILE_HIDDEN | EFI_FILE_SYSTEM
+    );
+    if (EFI_ERROR(Status)) {
+        DPRINTLN(L"-- No payload catalog is present.");
+        return EFI_NOT_FOUND;
+    }
+
+    CatalogSize = FileSize(&CatalogHandle);
+    if (CatalogSize < sizeof(MFTAH_CATALOG_HEADER)
+        || CatalogSize > (sizeof(MFTAH_CATALOG_HEADER) + (MFTAH_MAX_PAYLOADS * sizeof(MFTAH_CATALOG_ENTRY)))
+    ) {
+        Status = EFI_VOLUME_CORRUPTED;
+        goto Label__LoadPayloadCatalog__End;
+    }
+
+    CatalogBuffer = (UINT8 *)AllocatePool(CatalogSize);
+    if (NULL == CatalogBuffer) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto Label__LoadPayloadCatalog__End;
+    }
+
+    ReadSize = CatalogSize;
+    Status = uefi_call_wrapper(
+        CatalogHandle->Read, 3,
+        CatalogHandle,
+        &ReadSize,
+        CatalogBuffer
+    );
+    if (EFI_ERROR(Status) || ReadSize != CatalogSize) {
+        Status = EFI_VOLUME_CORRUPTED;
+        goto Label__LoadPayloadCatalog__End;
+    }
+
+    Header = (MFTAH_CATALOG_HEADER *)CatalogBuffer;
+    Entries = (MFTAH_CATALOG_ENTRY *)(CatalogBuffer + sizeof(MFTAH_CATALOG_HEADER));
+
+    if (MFTAH_CATALOG_SIGNATURE != Header->Signature
+        || MFTAH_CATALOG_VERSION != Header->Version
+        || Header->EntryCount > MFTAH_MAX_PAYLOADS
+        || CatalogSize != (sizeof(MFTAH_CATALOG_HEADER) + (Header->EntryCount * sizeof(MFTAH_CATALOG_ENTRY)))
+        || 0 == Header->DigestLength
+        || Header->DigestLength > MFTAH_CATALOG_MAX_DIGEST_LENGTH
+    ) {
+        Status = EFI_VOLUME_CORRUPTED;
+        goto Label__LoadPayloadCatalog__End;
+    }
+
+    if (0 == Header->EntryCount) {
+        Status = EFI_NOT_FOUND;
+        goto Label__LoadPayloadCatalog__End;
+    }
+
+    Status = uefi_call_wrapper(
+        BS->CalculateCrc32, 3,
+        Entries,
+        Header->EntryCount * sizeof(MFTAH_CATALOG_ENTRY),
+        &Crc32
+    );
+    if (EFI_ERROR(Status) || Crc32 != Header->EntriesCrc32) {
+        Status = EFI_VOLUME_CORRUPTED;
+        goto Label__LoadPayloadCatalog__End;
+    }
+
+    for (UINTN i = 0; i < Header->EntryCount; ++i) {
+        /* Never trust the terminator to be there. */
+        Entries[i].Name[MFTAH_MAX_FILENAME_LENGTH] = L'\0';
+
+        /* Payloads embedded at an offset into another file aren't loadable yet. */
+        if (!HasPayloadExtension(Entries[i].Name) || 0 != Entries[i].Offset || 0 == Entries[i].Size) {
+            Status = EFI_VOLUME_CORRUPTED;
+            goto Label__LoadPayloadCatalog__End;
+        }
+
+        CopyMem(Payloads[i].Name, Entries[i].Name, sizeof(Payloads[i].Name));
+        Payloads[i].Size = Entries[i].Size;
+        Payloads[i].Offset = Entries[i].Offset;
+        Payloads[i].FromCatalog = TRUE;
+        Payloads[i].DigestLength = Header->DigestLength;
+        CopyMem(Payloads[i].HeaderDigest, Entries[i].HeaderDigest, SIZE_OF_SHA_256_HASH);
+
+        PRINTLN(L"-- Discovered '%s'.", Payloads[i].Name);
+    }
+
+    *Count = Header->EntryCount;
+    Status = EFI_SUCCESS;
+
+Label__LoadPayloadCatalog__End:
+    if (EFI_VOLUME_CORRUPTED == Status) {
+        EFI_WARNINGLN(L"The payload catalog is invalid. Scanning for payloads instead.");
+    }
+
+    if (NULL != CatalogBuffer) FreePool(CatalogBuffer);
+    uefi_call_wrapper(CatalogHandle->Close, 1, CatalogHandle);
+
+    return Status;
+}
 
 
 EFI_STATUS
 EFIAPI
 DiscoverPayloads(IN EFI_HANDLE BaseImageHandle,
-                 OUT EFI_FILE_PROTOCOL ***LoadedPayloadHandles,
-                 OUT UINTN *LoadedHandlesCount,
+                 OUT DISCOVERED_PAYLOAD **DiscoveredPayloads,
+                 OUT UINTN *DiscoveredCount,
                  OUT UINT8 *LoadedLoaderHash OPTIONAL)
 {
     EFI_STATUS Status = EFI_SUCCESS;
-    mftah_status_t MftahStatus = MFTAH_SUCCESS;
     
     EFI_LOADED_IMAGE *LoadedImage;
     
     EFI_FILE_IO_INTERFACE *ImageIo;
-    EFI_FILE_PROTOCOL *VolumeHandle, *PayloadHandle;
+    EFI_FILE_PROTOCOL *VolumeHandle;
     EFI_FILE_INFO *FileInfo;
     
     UINTN HandleCount, FileInfoSize;
     
     EFI_FILE_PROTOCOL *LoaderHandle;
-    UINT8 *LoaderBuffer;
     UINT64 LoaderFileLength;
-    UINT64 LoaderChunkSize = 1 << 12;   /* 4 KiB */
 
     PRINTLN(L"Detecting payloads on the boot filesystem...");
 
-    if (NULL == LoadedPayloadHandles)
+    if (NULL == DiscoveredPayloads || NULL == DiscoveredCount)
         return EFI_INVALID_PARAMETER;
 
+    *DiscoveredCount = 0;
+
     DPRINTLN(L"-- Fetching UEFI Loaded Image Protocol.");
     ERRCHECK_UEFI(
         BS->HandleProtocol, 3,
@@ -57,9 +220,9 @@ DiscoverPayloads(IN EFI_HANDLE BaseImageHandle,
     /* Save this for later in case we need to reload a new payload file handle instance. */
     gOperatingPayload.VolumeHandle = VolumeHandle;
 
-    *LoadedPayloadHandles = (EFI_FILE_PROTOCOL **)
-        AllocatePool(sizeof(EFI_FILE_PROTOCOL *) * MFTAH_MAX_PAYLOADS);
-    if (NULL == *LoadedPayloadHandles)
+    *DiscoveredPayloads = (DISCOVERED_PAYLOAD *)
+        AllocateZeroPool(sizeof(DISCOVERED_PAYLOAD) * MFTAH_MAX_PAYLOADS);
+    if (NULL == *DiscoveredPayloads)
         return EFI_OUT_OF_RESOURCES;
 
     FileInfoSize = 1 << 12;   /* 4 KiB */
@@ -68,60 +231,51 @@ DiscoverPayloads(IN EFI_HANDLE BaseImageHandle,
         return EFI_OUT_OF_RESOURCES;
 
     /* Quickly create the hash of the loader, since the root filesystem is opened. */
-    DPRINTLN(L"-- Attempting to hash the MFTAH loader EXE.");
-    Status = uefi_call_wrapper(
-        VolumeHandle->Open, 5,
-        VolumeHandle,
-        &LoaderHandle,
-        MFTAH_LOADER_EXE_PATH,
-        EFI_FILE_MODE_READ,
-        EFI_FILE_READ_ONLY | EFI_FILE_ARCHIVE | EFI_FILE_HIDDEN | EFI_FILE_SYSTEM
-    );
-    if (EFI_ERROR(Status)) {
-        EFI_WARNINGLN(L"Failed to find the MFTAH application by path...");
-        EFI_WARNINGLN(L"    The EFI variable '__MFTAH_LOADER_HASH'");
-        EFI_WARNINGLN(L"    will not be available at OS runtime.");
-    } else {
-        LoaderFileLength = FileSize(&LoaderHandle);
-        LoaderBuffer = (UINT8 *)AllocateZeroPool(LoaderFileLength);
-
-        DPRINTLN(L"Opened loader file at (%llu) bytes. Readying hash.", LoaderFileLength);
-
-        if (0 == LoaderFileLength || NULL == LoaderBuffer) {
-            Status = EFI_OUT_OF_RESOURCES;
+    /*   It isn't needed again when discovery is repeated after a stale catalog. */
+    if (NULL != LoadedLoaderHash) {
+        DPRINTLN(L"-- Attempting to hash the MFTAH loader EXE.");
+        Status = uefi_call_wrapper(
+            VolumeHandle->Open, 5,
+            VolumeHandle,
+            &LoaderHandle,
+            MFTAH_LOADER_EXE_PATH,
+            EFI_FILE_MODE_READ,
+            EFI_FILE_READ_ONLY | EFI_FILE_ARCHIVE | EFI_FILE_HIDDEN | EFI_FILE_SYSTEM
+        );
+        if (EFI_ERROR(Status)) {
+            EFI_WARNINGLN(L"Failed to find the MFTAH application by path...");
+            EFI_WARNINGLN(L"    The EFI variable '__MFTAH_LOADER_HASH'");
+            EFI_WARNINGLN(L"    will not be available at OS runtime.");
         } else {
-            Status = uefi_call_wrapper(
-                LoaderHandle->SetPosition,
-                2,
-                LoaderHandle,
-                0
-            );
-
-            for (UINTN i = 0; LoaderChunkSize > 0; ++i) {
-                Status = uefi_call_wrapper(
-                    LoaderHandle->Read,
-                    3,
-                    LoaderHandle,
-                    &LoaderChunkSize,
-                    (LoaderBuffer + (i * (1 << 12)))
-                );
-
-                if (EFI_ERROR(Status)) break;
+            ProfilerBegin(ProfilePhaseLoaderHash);
+
+            LoaderFileLength = 0;
+            Status = HashFile(LoaderHandle, LoadedLoaderHash, &LoaderFileLength);
+            if (!EFI_ERROR(Status) && 0 == LoaderFileLength) {
+                Status = EFI_END_OF_FILE;
             }
 
-            if (!EFI_ERROR(Status)) {
-                MftahStatus = MFTAH->create_hash(MFTAH,
-                                               LoaderBuffer,
-                                               LoaderFileLength,
-                                               LoadedLoaderHash,
-                                               NULL);
+            DPRINTLN(L"Hashed loader file at (%llu) bytes.", LoaderFileLength);
+
+            ProfilerEnd(ProfilePhaseLoaderHash, LoaderFileLength);
+            uefi_call_wrapper(LoaderHandle->Close, 1, LoaderHandle);
+
+            if (EFI_ERROR(Status)) {
+                EFI_WARNINGLN(L"Failed to hash the MFTAH binary...");
+                EFI_WARNINGLN(L"    The EFI variable '__MFTAH_LOADER_HASH'");
+                EFI_WARNINGLN(L"    will not be available at OS runtime.");
             }
         }
-        if (MFTAH_ERROR(MftahStatus) || EFI_ERROR(Status)) {
-            EFI_WARNINGLN(L"Failed to hash the MFTAH binary...");
-            EFI_WARNINGLN(L"    The EFI variable '__MFTAH_LOADER_HASH'");
-            EFI_WARNINGLN(L"    will not be available at OS runtime.");
-        }
+    }
+
+    /* The catalog costs one read no matter how many payloads there are. */
+    if (1 == MFTAH_USE_PAYLOAD_CATALOG && !mCatalogStale
+        && EFI_SUCCESS == LoadPayloadCatalog(VolumeHandle, *DiscoveredPayloads, &HandleCount)
+    ) {
+        DPRINTLN(L"-- Using the payload catalog (%u entries).", HandleCount);
+
+        Status = EFI_SUCCESS;
+        goto Label__DiscoverPayloads__Done;
     }
 
     /*
@@ -158,48 +312,34 @@ DiscoverPayloads(IN EFI_HANDLE BaseImageHandle,
 
         DPRINTLN(L"'%s' (%lu)", FileInfo->FileName, FileInfo->FileSize);
 
-        /* The filename must be greater than the suffix pattern to check against. */
-        if (StrSize(FileInfo->FileName) > StrSize(BootPayloadExtensionPattern)) {
-            CHAR16 *slice = FileInfo->FileName
-                + StrLen(FileInfo->FileName)
-                - StrLen(BootPayloadExtensionPattern);
-            StrUpr(slice);
-
-            if (0 == StrCmp(BootPayloadExtensionPattern, slice)) {
-                DPRINTLN(L"------ Valid payload file! ");
-                ERRCHECK_UEFI(
-                    VolumeHandle->Open, 5,
-                    VolumeHandle,
-                    &PayloadHandle,
-                    FileInfo->FileName,
-                    EFI_FILE_MODE_READ,
-                    EFI_FILE_READ_ONLY | EFI_FILE_ARCHIVE | EFI_FILE_HIDDEN | EFI_FILE_SYSTEM
-                );
-
-                CopyMem(&((*LoadedPayloadHandles)[HandleCount]),
-                        &PayloadHandle,
-                        sizeof(EFI_FILE_PROTOCOL *));
-
-                PRINTLN(L"-- Discovered '%s'.", FileInfo->FileName);
-
-                ++HandleCount;
-                DPRINTLN(L"(open,success)");
-            }
+        /* Payloads are only opened once one is chosen, so only the name and size are kept. */
+        if (0 == (FileInfo->Attribute & EFI_FILE_DIRECTORY) && HasPayloadExtension(FileInfo->FileName)) {
+            DPRINTLN(L"------ Valid payload file! ");
+
+            StrCpy((*DiscoveredPayloads)[HandleCount].Name, FileInfo->FileName);
+            (*DiscoveredPayloads)[HandleCount].Size = FileInfo->FileSize;
+            (*DiscoveredPayloads)[HandleCount].Offset = 0;
+            (*DiscoveredPayloads)[HandleCount].FromCatalog = FALSE;
+
+            PRINTLN(L"-- Discovered '%s'.", FileInfo->FileName);
+
+            ++HandleCount;
         }
 
         ZeroMem(FileInfo, FileInfoSize);
         FileInfoSize = 1 << 12;
     }
 
+Label__DiscoverPayloads__Done:
     DPRINTLN(L"-- All done!");
     PRINTLN(L"");
 
-    *LoadedHandlesCount = HandleCount;
+    *DiscoveredCount = HandleCount;
     FreePool(FileInfo);
 
     if (EFI_ERROR(Status)) return Status;
 
-    /* Return a code based on the amount of discovered handles. */
+    /* Return a code based on the amount of discovered payloads. */
     switch (HandleCount) {
         case 0: return EFI_NO_PAYLOAD_FOUND;
         case 1: return EFI_SINGLE_PAYLOAD_FOUND;
@@ -208,121 +348,301 @@ DiscoverPayloads(IN EFI_HANDLE BaseImageHandle,
 }
 
 
-VOID
+EFI_STATUS
 EFIAPI
-SelectPayload(IN OUT EFI_FILE_PROTOCOL **PayloadFileHandle,
-              OUT UINT64 *PayloadFileStartingPosition,
-              OUT UINT8 *LoadedLoaderHash OPTIONAL)
+OpenDiscoveredPayload(IN CONST DISCOVERED_PAYLOAD *Payload,
+                      OUT EFI_FILE_PROTOCOL **PayloadFileHandle)
 {
     EFI_STATUS Status = EFI_SUCCESS;
-    
-    EFI_FILE_PROTOCOL **PayloadHandles = NULL;
-    UINTN PayloadHandlesCount = 0;
-    EFI_FILE_INFO *CurrentFileHandleInfo = NULL;
-    CHAR16 *CurrentFileNameShadow = NULL;
+    mftah_status_t MftahStatus = MFTAH_SUCCESS;
+    EFI_FILE_PROTOCOL *VolumeHandle = gOperatingPayload.VolumeHandle;
+
+    UINT8 *HeaderBuffer = NULL;
+    UINTN HeaderLength = 0;
+    UINT8 HeaderDigest[SIZE_OF_SHA_256_HASH] = {0};
 
-    EFI_FILE_PROTOCOL *PartialFileMatch = NULL;
+    Status = uefi_call_wrapper(
+        VolumeHandle->Open, 5,
+        VolumeHandle,
+        PayloadFileHandle,
+        (CHAR16 *)Payload->Name,
+        EFI_FILE_MODE_READ,
+        EFI_FILE_READ_ONLY | EFI_FILE_ARCHIVE | EFI_FILE_HIDDEN | EFI_FILE_SYSTEM
+    );
+    if (EFI_ERROR(Status)) {
+        /* A cataloged payload which is gone only means the catalog is out of date. */
+        if (Payload->FromCatalog && EFI_NOT_FOUND == Status) {
+            EFI_WARNINGLN(L"The payload catalog entry for '%s' is stale.", Payload->Name);
+            mCatalogStale = TRUE;
+            Status = EFI_VOLUME_CORRUPTED;
+        }
+
+        *PayloadFileHandle = NULL;
+        return Status;
+    }
+
+    if (Payload->FromCatalog) {
+        DPRINTLN(L"-- Verifying the catalog entry for '%s'.", Payload->Name);
+
+        if (FileSize(PayloadFileHandle) != Payload->Size) {
+            Status = EFI_VOLUME_CORRUPTED;
+            goto Label__OpenDiscoveredPayload__End;
+        }
+
+        HeaderLength = (UINTN)MIN((UINT64)Payload->DigestLength, Payload->Size - Payload->Offset);
+        HeaderBuffer = (UINT8 *)AllocatePool(HeaderLength);
+        if (NULL == HeaderBuffer) {
+            Status = EFI_OUT_OF_RESOURCES;
+            goto Label__OpenDiscoveredPayload__End;
+        }
+
+        Status = uefi_call_wrapper((*PayloadFileHandle)->SetPosition, 2, *PayloadFileHandle, Payload->Offset);
+        if (EFI_ERROR(Status)) {
+            goto Label__OpenDiscoveredPayload__End;
+        }
+
+        Status = uefi_call_wrapper(
+            (*PayloadFileHandle)->Read, 3,
+            *PayloadFileHandle,
+            &HeaderLength,
+            HeaderBuffer
+        );
+        if (EFI_ERROR(Status)) {
+            goto Label__OpenDiscoveredPayload__End;
+        }
+
+        MftahStatus = MFTAH->create_hash(MFTAH,
+                                       HeaderBuffer,
+                                       HeaderLength,
+                                       HeaderDigest,
+                                       NULL);
+        if (MFTAH_ERROR(MftahStatus) || 0 != CompareMem(HeaderDigest, Payload->HeaderDigest, SIZE_OF_SHA_256_HASH)) {
+            Status = EFI_VOLUME_CORRUPTED;
+            goto Label__OpenDiscoveredPayload__End;
+        }
+    }
+
+    Status = uefi_call_wrapper((*PayloadFileHandle)->SetPosition, 2, *PayloadFileHandle, Payload->Offset);
+
+Label__OpenDiscoveredPayload__End:
+    if (NULL != HeaderBuffer) FreePool(HeaderBuffer);
+
+    if (EFI_VOLUME_CORRUPTED == Status) {
+        EFI_WARNINGLN(L"The payload catalog entry for '%s' is stale.", Payload->Name);
+        mCatalogStale = TRUE;
+    }
+
+    if (EFI_ERROR(Status)) {
+        uefi_call_wrapper((*PayloadFileHandle)->Close, 1, *PayloadFileHandle);
+        *PayloadFileHandle = NULL;
+    }
+
+    return Status;
+}
+
+
+/**
+ * Resolve one typed, upper-cased name against the discovered payloads: an exact
+ *  match wins, otherwise a single partial match is used.
+ *
+ * @returns The index of the matching payload, or 'PayloadsCount' if none matched uniquely.
+ */
+STATIC
+UINTN
+EFIAPI
+MatchPayloadName(IN CONST CHAR16 *TypedName,
+                 IN CONST DISCOVERED_PAYLOAD *Payloads,
+                 IN UINTN PayloadsCount)
+{
+    CHAR16 CurrentFileName[MFTAH_MAX_FILENAME_LENGTH + 1] = {0};
+    UINTN TypedLength = StrLen(TypedName);
+
+    UINTN PartialFileMatch = PayloadsCount;
     UINTN PartialMatchesCount = 0;
 
-    UINT8 SelectedPayloadName[MFTAH_MAX_FILENAME_LENGTH+1] = {0};
-    UINTN SelectedPayloadNameLength = 0;
-    BOOLEAN IsValidSelection = FALSE;
+    /* Names are already in memory, so matching never touches the disk. */
+    for (UINTN i = 0; i < PayloadsCount; ++i) {
+        StrCpy(CurrentFileName, Payloads[i].Name);
+        StrUpr(CurrentFileName);
+
+        DPRINTLN(L"Selected '%s' vs Check '%s'", TypedName, CurrentFileName);
+
+        /* First, check the whole filename. */
+        if (0 == StrCmp(TypedName, CurrentFileName)) {
+            PRINTLN(L"++++ Selected payload '%s'...", Payloads[i].Name);
+            return i;
+        }
+
+        /* If it's not a full match, but it is partial, point to it and add to the partials counter. */
+        if (0 == StrnCmp(TypedName, CurrentFileName, TypedLength)) {
+            PartialFileMatch = i;
+            PartialMatchesCount++;
+
+            if (1 == PartialMatchesCount) {
+                PRINTLN(L"    Found a partial match with '%s'.", Payloads[i].Name);
+            } else if (2 == PartialMatchesCount) {
+                PRINTLN(L"    Found another partial match with '%s'. Failed to determine which one to load.", Payloads[i].Name);
+            }
+        }
+    }
+
+    /* If and only if a SINGLE partial match was found, use it. */
+    if (1 == PartialMatchesCount) {
+        PRINTLN(L"++++ Selected payload '%s'...", Payloads[PartialFileMatch].Name);
+        return PartialFileMatch;
+    } else if (0 == PartialMatchesCount) {
+        PRINTLN(L"    The payload name '%s' was not found.", TypedName);
+    }
+
+    return PayloadsCount;
+}
+
 
+/**
+ * Resolve a comma-separated selection line into payload indices.
+ *
+ * @returns How many payloads were selected; 0 if any name in the line was invalid.
+ */
+STATIC
+UINTN
+EFIAPI
+ParsePayloadSelection(IN CONST CHAR16 *Selection,
+                      IN CONST DISCOVERED_PAYLOAD *Payloads,
+                      IN UINTN PayloadsCount,
+                      OUT UINTN *SelectedIndices)
+{
+    CHAR16 TypedName[MFTAH_MAX_FILENAME_LENGTH + 1] = {0};
+    CONST CHAR16 *Cursor = Selection, *Name;
+    UINTN SelectedCount = 0, Length, Index;
+
+    while (L'\0' != *Cursor) {
+        /* Each name runs up to the next comma. */
+        Name = Cursor;
+        for (Length = 0; L'\0' != Name[Length] && L',' != Name[Length]; ++Length);
+        Cursor = Name + Length + ((L',' == Name[Length]) ? 1 : 0);
+
+        /* Trim the spaces around it. */
+        while (Length > 0 && L' ' == *Name) { ++Name; --Length; }
+        while (Length > 0 && L' ' == Name[Length - 1]) --Length;
+
+        if (0 == Length) continue;
+
+        if (Length > MFTAH_MAX_FILENAME_LENGTH) {
+            PRINTLN(L"    A payload name in the selection is too long.");
+            return 0;
+        }
+
+        ZeroMem(TypedName, sizeof(TypedName));
+        CopyMem(TypedName, (VOID *)Name, Length * sizeof(CHAR16));
+
+        Index = MatchPayloadName(TypedName, Payloads, PayloadsCount);
+        if (Index >= PayloadsCount) {
+            return 0;
+        }
+
+        for (UINTN i = 0; i < SelectedCount; ++i) {
+            if (SelectedIndices[i] == Index) {
+                PRINTLN(L"    The payload '%s' was selected more than once.", Payloads[Index].Name);
+                return 0;
+            }
+        }
+
+        if (SelectedCount >= MFTAH_MAX_SELECTED_PAYLOADS) {
+            PRINTLN(L"    At most %u payloads can be loaded at once.", MFTAH_MAX_SELECTED_PAYLOADS);
+            return 0;
+        }
+
+        SelectedIndices[SelectedCount++] = Index;
+    }
+
+    return SelectedCount;
+}
+
+
+VOID
+EFIAPI
+SelectPayloads(OUT EFI_FILE_PROTOCOL **PayloadFileHandles,
+               OUT CHAR16 **PayloadNames,
+               OUT UINTN *SelectedCount,
+               OUT UINT8 *LoadedLoaderHash OPTIONAL)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    
+    DISCOVERED_PAYLOAD *Payloads = NULL;
+    UINTN PayloadsCount = 0;
+    UINTN SelectedIndices[MFTAH_MAX_SELECTED_PAYLOADS] = {0};
+    UINTN NameLength = 0;
+    UINTN Rediscoveries = 0;
+#if MFTAH_FIRMWARE_BENCHMARK == 1
+    EFI_INPUT_KEY PendingKey = {0};
+#endif
+
+    CHAR16 Selection[MFTAH_MAX_SELECTION_LENGTH + 1] = {0};
+    UINT8 SelectionLength = 0;
+
+Label__SelectPayloads__Discover:
+    *SelectedCount = 0;
+
+    ProfilerBegin(ProfilePhaseDiscoverPayloads);
     Status = DiscoverPayloads(gImageHandle,
-                              &PayloadHandles,
-                              &PayloadHandlesCount,
+                              &Payloads,
+                              &PayloadsCount,
                               LoadedLoaderHash);
+    ProfilerEnd(ProfilePhaseDiscoverPayloads, 0);
+
+#if MFTAH_FIRMWARE_BENCHMARK == 1
+    /* A single payload is loaded without a prompt to type the benchmark entry into. A key
+        pressed while booting shows the prompt anyway. This never waits for one. */
+    if (EFI_SINGLE_PAYLOAD_FOUND == Status
+        && EFI_SUCCESS == uefi_call_wrapper(ST->ConIn->ReadKeyStroke, 2, ST->ConIn, &PendingKey)
+    ) {
+        Status = EFI_MULTI_PAYLOAD_FOUND;
+    }
+#endif
+
     switch (Status) {
         case EFI_NO_PAYLOAD_FOUND:
             PANIC(L"No compatible MFTAH payload was found on the boot filesystem/partition.");
         case EFI_MULTI_PAYLOAD_FOUND:
-            PRINTLN(L"\r\nMultiple payloads were discovered. Choose one to load by typing its name.");
-            PRINTLN(L"   You can also type the first few unique characters of a payload to select it.\r\n");
+            if (PayloadsCount > 1) {
+                PRINTLN(L"\r\nMultiple payloads were discovered. Choose one to load by typing its name.");
+            } else {
+                PRINTLN(L"\r\nOne payload was discovered. Load it by typing its name.");
+            }
+            PRINTLN(L"   You can also type the first few unique characters of a payload to select it.");
+            PRINTLN(L"   Separate names with commas to load up to %u payloads with one password.\r\n", MFTAH_MAX_SELECTED_PAYLOADS);
             
-            while (!IsValidSelection) {
-                /* Reset between selections. */
-                PartialFileMatch = NULL;
-                PartialMatchesCount = 0;
-
+            while (0 == *SelectedCount) {
                 Status = ReadChar16KeyboardInput(L"Which payload? ('q' to quit and reboot): ",
-                                                 SelectedPayloadName,
-                                                 &SelectedPayloadNameLength,
+                                                 Selection,
+                                                 &SelectionLength,
                                                  FALSE,
-                                                 MFTAH_MAX_FILENAME_LENGTH);
+                                                 MFTAH_MAX_SELECTION_LENGTH);
                 if (EFI_ERROR(Status)) {
                     PANIC(L"There was a problem parsing which payload file was selected.");
                 }
-                if (0 == SelectedPayloadNameLength) {
+                if (0 == SelectionLength) {
                     continue;
                 }
 
-                if (0 == StrnCmp(SelectedPayloadName, L"q\0", 2 * sizeof(CHAR16))) {
+                if (0 == StrnCmp(Selection, L"q\0", 2 * sizeof(CHAR16))) {
                     Shutdown(EFI_SUCCESS);
                 }
 
-                /* Convert the selected payload's name to uppercase for case-insensitive comparisons. */
-                StrUpr(SelectedPayloadName);
-                
-                for (UINTN i = 0; i < PayloadHandlesCount; ++i) {
-                    CurrentFileHandleInfo = LibFileInfo(PayloadHandles[i]);
-                    if (NULL == CurrentFileHandleInfo) {
-                        PRINTLN(L"\r\nSystem appears to be out of resources. This means your selection might not work.");
-                        continue;
-                    }
-
-                    /* Preserve the original filename. */
-                    CurrentFileNameShadow = StrDuplicate(CurrentFileHandleInfo->FileName);
-
-                    /* Convert the target filename to uppercase for case-insensitive comparisons. */
-                    StrUpr(CurrentFileHandleInfo->FileName);
-
-                    DPRINTLN(L"Selected '%s' vs Check '%s'", SelectedPayloadName, CurrentFileHandleInfo->FileName);
-                    
-                    /* First, check the whole filename. */
-                    if (0 != StrnCmp(SelectedPayloadName, CurrentFileHandleInfo->FileName, MFTAH_MAX_FILENAME_LENGTH)) {
-                        /* If it's not a full match, but it is partial, point to it and add to the partials counter. */
-                        if (0 == StrnCmp(SelectedPayloadName, CurrentFileHandleInfo->FileName, SelectedPayloadNameLength)) {
-                            PartialFileMatch = PayloadHandles[i];
-                            PartialMatchesCount++;
-
-                            if (1 == PartialMatchesCount) {
-                                PRINTLN(L"    Found a partial match with '%s'.\r\n", CurrentFileNameShadow);
-                                gOperatingPayload.Name = StrDuplicate(CurrentFileHandleInfo->FileName);
-                            } else if (2 == PartialMatchesCount) {
-                                PRINTLN(L"    Found another partial match with '%s'. Failed to determine which one to load.\r\n", CurrentFileNameShadow);
-                                
-                                FreePool(gOperatingPayload.Name);
-                                gOperatingPayload.Name = NULL;
-
-                                FreePool(CurrentFileHandleInfo);
-                                FreePool(CurrentFileNameShadow);
-                                break;
-                            }
-                        }
-
-                        FreePool(CurrentFileHandleInfo);
-                        FreePool(CurrentFileNameShadow);
-                        continue;
-                    }
-                    
-                    IsValidSelection = TRUE;
-                    *PayloadFileHandle = PayloadHandles[i];
-
-                    PRINTLN(L"++++ Selected payload '%s'...\r\n", CurrentFileNameShadow);
-
-                    FreePool(CurrentFileHandleInfo);
-                    FreePool(CurrentFileNameShadow);
-                    break;
-                }
+                /* Convert the selection to uppercase for case-insensitive comparisons. */
+                StrUpr(Selection);
 
-                /* If and only if a SINGLE partial match was found, use it. */
-                if (1 == PartialMatchesCount && NULL != PartialFileMatch) {
-                    *PayloadFileHandle = PartialFileMatch;
-                    IsValidSelection = TRUE;
+#if MFTAH_FIRMWARE_BENCHMARK == 1
+                /* A hidden entry: measure the machine, then ask again. */
+                if (0 == StrCmp(Selection, MFTAH_FIRMWARE_BENCHMARK_ENTRY)) {
+                    RunFirmwareBenchmark();
+                    continue;
                 }
+#endif
 
-                if (!IsValidSelection) {
-                    PRINTLN(L"    The selected payload name was not found. Try again.\r\n");
+                *SelectedCount = ParsePayloadSelection(Selection, Payloads, PayloadsCount, SelectedIndices);
+                if (0 == *SelectedCount) {
+                    PRINTLN(L"    The selection is not valid. Try again.\r\n");
                 } else {
                     PRINTLN(L"");
                 }
@@ -333,12 +653,9 @@ SelectPayload(IN OUT EFI_FILE_PROTOCOL **PayloadFileHandle,
         case EFI_SINGLE_PAYLOAD_FOUND:
             DPRINTLN(L"Got a single payload option. Easy choice.");
 
-            CurrentFileHandleInfo = LibFileInfo(PayloadHandles[0]);
-            gOperatingPayload.Name = StrDuplicate(CurrentFileHandleInfo->FileName);
-            FreePool(CurrentFileHandleInfo);
-
-            *PayloadFileHandle = PayloadHandles[0];
-            PRINTLN(L"Loading payload '%s'...", gOperatingPayload.Name);
+            SelectedIndices[0] = 0;
+            *SelectedCount = 1;
+            PRINTLN(L"Loading payload '%s'...", Payloads[0].Name);
 
             gOperatingPayload.FromMultiSelect = FALSE;
             break;
@@ -346,14 +663,46 @@ SelectPayload(IN OUT EFI_FILE_PROTOCOL **PayloadFileHandle,
             PANIC(L"Failure while gathering a list of MFTAH payloads!");
     }
 
-    Status = uefi_call_wrapper(
-        (*PayloadFileHandle)->GetPosition, 2,
-        (*PayloadFileHandle),
-        PayloadFileStartingPosition
-    );
-    if (EFI_ERROR(Status)) {
-        PANIC(L"Could not get payload handle position.");
+    for (UINTN i = 0; i < *SelectedCount; ++i) {
+        Status = OpenDiscoveredPayload(&Payloads[SelectedIndices[i]], &PayloadFileHandles[i]);
+        if (EFI_VOLUME_CORRUPTED == Status && Rediscoveries++ < MFTAH_CATALOG_MAX_REDISCOVERIES) {
+            /* The catalog is out of date: rescan the volume and choose again. */
+            while (i > 0) {
+                --i;
+                uefi_call_wrapper(PayloadFileHandles[i]->Close, 1, PayloadFileHandles[i]);
+                PayloadFileHandles[i] = NULL;
+
+                FreePool(PayloadNames[i]);
+                PayloadNames[i] = NULL;
+            }
+
+            NameLength = 0;
+
+            FreePool(Payloads);
+            Payloads = NULL;
+
+            LoadedLoaderHash = NULL;
+            goto Label__SelectPayloads__Discover;
+        } else if (EFI_ERROR(Status)) {
+            PANIC(L"Could not open the selected payload.");
+        }
+
+        PayloadNames[i] = StrDuplicate(Payloads[SelectedIndices[i]].Name);
+        NameLength += StrLen(PayloadNames[i]) + 2;
+    }
+
+    /* The password prompt names the whole selection. */
+    gOperatingPayload.Name = (CHAR16 *)AllocateZeroPool((NameLength + 1) * sizeof(CHAR16));
+    if (NULL == gOperatingPayload.Name) {
+        PANIC(L"Could not allocate the selected payload names.");
     }
 
+    for (UINTN i = 0; i < *SelectedCount; ++i) {
+        if (i > 0) StrCat(gOperatingPayload.Name, L", ");
+        StrCat(gOperatingPayload.Name, PayloadNames[i]);
+    }
+
+    FreePool(Payloads);
+
     PRINTLN(L"");
 }
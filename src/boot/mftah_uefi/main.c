@@ -2,14 +2,31 @@
 
 #include "core/util.h"
 #include "core/loader.h"
+#include "core/batch.h"
 #include "core/input.h"
 #include "core/wrappers.h"
+#include "core/memory.h"
+#include "core/arena.h"
+#include "core/profiler.h"
+#include "core/multiboot.h"
+#include "core/handoff.h"
+#include "core/hotprofile.h"
+#include "core/warmcache.h"
+#include "core/bootinfo.h"
+#include "core/progress.h"
+#include "core/kdf.h"
+#include "core/aead.h"
 
 #include "drivers/graphics.h"
 #include "drivers/ramdisk.h"
 #include "drivers/threading.h"
 
 
+#if RAM_DISK_COMPRESS == 1 && (MFTAH_EARLY_HANDOFF == 1 || MFTAH_WARM_CACHE == 1)
+    #error "Compressed ramdisks release the loaded image; it can't be used with MFTAH_EARLY_HANDOFF or MFTAH_WARM_CACHE."
+#endif
+
+
 /* "Fixup" for GNU-EFI's print.c compilation module. idk */
 extern UINTN _fltused = 0;
 
@@ -25,6 +42,9 @@ mftah_protocol_t *MFTAH;
 
 MFTAH_THREAD VOLATILE Threads[MFTAH_MAX_THREAD_COUNT];
 
+/* Whether the typed password went through the volume's KDF. Authenticated payloads need that. */
+STATIC BOOLEAN mPasswordDerived = FALSE;
+
 
 
 STATIC VOID EFIAPI EnvironmentInitialize();
@@ -42,21 +62,18 @@ STATIC EFI_STATUS EFIAPI CheckPassword(
     OUT UINT8 *PasswordLengthActual
 );
 
-STATIC EFI_STATUS EFIAPI LoadAndDecrypt(
-    IN EFI_FILE_PROTOCOL *PayloadFileHandle,
-    IN CONST UINT8 *Password,
-    IN CONST UINT8 PasswordLength,
-    OUT UINT8 *LoadedPayloadHash
-);
-
+#if MFTAH_LEGACY_EFI_HINTS == 1
 STATIC EFI_STATUS EFIAPI SetEfiVarsHints(
-    IN UINT8 **RamdiskMemoryLocation,
-    IN UINT64 *RamdiskLength,
-    IN UINT8 *LoadedLoaderHash,
-    IN UINT8 *LoadedPayloadHash
+    IN BATCH_PAYLOAD *Payloads,
+    IN UINTN PayloadCount,
+    IN UINT8 *LoadedLoaderHash
 );
+#endif
 
-STATIC EFI_STATUS EFIAPI WrapperRegisterRamdisk();
+STATIC EFI_STATUS EFIAPI WrapperRegisterRamdisk(
+    IN UINT8 *RamdiskImage,
+    IN UINT64 RamdiskLength
+);
 STATIC EFI_STATUS EFIAPI JumpToRamdisk();
 
 
@@ -75,21 +92,27 @@ efi_main(EFI_HANDLE ImageHandle,
     UINT8 PasswordLengthActual = 0;
 
     UINT8 LoadedLoaderHash[SIZE_OF_SHA_256_HASH] = {0};
-    UINT8 LoadedPayloadHash[SIZE_OF_SHA_256_HASH] = {0};
 
-    UINT64 PayloadFileStartingPosition = 0;
-    EFI_FILE_PROTOCOL *PayloadFileHandle = NULL;
+    EFI_FILE_PROTOCOL *PayloadFileHandles[MFTAH_MAX_SELECTED_PAYLOADS] = {0};
+    CHAR16 *PayloadNames[MFTAH_MAX_SELECTED_PAYLOADS] = {0};
+    UINTN PayloadCount = 0;
+    BATCH_PAYLOAD Payloads[MFTAH_MAX_SELECTED_PAYLOADS] = {0};
 
     /* Initialize the loader. */
     InitializeLib(ImageHandle, SystemTable);
     gImageHandle = ImageHandle;
 
+    /* Start timing the boot as early as possible. */
+    ProfilerInitialize();
+
     /* Disable the UEFI watchdog timer. The code '0x1FFFF' is a dummy
         value and doesn't actually do anything. Not a magic number. */
     ERRCHECK_UEFI(BS->SetWatchdogTimer, 4, 0, 0x1FFFF, 0, NULL);
 
     /* Load all necessary application drivers. */
+    ProfilerBegin(ProfilePhaseEnvironment);
     EnvironmentInitialize();
+    ProfilerEnd(ProfilePhaseEnvironment, 0);
 
     PRINTLN(L"Welcome to the MFTAH loader!");
     PRINTLN(L"    Select your payload image to decrypt to get started.\r\n");
@@ -98,18 +121,26 @@ Label__PayloadSelectionMenu:
     FreePool(gOperatingPayload.Name);
     gOperatingPayload.Name = NULL;
 
-    /* Detect available MFTAH payloads and select a file handle to open. */
-    SelectPayload(&PayloadFileHandle,
-                  &PayloadFileStartingPosition,
-                  LoadedLoaderHash);
+    /* Detect available MFTAH payloads and select the file handles to open. */
+    SelectPayloads(PayloadFileHandles,
+                   PayloadNames,
+                   &PayloadCount,
+                   LoadedLoaderHash);
 
     /* Unlock/Decrypt the selected payload and load it into memory. */
     do {
+        ProfilerBegin(ProfilePhasePasswordEntry);
         Status = GetPassword(Password, &PasswordLength);
+        ProfilerEnd(ProfilePhasePasswordEntry, 0);
 
         if (EFI_MENU_GO_BACK == Status) {
-            PayloadFileStartingPosition = 0;
-            PayloadFileHandle = NULL;
+            for (UINTN i = 0; i < PayloadCount; ++i) {
+                uefi_call_wrapper(PayloadFileHandles[i]->Close, 1, PayloadFileHandles[i]);
+                PayloadFileHandles[i] = NULL;
+
+                FreePool(PayloadNames[i]);
+                PayloadNames[i] = NULL;
+            }
 
             DPRINTLN(L"Requested to return to payload selection.");
             goto Label__PayloadSelectionMenu;
@@ -117,12 +148,26 @@ Label__PayloadSelectionMenu:
             PANIC(L"Something went wrong while getting the password.");
         }
 
-        /* Check the password against the payload blob. */
-        Status = CheckPassword(PayloadFileHandle,
-                               Password,
-                               PasswordLength,
-                               PasswordActual,
-                               &PasswordLengthActual);
+#if MFTAH_PASSWORD_KDF == 1
+        /* With KDF parameters on the volume, the payloads were encrypted with the derived password. */
+        Status = KdfDerivePassword(gOperatingPayload.VolumeHandle, Password, &PasswordLength);
+        if (EFI_ERROR(Status) && EFI_NOT_FOUND != Status) {
+            PANIC(L"Could not derive the payload password.");
+        }
+        mPasswordDerived = !EFI_ERROR(Status);
+#endif
+
+        /* Check the password against every selected payload blob. They all share it. */
+        ProfilerBegin(ProfilePhaseCheckPassword);
+        for (UINTN i = 0; i < PayloadCount; ++i) {
+            Status = CheckPassword(PayloadFileHandles[i],
+                                   Password,
+                                   PasswordLength,
+                                   PasswordActual,
+                                   &PasswordLengthActual);
+            if (EFI_ERROR(Status)) break;
+        }
+        ProfilerEnd(ProfilePhaseCheckPassword, 0);
         if (EFI_INVALID_PASSWORD == Status) {
             EFI_WARNINGLN(L"-- Invalid password. Try again.");
             continue;
@@ -130,13 +175,40 @@ Label__PayloadSelectionMenu:
             PANIC(L"Some other error occurred when loading the chosen payload.");
         }
 
-        /* Since the password is confirmed, attempt to load and decrypt the ramdisk. */
-        Status = LoadAndDecrypt(PayloadFileHandle,
-                                PasswordActual,
-                                PasswordLengthActual,
-                                LoadedPayloadHash);
-        if (EFI_ERROR(Status) || NULL == gRamdiskImage || 0 == gRamdiskImageLength) {
-            PANIC(L"Failed to load the chosen payload.");
+        /* Since the password is confirmed, attempt to load and decrypt the ramdisks. */
+        for (UINTN i = 0; i < PayloadCount; ++i) {
+            Payloads[i].Name = PayloadNames[i];
+            Payloads[i].FileHandle = PayloadFileHandles[i];
+        }
+
+        Status = EFI_NOT_FOUND;
+#if MFTAH_WARM_CACHE == 1
+        /* Only a single selected payload is ever kept across a warm reset. */
+        if (1 == PayloadCount) {
+            Status = WarmCacheRestore(&(Payloads[0]), PasswordActual, PasswordLengthActual);
+        }
+#endif
+
+        if (EFI_ERROR(Status)) {
+            Status = LoadAndDecryptBatch(Payloads,
+                                         PayloadCount,
+                                         PasswordActual,
+                                         PasswordLengthActual);
+            if (EFI_ERROR(Status)) {
+                PANIC(L"Failed to load the chosen payloads.");
+            }
+
+#if MFTAH_WARM_CACHE == 1
+            if (1 == PayloadCount && EFI_ERROR(WarmCacheStore(&(Payloads[0]), PasswordActual, PasswordLengthActual))) {
+                EFI_WARNINGLN(L"The decrypted ramdisk could not be kept for the next warm boot.");
+            }
+#endif
+        }
+
+        for (UINTN i = 0; i < PayloadCount; ++i) {
+            if (NULL == Payloads[i].RamdiskImage || 0 == Payloads[i].RamdiskLength) {
+                PANIC(L"Failed to load the chosen payloads.");
+            }
         }
 
         /* Clear the password out of system memory and jump out of the loop. */
@@ -151,24 +223,72 @@ Label__PayloadSelectionMenu:
 
     DPRINT(L"\r\n\r\n");
 
-    /* Hint to the loaded OS where the boot ramdisk is in physical memory and its size. */
-    Status = SetEfiVarsHints(&gRamdiskImage,
-                             &gRamdiskImageLength,
-                             NULL,
-                             NULL);
+    /* The first selected payload is the one booted from. */
+    gRamdiskImage = Payloads[0].RamdiskImage;
+    gRamdiskImageLength = Payloads[0].RamdiskLength;
+
+#if MFTAH_LEGACY_EFI_HINTS == 1
+    /* Hint to the loaded OS where the boot ramdisks are in physical memory and their sizes. */
+    Status = SetEfiVarsHints(Payloads,
+                             PayloadCount,
+                             LoadedLoaderHash);
 #if MFTAH_ENSURE_HINTS == 1
     if (EFI_ERROR(Status)) {
         PANIC(L"Could not set related EFI variables as hints about the loaded ramdisk.");
     }
+#endif
+#endif
+
+#if MFTAH_EARLY_HANDOFF == 1
+    /* The booted ramdisk is only partially decrypted now; without this record it's unusable. */
+    Status = HandoffPublish(gRamdiskImage, gRamdiskImageLength);
+    if (EFI_ERROR(Status)) {
+        PANIC(L"Could not hand the rest of the payload decryption to the kernel.");
+    }
+
+#if MFTAH_HOT_PROFILE == 1
+    if (EFI_ERROR(HotProfileStartRecording(gRamdiskImage, gRamdiskImageLength))) {
+        EFI_WARNINGLN(L"Could not record the ramdisk accesses of this boot.");
+    }
+#endif
 #endif
 
-    /* Register the ramdisk device. */
-    Status = WrapperRegisterRamdisk();
+    /* Describe the ramdisks and everything else left behind for the OS in one table. */
+    Status = BootInfoPublish(Payloads,
+                             PayloadCount,
+                             LoadedLoaderHash);
+#if MFTAH_ENSURE_HINTS == 1
     if (EFI_ERROR(Status)) {
-        PANIC(L"Failed to register the loaded ramdisk as a filesystem.");
+        PANIC(L"Could not publish the boot information table.");
+    }
+#endif
+
+#if MFTAH_MULTIBOOT_DIRECT == 1
+    /* Try handing the ramdisk's kernel control directly. This only returns on failure,
+        and only starts timing the chainload phase once it's sure to boot the kernel. */
+    Status = MultibootBootRamdisk(gRamdiskImage, gRamdiskImageLength);
+    EFI_WARNINGLN(L"Direct kernel boot failed (%r). Falling back to chainloading.", Status);
+#endif
+
+    /* Register each ramdisk as its own device. */
+    for (UINTN i = 0; i < PayloadCount; ++i) {
+        ProfilerBegin(ProfilePhaseRegisterRamdisk);
+        Status = WrapperRegisterRamdisk(Payloads[i].RamdiskImage, Payloads[i].RamdiskLength);
+        ProfilerEnd(ProfilePhaseRegisterRamdisk, Payloads[i].RamdiskLength);
+        if (EFI_ERROR(Status)) {
+            PANIC(L"Failed to register the loaded ramdisk as a filesystem.");
+        }
+    }
+
+    /* Ramdisks living in a compressed or deduplicating store no longer need their loaded images. */
+    for (UINTN i = 0; i < PayloadCount; ++i) {
+        if (RAM_DISK_RELEASES_IMAGE(i)) {
+            BatchFreePayloadBuffer(&(Payloads[i]));
+        }
     }
 
     /* Transfer bootloader control to it. */
+    ProfilerBegin(ProfilePhaseChainload);
     Status = JumpToRamdisk();
     if (EFI_ERROR(Status)) {
         PANIC(L"Failed to transfer control to the loaded ramdisk.");
@@ -206,12 +326,21 @@ EnvironmentInitialize()
     EFI_STATUS Status = EFI_SUCCESS;
     mftah_status_t MftahStatus = MFTAH_SUCCESS;
 
+    /* Pick the fastest memory primitives before anything big gets moved around. */
+    MemoryInitialize();
+
     /* Initial graphics setup. */
     Status = EntryGraphics();
     if (EFI_ERROR(Status)) {
         PANIC(L"Failed to initialize the graphics driver!");
     }
 
+    /* Progress is drawn from a timer event; without one, only final states are shown. */
+    Status = ProgressInitialize();
+    if (EFI_ERROR(Status)) {
+        EFI_WARNINGLN(L"Cannot start the progress renderer.");
+    }
+
     /* Initialize drivers. */
     Status = AcpiLoadDriver();
     if (EFI_ERROR(Status) || NULL == gAcpiTableProtocol) {
@@ -223,9 +352,20 @@ EnvironmentInitialize()
         PANIC(L"Failed to load the RamDisk driver!");
     }
 
-    // Status = InitializeThreading();
+#if MFTAH_THREADING == 1
+    Status = InitializeThreading();
     if (EFI_ERROR(Status)) {
         EFI_WARNINGLN(L"Cannot initialize multiprocessing.\r\nOperations may take significantly longer to complete.");
+    } else {
+        DPRINTLN(L"-- Multiprocessing enabled with %u application processor(s).", GetThreadLimit());
+    }
+#endif
+
+    /* Library allocations come from the loader arena. It grows on demand, but only on the BSP:
+        the slab reserved here is all that library code running on APs can allocate from. */
+    Status = ArenaCreate(&gLoaderArena, MFTAH_ARENA_SLAB_SIZE);
+    if (EFI_ERROR(Status)) {
+        EFI_WARNINGLN(L"Cannot reserve the loader arena.");
     }
 
     DPRINTLN(L"Loading and registering a new MFTAH protocol instance.");
@@ -331,7 +471,13 @@ CheckPassword(IN EFI_FILE_PROTOCOL *PayloadFileHandle,
     UINT8 PassLenChar8 = 0;
 
     DPRINTLN(L"MFTAH header size: %u", mftah_payload_header__sizeof());
-    CONST UINT64 InitialReadLength = mftah_payload_header__sizeof() + AES_BLOCKLEN;
+    CONST UINT64 MftahCheckLength = mftah_payload_header__sizeof() + AES_BLOCKLEN;
+#if MFTAH_AEAD_PAYLOADS == 1
+    /* An authenticated payload's header may be longer than what MFTAH needs. */
+    CONST UINT64 InitialReadLength = MAX(MftahCheckLength, sizeof(MFTAH_AEAD_HEADER));
+#else
+    CONST UINT64 InitialReadLength = MftahCheckLength;
+#endif
     UINTN InitialReadLengthShadow = InitialReadLength;
 
     UINT64 ReadFileSize = 0;
@@ -385,6 +531,40 @@ CheckPassword(IN EFI_FILE_PROTOCOL *PayloadFileHandle,
         goto Label__CheckPassword__End;
     }
 
+    DPRINTLN(L"---- Creating CHAR8 password buffer.");
+    PassLenChar8 = PassLen / sizeof(CHAR16);
+    PasswordBufferChar8 = (CHAR8 *)AllocateZeroPool(PassLenChar8 + 1);
+    for (UINTN i = 0; i < PassLenChar8; ++i) {
+        PasswordBufferChar8[i] = (CHAR8)PasswordBuffer[i * sizeof(CHAR16)];
+    }
+
+#if MFTAH_AEAD_PAYLOADS == 1
+    /* Authenticated payloads are checked against their own header instead of by MFTAH. */
+    if (AeadIsPayload(DataBuffer, InitialReadLength)) {
+        /* Its key is a single HMAC of the password, so only a stretched password may unlock it. */
+        if (!mPasswordDerived) {
+            EFI_WARNINGLN(L"Authenticated payloads need the password KDF parameters ('%s') on the boot volume.",
+                          PasswordKdfFileName);
+            Status = EFI_SECURITY_VIOLATION;
+            goto Label__CheckPassword__End;
+        }
+
+        DPRINTLN(L"-- Checking the password against an authenticated payload header.");
+        Status = AeadCheckPassword((MFTAH_AEAD_HEADER *)DataBuffer,
+                                   ReadFileSize,
+                                   (UINT8 *)PasswordBufferChar8,
+                                   PassLenChar8);
+        if (!EFI_ERROR(Status)) {
+            PRINTLN(L"Payload decrypted.");
+
+            CopyMem(PasswordActual, PasswordBufferChar8, PassLenChar8);
+            *PasswordLengthActual = PassLenChar8;
+        }
+
+        goto Label__CheckPassword__End;
+    }
+#endif
+
     /* Now that the data is loaded into the buffer, create the payload object. */
     DPRINTLN(L"-- Creating a minimal MFTAH payload of %u bytes.", mftah_payload__sizeof());
     LoadedPayload = (mftah_payload_t *)AllocateZeroPool(mftah_payload__sizeof());
@@ -392,7 +572,7 @@ CheckPassword(IN EFI_FILE_PROTOCOL *PayloadFileHandle,
     DPRINTLN(L"-- Invoking MFTAH 'create_payload' method.");
     MftahStatus = MFTAH->create_payload(MFTAH,
                                       DataBuffer,
-                                      InitialReadLength,
+                                      MftahCheckLength,
                                       LoadedPayload,
                                       NULL);
     if (MFTAH_ERROR(MftahStatus)) {
@@ -405,13 +585,6 @@ CheckPassword(IN EFI_FILE_PROTOCOL *PayloadFileHandle,
         If it's not, then checks will just return garbage/failures. */
     DPRINTLN(L"-- Checking the password '%s'.", PasswordBuffer);
 
-    DPRINTLN(L"---- Creating CHAR8 password buffer.");
-    PassLenChar8 = PassLen / sizeof(CHAR16);
-    PasswordBufferChar8 = (CHAR8 *)AllocateZeroPool(PassLenChar8 + 1);
-    for (UINTN i = 0; i < PassLenChar8; ++i) {
-        PasswordBufferChar8[i] = (CHAR8)PasswordBuffer[i * sizeof(CHAR16)];
-    }
-
     MftahStatus = MFTAH->check_password(MFTAH,
                                       LoadedPayload,
                                       PasswordBufferChar8,
@@ -444,239 +617,117 @@ Label__CheckPassword__End:
 }
 
 
-static
-EFI_STATUS
-EFIAPI
-LoadAndDecrypt(IN EFI_FILE_PROTOCOL *PayloadFileHandle,
-               IN CONST UINT8 *Password,
-               IN CONST UINT8 PasswordLength,
-               OUT UINT8 *LoadedPayloadHash)
-{
-    EFI_STATUS Status = EFI_SUCCESS;
-    mftah_status_t MftahStatus = MFTAH_SUCCESS;
-
-    UINT64 ReadFileSize = 0;
-    UINT8 *ReadBuffer = NULL;
-    mftah_payload_t *LoadedPayload = NULL;
-    VOID *PayloadBufferBase = NULL;
-
-    /* Read the file's size and do some sanity checks. */
-    DPRINTLN(L"-- Getting payload attributes...");
-    ReadFileSize = FileSize(&PayloadFileHandle);
-    DPRINTLN(L"---- Apparent payload size: %d bytes", ReadFileSize);
-    if (0 != (ReadFileSize % AES_BLOCKLEN)) {
-        EFI_WARNINGLN(L"The MFTAH payload size is not aligned to the AES block size.");
-        return EFI_ABORTED;
-    }
-
-    /* At this point, the file handle and password are valid. Load the whole encrypted ramdisk. */
-    /* NOTE: This segment should be loaded as type 'Runtime Services Data' so the
-        registered ramdisk and GRUB doesn't discard itself after ExitBootServices(). */
-    DPRINTLN(L"-- Allocating buffer of %d bytes.", ReadFileSize);
-    Status = uefi_call_wrapper(
-        BS->AllocatePool,
-        3,
-        EfiReservedMemoryType,
-        ReadFileSize,
-        (VOID **)&ReadBuffer
-    );
-    if (EFI_OUT_OF_RESOURCES == Status) {
-        PANIC(L"Not enough free memory available to allocate the ramdisk.");
-    } else if (NULL == ReadBuffer) {
-        PANIC(L"Ramdisk allocation returned a null pointer.");
-    } else if (EFI_ERROR(Status)) {
-        PANIC(L"An unknown error occurred while allocating the ramdisk.");
-    }
-
-    /* This operation probably doesn't need to be threaded, so it's not.
-        Future optimizations might look into it. */
-    PRINTLN(L"\r\n-- Reading payload into memory at '%p'...", ReadBuffer);
-    DPRINTLN(L"---- Copying payload of size '0x%08llx' bytes into RAM at '%p'...", ReadFileSize, ReadBuffer);
-
-    UINT64 FileChunkSize = MFTAH_RAMDISK_LOAD_BLOCK_SIZE;
-    for (UINT64 i = 0; i < ReadFileSize; i += MFTAH_RAMDISK_LOAD_BLOCK_SIZE) {
-        FileChunkSize = MFTAH_RAMDISK_LOAD_BLOCK_SIZE;
-
-        Status = uefi_call_wrapper(
-            PayloadFileHandle->Read,
-            3,
-            PayloadFileHandle,
-            &FileChunkSize,
-            (ReadBuffer + i)
-        );
-
-        /* Watch for errors reading the file handle. */
-        if (EFI_ERROR(Status)) {
-            FreePool(ReadBuffer);
-            return Status;
-        }
-
-        /* Only print the progress every so often. */
-        if (0 == (i % (1 << 24))) {
-            PrintProgress(&i, &ReadFileSize, NULL);
-        }
-    }
-
-    /* Guarantee this prints out a final 100%. */
-    PrintProgress(&ReadFileSize, &ReadFileSize, NULL);
-    PRINTLN(L"\r\n");
-
-    /* Hash the loaded payload image for later. */
-    PRINTLN(L"\r\n-- Generating a loaded payload hash.");
-    MftahStatus = MFTAH->create_hash(MFTAH,
-                                   ReadBuffer,
-                                   ReadFileSize,
-                                   LoadedPayloadHash,
-                                   NULL);
-    if (MFTAH_ERROR(MftahStatus)) {
-        EFI_WARNINGLN(L"Failed to hash the loaded payload buffer...");
-        EFI_WARNINGLN(L"    The '__MFTAH_PAYLOAD_HASH' EFI variable will not");
-        EFI_WARNINGLN(L"    be available at OS runtime.");
-    }
-
-    /* Create the payload object. */
-    DPRINTLN(L"-- Creating a full-size MFTAH payload object describing %u bytes.", ReadFileSize);
-    LoadedPayload = (mftah_payload_t *)AllocateZeroPool(mftah_payload__sizeof());
-
-    DPRINTLN(L"-- Creating a MFTAH payload.");
-    MftahStatus = MFTAH->create_payload(MFTAH,
-                                      ReadBuffer,
-                                      ReadFileSize,
-                                      LoadedPayload,
-                                      NULL);
-    if (MFTAH_ERROR(MftahStatus)) {
-        EFI_WARNINGLN(L"Loading the MFTAH payload failed with code '%u'.", MftahStatus);
-        FreePool(ReadBuffer);
-        return EFI_ABORTED;
-    }
-
-    /* Decrypt the ramdisk. We assume the created payload is indeed an encrypted MFTAH file here.
-        If it's not, then decryption will just return garbage or invalid responses and that's the
-        user's fault/ordeal. */
-    PRINTLN(L"-- Decrypting the ramdisk...");
-    PRINTLN(L"---- This may take a few minutes.");
-    PRINTLN(L"---- If you booted from external media, you may disconnect it now.");
-    MftahStatus = MFTAH->decrypt(MFTAH,
-                               LoadedPayload,
-                               Password,
-                               PasswordLength,
-                               SpawnDecryptionWorker,
-                               UefiSpin);
-    if (MFTAH_ERROR(MftahStatus)) {
-        EFI_WARNINGLN(L"Decrypting the MFTAH payload failed with code '%u'.", MftahStatus);
-        FreePool(ReadBuffer);
-        return EFI_ABORTED;
-    }
-
-    /* The 'length' field of the header is a certain offset into the base of the decrypted payload. */
-    MftahStatus = MFTAH->get_buffer_base(MFTAH, LoadedPayload, &PayloadBufferBase);
-    if (MFTAH_ERROR(MftahStatus) || NULL == PayloadBufferBase) {
-        EFI_WARNINGLN(L"Getting the payload buffer base failed with code '%u'.", MftahStatus);
-        FreePool(ReadBuffer);
-        return EFI_ABORTED;
-    }
-
-    /* The actual ramdisk starts after the payload header (buffer base). */
-    gRamdiskImage = (UINT8 *)PayloadBufferBase + mftah_payload_header__sizeof();
-    /* The payload length is at a particular offset into the payload header. */
-    gRamdiskImageLength = *((UINT64 *)((UINT8 *)PayloadBufferBase + 96));   /* TODO: No magic numbers pls & ty */
-
-    return EFI_SUCCESS;
-}
-
-
+#if MFTAH_LEGACY_EFI_HINTS == 1
+/**
+ * Store a SHA-256 hash in reserved memory and point an EFI variable at it.
+ */
 STATIC
 EFI_STATUS
 EFIAPI
-SetEfiVarsHints(IN UINT8 **RamdiskMemoryLocation,
-                IN UINT64 *RamdiskLength,
-                IN UINT8 *LoadedLoaderHash,
-                IN UINT8 *LoadedPayloadHash)
+SetEfiVarHashHint(IN CHAR16 *VariableName,
+                  IN UINT8 *Hash)
 {
     EFI_STATUS Status = EFI_SUCCESS;
+    VOID *HashLocationInMemory = NULL;
 
-    PRINTLN(L"-- Setting memory address device hint '__MFTAH_RDBASE'.");
-    ERRCHECK_UEFI(
-        ST->RuntimeServices->SetVariable,
-        5,
-        L"__MFTAH_RDBASE",
-        &gXmitVendorGuid,
-        EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
-        sizeof(VOID *),
-        RamdiskMemoryLocation   /* passing (VOID **) here because we WANT a (VOID *) stored... */
-    );
-
-    PRINTLN(L"-- Setting ramdisk size hint '__MFTAH_RDSIZE'.");
-    ERRCHECK_UEFI(
-        ST->RuntimeServices->SetVariable,
-        5,
-        L"__MFTAH_RDSIZE",
-        &gXmitVendorGuid,
-        EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
-        sizeof(UINT64),
-        RamdiskLength
-    );
-
-    PRINTLN(L"-- Setting MFTAH loader hash '__MFTAH_LOADER_HASH`.");
-
-    VOID *LoaderHashLocationInMemory = NULL;
     ERRCHECK_UEFI(
         BS->AllocatePool,
         3,
         EfiReservedMemoryType,
         SIZE_OF_SHA_256_HASH,
-        &LoaderHashLocationInMemory
+        &HashLocationInMemory
     );
-    if (NULL == LoaderHashLocationInMemory) {
+    if (NULL == HashLocationInMemory) {
         return EFI_OUT_OF_RESOURCES;
     }
 
-    CopyMem(LoaderHashLocationInMemory, LoadedLoaderHash, SIZE_OF_SHA_256_HASH);
+    CopyMem(HashLocationInMemory, Hash, SIZE_OF_SHA_256_HASH);
 
     ERRCHECK_UEFI(
         ST->RuntimeServices->SetVariable,
         5,
-        L"__MFTAH_LOADER_HASH",
+        VariableName,
         &gXmitVendorGuid,
         EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
         sizeof(VOID *),
-        &LoaderHashLocationInMemory
+        &HashLocationInMemory
     );
 
-    PRINTLN(L"-- Setting selected payload hash '__MFTAH_PAYLOAD_HASH`.");
+    return EFI_SUCCESS;
+}
 
-    VOID *PayloadHashLocationInMemory = NULL;
-    ERRCHECK_UEFI(
-        BS->AllocatePool,
-        3,
-        EfiReservedMemoryType,
-        SIZE_OF_SHA_256_HASH,
-        &PayloadHashLocationInMemory
-    );
-    if (NULL == PayloadHashLocationInMemory) {
-        return EFI_OUT_OF_RESOURCES;
-    }
 
-    CopyMem(PayloadHashLocationInMemory, LoadedPayloadHash, SIZE_OF_SHA_256_HASH);
+STATIC
+EFI_STATUS
+EFIAPI
+SetEfiVarsHints(IN BATCH_PAYLOAD *Payloads,
+                IN UINTN PayloadCount,
+                IN UINT8 *LoadedLoaderHash)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    CHAR16 VariableName[32] = {0};
+    UINT32 RamdiskCount = (UINT32)PayloadCount;
+
+    /* The first ramdisk keeps the original variable names. The others are suffixed with their index. */
+    for (UINTN i = 0; i < PayloadCount; ++i) {
+        /* Released loaded images have no base address to hint at. The OS finds those ramdisks
+            through '__MFTAH_RDCOMPRESS' or '__MFTAH_RDDEDUP' instead. */
+        if (!RAM_DISK_RELEASES_IMAGE(i)) {
+            SPrint(VariableName, sizeof(VariableName), (0 == i) ? L"__MFTAH_RDBASE" : L"__MFTAH_RDBASE%u", i);
+            PRINTLN(L"-- Setting memory address device hint '%s'.", VariableName);
+            ERRCHECK_UEFI(
+                ST->RuntimeServices->SetVariable,
+                5,
+                VariableName,
+                &gXmitVendorGuid,
+                EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+                sizeof(VOID *),
+                &(Payloads[i].RamdiskImage)   /* passing (VOID **) here because we WANT a (VOID *) stored... */
+            );
+        }
+
+        SPrint(VariableName, sizeof(VariableName), (0 == i) ? L"__MFTAH_RDSIZE" : L"__MFTAH_RDSIZE%u", i);
+        PRINTLN(L"-- Setting ramdisk size hint '%s'.", VariableName);
+        ERRCHECK_UEFI(
+            ST->RuntimeServices->SetVariable,
+            5,
+            VariableName,
+            &gXmitVendorGuid,
+            EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+            sizeof(UINT64),
+            &(Payloads[i].RamdiskLength)
+        );
+
+        /* For authenticated payloads, this only hashes the header and the tag table. */
+        SPrint(VariableName, sizeof(VariableName), (0 == i) ? L"__MFTAH_PAYLOAD_HASH" : L"__MFTAH_PAYLOAD_HASH%u", i);
+        PRINTLN(L"-- Setting selected payload hash '%s'.", VariableName);
+        ERRCHECK(SetEfiVarHashHint(VariableName, Payloads[i].PayloadHash));
+    }
 
+    PRINTLN(L"-- Setting ramdisk count hint '__MFTAH_RDCOUNT'.");
     ERRCHECK_UEFI(
         ST->RuntimeServices->SetVariable,
         5,
-        L"__MFTAH_PAYLOAD_HASH",
+        L"__MFTAH_RDCOUNT",
         &gXmitVendorGuid,
         EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
-        sizeof(VOID *),
-        &PayloadHashLocationInMemory
+        sizeof(UINT32),
+        &RamdiskCount
     );
 
+    PRINTLN(L"-- Setting MFTAH loader hash '__MFTAH_LOADER_HASH`.");
+    ERRCHECK(SetEfiVarHashHint(L"__MFTAH_LOADER_HASH", LoadedLoaderHash));
+
     return EFI_SUCCESS;
 }
+#endif   /* MFTAH_LEGACY_EFI_HINTS */
 
 
 static
 EFI_STATUS
 EFIAPI
-WrapperRegisterRamdisk()
+WrapperRegisterRamdisk(IN UINT8 *RamdiskImage,
+                       IN UINT64 RamdiskLength)
 {
     EFI_STATUS Status = EFI_SUCCESS;
     EFI_RAM_DISK_PROTOCOL *RamdiskProtocol;
@@ -695,14 +746,14 @@ WrapperRegisterRamdisk()
 
     DPRINTLN(L"-- Using protocol to register.");
     ERRCHECK(
-        RamdiskProtocol->Register((UINT64)gRamdiskImage,
-                                  gRamdiskImageLength,
+        RamdiskProtocol->Register((UINT64)RamdiskImage,
+                                  RamdiskLength,
                                   &gEfiRamdiskVirtualDiskGuid,
                                   NULL,
                                   &RamdiskDevicePath)
     );
 
-    DPRINTLN(L"\r-- Registered ramdisk at '%p' with size '%d'.", gRamdiskImage, gRamdiskImageLength);
+    DPRINTLN(L"\r-- Registered ramdisk at '%p' with size '%d'.", RamdiskImage, RamdiskLength);
     DPRINTLN(L"-- RamDisk Device Path Handle is at '%016x' (proto %016x).", *RamdiskDevicePath, RamdiskProtocol);
 
     CHAR16* DevPathAsStr = DevicePathToStr(RamdiskDevicePath);
@@ -829,6 +880,24 @@ JumpToRamdisk()
             MEMDUMP(loadedImageProtocol, sizeof(EFI_LOADED_IMAGE_PROTOCOL));
             DPRINT(L"\r\n\r\n");
 
+            /* Nothing allocated through the MFTAH hooks or by decryption workers outlives the loader. */
+            ArenaDestroy(&gLoaderArena);
+            ReleaseDecryptionArenas();
+
+#if MFTAH_HOT_PROFILE == 1
+            /* Everything up to here was read by the loader and firmware; the next boot decrypts it first. */
+            if (EFI_ERROR(HotProfileSave(gOperatingPayload.VolumeHandle))) {
+                EFI_WARNINGLN(L"Could not save the hot profile of this boot.");
+            }
+#endif
+
+            /* Leave the phase breakdown behind for the booted OS. */
+            ProfilerEnd(ProfilePhaseChainload, 0);
+            if (EFI_ERROR(ProfilerPublish())) {
+                EFI_WARNINGLN(L"Could not publish the boot profile.");
+            }
+            BootInfoFinalize();
+
             DPRINTLN(L"Booting...");
             ERRCHECK_UEFI(
                 BS->StartImage,
@@ -0,0 +1,570 @@
+#include "core/memory.h"
+
+#include <immintrin.h>
+#include <cpuid.h>
+
+
+
+/* Whether the CPU supports AVX2. The YMM state must still be checked per-core. */
+static BOOLEAN mHasAvx2 = FALSE;
+
+/* Whether the CPU supports Enhanced REP MOVSB/STOSB. */
+static BOOLEAN mHasErms = FALSE;
+
+
+/* CPUID feature bits. */
+#define CPUID_1_ECX_OSXSAVE     (1 << 27)
+#define CPUID_7_EBX_AVX2        (1 << 5)
+#define CPUID_7_EBX_ERMS        (1 << 9)
+
+/* Used for the scalar edges of the bulk primitives. */
+typedef UINT64 __attribute__((aligned(1), may_alias)) UNALIGNED_UINT64;
+typedef UINT32 __attribute__((aligned(1), may_alias)) UNALIGNED_UINT32;
+
+
+#define LOADU128(p)         _mm_loadu_si128((CONST __m128i *)(p))
+#define STOREU128(p, v)     _mm_storeu_si128((__m128i *)(p), (v))
+#define STORE128(p, v)      _mm_store_si128((__m128i *)(p), (v))
+#define STREAM128(p, v)     _mm_stream_si128((__m128i *)(p), (v))
+
+#define LOADU256(p)         _mm256_loadu_si256((CONST __m256i *)(p))
+#define STOREU256(p, v)     _mm256_storeu_si256((__m256i *)(p), (v))
+#define STORE256(p, v)      _mm256_store_si256((__m256i *)(p), (v))
+#define STREAM256(p, v)     _mm256_stream_si256((__m256i *)(p), (v))
+
+
+VOID
+EFIAPI
+MemoryInitialize(VOID)
+{
+    UINT32 Eax = 0, Ebx = 0, Ecx = 0, Edx = 0;
+    UINT32 MaxLeaf;
+
+    MaxLeaf = __get_cpuid_max(0, NULL);
+    if (MaxLeaf < 7) {
+        return;
+    }
+
+    __cpuid_count(7, 0, Eax, Ebx, Ecx, Edx);
+
+    mHasErms = (0 != (Ebx & CPUID_7_EBX_ERMS));
+#if MFTAH_MEMORY_USE_AVX2 == 1
+    mHasAvx2 = (0 != (Ebx & CPUID_7_EBX_AVX2));
+#endif
+
+    __cpuid(1, Eax, Ebx, Ecx, Edx);
+    if (0 == (Ecx & CPUID_1_ECX_OSXSAVE)) {
+        mHasAvx2 = FALSE;
+    }
+
+    DPRINTLN(L"-- Memory primitives: AVX2 (%u), ERMS (%u).", mHasAvx2, mHasErms);
+}
+
+
+BOOLEAN
+EFIAPI
+MemoryAvx2Usable(VOID)
+{
+    UINT64 Cr4;
+    UINT32 Xcr0Low, Xcr0High;
+
+    if (!mHasAvx2) {
+        return FALSE;
+    }
+
+    __asm__ __volatile__ ("mov %%cr4, %0" : "=r"(Cr4));
+    if (0 == (Cr4 & (1ULL << 18))) {
+        return FALSE;
+    }
+
+    __asm__ __volatile__ ("xgetbv" : "=a"(Xcr0Low), "=d"(Xcr0High) : "c"(0));
+    return (0x6 == (Xcr0Low & 0x6));
+}
+
+
+/**
+ * Copy up to 32 bytes. All loads happen before any store, so overlap is fine.
+ */
+static
+inline
+VOID
+MoveSmall(OUT UINT8 *Destination,
+          IN CONST UINT8 *Source,
+          IN UINTN Length)
+{
+    if (Length >= 16) {
+        __m128i Head = LOADU128(Source);
+        __m128i Tail = LOADU128(Source + Length - 16);
+        STOREU128(Destination, Head);
+        STOREU128(Destination + Length - 16, Tail);
+    } else if (Length >= 8) {
+        UINT64 Head = *((UNALIGNED_UINT64 *)Source);
+        UINT64 Tail = *((UNALIGNED_UINT64 *)(Source + Length - 8));
+        *((UNALIGNED_UINT64 *)Destination) = Head;
+        *((UNALIGNED_UINT64 *)(Destination + Length - 8)) = Tail;
+    } else if (Length >= 4) {
+        UINT32 Head = *((UNALIGNED_UINT32 *)Source);
+        UINT32 Tail = *((UNALIGNED_UINT32 *)(Source + Length - 4));
+        *((UNALIGNED_UINT32 *)Destination) = Head;
+        *((UNALIGNED_UINT32 *)(Destination + Length - 4)) = Tail;
+    } else if (Length > 0) {
+        UINT8 First = Source[0];
+        UINT8 Middle = Source[Length / 2];
+        UINT8 Last = Source[Length - 1];
+        Destination[0] = First;
+        Destination[Length / 2] = Middle;
+        Destination[Length - 1] = Last;
+    }
+}
+
+
+/*
+ * The bulk loops below all preload the first and last vector of the source before
+ *  storing anything, then align the destination and run the loop, and finally store
+ *  the preloaded head and tail. A forward loop never reads memory it already wrote
+ *  when Destination < Source, and a backward loop never does when Destination > Source.
+ */
+
+static
+VOID
+MoveForwardSse2(OUT UINT8 *Destination,
+                IN CONST UINT8 *Source,
+                IN UINTN Length,
+                IN BOOLEAN NonTemporal)
+{
+    __m128i Head = LOADU128(Source);
+    __m128i Tail = LOADU128(Source + Length - 16);
+    UINT8 *End = Destination + Length - 16;
+    UINTN Skew = 16 - ((UINTN)Destination & 15);
+    UINT8 *To = Destination + Skew;
+    CONST UINT8 *From = Source + Skew;
+
+    if (NonTemporal) {
+        for (; To < End; To += 16, From += 16) {
+            STREAM128(To, LOADU128(From));
+        }
+        _mm_sfence();
+    } else {
+        for (; (To + 32) <= End; To += 32, From += 32) {
+            __m128i A = LOADU128(From);
+            __m128i B = LOADU128(From + 16);
+            STORE128(To, A);
+            STORE128(To + 16, B);
+        }
+        for (; To < End; To += 16, From += 16) {
+            STORE128(To, LOADU128(From));
+        }
+    }
+
+    STOREU128(Destination, Head);
+    STOREU128(End, Tail);
+}
+
+
+static
+VOID
+MoveBackwardSse2(OUT UINT8 *Destination,
+                 IN CONST UINT8 *Source,
+                 IN UINTN Length)
+{
+    __m128i Head = LOADU128(Source);
+    __m128i Tail = LOADU128(Source + Length - 16);
+    UINTN Skew = ((UINTN)(Destination + Length) & 15) ?: 16;
+    UINT8 *To = Destination + Length - Skew;
+    CONST UINT8 *From = Source + Length - Skew;
+
+    while (To > (Destination + 16)) {
+        To -= 16; From -= 16;
+        STORE128(To, LOADU128(From));
+    }
+
+    STOREU128(Destination, Head);
+    STOREU128(Destination + Length - 16, Tail);
+}
+
+
+__attribute__((target("avx2")))
+static
+VOID
+MoveForwardAvx2(OUT UINT8 *Destination,
+                IN CONST UINT8 *Source,
+                IN UINTN Length,
+                IN BOOLEAN NonTemporal)
+{
+    __m256i Head = LOADU256(Source);
+    __m256i Tail = LOADU256(Source + Length - 32);
+    UINT8 *End = Destination + Length - 32;
+    UINTN Skew = 32 - ((UINTN)Destination & 31);
+    UINT8 *To = Destination + Skew;
+    CONST UINT8 *From = Source + Skew;
+
+    if (NonTemporal) {
+        for (; (To + 64) <= End; To += 64, From += 64) {
+            __m256i A = LOADU256(From);
+            __m256i B = LOADU256(From + 32);
+            STREAM256(To, A);
+            STREAM256(To + 32, B);
+        }
+        for (; To < End; To += 32, From += 32) {
+            STREAM256(To, LOADU256(From));
+        }
+        _mm_sfence();
+    } else {
+        for (; (To + 128) <= End; To += 128, From += 128) {
+            __m256i A = LOADU256(From);
+            __m256i B = LOADU256(From + 32);
+            __m256i C = LOADU256(From + 64);
+            __m256i D = LOADU256(From + 96);
+            STORE256(To, A);
+            STORE256(To + 32, B);
+            STORE256(To + 64, C);
+            STORE256(To + 96, D);
+        }
+        for (; To < End; To += 32, From += 32) {
+            STORE256(To, LOADU256(From));
+        }
+    }
+
+    STOREU256(Destination, Head);
+    STOREU256(End, Tail);
+    _mm256_zeroupper();
+}
+
+
+__attribute__((target("avx2")))
+static
+VOID
+MoveBackwardAvx2(OUT UINT8 *Destination,
+                 IN CONST UINT8 *Source,
+                 IN UINTN Length)
+{
+    __m256i Head = LOADU256(Source);
+    __m256i Tail = LOADU256(Source + Length - 32);
+    UINTN Skew = ((UINTN)(Destination + Length) & 31) ?: 32;
+    UINT8 *To = Destination + Length - Skew;
+    CONST UINT8 *From = Source + Length - Skew;
+
+    while (To > (Destination + 128)) {
+        To -= 128; From -= 128;
+        __m256i A = LOADU256(From + 96);
+        __m256i B = LOADU256(From + 64);
+        __m256i C = LOADU256(From + 32);
+        __m256i D = LOADU256(From);
+        STORE256(To + 96, A);
+        STORE256(To + 64, B);
+        STORE256(To + 32, C);
+        STORE256(To, D);
+    }
+
+    while (To > (Destination + 32)) {
+        To -= 32; From -= 32;
+        STORE256(To, LOADU256(From));
+    }
+
+    STOREU256(Destination, Head);
+    STOREU256(Destination + Length - 32, Tail);
+    _mm256_zeroupper();
+}
+
+
+VOID *
+EFIAPI
+FastMoveMem(OUT VOID *Destination,
+            IN CONST VOID *Source,
+            IN UINTN Length)
+{
+    UINT8 *To = (UINT8 *)Destination;
+    CONST UINT8 *From = (CONST UINT8 *)Source;
+    BOOLEAN Overlapping;
+    BOOLEAN UseAvx2;
+
+    if (Length <= 32) {
+        MoveSmall(To, From, Length);
+        return Destination;
+    }
+
+    if (To == From) {
+        return Destination;
+    }
+
+    Overlapping = ((UINTN)(To - From) < Length) || ((UINTN)(From - To) < Length);
+    UseAvx2 = (Length >= 256) && MemoryAvx2Usable();
+
+    if (Overlapping && To > From) {
+        if (UseAvx2) {
+            MoveBackwardAvx2(To, From, Length);
+        } else {
+            MoveBackwardSse2(To, From, Length);
+        }
+
+        return Destination;
+    }
+
+    if (!Overlapping && Length >= MFTAH_MEMORY_NT_THRESHOLD) {
+        if (UseAvx2) {
+            MoveForwardAvx2(To, From, Length, TRUE);
+        } else {
+            MoveForwardSse2(To, From, Length, TRUE);
+        }
+
+        return Destination;
+    }
+
+    if (!Overlapping && mHasErms && Length >= MFTAH_MEMORY_ERMS_THRESHOLD) {
+        __asm__ __volatile__ (
+            "rep movsb"
+            : "+D"(To), "+S"(From), "+c"(Length)
+            :
+            : "memory"
+        );
+
+        return Destination;
+    }
+
+    if (UseAvx2) {
+        MoveForwardAvx2(To, From, Length, FALSE);
+    } else {
+        MoveForwardSse2(To, From, Length, FALSE);
+    }
+
+    return Destination;
+}
+
+
+VOID *
+EFIAPI
+FastCopyMem(OUT VOID *Destination,
+            IN CONST VOID *Source,
+            IN UINTN Length)
+{
+    return FastMoveMem(Destination, Source, Length);
+}
+
+
+static
+VOID
+SetSse2(OUT UINT8 *Destination,
+        IN UINTN Length,
+        IN UINT8 Value,
+        IN BOOLEAN NonTemporal)
+{
+    __m128i Fill = _mm_set1_epi8((INT8)Value);
+    UINT8 *End = Destination + Length - 16;
+    UINT8 *To = Destination + (16 - ((UINTN)Destination & 15));
+
+    STOREU128(Destination, Fill);
+
+    if (NonTemporal) {
+        for (; To < End; To += 16) STREAM128(To, Fill);
+        _mm_sfence();
+    } else {
+        for (; To < End; To += 16) STORE128(To, Fill);
+    }
+
+    STOREU128(End, Fill);
+}
+
+
+__attribute__((target("avx2")))
+static
+VOID
+SetAvx2(OUT UINT8 *Destination,
+        IN UINTN Length,
+        IN UINT8 Value,
+        IN BOOLEAN NonTemporal)
+{
+    __m256i Fill = _mm256_set1_epi8((INT8)Value);
+    UINT8 *End = Destination + Length - 32;
+    UINT8 *To = Destination + (32 - ((UINTN)Destination & 31));
+
+    STOREU256(Destination, Fill);
+
+    if (NonTemporal) {
+        for (; To < End; To += 32) STREAM256(To, Fill);
+        _mm_sfence();
+    } else {
+        for (; (To + 128) <= End; To += 128) {
+            STORE256(To, Fill);
+            STORE256(To + 32, Fill);
+            STORE256(To + 64, Fill);
+            STORE256(To + 96, Fill);
+        }
+        for (; To < End; To += 32) STORE256(To, Fill);
+    }
+
+    STOREU256(End, Fill);
+    _mm256_zeroupper();
+}
+
+
+VOID *
+EFIAPI
+FastSetMem(OUT VOID *Destination,
+           IN UINTN Length,
+           IN UINT8 Value)
+{
+    UINT8 *To = (UINT8 *)Destination;
+    UINT64 Fill = 0x0101010101010101ULL * Value;
+    BOOLEAN NonTemporal = (Length >= MFTAH_MEMORY_NT_THRESHOLD);
+
+    if (Length < 16) {
+        if (Length >= 8) {
+            *((UNALIGNED_UINT64 *)To) = Fill;
+            *((UNALIGNED_UINT64 *)(To + Length - 8)) = Fill;
+        } else if (Length >= 4) {
+            *((UNALIGNED_UINT32 *)To) = (UINT32)Fill;
+            *((UNALIGNED_UINT32 *)(To + Length - 4)) = (UINT32)Fill;
+        } else if (Length > 0) {
+            To[0] = Value;
+            To[Length / 2] = Value;
+            To[Length - 1] = Value;
+        }
+
+        return Destination;
+    }
+
+    if (!NonTemporal && mHasErms && Length >= MFTAH_MEMORY_ERMS_THRESHOLD) {
+        __asm__ __volatile__ (
+            "rep stosb"
+            : "+D"(To), "+c"(Length)
+            : "a"(Value)
+            : "memory"
+        );
+
+        return Destination;
+    }
+
+    if (Length >= 256 && MemoryAvx2Usable()) {
+        SetAvx2(To, Length, Value, NonTemporal);
+    } else {
+        SetSse2(To, Length, Value, NonTemporal);
+    }
+
+    return Destination;
+}
+
+
+/**
+ * Get the memcmp-style result of two blocks which are known to differ.
+ */
+static
+inline
+INTN
+CompareMismatch(IN CONST UINT8 *Left,
+                IN CONST UINT8 *Right,
+                IN UINT32 DifferenceMask)
+{
+    UINTN Index = __builtin_ctz(DifferenceMask);
+
+    return (INTN)Left[Index] - (INTN)Right[Index];
+}
+
+
+__attribute__((target("avx2")))
+static
+INTN
+CompareAvx2(IN CONST UINT8 *Left,
+            IN CONST UINT8 *Right,
+            IN UINTN Length)
+{
+    UINT32 Mask;
+    UINTN Offset;
+
+    for (Offset = 0; (Offset + 32) <= Length; Offset += 32) {
+        Mask = ~(UINT32)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(LOADU256(Left + Offset), LOADU256(Right + Offset))
+        );
+        if (0 != Mask) {
+            _mm256_zeroupper();
+            return CompareMismatch(Left + Offset, Right + Offset, Mask);
+        }
+    }
+
+    _mm256_zeroupper();
+
+    /* Re-check the last (partly overlapping) block. */
+    if (Offset < Length) {
+        Offset = Length - 32;
+        Mask = ~(UINT32)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(LOADU128(Left + Offset), LOADU128(Right + Offset))
+        ) & 0xFFFF;
+        if (0 != Mask) return CompareMismatch(Left + Offset, Right + Offset, Mask);
+
+        Offset += 16;
+        Mask = ~(UINT32)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(LOADU128(Left + Offset), LOADU128(Right + Offset))
+        ) & 0xFFFF;
+        if (0 != Mask) return CompareMismatch(Left + Offset, Right + Offset, Mask);
+    }
+
+    return 0;
+}
+
+
+INTN
+EFIAPI
+FastCompareMem(IN CONST VOID *Left,
+               IN CONST VOID *Right,
+               IN UINTN Length)
+{
+    CONST UINT8 *L = (CONST UINT8 *)Left;
+    CONST UINT8 *R = (CONST UINT8 *)Right;
+    UINT32 Mask;
+    UINTN Offset;
+
+    if (Length < 16) {
+        for (Offset = 0; Offset < Length; ++Offset) {
+            if (L[Offset] != R[Offset]) {
+                return (INTN)L[Offset] - (INTN)R[Offset];
+            }
+        }
+
+        return 0;
+    }
+
+    if (Length >= 256 && MemoryAvx2Usable()) {
+        return CompareAvx2(L, R, Length);
+    }
+
+    for (Offset = 0; (Offset + 16) <= Length; Offset += 16) {
+        Mask = ~(UINT32)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(LOADU128(L + Offset), LOADU128(R + Offset))
+        ) & 0xFFFF;
+        if (0 != Mask) return CompareMismatch(L + Offset, R + Offset, Mask);
+    }
+
+    /* Re-check the last (partly overlapping) block. */
+    if (Offset < Length) {
+        Offset = Length - 16;
+        Mask = ~(UINT32)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(LOADU128(L + Offset), LOADU128(R + Offset))
+        ) & 0xFFFF;
+        if (0 != Mask) return CompareMismatch(L + Offset, R + Offset, Mask);
+    }
+
+    return 0;
+}
+
+
+INTN
+EFIAPI
+ConstantTimeCompareMem(IN CONST VOID *Left,
+                       IN CONST VOID *Right,
+                       IN UINTN Length)
+{
+    CONST VOLATILE UINT8 *L = (CONST VOLATILE UINT8 *)Left;
+    CONST VOLATILE UINT8 *R = (CONST VOLATILE UINT8 *)Right;
+    INT32 Result = 0;
+    INT32 Difference;
+    UINT32 StillEqual;
+
+    /* Only the first difference is kept, without ever branching on the data:
+        'StillEqual' is all ones until Result becomes nonzero, then all zeroes. */
+    for (UINTN i = 0; i < Length; ++i) {
+        Difference = (INT32)L[i] - (INT32)R[i];
+        StillEqual = (((UINT32)(Result | -Result)) >> 31) - 1;
+        Result |= (INT32)((UINT32)Difference & StillEqual);
+    }
+
+    return (INTN)Result;
+}
@@ -0,0 +1,1229 @@
+#include "core/multiboot.h"
+#include "core/handoff.h"
+#include "core/bootinfo.h"
+#include "core/memory.h"
+#include "core/arena.h"
+#include "core/profiler.h"
+#include "core/util.h"
+
+
+
+/* Just enough of ELF64 to place an x86_64 executable at its physical addresses. */
+#define ELF_MAGIC               0x464C457F      /* "\x7F" "ELF" */
+#define ELF_CLASS_64            2
+#define ELF_DATA_LSB            1
+#define ELF_TYPE_EXEC           2
+#define ELF_MACHINE_X86_64      62
+#define ELF_PT_LOAD             1
+#define ELF_MAX_PROGRAM_HEADERS 64
+
+typedef
+struct {
+    UINT32      Magic;
+    UINT8       Class;
+    UINT8       Data;
+    UINT8       IdentVersion;
+    UINT8       OsAbi;
+    UINT8       Padding[8];
+    UINT16      Type;
+    UINT16      Machine;
+    UINT32      Version;
+    UINT64      Entry;
+    UINT64      ProgramHeaderOffset;
+    UINT64      SectionHeaderOffset;
+    UINT32      Flags;
+    UINT16      HeaderSize;
+    UINT16      ProgramHeaderSize;
+    UINT16      ProgramHeaderCount;
+    UINT16      SectionHeaderSize;
+    UINT16      SectionHeaderCount;
+    UINT16      SectionNameIndex;
+} __attribute__((packed)) ELF64_HEADER;
+
+typedef
+struct {
+    UINT32      Type;
+    UINT32      Flags;
+    UINT64      Offset;
+    UINT64      VirtualAddress;
+    UINT64      PhysicalAddress;
+    UINT64      FileSize;
+    UINT64      MemorySize;
+    UINT64      Align;
+} __attribute__((packed)) ELF64_PROGRAM_HEADER;
+
+
+/* FAT directory entry fields. */
+#define FAT_DIRENT_SIZE         32
+#define FAT_ATTR_VOLUME_ID      0x08
+#define FAT_ATTR_DIRECTORY      0x10
+#define FAT_ATTR_LONG_NAME      0x0F
+#define FAT_DIRENT_FREE         0xE5
+#define FAT_DIRENT_END          0x00
+
+/* Partition table fields, for ramdisks which aren't a bare FAT volume. */
+#define MBR_PARTITION_TABLE     446
+#define MBR_PARTITION_COUNT     4
+#define MBR_TYPE_GPT_PROTECTIVE 0xEE
+#define GPT_HEADER_SIGNATURE    0x5452415020494645ULL   /* "EFI PART" */
+#define GPT_MAX_PARTITIONS      128
+#define PARTITION_SECTOR_SIZE   512
+
+#define MULTIBOOT_ALIGN_TAG(x) \
+    (((x) + 7) & ~((UINT64)7))
+
+/* Room for every boot information tag other than the two memory maps. */
+#define MULTIBOOT_FIXED_INFO_SIZE (1 << 12)
+
+/* Allocations done between sizing the memory map and the final snapshot can add descriptors. */
+#define MULTIBOOT_MEMORY_MAP_SLACK 32
+
+
+/* The kernel's requirements, as read from its Multiboot2 header. */
+typedef
+struct {
+    BOOLEAN     KeepBootServices;
+    BOOLEAN     WantsEfiMemoryMap;
+    BOOLEAN     WantsImageHandle;
+    BOOLEAN     RequiresFramebuffer;
+    BOOLEAN     HasEfiEntry;
+    UINT64      EfiEntry;
+} MULTIBOOT_REQUEST;
+
+
+static
+inline
+UINT16
+Le16(IN CONST UINT8 *p)
+{
+    return (UINT16)(p[0] | (p[1] << 8));
+}
+
+
+static
+inline
+UINT32
+Le32(IN CONST UINT8 *p)
+{
+    return (UINT32)p[0] | ((UINT32)p[1] << 8) | ((UINT32)p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+
+static
+inline
+UINT64
+Le64(IN CONST UINT8 *p)
+{
+    return (UINT64)Le32(p) | ((UINT64)Le32(p + 4) << 32);
+}
+
+
+/**
+ * Check for a FAT boot sector at the given location and describe the volume.
+ *
+ * @retval EFI_SUCCESS    The location holds a FAT12/16/32 volume.
+ * @retval EFI_NOT_FOUND  It doesn't.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+FatProbe(IN UINT8 *Base,
+         IN UINT64 Length,
+         OUT MULTIBOOT_FAT_VOLUME *Volume)
+{
+    UINT32 BytesPerSector, SectorsPerCluster, ReservedSectors, FatCount, RootEntries;
+    UINT64 TotalSectors, FatSectors, RootDirSectors, FirstDataSector;
+
+    if (Length < PARTITION_SECTOR_SIZE || 0x55 != Base[510] || 0xAA != Base[511]) {
+        return EFI_NOT_FOUND;
+    } else if (0xEB != Base[0] && 0xE9 != Base[0]) {
+        return EFI_NOT_FOUND;
+    }
+
+    BytesPerSector    = Le16(Base + 11);
+    SectorsPerCluster = Base[13];
+    ReservedSectors   = Le16(Base + 14);
+    FatCount          = Base[16];
+    RootEntries       = Le16(Base + 17);
+    TotalSectors      = (0 != Le16(Base + 19)) ? Le16(Base + 19) : Le32(Base + 32);
+    FatSectors        = (0 != Le16(Base + 22)) ? Le16(Base + 22) : Le32(Base + 36);
+
+    if ((512 != BytesPerSector && 1024 != BytesPerSector && 2048 != BytesPerSector && 4096 != BytesPerSector)
+        || 0 == SectorsPerCluster || 0 != (SectorsPerCluster & (SectorsPerCluster - 1))
+        || 0 == ReservedSectors || 0 == FatCount || 0 == TotalSectors || 0 == FatSectors
+    ) {
+        return EFI_NOT_FOUND;
+    }
+
+    RootDirSectors  = ((RootEntries * FAT_DIRENT_SIZE) + (BytesPerSector - 1)) / BytesPerSector;
+    FirstDataSector = ReservedSectors + (FatCount * FatSectors) + RootDirSectors;
+    if (FirstDataSector >= TotalSectors) {
+        return EFI_NOT_FOUND;
+    }
+
+    Volume->Base            = Base;
+    Volume->Length          = MIN(Length, TotalSectors * BytesPerSector);
+    Volume->BytesPerSector  = BytesPerSector;
+    Volume->BytesPerCluster = BytesPerSector * SectorsPerCluster;
+    Volume->FatOffset       = (UINT64)ReservedSectors * BytesPerSector;
+    Volume->RootDirOffset   = (ReservedSectors + (FatCount * FatSectors)) * BytesPerSector;
+    Volume->RootDirEntries  = RootEntries;
+    Volume->DataOffset      = FirstDataSector * BytesPerSector;
+    Volume->ClusterCount    = (UINT32)((TotalSectors - FirstDataSector) / SectorsPerCluster);
+
+    /* The FAT type is determined by the cluster count alone. */
+    if (Volume->ClusterCount < 4085) {
+        Volume->FatType = 12;
+    } else if (Volume->ClusterCount < 65525) {
+        Volume->FatType = 16;
+    } else {
+        Volume->FatType = 32;
+        Volume->RootCluster = Le32(Base + 44);
+
+        if (0 != RootEntries) return EFI_NOT_FOUND;
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Find the FAT volume in a ramdisk image: either the image itself, or the
+ *  first FAT partition listed by its MBR or GPT.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+FatLocateVolume(IN UINT8 *Image,
+                IN UINT64 Length,
+                OUT MULTIBOOT_FAT_VOLUME *Volume)
+{
+    UINT8 *Entry;
+    UINT64 StartLba, EntriesLba;
+    UINT32 EntryCount, EntrySize;
+    BOOLEAN IsGpt = FALSE;
+
+    if (EFI_SUCCESS == FatProbe(Image, Length, Volume)) {
+        return EFI_SUCCESS;
+    } else if (Length < (2 * PARTITION_SECTOR_SIZE) || 0x55 != Image[510] || 0xAA != Image[511]) {
+        return EFI_NOT_FOUND;
+    }
+
+    for (UINTN i = 0; i < MBR_PARTITION_COUNT; ++i) {
+        Entry = Image + MBR_PARTITION_TABLE + (i * 16);
+
+        if (MBR_TYPE_GPT_PROTECTIVE == Entry[4]) {
+            IsGpt = TRUE;
+            break;
+        }
+
+        StartLba = Le32(Entry + 8);
+        if (0 == Entry[4] || 0 == StartLba || (StartLba * PARTITION_SECTOR_SIZE) >= Length) {
+            continue;
+        }
+
+        if (EFI_SUCCESS == FatProbe(Image + (StartLba * PARTITION_SECTOR_SIZE),
+                                    Length - (StartLba * PARTITION_SECTOR_SIZE),
+                                    Volume)
+        ) {
+            return EFI_SUCCESS;
+        }
+    }
+
+    if (!IsGpt || GPT_HEADER_SIGNATURE != Le64(Image + PARTITION_SECTOR_SIZE)) {
+        return EFI_NOT_FOUND;
+    }
+
+    EntriesLba = Le64(Image + PARTITION_SECTOR_SIZE + 72);
+    EntryCount = MIN(Le32(Image + PARTITION_SECTOR_SIZE + 80), GPT_MAX_PARTITIONS);
+    EntrySize  = Le32(Image + PARTITION_SECTOR_SIZE + 84);
+    if (EntrySize < 128) {
+        return EFI_NOT_FOUND;
+    }
+
+    for (UINT32 i = 0; i < EntryCount; ++i) {
+        if (((EntriesLba * PARTITION_SECTOR_SIZE) + ((UINT64)(i + 1) * EntrySize)) > Length) {
+            break;
+        }
+
+        Entry = Image + (EntriesLba * PARTITION_SECTOR_SIZE) + ((UINT64)i * EntrySize);
+        StartLba = Le64(Entry + 32);
+
+        /* Unused entries have an all-zero type GUID. */
+        if (0 == (Le64(Entry) | Le64(Entry + 8)) || 0 == StartLba || (StartLba * PARTITION_SECTOR_SIZE) >= Length) {
+            continue;
+        }
+
+        if (EFI_SUCCESS == FatProbe(Image + (StartLba * PARTITION_SECTOR_SIZE),
+                                    Length - (StartLba * PARTITION_SECTOR_SIZE),
+                                    Volume)
+        ) {
+            return EFI_SUCCESS;
+        }
+    }
+
+    return EFI_NOT_FOUND;
+}
+
+
+/**
+ * Follow a cluster chain by one link.
+ *
+ * @returns FALSE if the FAT entry lies outside of the volume.
+ */
+STATIC
+BOOLEAN
+EFIAPI
+FatNextCluster(IN CONST MULTIBOOT_FAT_VOLUME *Volume,
+               IN UINT32 Cluster,
+               OUT UINT32 *Next)
+{
+    UINT64 Offset;
+
+    switch (Volume->FatType) {
+        case 12: Offset = Cluster + (Cluster / 2); break;
+        case 16: Offset = (UINT64)Cluster * 2; break;
+        default: Offset = (UINT64)Cluster * 4; break;
+    }
+
+    if ((Volume->FatOffset + Offset + 4) > Volume->Length) {
+        return FALSE;
+    }
+
+    switch (Volume->FatType) {
+        case 12:
+            *Next = Le16(Volume->Base + Volume->FatOffset + Offset);
+            *Next = (Cluster & 1) ? (*Next >> 4) : (*Next & 0xFFF);
+            break;
+        case 16:
+            *Next = Le16(Volume->Base + Volume->FatOffset + Offset);
+            break;
+        default:
+            *Next = Le32(Volume->Base + Volume->FatOffset + Offset) & 0x0FFFFFFF;
+            break;
+    }
+
+    return TRUE;
+}
+
+
+/**
+ * Get a cluster's data, or NULL if the cluster doesn't exist in the volume.
+ */
+STATIC
+UINT8 *
+EFIAPI
+FatClusterData(IN CONST MULTIBOOT_FAT_VOLUME *Volume,
+               IN UINT32 Cluster)
+{
+    UINT64 Offset;
+
+    if (Cluster < 2 || Cluster >= (Volume->ClusterCount + 2)) {
+        return NULL;
+    }
+
+    Offset = Volume->DataOffset + ((UINT64)(Cluster - 2) * Volume->BytesPerCluster);
+    if ((Offset + Volume->BytesPerCluster) > Volume->Length) {
+        return NULL;
+    }
+
+    return Volume->Base + Offset;
+}
+
+
+/**
+ * Search a run of directory entries for a short name.
+ *
+ * @returns 1 if found, -1 if the end of the directory was reached, 0 to keep looking.
+ */
+STATIC
+INTN
+EFIAPI
+FatSearchEntries(IN UINT8 *Entries,
+                 IN UINTN Count,
+                 IN CONST CHAR8 *ShortName,
+                 OUT UINT8 **Found)
+{
+    for (UINTN i = 0; i < Count; ++i) {
+        UINT8 *Entry = Entries + (i * FAT_DIRENT_SIZE);
+
+        if (FAT_DIRENT_END == Entry[0]) {
+            return -1;
+        } else if (FAT_DIRENT_FREE == Entry[0]
+            || FAT_ATTR_LONG_NAME == (Entry[11] & FAT_ATTR_LONG_NAME)
+            || 0 != (Entry[11] & FAT_ATTR_VOLUME_ID)
+        ) {
+            continue;
+        }
+
+        if (0 == CompareMem(Entry, ShortName, 11)) {
+            *Found = Entry;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Find a short name in a directory. A 'Directory' cluster of 0 is the root.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+FatFindEntry(IN CONST MULTIBOOT_FAT_VOLUME *Volume,
+             IN UINT32 Directory,
+             IN CONST CHAR8 *ShortName,
+             OUT UINT8 **Entry)
+{
+    UINT8 *Data;
+    INTN Result;
+
+    if (0 == Directory && 32 != Volume->FatType) {
+        if ((Volume->RootDirOffset + ((UINT64)Volume->RootDirEntries * FAT_DIRENT_SIZE)) > Volume->Length) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        Result = FatSearchEntries(Volume->Base + Volume->RootDirOffset,
+                                  Volume->RootDirEntries,
+                                  ShortName,
+                                  Entry);
+        return (1 == Result) ? EFI_SUCCESS : EFI_NOT_FOUND;
+    }
+
+    if (0 == Directory) {
+        Directory = Volume->RootCluster;
+    }
+
+    /* Bound the walk by the cluster count so a looping chain can't hang the loader. */
+    for (UINT32 Steps = 0; Steps < Volume->ClusterCount; ++Steps) {
+        Data = FatClusterData(Volume, Directory);
+        if (NULL == Data) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        Result = FatSearchEntries(Data, Volume->BytesPerCluster / FAT_DIRENT_SIZE, ShortName, Entry);
+        if (1 == Result) {
+            return EFI_SUCCESS;
+        } else if (-1 == Result || !FatNextCluster(Volume, Directory, &Directory)) {
+            return EFI_NOT_FOUND;
+        }
+    }
+
+    return EFI_VOLUME_CORRUPTED;
+}
+
+
+/**
+ * Convert one path component to its padded, upper-case 8.3 form.
+ */
+STATIC
+BOOLEAN
+EFIAPI
+FatToShortName(IN CONST CHAR8 *Component,
+               IN UINTN Length,
+               OUT CHAR8 *ShortName)
+{
+    UINTN Position = 0, Limit = 8;
+
+    SetMem(ShortName, 11, ' ');
+
+    for (UINTN i = 0; i < Length; ++i) {
+        CHAR8 c = Component[i];
+
+        if ('.' == c) {
+            /* Only one extension is allowed, and the base name can't be empty. */
+            if (8 != Limit || 0 == i) return FALSE;
+
+            Position = 8;
+            Limit = 11;
+            continue;
+        }
+
+        if (Position >= Limit) return FALSE;
+
+        ShortName[Position++] = (c >= 'a' && c <= 'z') ? (c - 'a' + 'A') : c;
+    }
+
+    return 0 != Length;
+}
+
+
+STATIC
+EFI_STATUS
+EFIAPI
+FatOpen(IN MULTIBOOT_FAT_VOLUME *Volume,
+        IN CONST CHAR8 *Path,
+        OUT MULTIBOOT_FAT_FILE *File)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    CHAR8 ShortName[11];
+    UINT8 *Entry = NULL;
+    UINT32 Directory = 0, Cluster;
+    UINTN Length;
+
+    while ('\0' != *Path) {
+        for (Length = 0; '\0' != Path[Length] && '\\' != Path[Length]; ++Length);
+
+        if (!FatToShortName(Path, Length, ShortName)) {
+            return EFI_INVALID_PARAMETER;
+        }
+
+        ERRCHECK(FatFindEntry(Volume, Directory, ShortName, &Entry));
+
+        Cluster = Le16(Entry + 26);
+        if (32 == Volume->FatType) {
+            Cluster |= (UINT32)Le16(Entry + 20) << 16;
+        }
+
+        Path += Length;
+        if ('\\' == *Path) {
+            /* Intermediate components must be directories. */
+            if (0 == (Entry[11] & FAT_ATTR_DIRECTORY)) return EFI_NOT_FOUND;
+
+            Directory = Cluster;
+            ++Path;
+            continue;
+        }
+
+        if (0 != (Entry[11] & FAT_ATTR_DIRECTORY)) return EFI_NOT_FOUND;
+
+        File->Volume        = Volume;
+        File->FirstCluster  = Cluster;
+        File->Size          = Le32(Entry + 28);
+        File->CursorIndex   = 0;
+        File->CursorCluster = Cluster;
+
+        return EFI_SUCCESS;
+    }
+
+    return EFI_NOT_FOUND;
+}
+
+
+/**
+ * Copy a range of a file out of the volume.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+FatRead(IN MULTIBOOT_FAT_FILE *File,
+        IN UINT64 Offset,
+        OUT VOID *Buffer,
+        IN UINT64 Length)
+{
+    MULTIBOOT_FAT_VOLUME *Volume = File->Volume;
+    UINT8 *Destination = (UINT8 *)Buffer;
+    UINT8 *Data;
+    UINT64 Within, Chunk;
+    UINT32 Index;
+
+    if (0 == Length) {
+        return EFI_SUCCESS;
+    } else if (Offset > File->Size || Length > (File->Size - Offset)) {
+        return EFI_END_OF_FILE;
+    }
+
+    Index  = (UINT32)(Offset / Volume->BytesPerCluster);
+    Within = Offset % Volume->BytesPerCluster;
+
+    /* The cursor only moves forward, so rewind it for backwards reads. */
+    if (Index < File->CursorIndex) {
+        File->CursorIndex   = 0;
+        File->CursorCluster = File->FirstCluster;
+    }
+
+    while (TRUE) {
+        while (File->CursorIndex < Index) {
+            if (!FatNextCluster(Volume, File->CursorCluster, &(File->CursorCluster))) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            File->CursorIndex++;
+        }
+
+        Data = FatClusterData(Volume, File->CursorCluster);
+        if (NULL == Data) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        Chunk = MIN(Volume->BytesPerCluster - Within, Length);
+        FastCopyMem(Destination, Data + Within, Chunk);
+
+        Destination += Chunk;
+        Length -= Chunk;
+        if (0 == Length) break;
+
+        Within = 0;
+        Index++;
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Find and validate the kernel's Multiboot2 header, and work out what the kernel needs.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+MultibootParseHeader(IN MULTIBOOT_FAT_FILE *Kernel,
+                     IN BOOLEAN HasFramebuffer,
+                     OUT MULTIBOOT_REQUEST *Request)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINT8 *Search = NULL, *Tag;
+    UINT64 SearchLength = MIN((UINT64)MULTIBOOT_SEARCH_LIMIT, Kernel->Size);
+    UINT64 HeaderOffset = 0, HeaderLength = 0, TagOffset;
+    BOOLEAN Found = FALSE;
+
+    SetMem(Request, sizeof(MULTIBOOT_REQUEST), 0);
+
+    Search = (UINT8 *)AllocatePool(SearchLength);
+    if (NULL == Search) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    Status = FatRead(Kernel, 0, Search, SearchLength);
+    if (EFI_ERROR(Status)) {
+        goto Label__MultibootParseHeader__End;
+    }
+
+    for (HeaderOffset = 0; (HeaderOffset + sizeof(multiboot_header)) <= SearchLength; HeaderOffset += MULTIBOOT_SEARCH_ALIGNMENT) {
+        UINT8 *Header = Search + HeaderOffset;
+
+        if (MULTIBOOT_MAGIC_HEADER != Le32(Header)) continue;
+
+        HeaderLength = Le32(Header + 8);
+        if (0 != (UINT32)(Le32(Header) + Le32(Header + 4) + Le32(Header + 8) + Le32(Header + 12))
+            || HeaderLength < sizeof(multiboot_header)
+            || (HeaderOffset + HeaderLength) > SearchLength
+        ) {
+            continue;
+        }
+
+        Found = TRUE;
+        break;
+    }
+
+    if (!Found) {
+        DPRINTLN(L"-- The kernel has no valid Multiboot2 header.");
+        Status = EFI_LOAD_ERROR;
+        goto Label__MultibootParseHeader__End;
+    }
+
+    for (TagOffset = sizeof(multiboot_header); (TagOffset + sizeof(multiboot_tag_header)) <= HeaderLength; ) {
+        Tag = Search + HeaderOffset + TagOffset;
+
+        UINT16 Type     = Le16(Tag);
+        BOOLEAN Optional = 0 != (Le16(Tag + 2) & MULTIBOOT_FLAG_TAG_OPTIONAL);
+        UINT32 Size     = Le32(Tag + 4);
+
+        if (MB_END == Type) break;
+        if (Size < sizeof(multiboot_tag_header) || (TagOffset + Size) > HeaderLength) {
+            Status = EFI_LOAD_ERROR;
+            goto Label__MultibootParseHeader__End;
+        }
+
+        switch (Type) {
+            case MB_INFO_REQ:
+                for (UINT32 i = sizeof(multiboot_tag_header); (i + 4) <= Size; i += 4) {
+                    switch (Le32(Tag + i)) {
+                        case MBI_CMD_LINE:
+                        case MBI_LOADER_NAME:
+                        case MBI_MEMORY_MAP:
+                        case MBI_EFI_ST_64:
+                        case MBI_ACPI_10:
+                        case MBI_ACPI_20:
+                            break;
+                        case MBI_FRAMEBUFFER:
+                            Request->RequiresFramebuffer = !Optional;
+                            break;
+                        case MBI_EFI_MEMORY_MAP:
+                            Request->WantsEfiMemoryMap = TRUE;
+                            break;
+                        case MBI_IMG_HND_64:
+                            Request->WantsImageHandle = TRUE;
+                            break;
+                        default:
+                            if (!Optional) {
+                                DPRINTLN(L"-- The kernel requires unsupported info tag '%u'.", Le32(Tag + i));
+                                Status = EFI_UNSUPPORTED;
+                                goto Label__MultibootParseHeader__End;
+                            }
+                            break;
+                    }
+                }
+                break;
+            case MB_EFI_BS:
+                Request->KeepBootServices = TRUE;
+                break;
+            case MB_AMD64_ENTRY:
+                Request->HasEfiEntry = TRUE;
+                Request->EfiEntry = Le32(Tag + 8);
+                break;
+            /* The kernel is always entered in long mode at its ELF entry point, at its
+                linked addresses, with the firmware's current video mode, and without modules. */
+            case MB_ENTRY:
+            case MB_FLAGS:
+            case MB_FRAMEBUFFER:
+            case MB_MOD_ALIGN:
+            case MB_RELOCATABLE:
+                break;
+            default:
+                /* Includes the a.out address tag: only ELF kernels can be loaded. */
+                if (!Optional) {
+                    DPRINTLN(L"-- The kernel requires unsupported header tag '%u'.", Type);
+                    Status = EFI_UNSUPPORTED;
+                    goto Label__MultibootParseHeader__End;
+                }
+                break;
+        }
+
+        TagOffset += MULTIBOOT_ALIGN_TAG(Size);
+    }
+
+    /* The EFI amd64 entry point only applies while boot services are kept. */
+    Request->HasEfiEntry = Request->HasEfiEntry && Request->KeepBootServices;
+
+    if (Request->RequiresFramebuffer && !HasFramebuffer) {
+        DPRINTLN(L"-- The kernel requires a framebuffer, but none is available.");
+        Status = EFI_UNSUPPORTED;
+    }
+
+Label__MultibootParseHeader__End:
+    FreePool(Search);
+    return Status;
+}
+
+
+/**
+ * Place the kernel's loadable segments at their physical addresses.
+ *
+ * @param[out] Entry  The kernel's ELF entry point.
+ * @param[out] KernelBase   Set to the start of the pages holding the segments.
+ * @param[out] KernelPages  Set to the number of those pages. The caller frees them if it can't boot.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+MultibootLoadElf(IN MULTIBOOT_FAT_FILE *Kernel,
+                 OUT UINT64 *Entry,
+                 OUT EFI_PHYSICAL_ADDRESS *KernelBase,
+                 OUT UINTN *KernelPages)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    ELF64_HEADER Header;
+    ELF64_PROGRAM_HEADER *Segments = NULL;
+    UINT64 Lowest = (UINT64)-1, Highest = 0;
+    EFI_PHYSICAL_ADDRESS Base;
+    UINTN Pages = 0;
+
+    ERRCHECK(FatRead(Kernel, 0, &Header, sizeof(ELF64_HEADER)));
+
+    if (ELF_MAGIC != Header.Magic
+        || ELF_CLASS_64 != Header.Class
+        || ELF_DATA_LSB != Header.Data
+        || ELF_TYPE_EXEC != Header.Type
+        || ELF_MACHINE_X86_64 != Header.Machine
+        || Header.ProgramHeaderSize < sizeof(ELF64_PROGRAM_HEADER)
+        || 0 == Header.ProgramHeaderCount
+        || Header.ProgramHeaderCount > ELF_MAX_PROGRAM_HEADERS
+    ) {
+        DPRINTLN(L"-- The kernel isn't an x86_64 ELF64 executable.");
+        return EFI_LOAD_ERROR;
+    }
+
+    Segments = (ELF64_PROGRAM_HEADER *)AllocatePool(Header.ProgramHeaderCount * sizeof(ELF64_PROGRAM_HEADER));
+    if (NULL == Segments) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    for (UINTN i = 0; i < Header.ProgramHeaderCount; ++i) {
+        Status = FatRead(Kernel,
+                         Header.ProgramHeaderOffset + (i * Header.ProgramHeaderSize),
+                         &Segments[i],
+                         sizeof(ELF64_PROGRAM_HEADER));
+        if (EFI_ERROR(Status)) {
+            goto Label__MultibootLoadElf__End;
+        }
+
+        if (ELF_PT_LOAD != Segments[i].Type || 0 == Segments[i].MemorySize) continue;
+
+        if (Segments[i].FileSize > Segments[i].MemorySize
+            || Segments[i].PhysicalAddress > ((UINT64)-1 - Segments[i].MemorySize)
+        ) {
+            Status = EFI_LOAD_ERROR;
+            goto Label__MultibootLoadElf__End;
+        }
+
+        Lowest  = MIN(Lowest, Segments[i].PhysicalAddress);
+        Highest = MAX(Highest, Segments[i].PhysicalAddress + Segments[i].MemorySize);
+    }
+
+    if (Highest <= Lowest || Header.Entry < Lowest || Header.Entry >= Highest) {
+        Status = EFI_LOAD_ERROR;
+        goto Label__MultibootLoadElf__End;
+    }
+
+    /* The segments are packed together, so claim their whole span at once. */
+    Base  = Lowest & ~((UINT64)EFI_PAGE_MASK);
+    Pages = EFI_SIZE_TO_PAGES(Highest - Base);
+
+    Status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAddress, EfiLoaderData, Pages, &Base);
+    if (EFI_ERROR(Status)) {
+        DPRINTLN(L"-- The kernel's physical range at '%llx' is not free.", Base);
+        Status = EFI_OUT_OF_RESOURCES;
+        goto Label__MultibootLoadElf__End;
+    }
+
+    FastSetMem((VOID *)(UINTN)Base, EFI_PAGES_TO_SIZE(Pages), 0x00);
+
+    for (UINTN i = 0; i < Header.ProgramHeaderCount; ++i) {
+        if (ELF_PT_LOAD != Segments[i].Type || 0 == Segments[i].FileSize) continue;
+
+        DPRINTLN(L"---- Segment at '%llx' (%llu bytes).", Segments[i].PhysicalAddress, Segments[i].MemorySize);
+        Status = FatRead(Kernel,
+                         Segments[i].Offset,
+                         (VOID *)(UINTN)Segments[i].PhysicalAddress,
+                         Segments[i].FileSize);
+        if (EFI_ERROR(Status)) {
+            uefi_call_wrapper(BS->FreePages, 2, Base, Pages);
+            goto Label__MultibootLoadElf__End;
+        }
+    }
+
+    *Entry = Header.Entry;
+    *KernelBase = Base;
+    *KernelPages = Pages;
+
+Label__MultibootLoadElf__End:
+    FreePool(Segments);
+    return Status;
+}
+
+
+/**
+ * Append a boot information tag and return it. The space is already zeroed.
+ */
+STATIC
+VOID *
+EFIAPI
+MultibootAppendTag(IN OUT UINT8 **Cursor,
+                   IN UINT32 Type,
+                   IN UINT32 Size)
+{
+    multiboot_info_tag_header *Tag = (multiboot_info_tag_header *)*Cursor;
+
+    Tag->type = Type;
+    Tag->size = Size;
+
+    *Cursor += MULTIBOOT_ALIGN_TAG(Size);
+    return (VOID *)Tag;
+}
+
+
+STATIC
+VOID
+EFIAPI
+MultibootAppendString(IN OUT UINT8 **Cursor,
+                      IN UINT32 Type,
+                      IN CONST CHAR8 *String)
+{
+    UINTN Length = strlena((CHAR8 *)String) + 1;
+    UINT8 *Tag = (UINT8 *)MultibootAppendTag(Cursor, Type, sizeof(multiboot_info_tag_header) + Length);
+
+    CopyMem(Tag + sizeof(multiboot_info_tag_header), (VOID *)String, Length);
+}
+
+
+/**
+ * Build the kernel command line: the configured one, plus the address of the early
+ *  decryption handoff record when there is one.
+ */
+STATIC
+VOID
+EFIAPI
+MultibootBuildCmdline(OUT CHAR8 *Buffer)
+{
+    CONST CHAR8 *Parameter = (CONST CHAR8 *)MFTAH_HANDOFF_CMDLINE_PARAM "0x";
+    UINT64 Record = HandoffRecordAddress();
+    UINTN Length = strlena((CHAR8 *)MFTAH_MULTIBOOT_CMDLINE);
+
+    CopyMem(Buffer, (VOID *)MFTAH_MULTIBOOT_CMDLINE, Length + 1);
+    if (0 == Record) return;
+
+    if (Length > 0) Buffer[Length++] = ' ';
+    for (; *Parameter; ++Parameter) Buffer[Length++] = *Parameter;
+
+    for (INTN Shift = 60; Shift >= 0; Shift -= 4) {
+        Buffer[Length++] = "0123456789abcdef"[(Record >> Shift) & 0xF];
+    }
+    Buffer[Length] = '\0';
+}
+
+
+/**
+ * Describe the current GOP mode as a direct RGB framebuffer. Nothing is appended for
+ *  modes without a linear framebuffer (PixelBltOnly) or with an unusable bit mask.
+ *  The pixel size of a PixelBitMask mode is that of its highest mask bit, in whole bytes.
+ */
+STATIC
+VOID
+EFIAPI
+MultibootAppendFramebuffer(IN OUT UINT8 **Cursor,
+                           IN EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop)
+{
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *Info = Gop->Mode->Info;
+    multiboot_info_tag_framebuffer *Tag;
+    UINT32 Masks[3] = {0};
+    UINT32 AllMasks, BitsPerPixel = 32;
+
+    switch (Info->PixelFormat) {
+        case PixelRedGreenBlueReserved8BitPerColor:
+            Masks[0] = 0x0000FF; Masks[1] = 0x00FF00; Masks[2] = 0xFF0000;
+            break;
+        case PixelBlueGreenRedReserved8BitPerColor:
+            Masks[0] = 0xFF0000; Masks[1] = 0x00FF00; Masks[2] = 0x0000FF;
+            break;
+        case PixelBitMask:
+            Masks[0] = Info->PixelInformation.RedMask;
+            Masks[1] = Info->PixelInformation.GreenMask;
+            Masks[2] = Info->PixelInformation.BlueMask;
+            if (0 == Masks[0] || 0 == Masks[1] || 0 == Masks[2]) return;
+
+            AllMasks = Masks[0] | Masks[1] | Masks[2] | Info->PixelInformation.ReservedMask;
+            BitsPerPixel = ((32 - __builtin_clz(AllMasks)) + 7) & ~7U;
+            break;
+        default:
+            return;
+    }
+
+    Tag = (multiboot_info_tag_framebuffer *)MultibootAppendTag(Cursor, MBI_FRAMEBUFFER, sizeof(multiboot_info_tag_framebuffer));
+    Tag->FramebufferPhysAddr = Gop->Mode->FrameBufferBase;
+    Tag->Pitch               = Info->PixelsPerScanLine * (BitsPerPixel / 8);
+    Tag->Width               = Info->HorizontalResolution;
+    Tag->Height              = Info->VerticalResolution;
+    Tag->BitsPerPixel        = (UINT8)BitsPerPixel;
+    Tag->Type                = MULTIBOOT_FB_TYPE_RGB;
+
+    /* Each mask is described as a bit position and a width. */
+    Tag->RedFieldPosition   = (UINT8)__builtin_ctz(Masks[0]);
+    Tag->RedMaskSize        = (UINT8)__builtin_popcount(Masks[0]);
+    Tag->GreenFieldPosition = (UINT8)__builtin_ctz(Masks[1]);
+    Tag->GreenMaskSize      = (UINT8)__builtin_popcount(Masks[1]);
+    Tag->BlueFieldPosition  = (UINT8)__builtin_ctz(Masks[2]);
+    Tag->BlueMaskSize       = (UINT8)__builtin_popcount(Masks[2]);
+}
+
+
+/**
+ * Translate an EFI memory type to what the kernel may do with it once boot services are gone.
+ */
+STATIC
+UINT32
+EFIAPI
+MultibootMemoryType(IN UINT32 EfiType)
+{
+    switch (EfiType) {
+        case EfiConventionalMemory:
+        case EfiBootServicesCode:
+        case EfiBootServicesData:
+            return MULTIBOOT_MEM_AVAILABLE;
+        case EfiACPIReclaimMemory:
+            return MULTIBOOT_MEM_ACPI_RECLAIMABLE;
+        case EfiACPIMemoryNVS:
+            return MULTIBOOT_MEM_NVS;
+        case EfiUnusableMemory:
+            return MULTIBOOT_MEM_BADRAM;
+        /* Loader memory holds the kernel, this information block, and the kernel's stack. */
+        default:
+            return MULTIBOOT_MEM_RESERVED;
+    }
+}
+
+
+/**
+ * Append the memory map tags from a firmware memory map snapshot, then close the block.
+ *  Nothing here may allocate, since the snapshot is used to exit boot services.
+ */
+STATIC
+VOID
+EFIAPI
+MultibootFinishInfo(IN OUT UINT8 *Cursor,
+                    IN multiboot_info_header *Info,
+                    IN CONST MULTIBOOT_REQUEST *Request,
+                    IN EFI_MEMORY_DESCRIPTOR *Map,
+                    IN UINTN MapSize,
+                    IN UINTN DescriptorSize,
+                    IN UINT32 DescriptorVersion)
+{
+    multiboot_info_tag_memory_map *MapTag;
+    multiboot_memory_map_entry *Entries;
+    multiboot_info_tag_efi_memory_map *EfiMapTag;
+    UINTN Count = 0;
+
+    MapTag = (multiboot_info_tag_memory_map *)Cursor;
+    Entries = (multiboot_memory_map_entry *)(Cursor + sizeof(multiboot_info_tag_memory_map));
+
+    for (UINTN Offset = 0; Offset < MapSize; Offset += DescriptorSize) {
+        EFI_MEMORY_DESCRIPTOR *Descriptor = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)Map + Offset);
+        UINT32 Type = MultibootMemoryType(Descriptor->Type);
+        UINT64 Length = EFI_PAGES_TO_SIZE(Descriptor->NumberOfPages);
+
+        /* Merge adjacent ranges of the same kind; firmware maps are heavily fragmented. */
+        if (Count > 0
+            && Entries[Count - 1].Type == Type
+            && (Entries[Count - 1].Base + Entries[Count - 1].Length) == Descriptor->PhysicalStart
+        ) {
+            Entries[Count - 1].Length += Length;
+            continue;
+        }
+
+        Entries[Count].Base     = Descriptor->PhysicalStart;
+        Entries[Count].Length   = Length;
+        Entries[Count].Type     = Type;
+        Entries[Count].Reserved = 0;
+        ++Count;
+    }
+
+    MapTag->Header.type  = MBI_MEMORY_MAP;
+    MapTag->Header.size  = sizeof(multiboot_info_tag_memory_map) + (Count * sizeof(multiboot_memory_map_entry));
+    MapTag->EntrySize    = sizeof(multiboot_memory_map_entry);
+    MapTag->EntryVersion = 0;
+    Cursor += MULTIBOOT_ALIGN_TAG(MapTag->Header.size);
+
+    if (Request->WantsEfiMemoryMap) {
+        EfiMapTag = (multiboot_info_tag_efi_memory_map *)
+            MultibootAppendTag(&Cursor, MBI_EFI_MEMORY_MAP, sizeof(multiboot_info_tag_efi_memory_map) + MapSize);
+        EfiMapTag->DescriptorSize    = DescriptorSize;
+        EfiMapTag->DescriptorVersion = DescriptorVersion;
+        CopyMem(EfiMapTag->EfiMemoryMap, Map, MapSize);
+    }
+
+    MultibootAppendTag(&Cursor, MBI_END, sizeof(multiboot_info_tag_header));
+
+    Info->total_size = (UINT32)(Cursor - (UINT8 *)Info);
+    Info->reserved = 0;
+}
+
+
+/**
+ * Switch to the kernel's stack and enter it the way Multiboot2 kernels expect:
+ *  the info magic in EAX and the info block's physical address in EBX. Should
+ *  the kernel ever return, the processor is halted.
+ */
+STATIC
+VOID
+__attribute__((noreturn))
+EFIAPI
+MultibootEnterKernel(IN UINT64 Entry,
+                     IN UINT64 InfoBlock,
+                     IN UINT64 StackTop)
+{
+    __asm__ __volatile__ (
+        "movq   %2, %%rsp       \n\t"
+        "leaq   1f(%%rip), %%rcx\n\t"
+        "pushq  %%rcx           \n\t"
+        "jmpq   *%3             \n\t"
+        "1:                     \n\t"
+        "cli                    \n\t"
+        "hlt                    \n\t"
+        "jmp    1b              \n\t"
+        :
+        : "a"((UINT64)MULTIBOOT_INFO_MAGIC), "b"(InfoBlock), "r"(StackTop), "r"(Entry)
+        : "rcx", "memory"
+    );
+
+    __builtin_unreachable();
+}
+
+
+/**
+ * Stop for good. Once ExitBootServices was called, there's neither a console to
+ *  report on nor a loader to fall back to.
+ */
+STATIC
+VOID
+__attribute__((noreturn))
+EFIAPI
+MultibootHalt(VOID)
+{
+    for (;;) {
+        __asm__ __volatile__ ("cli; hlt");
+    }
+}
+
+
+EFI_STATUS
+EFIAPI
+MultibootBootRamdisk(IN UINT8 *RamdiskImage,
+                     IN UINT64 RamdiskLength)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    MULTIBOOT_FAT_VOLUME Volume = {0};
+    MULTIBOOT_FAT_FILE Kernel = {0};
+    MULTIBOOT_REQUEST Request = {0};
+    UINT64 Entry = 0;
+    EFI_PHYSICAL_ADDRESS KernelBase = 0;
+    UINTN KernelPages = 0;
+    BOOLEAN ExitAttempted = FALSE;
+
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = NULL;
+    VOID *Rsdp = NULL;
+
+    EFI_MEMORY_DESCRIPTOR *Map = NULL;
+    UINTN MapSize = 0, MapCapacity = 0, MapKey = 0, DescriptorSize = 0;
+    UINT32 DescriptorVersion = 0;
+
+    EFI_PHYSICAL_ADDRESS InfoBase = 0xFFFFFFFF;
+    UINTN InfoPages = 0;
+    UINT8 *Cursor, *MapTagsStart;
+    multiboot_info_header *Info;
+    multiboot_info_tag_pointer_64 *Pointer;
+    CHAR8 Cmdline[sizeof(MFTAH_MULTIBOOT_CMDLINE) + sizeof(" " MFTAH_HANDOFF_CMDLINE_PARAM "0x") + 16] = {0};
+
+    PRINTLN(L"Looking for a Multiboot2 kernel in the ramdisk...");
+
+    Status = FatLocateVolume(RamdiskImage, RamdiskLength, &Volume);
+    if (EFI_ERROR(Status)) {
+        DPRINTLN(L"-- No FAT filesystem was found in the ramdisk.");
+        return EFI_NOT_FOUND;
+    }
+    DPRINTLN(L"-- Found a FAT%u volume at ramdisk offset '%llx'.", Volume.FatType, (UINT64)(Volume.Base - RamdiskImage));
+
+    Status = FatOpen(&Volume, MFTAH_MULTIBOOT_KERNEL_PATH, &Kernel);
+    if (EFI_ERROR(Status)) {
+        DPRINTLN(L"-- The kernel '%a' was not found in the ramdisk.", MFTAH_MULTIBOOT_KERNEL_PATH);
+        return EFI_NOT_FOUND;
+    }
+
+    uefi_call_wrapper(BS->LocateProtocol, 3, &gEfiGraphicsOutputProtocolGuid, NULL, (VOID **)&Gop);
+    if (NULL != Gop && (NULL == Gop->Mode || NULL == Gop->Mode->Info || PixelBltOnly == Gop->Mode->Info->PixelFormat)) {
+        Gop = NULL;
+    }
+
+    ERRCHECK(MultibootParseHeader(&Kernel, NULL != Gop, &Request));
+
+    /* Size the memory map, with room for descriptors added by the allocations below. */
+    Status = uefi_call_wrapper(BS->GetMemoryMap, 5, &MapSize, NULL, &MapKey, &DescriptorSize, &DescriptorVersion);
+    if (EFI_BUFFER_TOO_SMALL != Status || 0 == DescriptorSize) {
+        return EFI_ERROR(Status) ? Status : EFI_LOAD_ERROR;
+    }
+    MapCapacity = MapSize + (MULTIBOOT_MEMORY_MAP_SLACK * DescriptorSize);
+
+    /* The info block, the firmware map snapshot and the kernel's stack share one allocation,
+        which has to be addressable through the kernel's 32-bit EBX. */
+    InfoPages = EFI_SIZE_TO_PAGES(
+        MULTIBOOT_FIXED_INFO_SIZE
+        + sizeof(multiboot_info_tag_memory_map) + ((MapCapacity / DescriptorSize) * sizeof(multiboot_memory_map_entry))
+        + (Request.WantsEfiMemoryMap ? (sizeof(multiboot_info_tag_efi_memory_map) + MapCapacity + 8) : 0)
+        + MapCapacity
+    ) + EFI_SIZE_TO_PAGES(MFTAH_MULTIBOOT_STACK_SIZE);
+
+    ERRCHECK(MultibootLoadElf(&Kernel, &Entry, &KernelBase, &KernelPages));
+
+    Status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateMaxAddress, EfiLoaderData, InfoPages, &InfoBase);
+    if (EFI_ERROR(Status)) {
+        uefi_call_wrapper(BS->FreePages, 2, KernelBase, KernelPages);
+        return EFI_OUT_OF_RESOURCES;
+    }
+    FastSetMem((VOID *)(UINTN)InfoBase, EFI_PAGES_TO_SIZE(InfoPages), 0x00);
+
+    Info = (multiboot_info_header *)(UINTN)InfoBase;
+    Map = (EFI_MEMORY_DESCRIPTOR *)(UINTN)(InfoBase + EFI_PAGES_TO_SIZE(InfoPages)
+        - MFTAH_MULTIBOOT_STACK_SIZE - MapCapacity);
+    Map = (EFI_MEMORY_DESCRIPTOR *)((UINTN)Map & ~((UINTN)7));
+
+    Cursor = (UINT8 *)Info + sizeof(multiboot_info_header);
+
+    MultibootBuildCmdline(Cmdline);
+    MultibootAppendString(&Cursor, MBI_CMD_LINE, Cmdline);
+    MultibootAppendString(&Cursor, MBI_LOADER_NAME, MFTAH_MULTIBOOT_LOADER_NAME);
+
+    Pointer = (multiboot_info_tag_pointer_64 *)MultibootAppendTag(&Cursor, MBI_EFI_ST_64, sizeof(multiboot_info_tag_pointer_64));
+    Pointer->physical_address = (UINT64)(UINTN)ST;
+
+    if (NULL != Gop) {
+        MultibootAppendFramebuffer(&Cursor, Gop);
+    }
+
+    if (EFI_SUCCESS == LibGetSystemConfigurationTable(&Acpi20TableGuid, &Rsdp) && NULL != Rsdp) {
+        /* The RSDP's own length field covers the extended (2.0+) structure. */
+        UINT32 RsdpLength = MIN(Le32((UINT8 *)Rsdp + 20), 64);
+        UINT8 *Tag = (UINT8 *)MultibootAppendTag(&Cursor, MBI_ACPI_20, sizeof(multiboot_info_tag_header) + RsdpLength);
+        CopyMem(Tag + sizeof(multiboot_info_tag_header), Rsdp, RsdpLength);
+    } else if (EFI_SUCCESS == LibGetSystemConfigurationTable(&AcpiTableGuid, &Rsdp) && NULL != Rsdp) {
+        UINT8 *Tag = (UINT8 *)MultibootAppendTag(&Cursor, MBI_ACPI_10, sizeof(multiboot_info_tag_header) + 20);
+        CopyMem(Tag + sizeof(multiboot_info_tag_header), Rsdp, 20);
+    }
+
+    if (Request.WantsImageHandle) {
+        Pointer = (multiboot_info_tag_pointer_64 *)MultibootAppendTag(&Cursor, MBI_IMG_HND_64, sizeof(multiboot_info_tag_pointer_64));
+        Pointer->physical_address = (UINT64)(UINTN)gImageHandle;
+    }
+
+    if (0 != BootInfoTableAddress()) {
+        Pointer = (multiboot_info_tag_pointer_64 *)MultibootAppendTag(&Cursor, MFTAH_BOOTINFO_MULTIBOOT_TAG, sizeof(multiboot_info_tag_pointer_64));
+        Pointer->physical_address = BootInfoTableAddress();
+    }
+
+    if (Request.KeepBootServices) {
+        MultibootAppendTag(&Cursor, MBI_NO_EXIT_BOOT_SVCS, sizeof(multiboot_info_tag_header));
+    }
+
+    MapTagsStart = Cursor;
+
+    PRINTLN(L"Booting '%a' directly...", MFTAH_MULTIBOOT_KERNEL_PATH);
+    ProfilerBegin(ProfilePhaseChainload);
+
+    /* Nothing allocated through the MFTAH hooks or by decryption workers outlives the loader.
+        From here on there is no returning to the chainloading fallback. */
+    ArenaDestroy(&gLoaderArena);
+    ReleaseDecryptionArenas();
+
+    ProfilerEnd(ProfilePhaseChainload, 0);
+    ProfilerPublish();
+    BootInfoFinalize();
+
+    /* The snapshot is invalidated by any allocation, so take it last. ExitBootServices
+        may legitimately fail once if the firmware changed the map in the meantime. */
+    for (UINTN Attempt = 0; Attempt < 2; ++Attempt) {
+        MapSize = MapCapacity;
+        Status = uefi_call_wrapper(BS->GetMemoryMap, 5, &MapSize, Map, &MapKey, &DescriptorSize, &DescriptorVersion);
+        if (EFI_ERROR(Status)) {
+            break;
+        }
+
+        MultibootFinishInfo(MapTagsStart, Info, &Request, Map, MapSize, DescriptorSize, DescriptorVersion);
+
+        if (Request.KeepBootServices) {
+            break;
+        }
+
+        Status = uefi_call_wrapper(BS->ExitBootServices, 2, gImageHandle, MapKey);
+        ExitAttempted = TRUE;
+        if (EFI_INVALID_PARAMETER != Status) {
+            break;
+        }
+    }
+
+    if (EFI_ERROR(Status)) {
+        /* After a failed ExitBootServices only the memory map services may be used. */
+        if (ExitAttempted) {
+            MultibootHalt();
+        }
+
+        PANIC(L"Could not take the memory map for the kernel.");
+    }
+
+    if (!Request.KeepBootServices) {
+        __asm__ __volatile__ ("cli");
+    }
+
+    MultibootEnterKernel(Request.HasEfiEntry ? Request.EfiEntry : Entry,
+                         (UINT64)(UINTN)Info,
+                         InfoBase + EFI_PAGES_TO_SIZE(InfoPages));
+}
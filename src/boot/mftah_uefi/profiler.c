@@ -0,0 +1,192 @@
+#include "core/profiler.h"
+
+
+
+static MFTAH_BOOT_PROFILE mBootProfile = {0};
+
+/* When each phase was last entered, or 0 while it isn't running. */
+static UINT64 mPhaseStart[ProfilePhaseMax] = {0};
+
+static CONST CHAR16 *mPhaseNames[ProfilePhaseMax] = {
+    L"Environment",
+    L"DiscoverPayloads",
+    L"  LoaderHash",
+    L"PasswordEntry",
+    L"CheckPassword",
+    L"ReadPayload",
+    L"HashPayload",
+    L"Decrypt",
+    L"RegisterRamdisk",
+    L"Chainload",
+    L"PasswordKdf",
+};
+
+
+static
+inline
+UINT64
+ReadTsc(VOID)
+{
+    UINT32 Low, High;
+
+    __asm__ __volatile__ ("rdtsc" : "=a"(Low), "=d"(High));
+    return ((UINT64)High << 32) | Low;
+}
+
+
+/**
+ * Convert TSC ticks to microseconds using the calibrated frequency.
+ */
+static
+UINT64
+TicksToMicroseconds(IN UINT64 Ticks)
+{
+    if (0 == mBootProfile.TscFrequency) {
+        return 0;
+    }
+
+    /* Split the division so that long phases can't overflow the multiplication. */
+    return ((Ticks / mBootProfile.TscFrequency) * 1000000)
+        + (((Ticks % mBootProfile.TscFrequency) * 1000000) / mBootProfile.TscFrequency);
+}
+
+
+VOID
+EFIAPI
+ProfilerInitialize(VOID)
+{
+    UINT64 Before, After;
+
+    mBootProfile.Signature  = MFTAH_BOOT_PROFILE_SIGNATURE;
+    mBootProfile.Version    = MFTAH_BOOT_PROFILE_VERSION;
+    mBootProfile.PhaseCount = ProfilePhaseMax;
+    mBootProfile.EntryTsc   = ReadTsc();
+
+    Before = ReadTsc();
+    uefi_call_wrapper(BS->Stall, 1, MFTAH_PROFILE_CALIBRATION_US);
+    After = ReadTsc();
+
+    mBootProfile.TscFrequency = ((After - Before) * 1000000) / MFTAH_PROFILE_CALIBRATION_US;
+}
+
+
+VOID
+EFIAPI
+ProfilerBegin(IN MFTAH_PROFILE_PHASE Phase)
+{
+    if (Phase >= ProfilePhaseMax) return;
+
+    mPhaseStart[Phase] = ReadTsc();
+
+    if (0 == mBootProfile.Phases[Phase].FirstStart) {
+        mBootProfile.Phases[Phase].FirstStart = mPhaseStart[Phase];
+    }
+}
+
+
+VOID
+EFIAPI
+ProfilerEnd(IN MFTAH_PROFILE_PHASE Phase,
+            IN UINT64 Bytes)
+{
+    if (Phase >= ProfilePhaseMax || 0 == mPhaseStart[Phase]) return;
+
+    mBootProfile.Phases[Phase].Ticks += ReadTsc() - mPhaseStart[Phase];
+    mBootProfile.Phases[Phase].Bytes += Bytes;
+    mBootProfile.Phases[Phase].Count++;
+
+    mPhaseStart[Phase] = 0;
+}
+
+
+VOID
+EFIAPI
+ProfilerPrintSummary(VOID)
+{
+    MFTAH_PROFILE_PHASE_RECORD *Record;
+    UINT64 Microseconds;
+
+    PRINTLN(L"\r\n-- Boot profile (TSC at %llu kHz):", mBootProfile.TscFrequency / 1000);
+    PRINTLN(L"    %-18s %8s %12s %10s", L"Phase", L"Runs", L"Time (ms)", L"MiB/s");
+
+    for (UINTN i = 0; i < ProfilePhaseMax; ++i) {
+        Record = &(mBootProfile.Phases[i]);
+        if (0 == Record->Count) continue;
+
+        Microseconds = TicksToMicroseconds(Record->Ticks);
+
+        if (0 != Record->Bytes && 0 != Microseconds) {
+            PRINTLN(
+                L"    %-18s %8u %8llu.%03llu %10llu",
+                mPhaseNames[i],
+                Record->Count,
+                Microseconds / 1000,
+                Microseconds % 1000,
+                ((Record->Bytes * 1000000) / Microseconds) >> 20
+            );
+        } else {
+            PRINTLN(
+                L"    %-18s %8u %8llu.%03llu %10s",
+                mPhaseNames[i],
+                Record->Count,
+                Microseconds / 1000,
+                Microseconds % 1000,
+                L"-"
+            );
+        }
+    }
+
+    Microseconds = TicksToMicroseconds(ReadTsc() - mBootProfile.EntryTsc);
+    PRINTLN(L"    %-18s %8s %8llu.%03llu\r\n", L"Total", L"", Microseconds / 1000, Microseconds % 1000);
+}
+
+
+EFI_STATUS
+EFIAPI
+ProfilerPublish(VOID)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+
+    mBootProfile.PublishTsc = ReadTsc();
+
+#if MFTAH_PRINT_PROFILE == 1 || EFI_DEBUG == 1
+    ProfilerPrintSummary();
+#endif
+
+    DPRINTLN(L"-- Setting boot profile variable '__MFTAH_BOOT_PROFILE'.");
+    ERRCHECK_UEFI(
+        ST->RuntimeServices->SetVariable,
+        5,
+        L"__MFTAH_BOOT_PROFILE",
+        &gXmitVendorGuid,
+        EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+        sizeof(MFTAH_BOOT_PROFILE),
+        &mBootProfile
+    );
+
+    return EFI_SUCCESS;
+}
+
+
+CONST MFTAH_BOOT_PROFILE *
+EFIAPI
+ProfilerGetRecord(VOID)
+{
+    return &mBootProfile;
+}
+
+
+UINT64
+EFIAPI
+ProfilerReadTicks(VOID)
+{
+    return ReadTsc();
+}
+
+
+UINT64
+EFIAPI
+ProfilerTicksToMicroseconds(IN UINT64 Ticks)
+{
+    return TicksToMicroseconds(Ticks);
+}
@@ -0,0 +1,185 @@
+#include "core/progress.h"
+#include "core/util.h"
+
+
+
+STATIC UINT64 VOLATILE mProgressCurrent = 0;
+STATIC UINT64 VOLATILE mProgressTotal = 0;
+
+/* The percentage last drawn, so unchanged progress isn't drawn again. */
+STATIC INTN mProgressDrawn = -1;
+
+STATIC EFI_EVENT mProgressTimer = NULL;
+STATIC BOOLEAN mProgressActive = FALSE;
+
+STATIC EFI_GRAPHICS_OUTPUT_PROTOCOL *mProgressGop = NULL;
+
+STATIC CONST EFI_GRAPHICS_OUTPUT_BLT_PIXEL mProgressTrackColor = { 0x40, 0x40, 0x40, 0x00 };
+STATIC CONST EFI_GRAPHICS_OUTPUT_BLT_PIXEL mProgressFillColor  = { 0x30, 0xC0, 0x30, 0x00 };
+
+
+
+/**
+ * The recorded progress as a whole percentage, or -1 when there's nothing to show.
+ */
+STATIC
+INTN
+EFIAPI
+ProgressPercent(VOID)
+{
+    UINT64 Current = mProgressCurrent;
+    UINT64 Total = mProgressTotal;
+
+    if (0 == Total) return -1;
+
+    /* Split the division so huge totals can't overflow the multiplication. */
+    return (INTN)MIN(100, (Current >= Total)
+        ? 100
+        : ((Current / Total) * 100) + (((Current % Total) * 100) / Total));
+}
+
+
+/**
+ * Draw the progress as one line of text, written with a single call.
+ */
+STATIC
+VOID
+EFIAPI
+ProgressDrawText(IN INTN Percent)
+{
+    CHAR16 Bar[MFTAH_PROGRESS_TEXT_WIDTH + 1] = {0};
+    UINTN Filled = (UINTN)((Percent * MFTAH_PROGRESS_TEXT_WIDTH) / 100);
+
+    for (UINTN i = 0; i < MFTAH_PROGRESS_TEXT_WIDTH; ++i) {
+        Bar[i] = (i < Filled) ? L'=' : L' ';
+    }
+
+    Print(L"\r  %3d%% [%s] (%16llx / %16llx)   ", Percent, Bar, mProgressCurrent, mProgressTotal);
+}
+
+
+/**
+ * Draw the progress as a bar near the bottom of the framebuffer.
+ */
+STATIC
+VOID
+EFIAPI
+ProgressDrawBar(IN INTN Percent)
+{
+    UINTN Width = (mProgressGop->Mode->Info->HorizontalResolution * 3) / 5;
+    UINTN Left = (mProgressGop->Mode->Info->HorizontalResolution - Width) / 2;
+    UINTN Top = mProgressGop->Mode->Info->VerticalResolution - MFTAH_PROGRESS_BAR_MARGIN - MFTAH_PROGRESS_BAR_HEIGHT;
+    UINTN Filled = (Width * (UINTN)Percent) / 100;
+
+    if (Filled > 0) {
+        uefi_call_wrapper(mProgressGop->Blt, 10, mProgressGop,
+                          (EFI_GRAPHICS_OUTPUT_BLT_PIXEL *)&mProgressFillColor, EfiBltVideoFill,
+                          0, 0, Left, Top, Filled, MFTAH_PROGRESS_BAR_HEIGHT, 0);
+    }
+    if (Filled < Width) {
+        uefi_call_wrapper(mProgressGop->Blt, 10, mProgressGop,
+                          (EFI_GRAPHICS_OUTPUT_BLT_PIXEL *)&mProgressTrackColor, EfiBltVideoFill,
+                          0, 0, Left + Filled, Top, Width - Filled, MFTAH_PROGRESS_BAR_HEIGHT, 0);
+    }
+}
+
+
+/**
+ * The timer event's notification function. Draws the progress if it changed.
+ */
+STATIC
+VOID
+EFIAPI
+ProgressRender(IN EFI_EVENT Event,
+               IN VOID *Context)
+{
+    INTN Percent = ProgressPercent();
+
+    (VOID)Event;
+    (VOID)Context;
+
+    if (!mProgressActive || Percent < 0 || Percent == mProgressDrawn) return;
+
+    mProgressDrawn = Percent;
+
+    if (NULL != mProgressGop) {
+        ProgressDrawBar(Percent);
+    } else {
+        ProgressDrawText(Percent);
+    }
+}
+
+
+EFI_STATUS
+EFIAPI
+ProgressInitialize(VOID)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+
+#if MFTAH_PROGRESS_FRAMEBUFFER == 1
+    Status = uefi_call_wrapper(BS->LocateProtocol, 3,
+                               &gEfiGraphicsOutputProtocolGuid, NULL, (VOID **)&mProgressGop);
+    if (EFI_ERROR(Status) || NULL == mProgressGop || NULL == mProgressGop->Mode
+        || NULL == mProgressGop->Mode->Info
+        || mProgressGop->Mode->Info->VerticalResolution <= (MFTAH_PROGRESS_BAR_MARGIN + MFTAH_PROGRESS_BAR_HEIGHT)
+    ) {
+        DPRINTLN(L"-- No usable framebuffer; progress is drawn as text.");
+        mProgressGop = NULL;
+    }
+#endif
+
+    ERRCHECK_UEFI(BS->CreateEvent, 5,
+                  (EVT_TIMER | EVT_NOTIFY_SIGNAL), TPL_CALLBACK,
+                  (EFI_EVENT_NOTIFY)ProgressRender, NULL, &mProgressTimer);
+
+    return EFI_SUCCESS;
+}
+
+
+VOID
+EFIAPI
+ProgressBegin(VOID)
+{
+    mProgressCurrent = 0;
+    mProgressTotal = 0;
+    mProgressDrawn = -1;
+    mProgressActive = TRUE;
+
+    if (NULL != mProgressTimer) {
+        /* The period is given in units of 100 ns. */
+        uefi_call_wrapper(BS->SetTimer, 3, mProgressTimer, TimerPeriodic,
+                          (UINT64)MFTAH_PROGRESS_INTERVAL_MS * 10000);
+    }
+}
+
+
+VOID
+EFIAPI
+ProgressUpdate(IN UINT64 Current,
+               IN UINT64 Total)
+{
+    mProgressTotal = Total;
+    mProgressCurrent = Current;
+}
+
+
+VOID
+EFIAPI
+ProgressEnd(VOID)
+{
+    INTN Percent;
+
+    if (NULL != mProgressTimer) {
+        uefi_call_wrapper(BS->SetTimer, 3, mProgressTimer, TimerCancel, 0);
+    }
+
+    mProgressActive = FALSE;
+
+    Percent = ProgressPercent();
+    if (Percent < 0) return;
+
+    if (NULL != mProgressGop) {
+        ProgressDrawBar(Percent);
+    }
+    ProgressDrawText(Percent);
+}
@@ -2,6 +2,8 @@
 #pragma clang diagnostic ignored "-Wunused-variable"
 
 #include "drivers/ramdisk.h"
+#include "core/handoff.h"
+#include "core/hotprofile.h"
 
 
 
@@ -69,6 +71,22 @@ mRamDiskBlockIo2Template = {
 };
 
 
+/* Every registered ramdisk, indexed by its instance number. */
+static
+RAMDISK_PRIVATE_DATA *
+mRamDiskInstances[RAM_DISK_MAX_INSTANCES] = { NULL };
+
+/* The BlockIo2 transfers still running on APs, indexed like mRamDiskInstances. */
+static
+RAMDISK_ASYNC_IN_FLIGHT
+mRamDiskAsyncInFlight[RAM_DISK_MAX_INSTANCES] = {0};
+
+/* The NVDIMM root SSDT is shared by all ramdisks, and one NFIT describes all of them. */
+static BOOLEAN mSsdtInstalled = FALSE;
+static BOOLEAN mNfitInstalled = FALSE;
+static UINTN mNfitTableKey = 0;
+
+
 
 /**
  * Publish the SSDT table containing a root NVDIMM device.
@@ -103,6 +121,10 @@ RamDiskPublishSsdt()
         0x00, 0xa4, 0x0a, 0x0f, 
     };
 
+    if (mSsdtInstalled) {
+        return EFI_SUCCESS;
+    }
+
     DPRINTLN(L"-- Publishing RamDisk SSDT entry for ACPI.");
     MEMDUMP(nvdimmRootAml, sizeof(nvdimmRootAml));
     DPRINTLN(L"");
@@ -130,12 +152,152 @@ RamDiskPublishSsdt()
         &DummySsdtTableKey
     );
 
+    mSsdtInstalled = !EFI_ERROR(Status);
     return Status;
 }
 
 
 /**
- * Publish the given ramdisk to the ACPI NVDIMM Firmware Interface Table (NFIT).
+ * Remove the NFIT installed under the given table key.
+ *
+ * @param[in]  TableKey  The key InstallAcpiTable returned for the NFIT.
+ *
+ * @returns Whether the NFIT could be removed.
+ */
+static
+EFI_STATUS
+RamDiskUninstallNfit(IN UINTN TableKey)
+{
+    return uefi_call_wrapper(
+        gAcpiTableProtocol->UninstallAcpiTable,
+        2,
+        gAcpiTableProtocol,
+        TableKey
+    );
+}
+
+
+/**
+ * (Re)build the NFIT so that it holds one SPA range for every registered ramdisk
+ *  which was published to it. The new NFIT is installed before any previously
+ *  installed one is removed, so on failure the old NFIT stays in place.
+ *
+ * @returns Whether the publishing operation succeeded.
+ */
+static
+EFI_STATUS
+RamDiskRebuildNfit()
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_ACPI_DESCRIPTION_HEADER *NfitHeader;
+    EFI_ACPI_6_4_NFIT_SYSTEM_PHYSICAL_ADDRESS_RANGE_STRUCTURE *SpaRange;
+    RAMDISK_PRIVATE_DATA *PrivateData;
+    VOID *Nfit;
+    UINT32 NfitLen;
+    UINT16 RangeCount = 0;
+    UINTN NewTableKey = 0;
+
+    if (NULL == gAcpiTableProtocol) {
+        return EFI_NOT_FOUND;
+    }
+
+    for (UINTN i = 0; i < RAM_DISK_MAX_INSTANCES; ++i) {
+        if (NULL != mRamDiskInstances[i] && mRamDiskInstances[i]->InNfit) {
+            RangeCount++;
+        }
+    }
+
+    if (0 == RangeCount) {
+        if (mNfitInstalled) {
+            Status = RamDiskUninstallNfit(mNfitTableKey);
+            mNfitInstalled = EFI_ERROR(Status);
+        }
+
+        return Status;
+    }
+
+    /* Assume that if no NFIT is in the ACPI table, then there is no NVDIMM 
+          device in the \SB scope. So report one via the SSDT. */
+    ERRCHECK(RamDiskPublishSsdt());
+
+    /* TODO! Determine if one exists already and append the SPA. */
+    DPRINTLN(L"\r\nRamDiskPublishNfit: Creating an NFIT with %u SPA range(s).", RangeCount);
+
+    NfitLen = 40 + (RangeCount * sizeof(EFI_ACPI_6_4_NFIT_SYSTEM_PHYSICAL_ADDRESS_RANGE_STRUCTURE));
+    Nfit = AllocateZeroPool(NfitLen);
+    if (NULL == Nfit) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    UINT8 PcdAcpiDefaultOemId[6] = { 'S', 'O', 'L', 'S', ' ', ' ' };
+
+    NfitHeader                  = (EFI_ACPI_DESCRIPTION_HEADER *)Nfit;
+    NfitHeader->Signature       = EFI_ACPI_NFIT_SIGNATURE;
+    NfitHeader->Length          = NfitLen;
+    NfitHeader->Revision        = EFI_ACPI_6_4_NVDIMM_FIRMWARE_INTERFACE_TABLE_REVISION;
+    NfitHeader->OemRevision     = MFTAH_RELEASE_DATE;   /* OEM Revision by some MFTAH release date. */
+    NfitHeader->CreatorId       = MFTAH_CREATOR_ID;
+    NfitHeader->CreatorRevision = 0x1;   /* Should always be 1. */
+    NfitHeader->OemTableId      = MFTAH_OEM_TABLE_ID;
+    CopyMem(NfitHeader->OemId, &PcdAcpiDefaultOemId[0], sizeof(NfitHeader->OemId));
+
+    /* Fill in one SPA Range Structure per published ramdisk. */
+    SpaRange = (EFI_ACPI_6_4_NFIT_SYSTEM_PHYSICAL_ADDRESS_RANGE_STRUCTURE *)
+               ((UINT8 *)Nfit + 40);
+    RangeCount = 0;
+
+    for (UINTN i = 0; i < RAM_DISK_MAX_INSTANCES; ++i) {
+        PrivateData = mRamDiskInstances[i];
+        if (NULL == PrivateData || !PrivateData->InNfit) continue;
+
+        SpaRange->Type                             = EFI_ACPI_6_4_NFIT_SYSTEM_PHYSICAL_ADDRESS_RANGE_STRUCTURE_TYPE;
+        SpaRange->Length                           = sizeof(EFI_ACPI_6_4_NFIT_SYSTEM_PHYSICAL_ADDRESS_RANGE_STRUCTURE);
+        SpaRange->SPARangeStructureIndex           = ++RangeCount;
+        SpaRange->SystemPhysicalAddressRangeBase   = PrivateData->StartingAddr;
+        SpaRange->SystemPhysicalAddressRangeLength = PrivateData->Size;
+        CopyMem(&SpaRange->AddressRangeTypeGUID, &PrivateData->TypeGuid, sizeof(EFI_GUID));
+
+        SpaRange++;
+    }
+
+    /* Finally, calculate the checksum of the NFIT table. */
+    NfitHeader->Checksum = CalculateCheckSum8((UINT8 *)Nfit, NfitHeader->Length);
+
+    /* Publish the NFIT to the ACPI table. */
+    Status = uefi_call_wrapper(
+        gAcpiTableProtocol->InstallAcpiTable,
+        4,
+        gAcpiTableProtocol,
+        Nfit,
+        NfitHeader->Length,
+        &NewTableKey
+    );
+    FreePool(Nfit);
+
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    /* Only retire the old NFIT once its replacement is in place. If it won't go,
+        take the new one back out so the OS doesn't see two of them. */
+    if (mNfitInstalled) {
+        Status = RamDiskUninstallNfit(mNfitTableKey);
+        if (EFI_ERROR(Status)) {
+            RamDiskUninstallNfit(NewTableKey);
+            return Status;
+        }
+    }
+
+    mNfitTableKey = NewTableKey;
+    mNfitInstalled = TRUE;
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Publish the given ramdisk to the ACPI NVDIMM Firmware Interface Table (NFIT),
+ *  alongside every other ramdisk which is already published.
  * 
  * @param[in]  PrivateData  A pointer to some existing ramdisk data meta-structure.
  * 
@@ -153,16 +315,9 @@ RamDiskPublishNfit(IN RAMDISK_PRIVATE_DATA *PrivateData)
     UINTN TableIndex;
     VOID *TableHeader;
     EFI_ACPI_TABLE_VERSION TableVersion;
-    UINTN TableKey;
-    EFI_ACPI_DESCRIPTION_HEADER *NfitHeader;
-    EFI_ACPI_6_4_NFIT_SYSTEM_PHYSICAL_ADDRESS_RANGE_STRUCTURE *SpaRange;
-    VOID *Nfit;
-    UINT32 NfitLen;
     UINTN MapKey;
     UINTN DescriptorSize;
     UINT32 DescriptorVersion;
-    UINT64 CurrentData;
-    UINT8 Checksum;
     BOOLEAN MemoryFound;
 
     MemoryMapSize = 0;
@@ -235,60 +390,2023 @@ RamDiskPublishNfit(IN RAMDISK_PRIVATE_DATA *PrivateData)
         return EFI_NOT_FOUND;
     }
 
-    /* Assume that if no NFIT is in the ACPI table, then there is no NVDIMM 
-          device in the \SB scope. So report one via the SSDT. */
-    ERRCHECK(RamDiskPublishSsdt());
+    PrivateData->InNfit = TRUE;
+    return RamDiskRebuildNfit();
+}
 
-    /* TODO! Determine if one exists already and append the SPA. */
-    DPRINTLN(L"\r\nRamDiskPublishNfit: No NFIT is in the ACPI Table, will create one.");
 
-    NfitLen = 40 + 56;// + 48;
-            //sizeof(EFI_ACPI_6_1_NVDIMM_FIRMWARE_INTERFACE_TABLE) +
-            //sizeof(EFI_ACPI_6_1_NFIT_SYSTEM_PHYSICAL_ADDRESS_RANGE_STRUCTURE) +
-            //sizeof(EFI_ACPI_6_1_NFIT_REGION_MAPPING_STRUCTURE);
-    Nfit = AllocateZeroPool(NfitLen);
-    if (NULL == Nfit) {
+/**
+ * Validate the parameters of a block read or write request against the ramdisk media.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data.
+ * @param[in]  MediaId      The media ID that the request is for.
+ * @param[in]  Lba          The starting logical block address of the request.
+ * @param[in]  BufferSize   The size of the request buffer in bytes.
+ * @param[in]  Buffer       The request buffer.
+ * @param[in]  IsWrite      Whether the request would write to the ramdisk.
+ *
+ * @returns EFI_SUCCESS if the request can be serviced, or the BlockIo error status otherwise.
+ */
+static
+EFI_STATUS
+RamDiskCheckRequest(IN RAMDISK_PRIVATE_DATA *PrivateData,
+                    IN UINT32 MediaId,
+                    IN EFI_LBA Lba,
+                    IN UINTN BufferSize,
+                    IN VOID *Buffer,
+                    IN BOOLEAN IsWrite)
+{
+    UINTN NumberOfBlocks;
+
+    if (MediaId != PrivateData->Media.MediaId) {
+        return EFI_MEDIA_CHANGED;
+    }
+
+    if (IsWrite && TRUE == PrivateData->Media.ReadOnly) {
+        return EFI_WRITE_PROTECTED;
+    }
+
+    if (NULL == Buffer) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (0 == BufferSize) {
+        return EFI_SUCCESS;
+    }
+
+    if ((BufferSize % PrivateData->Media.BlockSize) != 0) {
+        return EFI_BAD_BUFFER_SIZE;
+    }
+
+    if (Lba > PrivateData->Media.LastBlock) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    NumberOfBlocks = BufferSize / PrivateData->Media.BlockSize;
+    if ((Lba + NumberOfBlocks - 1) > PrivateData->Media.LastBlock) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+/* The deduplicating block store shared by every registered ramdisk. */
+static RAMDISK_DEDUP_STORE *mDedupStore = NULL;
+
+/* The slab which unique blocks of later ramdisks are currently copied into. */
+static EFI_PHYSICAL_ADDRESS mDedupSlab = 0;
+static UINT64 mDedupSlabUsed = RAM_DISK_DEDUP_SLAB_SIZE;
+
+/* The ramdisk whose own memory backs the blocks it brought into the store. */
+static RAMDISK_PRIVATE_DATA *mDedupSeed = NULL;
+
+/* Block slots which nothing references anymore, chained through their 'Next'. */
+static UINT32 mDedupFreeBlocks = RAM_DISK_DEDUP_NONE;
+static UINT64 mDedupFreeBlockCount = 0;
+
+/* Slab memory of freed blocks, chained through the first 8 bytes of each. */
+static UINT64 mDedupFreeData = 0;
+
+
+#define RAM_DISK_DEDUP_BLOCKS(Store) \
+    ((RAMDISK_DEDUP_BLOCK *)(UINTN)(Store)->Blocks)
+#define RAM_DISK_DEDUP_BUCKETS(Store) \
+    ((UINT32 *)(UINTN)(Store)->Buckets)
+#define RAM_DISK_DEDUP_MAP(Disk) \
+    ((UINT32 *)(UINTN)(Disk)->BlockMap)
+
+
+/**
+ * Fingerprint one full dedup block. This only needs to spread blocks across
+ *  buckets: every match is confirmed byte-for-byte before a block is shared.
+ *  Buckets are picked by the low bits, so all of them are kept; only a zero hash
+ *  is remapped, since that means 'not indexed'.
+ *
+ * @param[in]  Data  The block to hash, RAM_DISK_DEDUP_BLOCK_SIZE bytes long.
+ *
+ * @returns The nonzero fingerprint of the block.
+ */
+static
+UINT64
+RamDiskDedupHash(IN CONST VOID *Data)
+{
+    CONST UINT64 *Words = (CONST UINT64 *)Data;
+    UINT64 Hash = 0xCBF29CE484222325ULL;
+
+    for (UINTN i = 0; i < RAM_DISK_DEDUP_BLOCK_SIZE / sizeof(UINT64); ++i) {
+        Hash ^= Words[i];
+        Hash = ((Hash << 31) | (Hash >> 33)) * 0x100000001B3ULL;
+    }
+
+    Hash ^= (Hash >> 29);
+    return (0 != Hash) ? Hash : 1;
+}
+
+
+/**
+ * Make sure the store has room for more blocks. Growing the store reallocates the
+ *  block array and rehashes every indexed block into a larger bucket table.
+ *
+ * @param[in]  Needed  The amount of blocks about to be added.
+ *
+ * @retval EFI_SUCCESS           At least 'Needed' free block slots are available.
+ * @retval EFI_OUT_OF_RESOURCES  The store could not be grown.
+ */
+static
+EFI_STATUS
+RamDiskDedupReserve(IN UINT64 Needed)
+{
+    RAMDISK_DEDUP_STORE *Store = mDedupStore;
+    RAMDISK_DEDUP_BLOCK *NewBlocks = NULL;
+    UINT32 *NewBuckets = NULL;
+    UINT64 NewCapacity, NewBucketCount, Slot;
+
+    if ((Store->BlockCount + Needed) <= (Store->BlockCapacity + mDedupFreeBlockCount)) {
+        return EFI_SUCCESS;
+    }
+
+    NewCapacity = MAX(Store->BlockCapacity * 2, Store->BlockCount + Needed);
+    if (NewCapacity >= RAM_DISK_DEDUP_NONE) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    for (NewBucketCount = 1; NewBucketCount < NewCapacity; NewBucketCount <<= 1);
+
+    uefi_call_wrapper(BS->AllocatePool, 3, EfiReservedMemoryType,
+                      NewCapacity * sizeof(RAMDISK_DEDUP_BLOCK), (VOID **)&NewBlocks);
+    uefi_call_wrapper(BS->AllocatePool, 3, EfiReservedMemoryType,
+                      NewBucketCount * sizeof(UINT32), (VOID **)&NewBuckets);
+    if (NULL == NewBlocks || NULL == NewBuckets) {
+        if (NULL != NewBlocks) FreePool(NewBlocks);
+        if (NULL != NewBuckets) FreePool(NewBuckets);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    SetMem(NewBuckets, NewBucketCount * sizeof(UINT32), 0xFF);
+    if (Store->BlockCount > 0) {
+        CopyMem(NewBlocks, RAM_DISK_DEDUP_BLOCKS(Store), Store->BlockCount * sizeof(RAMDISK_DEDUP_BLOCK));
+    }
+
+    for (UINT64 Id = 0; Id < Store->BlockCount; ++Id) {
+        if (0 == NewBlocks[Id].Hash) continue;
+
+        Slot = NewBlocks[Id].Hash & (NewBucketCount - 1);
+        NewBlocks[Id].Next = NewBuckets[Slot];
+        NewBuckets[Slot] = (UINT32)Id;
+    }
+
+    if (0 != Store->Blocks) FreePool(RAM_DISK_DEDUP_BLOCKS(Store));
+    if (0 != Store->Buckets) FreePool(RAM_DISK_DEDUP_BUCKETS(Store));
+
+    Store->Blocks        = (UINT64)(UINTN)NewBlocks;
+    Store->Buckets       = (UINT64)(UINTN)NewBuckets;
+    Store->BlockCapacity = NewCapacity;
+    Store->BucketCount   = NewBucketCount;
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Hand out backing memory for one new dedup block, preferring that of a freed block.
+ *
+ * @returns The address of RAM_DISK_DEDUP_BLOCK_SIZE free bytes, or 0 if out of memory.
+ */
+static
+UINT64
+RamDiskDedupAllocData(VOID)
+{
+    EFI_STATUS Status;
+    EFI_PHYSICAL_ADDRESS Slab = 0;
+    UINT64 Data;
+
+    if (0 != mDedupFreeData) {
+        Data = mDedupFreeData;
+        mDedupFreeData = *((UINT64 *)(UINTN)Data);
+        return Data;
+    }
+
+    if ((mDedupSlabUsed + RAM_DISK_DEDUP_BLOCK_SIZE) > RAM_DISK_DEDUP_SLAB_SIZE) {
+        /* The remainder of an exhausted slab is left to the store; slabs are never returned. */
+        Status = uefi_call_wrapper(
+            BS->AllocatePages,
+            4,
+            AllocateAnyPages,
+            EfiReservedMemoryType,
+            EFI_SIZE_TO_PAGES(RAM_DISK_DEDUP_SLAB_SIZE),
+            &Slab
+        );
+        if (EFI_ERROR(Status)) {
+            return 0;
+        }
+
+        mDedupSlab = Slab;
+        mDedupSlabUsed = 0;
+    }
+
+    mDedupSlabUsed += RAM_DISK_DEDUP_BLOCK_SIZE;
+    return (UINT64)mDedupSlab + mDedupSlabUsed - RAM_DISK_DEDUP_BLOCK_SIZE;
+}
+
+
+/**
+ * Add a block to the store, in a freed slot if there is one. The caller must have
+ *  reserved room for it.
+ *
+ * @param[in]  Hash  The block's fingerprint, or 0 to leave it out of the index.
+ * @param[in]  Data  The address of the block's contents.
+ *
+ * @returns The ID of the new block, holding a single reference.
+ */
+static
+UINT32
+RamDiskDedupAppend(IN UINT64 Hash,
+                   IN UINT64 Data)
+{
+    RAMDISK_DEDUP_STORE *Store = mDedupStore;
+    RAMDISK_DEDUP_BLOCK *Block;
+    UINT32 Id;
+    UINT64 Slot;
+
+    if (RAM_DISK_DEDUP_NONE != mDedupFreeBlocks) {
+        Id = mDedupFreeBlocks;
+        mDedupFreeBlocks = RAM_DISK_DEDUP_BLOCKS(Store)[Id].Next;
+        mDedupFreeBlockCount--;
+    } else {
+        Id = (UINT32)(Store->BlockCount++);
+    }
+
+    Block = &(RAM_DISK_DEDUP_BLOCKS(Store)[Id]);
+
+    Block->Hash     = Hash;
+    Block->Data     = Data;
+    Block->RefCount = 1;
+    Block->Next     = RAM_DISK_DEDUP_NONE;
+
+    if (0 != Hash) {
+        Slot = Hash & (Store->BucketCount - 1);
+        Block->Next = RAM_DISK_DEDUP_BUCKETS(Store)[Slot];
+        RAM_DISK_DEDUP_BUCKETS(Store)[Slot] = Id;
+    }
+
+    return Id;
+}
+
+
+/**
+ * Take a block out of the store's index, because its contents are about to change
+ *  or because nothing references it anymore.
+ *
+ * @param[in]  Id  The ID of an indexed block.
+ */
+static
+VOID
+RamDiskDedupUnlink(IN UINT32 Id)
+{
+    RAMDISK_DEDUP_STORE *Store = mDedupStore;
+    RAMDISK_DEDUP_BLOCK *Blocks = RAM_DISK_DEDUP_BLOCKS(Store);
+    UINT32 *Link = &(RAM_DISK_DEDUP_BUCKETS(Store)[Blocks[Id].Hash & (Store->BucketCount - 1)]);
+
+    while (RAM_DISK_DEDUP_NONE != *Link) {
+        if (Id == *Link) {
+            *Link = Blocks[Id].Next;
+            break;
+        }
+
+        Link = &(Blocks[*Link].Next);
+    }
+
+    Blocks[Id].Hash = 0;
+    Blocks[Id].Next = RAM_DISK_DEDUP_NONE;
+}
+
+
+/**
+ * Return a block which lost its last reference to the store. Its slot is reused by
+ *  the next new block, and so is its memory when that came from a slab. Memory of
+ *  the seeding ramdisk is its owner's, so it is simply no longer referenced.
+ *
+ * @param[in]  Id  The ID of a block without any references.
+ */
+static
+VOID
+RamDiskDedupFree(IN UINT32 Id)
+{
+    RAMDISK_DEDUP_BLOCK *Blocks = RAM_DISK_DEDUP_BLOCKS(mDedupStore);
+    UINT64 Data = Blocks[Id].Data;
+
+    if (0 != Blocks[Id].Hash) {
+        RamDiskDedupUnlink(Id);
+    }
+
+    if (
+        NULL == mDedupSeed
+        || Data < mDedupSeed->StartingAddr
+        || Data >= (mDedupSeed->StartingAddr + mDedupSeed->Size)
+    ) {
+        *((UINT64 *)(UINTN)Data) = mDedupFreeData;
+        mDedupFreeData = Data;
+    }
+
+    Blocks[Id].Data = 0;
+    Blocks[Id].Next = mDedupFreeBlocks;
+    mDedupFreeBlocks = Id;
+    mDedupFreeBlockCount++;
+}
+
+
+/**
+ * Drop every store reference held by a ramdisk and detach it from the store.
+ *  Blocks which lose their last reference are freed for reuse.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data with an attached store view.
+ */
+static
+VOID
+RamDiskReleaseDedup(IN RAMDISK_PRIVATE_DATA *PrivateData)
+{
+    RAMDISK_DEDUP_DISK *Disk = PrivateData->Dedup;
+    RAMDISK_DEDUP_BLOCK *Blocks = RAM_DISK_DEDUP_BLOCKS(mDedupStore);
+    UINT32 Id;
+
+    for (UINT64 i = 0; i < Disk->BlockCount; ++i) {
+        Id = RAM_DISK_DEDUP_MAP(Disk)[i];
+        if (RAM_DISK_DEDUP_NONE == Id) continue;
+
+        if (0 == --(Blocks[Id].RefCount)) {
+            RamDiskDedupFree(Id);
+        }
+    }
+
+    FreePool(RAM_DISK_DEDUP_MAP(Disk));
+    SetMem(Disk, sizeof(RAMDISK_DEDUP_DISK), 0x00);
+
+    /* The freed entry is reused by the next ramdisk; trailing free entries are dropped. */
+    while (mDedupStore->DiskCount > 0 && 0 == mDedupStore->Disks[mDedupStore->DiskCount - 1].BlockMap) {
+        mDedupStore->DiskCount--;
+    }
+
+    if (PrivateData == mDedupSeed) {
+        mDedupSeed = NULL;
+    }
+
+    PrivateData->Dedup = NULL;
+}
+
+
+/**
+ * Move every block which other ramdisks still share out of the seeding ramdisk's
+ *  memory and into store slabs, so that memory can be handed back to its owner.
+ *  Blocks only the seed references stay where they are. A partial failure is
+ *  harmless: blocks moved so far simply live in a slab from then on.
+ *
+ * @param[in]  PrivateData  Points to the private data of the seeding ramdisk.
+ *
+ * @retval EFI_SUCCESS           No other ramdisk references the seed's memory anymore.
+ * @retval EFI_OUT_OF_RESOURCES  A shared block could not be moved.
+ */
+static
+EFI_STATUS
+RamDiskDedupDetachSeed(IN RAMDISK_PRIVATE_DATA *PrivateData)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    RAMDISK_DEDUP_DISK *Disk = PrivateData->Dedup;
+    RAMDISK_DEDUP_BLOCK *Blocks = RAM_DISK_DEDUP_BLOCKS(mDedupStore);
+    UINT64 Data;
+
+    /* Drop the seed's own references for now, so any left over belong to other disks. */
+    for (UINT64 i = 0; i < Disk->BlockCount; ++i) {
+        Blocks[RAM_DISK_DEDUP_MAP(Disk)[i]].RefCount--;
+    }
+
+    for (UINT64 Id = 0; Id < mDedupStore->BlockCount; ++Id) {
+        if (
+            0 == Blocks[Id].RefCount
+            || Blocks[Id].Data < PrivateData->StartingAddr
+            || Blocks[Id].Data >= (PrivateData->StartingAddr + PrivateData->Size)
+        ) {
+            continue;
+        }
+
+        /* Only full blocks are ever shared, so this never reads past the seed. */
+        Data = RamDiskDedupAllocData();
+        if (0 == Data) {
+            Status = EFI_OUT_OF_RESOURCES;
+            break;
+        }
+
+        FastCopyMem((VOID *)(UINTN)Data, (VOID *)(UINTN)Blocks[Id].Data, RAM_DISK_DEDUP_BLOCK_SIZE);
+        Blocks[Id].Data = Data;
+    }
+
+    for (UINT64 i = 0; i < Disk->BlockCount; ++i) {
+        Blocks[RAM_DISK_DEDUP_MAP(Disk)[i]].RefCount++;
+    }
+
+    return Status;
+}
+
+
+/**
+ * Attach a ramdisk to the deduplicating store, creating the store on first use.
+ *  The first ramdisk's blocks are referenced where they lie. For every later ramdisk,
+ *  blocks already in the store are shared and the rest are copied into store slabs.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data.
+ *
+ * @retval EFI_SUCCESS           The ramdisk is now backed by the store.
+ * @retval EFI_OUT_OF_RESOURCES  The store is full or could not be grown.
+ */
+static
+EFI_STATUS
+RamDiskInitDedup(IN RAMDISK_PRIVATE_DATA *PrivateData)
+{
+    RAMDISK_DEDUP_STORE *Store;
+    RAMDISK_DEDUP_DISK *Disk;
+    RAMDISK_DEDUP_BLOCK *Blocks;
+    UINT32 *Map = NULL;
+    UINT32 Id, DiskIndex;
+    UINT64 BlockCount, Hash, Data, Unique = 0;
+    UINT8 *Source;
+    BOOLEAN InPlace;
+
+    if (NULL == mDedupStore) {
+        uefi_call_wrapper(BS->AllocatePool, 3, EfiReservedMemoryType,
+                          sizeof(RAMDISK_DEDUP_STORE), (VOID **)&mDedupStore);
+        if (NULL == mDedupStore) {
+            return EFI_OUT_OF_RESOURCES;
+        }
+
+        SetMem(mDedupStore, sizeof(RAMDISK_DEDUP_STORE), 0x00);
+        mDedupStore->Signature = RAMDISK_DEDUP_STORE_SIGNATURE;
+        mDedupStore->Version   = RAMDISK_DEDUP_STORE_VERSION;
+        mDedupStore->BlockSize = RAM_DISK_DEDUP_BLOCK_SIZE;
+    }
+
+    Store = mDedupStore;
+    for (DiskIndex = 0; DiskIndex < Store->DiskCount && 0 != Store->Disks[DiskIndex].BlockMap; ++DiskIndex);
+    if (DiskIndex >= RAM_DISK_DEDUP_MAX_DISKS) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    BlockCount = DivU64x32(PrivateData->Size + RAM_DISK_DEDUP_BLOCK_SIZE - 1, RAM_DISK_DEDUP_BLOCK_SIZE, NULL);
+    InPlace = (0 == Store->DiskCount);
+
+    if (EFI_ERROR(RamDiskDedupReserve(BlockCount))) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    uefi_call_wrapper(BS->AllocatePool, 3, EfiReservedMemoryType,
+                      BlockCount * sizeof(UINT32), (VOID **)&Map);
+    if (NULL == Map) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    SetMem(Map, BlockCount * sizeof(UINT32), 0xFF);
+
+    Disk = &(Store->Disks[DiskIndex]);
+    if (DiskIndex == Store->DiskCount) {
+        Store->DiskCount++;
+    }
+    Disk->Size       = PrivateData->Size;
+    Disk->BlockCount = BlockCount;
+    Disk->BlockMap   = (UINT64)(UINTN)Map;
+    PrivateData->Dedup = Disk;
+
+    Blocks = RAM_DISK_DEDUP_BLOCKS(Store);
+
+    /* Set before any block is added, so a failure here never frees the seed's memory into the store. */
+    if (InPlace) {
+        mDedupSeed = PrivateData;
+    }
+
+    for (UINT64 i = 0; i < BlockCount; ++i) {
+        Source = (UINT8 *)(UINTN)(PrivateData->StartingAddr + MultU64x32(i, RAM_DISK_DEDUP_BLOCK_SIZE));
+
+        /* A partial tail block is never shared, since its padding isn't part of the disk. */
+        if ((PrivateData->Size - MultU64x32(i, RAM_DISK_DEDUP_BLOCK_SIZE)) < RAM_DISK_DEDUP_BLOCK_SIZE) {
+            Hash = 0;
+        } else {
+            Hash = RamDiskDedupHash(Source);
+
+            for (
+                Id = RAM_DISK_DEDUP_BUCKETS(Store)[Hash & (Store->BucketCount - 1)];
+                RAM_DISK_DEDUP_NONE != Id;
+                Id = Blocks[Id].Next
+            ) {
+                if (
+                    Hash == Blocks[Id].Hash
+                    && 0 == FastCompareMem(Source, (VOID *)(UINTN)Blocks[Id].Data, RAM_DISK_DEDUP_BLOCK_SIZE)
+                ) {
+                    break;
+                }
+            }
+
+            if (RAM_DISK_DEDUP_NONE != Id) {
+                Blocks[Id].RefCount++;
+                Map[i] = Id;
+                continue;
+            }
+        }
+
+        if (InPlace) {
+            Data = (UINT64)(UINTN)Source;
+        } else {
+            Data = RamDiskDedupAllocData();
+            if (0 == Data) {
+                RamDiskReleaseDedup(PrivateData);
+                return EFI_OUT_OF_RESOURCES;
+            }
+
+            SetMem((VOID *)(UINTN)Data, RAM_DISK_DEDUP_BLOCK_SIZE, 0x00);
+            FastCopyMem((VOID *)(UINTN)Data,
+                    Source,
+                    MIN(RAM_DISK_DEDUP_BLOCK_SIZE, PrivateData->Size - MultU64x32(i, RAM_DISK_DEDUP_BLOCK_SIZE)));
+        }
+
+        Map[i] = RamDiskDedupAppend(Hash, Data);
+        Unique++;
+    }
+
+    DPRINTLN(
+        L"-- Ramdisk dedup: %llu of %llu blocks were unique (%llu blocks in store).",
+        Unique,
+        BlockCount,
+        Store->BlockCount
+    );
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Tell the OS where the deduplicating block store lives.
+ *
+ * @returns Whether the hint variable could be set.
+ */
+static
+EFI_STATUS
+RamDiskPublishDedup(VOID)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    VOID *StoreLocationInMemory = (VOID *)mDedupStore;
+
+    PRINTLN(L"-- Setting ramdisk dedup store hint '__MFTAH_RDDEDUP'.");
+    ERRCHECK_UEFI(
+        ST->RuntimeServices->SetVariable,
+        5,
+        L"__MFTAH_RDDEDUP",
+        &gXmitVendorGuid,
+        EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+        sizeof(VOID *),
+        &StoreLocationInMemory
+    );
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Copy a byte range out of a deduplicated ramdisk.
+ *
+ * @param[in]  Disk    The ramdisk's view of the store.
+ * @param[in]  Offset  The byte offset into the ramdisk to read from.
+ * @param[out] Buffer  The destination buffer.
+ * @param[in]  Length  The amount of bytes to read.
+ */
+static
+VOID
+RamDiskDedupReadRange(IN RAMDISK_DEDUP_DISK *Disk,
+                      IN UINT64 Offset,
+                      OUT UINT8 *Buffer,
+                      IN UINTN Length)
+{
+    RAMDISK_DEDUP_BLOCK *Blocks = RAM_DISK_DEDUP_BLOCKS(mDedupStore);
+    UINT64 Block, Part;
+
+    while (Length > 0) {
+        Block = Offset / RAM_DISK_DEDUP_BLOCK_SIZE;
+        Part = MIN(Length, RAM_DISK_DEDUP_BLOCK_SIZE - (Offset % RAM_DISK_DEDUP_BLOCK_SIZE));
+
+        FastCopyMem(Buffer,
+                (VOID *)(UINTN)(Blocks[RAM_DISK_DEDUP_MAP(Disk)[Block]].Data + (Offset % RAM_DISK_DEDUP_BLOCK_SIZE)),
+                Part);
+
+        Buffer += Part; Offset += Part; Length -= Part;
+    }
+}
+
+
+/**
+ * Copy a byte range into a deduplicated ramdisk. Shared blocks are split off into
+ *  a private copy first, and private blocks leave the index before they change.
+ *
+ * @param[in]  Disk    The ramdisk's view of the store.
+ * @param[in]  Offset  The byte offset into the ramdisk to write to.
+ * @param[in]  Buffer  The source buffer.
+ * @param[in]  Length  The amount of bytes to write.
+ *
+ * @retval EFI_SUCCESS      The data was written.
+ * @retval EFI_VOLUME_FULL  No memory was left to split a shared block.
+ */
+static
+EFI_STATUS
+RamDiskDedupWriteRange(IN RAMDISK_DEDUP_DISK *Disk,
+                       IN UINT64 Offset,
+                       IN UINT8 *Buffer,
+                       IN UINTN Length)
+{
+    RAMDISK_DEDUP_BLOCK *Blocks;
+    UINT64 Block, Part, Data;
+    UINT32 Id;
+
+    while (Length > 0) {
+        Block = Offset / RAM_DISK_DEDUP_BLOCK_SIZE;
+        Part = MIN(Length, RAM_DISK_DEDUP_BLOCK_SIZE - (Offset % RAM_DISK_DEDUP_BLOCK_SIZE));
+
+        Blocks = RAM_DISK_DEDUP_BLOCKS(mDedupStore);
+        Id = RAM_DISK_DEDUP_MAP(Disk)[Block];
+
+        if (Blocks[Id].RefCount > 1) {
+            if (EFI_ERROR(RamDiskDedupReserve(1))) {
+                return EFI_VOLUME_FULL;
+            }
+
+            Data = RamDiskDedupAllocData();
+            if (0 == Data) {
+                return EFI_VOLUME_FULL;
+            }
+
+            /* Growing the store may have moved the block array. */
+            Blocks = RAM_DISK_DEDUP_BLOCKS(mDedupStore);
+            FastCopyMem((VOID *)(UINTN)Data, (VOID *)(UINTN)Blocks[Id].Data, RAM_DISK_DEDUP_BLOCK_SIZE);
+
+            Blocks[Id].RefCount--;
+            Id = RamDiskDedupAppend(0, Data);
+            RAM_DISK_DEDUP_MAP(Disk)[Block] = Id;
+        } else if (0 != Blocks[Id].Hash) {
+            RamDiskDedupUnlink(Id);
+        }
+
+        FastCopyMem((VOID *)(UINTN)(Blocks[Id].Data + (Offset % RAM_DISK_DEDUP_BLOCK_SIZE)), Buffer, Part);
+        Buffer += Part; Offset += Part; Length -= Part;
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+/* Scratch space for recompressing evicted blocks, or for decoding a block when nothing
+    can be evicted. Like every other change to a compressed store, this is BSP-only. */
+static UINT8 *mCompressScratch = NULL;
+static UINT32 mCompressHashTable[COMPRESS_HASH_ENTRIES];
+
+/* Ramdisks are compressed this many blocks at a time while they are registered. */
+#define RAM_DISK_COMPRESS_WINDOW_BLOCKS 256
+
+/* Every pool slab starts with the address of the slab before it and its own size. */
+#define RAM_DISK_COMPRESS_SLAB_HEADER (2 * sizeof(UINT64))
+
+
+#define RAM_DISK_COMPRESSED_BLOCKS(Store) \
+    ((RAMDISK_COMPRESSED_BLOCK *)(UINTN)(Store)->Blocks)
+#define RAM_DISK_COMPRESSED_CACHE(Store) \
+    ((RAMDISK_COMPRESSED_CACHE_ENTRY *)(UINTN)(Store)->Cache)
+#define RAM_DISK_COMPRESSED_LENGTH(Store, Block) \
+    ((UINTN)MIN((UINT64)(Store)->BlockSize, (Store)->Size - MultU64x32((Block), (Store)->BlockSize)))
+
+
+/**
+ * One window of blocks being compressed while a ramdisk is registered. The BSP and
+ *  every AP helping it pull block indices from 'Next' until none are left.
+ */
+typedef
+struct {
+    CONST UINT8                 *Image;
+    UINT64                      Size;
+    UINT64                      First;
+    UINT32                      Count;
+    UINT32 VOLATILE             Next;
+    UINT8                       *Staging;
+    UINT32                      *Lengths;
+    UINT32                      *HashTables;
+    UINT32 VOLATILE             NextHashTable;
+} RAMDISK_COMPRESS_JOB;
+
+
+/**
+ * Compress a block for the pool. Runs on the BSP and on APs alike.
+ *
+ * @param[in]  Data        The block's contents.
+ * @param[in]  Length      The length of the block.
+ * @param[out] Compressed  Receives the compressed block. It needs room for 'Length' bytes.
+ * @param[in]  HashTable   The calling processor's match finder table.
+ *
+ * @returns The length to store: 0 for an all-zero block, or 'Length' if it's stored as-is.
+ */
+static
+UINT32
+RamDiskCompressedEncode(IN CONST UINT8 *Data,
+                        IN UINTN Length,
+                        OUT UINT8 *Compressed,
+                        IN UINT32 *HashTable)
+{
+    CONST UINT64 *Words = (CONST UINT64 *)Data;
+    UINTN CompressedLength;
+    UINTN i;
+
+    for (i = 0; i < Length / sizeof(UINT64) && 0 == Words[i]; ++i);
+    if (i == Length / sizeof(UINT64)) {
+        return 0;
+    }
+
+    /* A block is only worth decompressing if it shrinks. */
+    CompressedLength = CompressBlock(Data, Length, Compressed, Length - 1, HashTable);
+    return (UINT32)((0 == CompressedLength) ? Length : CompressedLength);
+}
+
+
+/**
+ * Decompress a block out of the pool. Uses no boot services.
+ *
+ * @param[in]  Store        The compressed store.
+ * @param[in]  Block        The index of the block.
+ * @param[out] Destination  Receives the block's contents.
+ *
+ * @retval EFI_SUCCESS           The block was decompressed.
+ * @retval EFI_VOLUME_CORRUPTED  The compressed block is damaged.
+ */
+static
+EFI_STATUS
+RamDiskCompressedDecode(IN RAMDISK_COMPRESSED_STORE *Store,
+                        IN UINT64 Block,
+                        OUT UINT8 *Destination)
+{
+    RAMDISK_COMPRESSED_BLOCK *Entry = &(RAM_DISK_COMPRESSED_BLOCKS(Store)[Block]);
+    UINTN Length = RAM_DISK_COMPRESSED_LENGTH(Store, Block);
+
+    if (0 == Entry->Length) {
+        FastSetMem(Destination, Length, 0x00);
+        return EFI_SUCCESS;
+    }
+
+    if (Length == Entry->Length) {
+        FastCopyMem(Destination, (VOID *)(UINTN)Entry->Data, Length);
+        return EFI_SUCCESS;
+    }
+
+    return DecompressBlock((CONST UINT8 *)(UINTN)Entry->Data, Entry->Length, Destination, Length);
+}
+
+
+/**
+ * Carve space for a compressed block out of the newest pool slab, reserving a new
+ *  slab when it is full. Slabs are only returned along with the whole store.
+ *
+ * @param[in]  Store   The compressed store.
+ * @param[in]  Length  The amount of bytes needed.
+ *
+ * @returns The address of at least 'Length' free bytes, or 0 if out of memory.
+ */
+static
+UINT64
+RamDiskCompressedAllocPool(IN RAMDISK_COMPRESSED_STORE *Store,
+                           IN UINT32 Length)
+{
+    EFI_STATUS Status;
+    EFI_PHYSICAL_ADDRESS Slab = 0;
+    UINT64 SlabSize;
+
+    Length = (Length + 7) & ~7U;
+
+    if (0 == Store->Slabs || (Store->SlabUsed + Length) > Store->SlabSize) {
+        /* The remainder of a full slab is left unused. */
+        SlabSize = EFI_PAGES_TO_SIZE(EFI_SIZE_TO_PAGES(MAX(RAM_DISK_COMPRESS_SLAB_SIZE, RAM_DISK_COMPRESS_SLAB_HEADER + Length)));
+
+        Status = uefi_call_wrapper(
+            BS->AllocatePages,
+            4,
+            AllocateAnyPages,
+            EfiReservedMemoryType,
+            EFI_SIZE_TO_PAGES(SlabSize),
+            &Slab
+        );
+        if (EFI_ERROR(Status)) {
+            return 0;
+        }
+
+        ((UINT64 *)(UINTN)Slab)[0] = Store->Slabs;
+        ((UINT64 *)(UINTN)Slab)[1] = SlabSize;
+
+        Store->Slabs     = (UINT64)Slab;
+        Store->SlabSize  = SlabSize;
+        Store->SlabUsed  = RAM_DISK_COMPRESS_SLAB_HEADER;
+        Store->PoolBytes += SlabSize;
+    }
+
+    Store->SlabUsed += Length;
+    return Store->Slabs + Store->SlabUsed - Length;
+}
+
+
+/**
+ * Put the new contents of a block into the pool. A block keeps its pool space while
+ *  its new contents fit; otherwise it moves to new space and the old space is stranded.
+ *
+ * @param[in]  Store   The compressed store.
+ * @param[in]  Block   The index of the block.
+ * @param[in]  Data    The compressed block, or the raw block if 'Length' is its full length.
+ * @param[in]  Length  The length of the data, or 0 if the block is all zeroes.
+ *
+ * @retval EFI_SUCCESS      The block was stored.
+ * @retval EFI_VOLUME_FULL  No memory was left for a block which grew. It keeps its old contents.
+ */
+static
+EFI_STATUS
+RamDiskCompressedPlace(IN RAMDISK_COMPRESSED_STORE *Store,
+                       IN UINT64 Block,
+                       IN CONST UINT8 *Data,
+                       IN UINT32 Length)
+{
+    RAMDISK_COMPRESSED_BLOCK *Entry = &(RAM_DISK_COMPRESSED_BLOCKS(Store)[Block]);
+    UINT64 Space;
+
+    if (Length > Entry->Capacity) {
+        Space = RamDiskCompressedAllocPool(Store, Length);
+        if (0 == Space) {
+            return EFI_VOLUME_FULL;
+        }
+
+        Entry->Data     = Space;
+        Entry->Capacity = (Length + 7) & ~7U;
+    }
+
+    if (Length > 0) {
+        FastCopyMem((VOID *)(UINTN)Entry->Data, Data, Length);
+    }
+
+    Store->StoredBytes = Store->StoredBytes - Entry->Length + Length;
+    Entry->Length = Length;
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Recompress a dirty cache entry into the pool.
+ *
+ * @param[in]  Store  The compressed store.
+ * @param[in]  Entry  The dirty cache entry.
+ *
+ * @retval EFI_SUCCESS      The entry is clean.
+ * @retval EFI_VOLUME_FULL  No memory was left for the block. The entry stays dirty.
+ */
+static
+EFI_STATUS
+RamDiskCompressedWriteBack(IN RAMDISK_COMPRESSED_STORE *Store,
+                           IN RAMDISK_COMPRESSED_CACHE_ENTRY *Entry)
+{
+    EFI_STATUS Status;
+    UINT8 *Data = (UINT8 *)(UINTN)Entry->Data;
+    UINTN Length = RAM_DISK_COMPRESSED_LENGTH(Store, Entry->Block);
+    UINT32 Stored;
+
+    Stored = RamDiskCompressedEncode(Data, Length, mCompressScratch, mCompressHashTable);
+
+    Status = RamDiskCompressedPlace(Store, Entry->Block, (Length == Stored) ? Data : mCompressScratch, Stored);
+    if (!EFI_ERROR(Status)) {
+        Entry->Dirty = 0;
+    }
+
+    return Status;
+}
+
+
+/**
+ * Look a block up in the cache, marking it as the most recently used on a hit.
+ *
+ * @param[in]  Store  The compressed store.
+ * @param[in]  Block  The index of the block.
+ *
+ * @returns The cache entry holding the block, or NULL if it isn't cached.
+ */
+static
+RAMDISK_COMPRESSED_CACHE_ENTRY *
+RamDiskCompressedFind(IN RAMDISK_COMPRESSED_STORE *Store,
+                      IN UINT64 Block)
+{
+    RAMDISK_COMPRESSED_CACHE_ENTRY *Cache = RAM_DISK_COMPRESSED_CACHE(Store);
+
+    for (UINT32 i = 0; i < Store->CacheCount; ++i) {
+        if (Block == Cache[i].Block) {
+            Cache[i].LastUse = ++(Store->Tick);
+            return &(Cache[i]);
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Bring a block into the cache in place of the least recently used entry. Free
+ *  entries are never used, so they always go first. A dirty entry is written back
+ *  before it is replaced.
+ *
+ * @param[in]  Store  The compressed store.
+ * @param[in]  Block  The index of a block which isn't cached.
+ * @param[in]  Fill   Whether to decompress the block, rather than leave it to be overwritten whole.
+ * @param[out] Entry  Receives the cache entry now holding the block.
+ *
+ * @retval EFI_SUCCESS           The block is cached.
+ * @retval EFI_VOLUME_FULL       The replaced entry could not be written back, so it stays cached.
+ * @retval EFI_VOLUME_CORRUPTED  The block could not be decompressed.
+ */
+static
+EFI_STATUS
+RamDiskCompressedLoad(IN RAMDISK_COMPRESSED_STORE *Store,
+                      IN UINT64 Block,
+                      IN BOOLEAN Fill,
+                      OUT RAMDISK_COMPRESSED_CACHE_ENTRY **Entry)
+{
+    EFI_STATUS Status;
+    RAMDISK_COMPRESSED_CACHE_ENTRY *Cache = RAM_DISK_COMPRESSED_CACHE(Store);
+    RAMDISK_COMPRESSED_CACHE_ENTRY *Victim = &(Cache[0]);
+
+    for (UINT32 i = 1; i < Store->CacheCount; ++i) {
+        if (Cache[i].LastUse < Victim->LastUse) {
+            Victim = &(Cache[i]);
+        }
+    }
+
+    if (Victim->Dirty) {
+        Status = RamDiskCompressedWriteBack(Store, Victim);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+    }
+
+    Victim->Block = RAM_DISK_COMPRESS_NONE;
+    Victim->LastUse = 0;
+
+    if (Fill) {
+        Status = RamDiskCompressedDecode(Store, Block, (UINT8 *)(UINTN)Victim->Data);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+    }
+
+    Victim->Block = Block;
+    Victim->LastUse = ++(Store->Tick);
+
+    *Entry = Victim;
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Copy a byte range out of a compressed ramdisk.
+ *
+ * @param[in]  Store   The compressed store.
+ * @param[in]  Offset  The byte offset into the ramdisk to read from.
+ * @param[out] Buffer  The destination buffer.
+ * @param[in]  Length  The amount of bytes to read.
+ *
+ * @retval EFI_SUCCESS       The data was read.
+ * @retval EFI_DEVICE_ERROR  A compressed block is damaged.
+ */
+static
+EFI_STATUS
+RamDiskCompressedReadRange(IN RAMDISK_COMPRESSED_STORE *Store,
+                           IN UINT64 Offset,
+                           OUT UINT8 *Buffer,
+                           IN UINTN Length)
+{
+    EFI_STATUS Status;
+    RAMDISK_COMPRESSED_CACHE_ENTRY *Entry;
+    UINT64 Block, Within, Part;
+
+    while (Length > 0) {
+        Block = Offset / Store->BlockSize;
+        Within = Offset % Store->BlockSize;
+        Part = MIN(Length, Store->BlockSize - Within);
+
+        Entry = RamDiskCompressedFind(Store, Block);
+        if (NULL != Entry) {
+            FastCopyMem(Buffer, (UINT8 *)(UINTN)Entry->Data + Within, Part);
+        } else if (Part == RAM_DISK_COMPRESSED_LENGTH(Store, Block)) {
+            /* Whole blocks go straight to the caller, so one long read can't flush the cache. */
+            if (EFI_ERROR(RamDiskCompressedDecode(Store, Block, Buffer))) {
+                return EFI_DEVICE_ERROR;
+            }
+        } else {
+            Status = RamDiskCompressedLoad(Store, Block, TRUE, &Entry);
+
+            /* With nothing evictable, the read is still served, just not cached. */
+            if (EFI_VOLUME_FULL == Status) {
+                Status = RamDiskCompressedDecode(Store, Block, mCompressScratch);
+                Entry = NULL;
+            }
+
+            if (EFI_ERROR(Status)) {
+                return EFI_DEVICE_ERROR;
+            }
+
+            FastCopyMem(Buffer, ((NULL != Entry) ? (UINT8 *)(UINTN)Entry->Data : mCompressScratch) + Within, Part);
+        }
+
+        Buffer += Part; Offset += Part; Length -= Part;
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Copy a byte range into a compressed ramdisk. Writes only go to the cache; blocks
+ *  are recompressed when they are evicted or the disk is flushed.
+ *
+ * @param[in]  Store   The compressed store.
+ * @param[in]  Offset  The byte offset into the ramdisk to write to.
+ * @param[in]  Buffer  The source buffer.
+ * @param[in]  Length  The amount of bytes to write.
+ *
+ * @retval EFI_SUCCESS       The data was written.
+ * @retval EFI_VOLUME_FULL   No memory was left to recompress an evicted block into.
+ * @retval EFI_DEVICE_ERROR  A compressed block is damaged.
+ */
+static
+EFI_STATUS
+RamDiskCompressedWriteRange(IN RAMDISK_COMPRESSED_STORE *Store,
+                            IN UINT64 Offset,
+                            IN UINT8 *Buffer,
+                            IN UINTN Length)
+{
+    EFI_STATUS Status;
+    RAMDISK_COMPRESSED_CACHE_ENTRY *Entry;
+    UINT64 Block, Within, Part;
+
+    while (Length > 0) {
+        Block = Offset / Store->BlockSize;
+        Within = Offset % Store->BlockSize;
+        Part = MIN(Length, Store->BlockSize - Within);
+
+        Entry = RamDiskCompressedFind(Store, Block);
+        if (NULL == Entry) {
+            /* A block which is overwritten whole needn't be decompressed first. */
+            Status = RamDiskCompressedLoad(Store, Block, (Part < RAM_DISK_COMPRESSED_LENGTH(Store, Block)), &Entry);
+            if (EFI_ERROR(Status)) {
+                return (EFI_VOLUME_FULL == Status) ? EFI_VOLUME_FULL : EFI_DEVICE_ERROR;
+            }
+        }
+
+        FastCopyMem((UINT8 *)(UINTN)Entry->Data + Within, Buffer, Part);
+        Entry->Dirty = 1;
+
+        Buffer += Part; Offset += Part; Length -= Part;
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Recompress every dirty block of a compressed ramdisk's cache into its pool.
+ *
+ * @param[in]  Store  The compressed store.
+ *
+ * @retval EFI_SUCCESS       Every cached block is clean.
+ * @retval EFI_DEVICE_ERROR  No memory was left for some block. It stays dirty and cached.
+ */
+static
+EFI_STATUS
+RamDiskCompressedFlush(IN RAMDISK_COMPRESSED_STORE *Store)
+{
+    RAMDISK_COMPRESSED_CACHE_ENTRY *Cache = RAM_DISK_COMPRESSED_CACHE(Store);
+    EFI_STATUS Result = EFI_SUCCESS;
+
+    for (UINT32 i = 0; i < Store->CacheCount; ++i) {
+        if (RAM_DISK_COMPRESS_NONE != Cache[i].Block && Cache[i].Dirty) {
+            if (EFI_ERROR(RamDiskCompressedWriteBack(Store, &(Cache[i])))) {
+                Result = EFI_DEVICE_ERROR;
+            }
+        }
+    }
+
+    return Result;
+}
+
+
+/**
+ * Take blocks of the current window until none are left. This is what the helping
+ *  APs run, so it must not use any boot services.
+ *
+ * @param[in]  Context  The RAMDISK_COMPRESS_JOB to work on.
+ */
+static
+VOID
+EFIAPI
+RamDiskCompressWindow(IN VOID *Context)
+{
+    RAMDISK_COMPRESS_JOB *Job = (RAMDISK_COMPRESS_JOB *)Context;
+    UINT32 *HashTable = Job->HashTables + ((UINTN)__sync_fetch_and_add(&(Job->NextHashTable), 1) * COMPRESS_HASH_ENTRIES);
+    UINT64 Offset;
+    UINT32 Index;
+
+    while ((Index = __sync_fetch_and_add(&(Job->Next), 1)) < Job->Count) {
+        Offset = MultU64x32(Job->First + Index, RAM_DISK_COMPRESS_BLOCK_SIZE);
+
+        Job->Lengths[Index] = RamDiskCompressedEncode(Job->Image + Offset,
+                                                      (UINTN)MIN((UINT64)RAM_DISK_COMPRESS_BLOCK_SIZE, Job->Size - Offset),
+                                                      Job->Staging + ((UINTN)Index * RAM_DISK_COMPRESS_BLOCK_SIZE),
+                                                      HashTable);
+    }
+}
+
+
+/**
+ * Release the compressed store of a ramdisk, if it has one.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data.
+ */
+static
+VOID
+RamDiskFreeCompressed(IN RAMDISK_PRIVATE_DATA *PrivateData)
+{
+    RAMDISK_COMPRESSED_STORE *Store = PrivateData->Compressed;
+    UINT64 Slab, Previous;
+
+    if (NULL == Store) {
+        return;
+    }
+
+    for (Slab = Store->Slabs; 0 != Slab; Slab = Previous) {
+        Previous = ((UINT64 *)(UINTN)Slab)[0];
+        uefi_call_wrapper(BS->FreePages, 2, (EFI_PHYSICAL_ADDRESS)Slab, EFI_SIZE_TO_PAGES(((UINT64 *)(UINTN)Slab)[1]));
+    }
+
+    uefi_call_wrapper(
+        BS->FreePages,
+        2,
+        (EFI_PHYSICAL_ADDRESS)RAM_DISK_COMPRESSED_CACHE(Store)[0].Data,
+        EFI_SIZE_TO_PAGES(Store->CacheCount * Store->BlockSize)
+    );
+    FreePool(Store);
+
+    PrivateData->Compressed = NULL;
+}
+
+
+/**
+ * Compress a ramdisk into a store of its own. The descriptor, cache entries and block
+ *  table share one reserved pool; the cached blocks and the pool slabs are reserved
+ *  separately. Windows of blocks are compressed on the BSP and every idle AP at once,
+ *  then packed into the pool on the BSP. The loaded image is only read.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data.
+ *
+ * @retval EFI_SUCCESS           The ramdisk is now backed by the store.
+ * @retval EFI_OUT_OF_RESOURCES  The store could not be reserved or filled.
+ */
+static
+EFI_STATUS
+RamDiskInitCompressed(IN RAMDISK_PRIVATE_DATA *PrivateData)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    RAMDISK_COMPRESSED_STORE *Store = NULL;
+    RAMDISK_COMPRESSED_CACHE_ENTRY *Cache;
+    RAMDISK_COMPRESS_JOB Job = {0};
+    MFTAH_THREAD *Helpers = NULL;
+    EFI_PHYSICAL_ADDRESS CacheBase = 0;
+    UINTN HelperCount = 0, Started = 0;
+    UINT64 BlockCount;
+    UINT32 Stored;
+
+    BlockCount = DivU64x32(PrivateData->Size + RAM_DISK_COMPRESS_BLOCK_SIZE - 1, RAM_DISK_COMPRESS_BLOCK_SIZE, NULL);
+
+    if (NULL == mCompressScratch) {
+        mCompressScratch = (UINT8 *)AllocatePool(RAM_DISK_COMPRESS_BLOCK_SIZE);
+        if (NULL == mCompressScratch) {
+            return EFI_OUT_OF_RESOURCES;
+        }
+    }
+
+    uefi_call_wrapper(
+        BS->AllocatePool,
+        3,
+        EfiReservedMemoryType,
+        sizeof(RAMDISK_COMPRESSED_STORE)
+            + (RAM_DISK_COMPRESS_CACHE_BLOCKS * sizeof(RAMDISK_COMPRESSED_CACHE_ENTRY))
+            + (BlockCount * sizeof(RAMDISK_COMPRESSED_BLOCK)),
+        (VOID **)&Store
+    );
+    if (NULL == Store) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    Status = uefi_call_wrapper(
+        BS->AllocatePages,
+        4,
+        AllocateAnyPages,
+        EfiReservedMemoryType,
+        EFI_SIZE_TO_PAGES(RAM_DISK_COMPRESS_CACHE_BLOCKS * RAM_DISK_COMPRESS_BLOCK_SIZE),
+        &CacheBase
+    );
+    if (EFI_ERROR(Status)) {
+        FreePool(Store);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    SetMem(Store,
+           sizeof(RAMDISK_COMPRESSED_STORE)
+               + (RAM_DISK_COMPRESS_CACHE_BLOCKS * sizeof(RAMDISK_COMPRESSED_CACHE_ENTRY))
+               + (BlockCount * sizeof(RAMDISK_COMPRESSED_BLOCK)),
+           0x00);
+
+    Store->Signature  = RAMDISK_COMPRESSED_STORE_SIGNATURE;
+    Store->Version    = RAMDISK_COMPRESSED_STORE_VERSION;
+    Store->Size       = PrivateData->Size;
+    Store->BlockSize  = RAM_DISK_COMPRESS_BLOCK_SIZE;
+    Store->CacheCount = RAM_DISK_COMPRESS_CACHE_BLOCKS;
+    Store->BlockCount = BlockCount;
+    Store->Cache      = (UINT64)(UINTN)((UINT8 *)Store + sizeof(RAMDISK_COMPRESSED_STORE));
+    Store->Blocks     = Store->Cache + (RAM_DISK_COMPRESS_CACHE_BLOCKS * sizeof(RAMDISK_COMPRESSED_CACHE_ENTRY));
+
+    Cache = RAM_DISK_COMPRESSED_CACHE(Store);
+    for (UINT32 i = 0; i < RAM_DISK_COMPRESS_CACHE_BLOCKS; ++i) {
+        Cache[i].Block = RAM_DISK_COMPRESS_NONE;
+        Cache[i].Data  = (UINT64)CacheBase + ((UINT64)i * RAM_DISK_COMPRESS_BLOCK_SIZE);
+    }
+
+    PrivateData->Compressed = Store;
+
+    /* Idle APs each take blocks of every window too. */
+    if (IsThreadingEnabled() && BlockCount > 1) {
+        HelperCount = MIN(MIN(GetThreadLimit(), (UINTN)MIN(BlockCount, RAM_DISK_COMPRESS_WINDOW_BLOCKS) - 1), MFTAH_MAX_THREAD_COUNT);
+        if (HelperCount > 0) {
+            Helpers = (MFTAH_THREAD *)AllocateZeroPool(HelperCount * sizeof(MFTAH_THREAD));
+            if (NULL == Helpers) HelperCount = 0;
+        }
+    }
+
+    Job.Image      = (CONST UINT8 *)(UINTN)PrivateData->StartingAddr;
+    Job.Size       = PrivateData->Size;
+    Job.Staging    = (UINT8 *)AllocatePool(RAM_DISK_COMPRESS_WINDOW_BLOCKS * RAM_DISK_COMPRESS_BLOCK_SIZE);
+    Job.Lengths    = (UINT32 *)AllocatePool(RAM_DISK_COMPRESS_WINDOW_BLOCKS * sizeof(UINT32));
+    Job.HashTables = (UINT32 *)AllocatePool((HelperCount + 1) * COMPRESS_HASH_ENTRIES * sizeof(UINT32));
+    if (NULL == Job.Staging || NULL == Job.Lengths || NULL == Job.HashTables) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto Done;
+    }
+
+    for (Job.First = 0; Job.First < BlockCount; Job.First += Job.Count) {
+        Job.Count = (UINT32)MIN(BlockCount - Job.First, RAM_DISK_COMPRESS_WINDOW_BLOCKS);
+        Job.Next = 0;
+        Job.NextHashTable = 0;
+
+        /* Helpers which can't be started are simply not waited on. */
+        for (Started = 0; Started < MIN(HelperCount, (UINTN)Job.Count - 1); ++Started) {
+            if (EFI_ERROR(CreateThread(RamDiskCompressWindow, (VOID *)&Job, &(Helpers[Started])))) break;
+
+            if (EFI_ERROR(StartThread(&(Helpers[Started]), FALSE))) {
+                uefi_call_wrapper(BS->CloseEvent, 1, Helpers[Started].CompletionEvent);
+                break;
+            }
+        }
+
+        RamDiskCompressWindow(&Job);
+
+        for (UINTN i = 0; i < Started; ++i) {
+            JoinThread(&(Helpers[i]));
+            uefi_call_wrapper(BS->CloseEvent, 1, Helpers[i].CompletionEvent);
+        }
+
+        /* Pool space is handed out on the BSP only, in block order. */
+        for (UINT32 i = 0; i < Job.Count; ++i) {
+            Stored = Job.Lengths[i];
+
+            Status = RamDiskCompressedPlace(
+                Store,
+                Job.First + i,
+                (Stored == RAM_DISK_COMPRESSED_LENGTH(Store, Job.First + i))
+                    ? Job.Image + MultU64x32(Job.First + i, RAM_DISK_COMPRESS_BLOCK_SIZE)
+                    : Job.Staging + ((UINTN)i * RAM_DISK_COMPRESS_BLOCK_SIZE),
+                Stored
+            );
+            if (EFI_ERROR(Status)) {
+                Status = EFI_OUT_OF_RESOURCES;
+                goto Done;
+            }
+        }
+    }
+
+    DPRINTLN(
+        L"-- Ramdisk compressed: %llu blocks of %u bytes into %llu bytes (%llu bytes of pool) with (%u) helpers.",
+        BlockCount,
+        RAM_DISK_COMPRESS_BLOCK_SIZE,
+        Store->StoredBytes,
+        Store->PoolBytes,
+        HelperCount
+    );
+
+Done:
+    if (NULL != Job.Staging) FreePool(Job.Staging);
+    if (NULL != Job.Lengths) FreePool(Job.Lengths);
+    if (NULL != Job.HashTables) FreePool(Job.HashTables);
+    if (NULL != Helpers) FreePool(Helpers);
+
+    if (EFI_ERROR(Status)) {
+        RamDiskFreeCompressed(PrivateData);
+    }
+
+    return Status;
+}
+
+
+#define RAM_DISK_OVERLAY_IS_DIRTY(Overlay, Chunk) \
+    (0 != (((UINT8 *)(UINTN)(Overlay)->DirtyBitmap)[(Chunk) >> 3] & (1 << ((Chunk) & 7))))
+
+
+/**
+ * Copy a byte range out of the ramdisk, honoring the dedup store, compressed store or
+ *  copy-on-write overlay. Runs of pristine chunks are coalesced into single copies
+ *  from the loaded image.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data.
+ * @param[in]  Offset       The byte offset into the ramdisk to read from.
+ * @param[out] Buffer       The destination buffer.
+ * @param[in]  Length       The amount of bytes to read.
+ *
+ * @retval EFI_SUCCESS       The data was read.
+ * @retval EFI_DEVICE_ERROR  A block of the compressed store is damaged.
+ */
+static
+EFI_STATUS
+RamDiskReadRange(IN RAMDISK_PRIVATE_DATA *PrivateData,
+                 IN UINT64 Offset,
+                 OUT VOID *Buffer,
+                 IN UINTN Length)
+{
+    RAMDISK_OVERLAY *Overlay = PrivateData->Overlay;
+    UINT8 *Into = (UINT8 *)Buffer;
+    UINT64 Chunk, RunStart, RunLength, Part;
+
+    if (NULL != PrivateData->Dedup) {
+        RamDiskDedupReadRange(PrivateData->Dedup, Offset, Into, Length);
+        return EFI_SUCCESS;
+    }
+
+    if (NULL != PrivateData->Compressed) {
+        return RamDiskCompressedReadRange(PrivateData->Compressed, Offset, Into, Length);
+    }
+
+    if (NULL == Overlay) {
+        FastCopyMem(Into, (VOID *)(UINTN)(PrivateData->StartingAddr + Offset), Length);
+        return EFI_SUCCESS;
+    }
+
+    while (Length > 0) {
+        Chunk = Offset / Overlay->ChunkSize;
+        Part = MIN(Length, Overlay->ChunkSize - (Offset % Overlay->ChunkSize));
+
+        if (RAM_DISK_OVERLAY_IS_DIRTY(Overlay, Chunk)) {
+            FastCopyMem(
+                Into,
+                (VOID *)(UINTN)(
+                    Overlay->OverlayBase
+                    + MultU64x32(((UINT32 *)(UINTN)Overlay->ChunkMap)[Chunk], Overlay->ChunkSize)
+                    + (Offset % Overlay->ChunkSize)
+                ),
+                Part
+            );
+
+            Into += Part; Offset += Part; Length -= Part;
+            continue;
+        }
+
+        /* Extend the run across every following pristine chunk. */
+        RunStart = Offset;
+        RunLength = Part;
+        while (RunLength < Length && !RAM_DISK_OVERLAY_IS_DIRTY(Overlay, (RunStart + RunLength) / Overlay->ChunkSize)) {
+            RunLength += MIN(Length - RunLength, Overlay->ChunkSize);
+        }
+
+        FastCopyMem(Into, (VOID *)(UINTN)(PrivateData->StartingAddr + RunStart), RunLength);
+        Into += RunLength; Offset += RunLength; Length -= RunLength;
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Copy a byte range into the ramdisk. With a copy-on-write overlay, each touched chunk
+ *  is first given an overlay slot (seeded from the pristine image on partial writes).
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data.
+ * @param[in]  Offset       The byte offset into the ramdisk to write to.
+ * @param[in]  Buffer       The source buffer.
+ * @param[in]  Length       The amount of bytes to write.
+ *
+ * @retval EFI_SUCCESS       The data was written.
+ * @retval EFI_VOLUME_FULL   The overlay pool, the dedup store or the compressed store has no room left.
+ * @retval EFI_DEVICE_ERROR  A block of the compressed store is damaged.
+ */
+static
+EFI_STATUS
+RamDiskWriteRange(IN RAMDISK_PRIVATE_DATA *PrivateData,
+                  IN UINT64 Offset,
+                  IN VOID *Buffer,
+                  IN UINTN Length)
+{
+    RAMDISK_OVERLAY *Overlay = PrivateData->Overlay;
+    UINT8 *From = (UINT8 *)Buffer;
+    UINT8 *Slot;
+    UINT64 Chunk, ChunkStart, Part;
+
+    if (NULL != PrivateData->Dedup) {
+        return RamDiskDedupWriteRange(PrivateData->Dedup, Offset, From, Length);
+    }
+
+    if (NULL != PrivateData->Compressed) {
+        return RamDiskCompressedWriteRange(PrivateData->Compressed, Offset, From, Length);
+    }
+
+    if (NULL == Overlay) {
+        FastCopyMem((VOID *)(UINTN)(PrivateData->StartingAddr + Offset), From, Length);
+        return EFI_SUCCESS;
+    }
+
+    while (Length > 0) {
+        Chunk = Offset / Overlay->ChunkSize;
+        ChunkStart = MultU64x32(Chunk, Overlay->ChunkSize);
+        Part = MIN(Length, Overlay->ChunkSize - (Offset - ChunkStart));
+
+        if (!RAM_DISK_OVERLAY_IS_DIRTY(Overlay, Chunk)) {
+            if (Overlay->OverlayUsed >= Overlay->OverlayCapacity) {
+                return EFI_VOLUME_FULL;
+            }
+
+            ((UINT32 *)(UINTN)Overlay->ChunkMap)[Chunk] = (UINT32)Overlay->OverlayUsed;
+            Slot = (UINT8 *)(UINTN)(Overlay->OverlayBase + MultU64x32(Overlay->OverlayUsed, Overlay->ChunkSize));
+
+            /* Only partially-overwritten chunks need their pristine contents carried over. */
+            if (Part < Overlay->ChunkSize) {
+                FastCopyMem(Slot,
+                        (VOID *)(UINTN)(PrivateData->StartingAddr + ChunkStart),
+                        MIN(Overlay->ChunkSize, PrivateData->Size - ChunkStart));
+            }
+
+            FastCopyMem(Slot + (Offset - ChunkStart), From, Part);
+
+            /* Fill the slot completely before the dirty bit publishes it, so a reader never
+                sees a half-made chunk. The barrier keeps the compiler from reordering that. */
+            __asm__ __volatile__ ("" ::: "memory");
+            Overlay->OverlayUsed++;
+            ((UINT8 *)(UINTN)Overlay->DirtyBitmap)[Chunk >> 3] |= (UINT8)(1 << (Chunk & 7));
+
+            From += Part; Offset += Part; Length -= Part;
+            continue;
+        }
+
+        FastCopyMem(
+            (VOID *)(UINTN)(
+                Overlay->OverlayBase
+                + MultU64x32(((UINT32 *)(UINTN)Overlay->ChunkMap)[Chunk], Overlay->ChunkSize)
+                + (Offset - ChunkStart)
+            ),
+            From,
+            Part
+        );
+
+        From += Part; Offset += Part; Length -= Part;
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Set up the copy-on-write overlay of a ramdisk. The descriptor, dirty bitmap, and
+ *  chunk map share one reserved pool; the overlay chunks are reserved separately.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data.
+ *
+ * @retval EFI_SUCCESS           The overlay was attached to the ramdisk.
+ * @retval EFI_OUT_OF_RESOURCES  The overlay memory could not be reserved.
+ */
+static
+EFI_STATUS
+RamDiskInitOverlay(IN RAMDISK_PRIVATE_DATA *PrivateData)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    RAMDISK_OVERLAY *Overlay = NULL;
+    EFI_PHYSICAL_ADDRESS OverlayBase = 0;
+    UINT64 ChunkCount, BitmapSize, ChunkMapSize, Capacity;
+
+    ChunkCount   = DivU64x32(PrivateData->Size + RAM_DISK_COW_CHUNK_SIZE - 1, RAM_DISK_COW_CHUNK_SIZE, NULL);
+    BitmapSize   = (((ChunkCount + 7) / 8) + 7) & ~7ULL;   /* Keep the chunk map 8-byte aligned. */
+    ChunkMapSize = ChunkCount * sizeof(UINT32);
+    Capacity     = MIN(ChunkCount, RAM_DISK_COW_POOL_SIZE / RAM_DISK_COW_CHUNK_SIZE);
+
+    ERRCHECK_UEFI(
+        BS->AllocatePool,
+        3,
+        EfiReservedMemoryType,
+        sizeof(RAMDISK_OVERLAY) + BitmapSize + ChunkMapSize,
+        (VOID **)&Overlay
+    );
+    if (NULL == Overlay) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    Status = uefi_call_wrapper(
+        BS->AllocatePages,
+        4,
+        AllocateAnyPages,
+        EfiReservedMemoryType,
+        EFI_SIZE_TO_PAGES(Capacity * RAM_DISK_COW_CHUNK_SIZE),
+        &OverlayBase
+    );
+    if (EFI_ERROR(Status)) {
+        FreePool(Overlay);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    SetMem(Overlay, sizeof(RAMDISK_OVERLAY) + BitmapSize, 0x00);
+
+    Overlay->Signature       = RAMDISK_OVERLAY_SIGNATURE;
+    Overlay->Version         = RAMDISK_OVERLAY_VERSION;
+    Overlay->ImageBase       = PrivateData->StartingAddr;
+    Overlay->ImageSize       = PrivateData->Size;
+    Overlay->ChunkSize       = RAM_DISK_COW_CHUNK_SIZE;
+    Overlay->ChunkCount      = ChunkCount;
+    Overlay->DirtyBitmap     = (UINT64)(UINTN)((UINT8 *)Overlay + sizeof(RAMDISK_OVERLAY));
+    Overlay->ChunkMap        = Overlay->DirtyBitmap + BitmapSize;
+    Overlay->OverlayBase     = (UINT64)OverlayBase;
+    Overlay->OverlayCapacity = Capacity;
+    Overlay->OverlayUsed     = 0;
+
+    DPRINTLN(
+        L"-- Ramdisk overlay: %llu chunks of %u bytes, %llu overlay slots at '%p'.",
+        ChunkCount,
+        RAM_DISK_COW_CHUNK_SIZE,
+        Capacity,
+        OverlayBase
+    );
+
+    PrivateData->Overlay = Overlay;
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Release the copy-on-write overlay of a ramdisk, if it has one.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data.
+ */
+static
+VOID
+RamDiskFreeOverlay(IN RAMDISK_PRIVATE_DATA *PrivateData)
+{
+    if (NULL == PrivateData->Overlay) {
+        return;
+    }
+
+    uefi_call_wrapper(
+        BS->FreePages,
+        2,
+        (EFI_PHYSICAL_ADDRESS)PrivateData->Overlay->OverlayBase,
+        EFI_SIZE_TO_PAGES(PrivateData->Overlay->OverlayCapacity * PrivateData->Overlay->ChunkSize)
+    );
+    FreePool(PrivateData->Overlay);
+
+    PrivateData->Overlay = NULL;
+}
+
+
+/**
+ * Get the name of a per-ramdisk hint variable. Instance 0 keeps the bare name, so
+ *  a single-ramdisk boot looks the same to the OS as it always has.
+ *
+ * @param[in]  Prefix    The bare variable name, like L"__MFTAH_RDOVERLAY".
+ * @param[in]  Instance  The ramdisk's instance number.
+ * @param[out] Name      Receives the variable name. Must hold at least 32 characters.
+ */
+static
+VOID
+RamDiskHintName(IN CONST CHAR16 *Prefix,
+                IN UINT16 Instance,
+                OUT CHAR16 *Name)
+{
+    if (0 == Instance) {
+        SPrint(Name, 32 * sizeof(CHAR16), L"%s", Prefix);
+    } else {
+        SPrint(Name, 32 * sizeof(CHAR16), L"%s%u", Prefix, Instance);
+    }
+}
+
+
+/**
+ * Tell the OS where the overlay descriptor of a ramdisk lives.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data with an attached overlay.
+ *
+ * @returns Whether the hint variable could be set.
+ */
+static
+EFI_STATUS
+RamDiskPublishOverlay(IN RAMDISK_PRIVATE_DATA *PrivateData)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    VOID *OverlayLocationInMemory = (VOID *)PrivateData->Overlay;
+    CHAR16 VariableName[32];
+
+    RamDiskHintName(L"__MFTAH_RDOVERLAY", PrivateData->InstanceNumber, VariableName);
+
+    PRINTLN(L"-- Setting ramdisk overlay hint '%s'.", VariableName);
+    ERRCHECK_UEFI(
+        ST->RuntimeServices->SetVariable,
+        5,
+        VariableName,
+        &gXmitVendorGuid,
+        EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+        sizeof(VOID *),
+        &OverlayLocationInMemory
+    );
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Tell the OS where the compressed store of a ramdisk lives.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data with an attached compressed store.
+ *
+ * @returns Whether the hint variable could be set.
+ */
+static
+EFI_STATUS
+RamDiskPublishCompressed(IN RAMDISK_PRIVATE_DATA *PrivateData)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    VOID *StoreLocationInMemory = (VOID *)PrivateData->Compressed;
+    CHAR16 VariableName[32];
+
+    RamDiskHintName(L"__MFTAH_RDCOMPRESS", PrivateData->InstanceNumber, VariableName);
+
+    PRINTLN(L"-- Setting ramdisk compressed store hint '%s'.", VariableName);
+    ERRCHECK_UEFI(
+        ST->RuntimeServices->SetVariable,
+        5,
+        VariableName,
+        &gXmitVendorGuid,
+        EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+        sizeof(VOID *),
+        &StoreLocationInMemory
+    );
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Delete a per-ramdisk hint variable again.
+ *
+ * @param[in]  Prefix    The bare variable name.
+ * @param[in]  Instance  The ramdisk's instance number.
+ */
+static
+VOID
+RamDiskClearHint(IN CONST CHAR16 *Prefix,
+                 IN UINT16 Instance)
+{
+    CHAR16 VariableName[32];
+
+    RamDiskHintName(Prefix, Instance, VariableName);
+    uefi_call_wrapper(
+        ST->RuntimeServices->SetVariable,
+        5,
+        VariableName,
+        &gXmitVendorGuid,
+        EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+        0,
+        NULL
+    );
+}
+
+
+/**
+ * Set up the access statistics of a ramdisk. Without them, the ramdisk just goes uncounted.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data with initialized media.
+ */
+static
+VOID
+RamDiskInitStats(IN RAMDISK_PRIVATE_DATA *PrivateData)
+{
+    RAMDISK_STATS *Stats = NULL;
+    UINT32 Shift = 0;
+
+    uefi_call_wrapper(BS->AllocatePool, 3, EfiReservedMemoryType, sizeof(RAMDISK_STATS), (VOID **)&Stats);
+    if (NULL == Stats) {
+        EFI_WARNINGLN(L"Not enough memory to count the accesses of ramdisk #%u.", PrivateData->InstanceNumber);
+        return;
+    }
+
+    SetMem(Stats, sizeof(RAMDISK_STATS), 0x00);
+
+    while ((PrivateData->Media.LastBlock >> Shift) >= RAM_DISK_STATS_REGIONS) {
+        Shift++;
+    }
+
+    Stats->Signature   = RAMDISK_STATS_SIGNATURE;
+    Stats->Version     = RAMDISK_STATS_VERSION;
+    Stats->Size        = PrivateData->Size;
+    Stats->BlockSize   = PrivateData->Media.BlockSize;
+    Stats->RegionCount = (UINT32)(PrivateData->Media.LastBlock >> Shift) + 1;
+    Stats->RegionShift = Shift;
+    Stats->NextReadLba = 0xFFFFFFFFFFFFFFFFULL;
+
+    PrivateData->Stats = Stats;
+}
+
+
+/**
+ * Count a validated, nonempty read or write into the statistics of a ramdisk.
+ *  This only ever runs on the BSP, as part of a BlockIo call.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data.
+ * @param[in]  IsWrite      Whether the request writes to the ramdisk.
+ * @param[in]  Lba          The starting logical block address of the request.
+ * @param[in]  BufferSize   The size of the request in bytes.
+ * @param[in]  IsAsync      Whether the request was handed to an AP.
+ */
+static
+VOID
+RamDiskRecordAccess(IN RAMDISK_PRIVATE_DATA *PrivateData,
+                    IN BOOLEAN IsWrite,
+                    IN EFI_LBA Lba,
+                    IN UINTN BufferSize,
+                    IN BOOLEAN IsAsync)
+{
+    RAMDISK_STATS *Stats = PrivateData->Stats;
+    RAMDISK_STATS_REGION *Region;
+    UINT64 Blocks, End, Bucket, InRegion;
+
+    if (NULL == Stats) {
+        return;
+    }
+
+    Blocks = BufferSize / PrivateData->Media.BlockSize;
+    End = Lba + Blocks;
+    Bucket = MIN((UINT64)(63 - __builtin_clzll(Blocks)), RAM_DISK_STATS_SIZE_BUCKETS - 1);
+
+    if (IsWrite) {
+        Stats->WriteRequests++;
+        Stats->BlocksWritten += Blocks;
+        Stats->WriteSizes[Bucket]++;
+    } else {
+        Stats->ReadRequests++;
+        Stats->BlocksRead += Blocks;
+        Stats->ReadSizes[Bucket]++;
+
+        if (Lba == Stats->NextReadLba) Stats->SequentialReads++;
+        Stats->NextReadLba = End;
+    }
+
+    if (IsAsync) {
+        Stats->AsyncRequests++;
+    }
+
+    /* Spread the blocks over every region the request touches. */
+    for (UINT64 r = Lba >> Stats->RegionShift; r <= ((End - 1) >> Stats->RegionShift); ++r) {
+        Region = &(Stats->Regions[r]);
+        InRegion = MIN(End, (r + 1) << Stats->RegionShift) - MAX(Lba, r << Stats->RegionShift);
+
+        if (IsWrite) {
+            Region->BlocksWritten = (UINT32)MIN((UINT64)Region->BlocksWritten + InRegion, 0xFFFFFFFFULL);
+        } else {
+            Region->BlocksRead = (UINT32)MIN((UINT64)Region->BlocksRead + InRegion, 0xFFFFFFFFULL);
+        }
+    }
+}
+
+
+/**
+ * Make sure a request only ever sees plaintext. With the early handoff, the boot
+ *  ramdisk stays ciphertext beyond the prefix until something touches it.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data.
+ * @param[in]  Lba          The starting logical block address of the request.
+ * @param[in]  BufferSize   The size of the request in bytes.
+ */
+static
+VOID
+RamDiskFaultIn(IN RAMDISK_PRIVATE_DATA *PrivateData,
+               IN EFI_LBA Lba,
+               IN UINTN BufferSize)
+{
+#if MFTAH_EARLY_HANDOFF == 1
+    UINT64 Address = PrivateData->StartingAddr + MultU64x32(Lba, PrivateData->Media.BlockSize);
+
+#if MFTAH_HOT_PROFILE == 1
+    HotProfileRecord(Address, BufferSize);
+#endif
+    HandoffFaultIn(Address, BufferSize);
+#endif
+}
+
+
+/**
+ * Tell the OS where the access statistics of a ramdisk live.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data with attached statistics.
+ *
+ * @returns Whether the hint variable could be set.
+ */
+static
+EFI_STATUS
+RamDiskPublishStats(IN RAMDISK_PRIVATE_DATA *PrivateData)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    VOID *StatsLocationInMemory = (VOID *)PrivateData->Stats;
+    CHAR16 VariableName[32];
+
+    RamDiskHintName(L"__MFTAH_RDSTATS", PrivateData->InstanceNumber, VariableName);
+
+    DPRINTLN(L"-- Setting ramdisk statistics hint '%s'.", VariableName);
+    ERRCHECK_UEFI(
+        ST->RuntimeServices->SetVariable,
+        5,
+        VariableName,
+        &gXmitVendorGuid,
+        EFI_VARIABLE_RUNTIME_ACCESS | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+        sizeof(VOID *),
+        &StatsLocationInMemory
+    );
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * AP-side body of a queued BlockIo2 transfer. This must not touch any
+ *  boot services, so it only moves the memory and drops the write count.
+ *
+ * @param[in]  Context  The RAMDISK_ASYNC_REQUEST to service.
+ */
+static
+VOID
+EFIAPI
+RamDiskAsyncWorker(IN VOID *Context)
+{
+    RAMDISK_ASYNC_REQUEST *Request = (RAMDISK_ASYNC_REQUEST *)Context;
+    RAMDISK_ASYNC_IN_FLIGHT *InFlight = &mRamDiskAsyncInFlight[Request->PrivateData->InstanceNumber];
+
+    if (Request->IsWrite) {
+        RamDiskWriteRange(Request->PrivateData, Request->Offset, Request->Buffer, Request->Length);
+    } else {
+        RamDiskReadRange(Request->PrivateData, Request->Offset, Request->Buffer, Request->Length);
+    }
+
+    if (Request->IsWrite) {
+        __sync_fetch_and_sub(&(InFlight->Writes), 1);
+    }
+
+    __sync_fetch_and_sub(&(InFlight->Requests), 1);
+}
+
+
+/**
+ * Wait until APs are done with a ramdisk's queued BlockIo2 transfers.
+ *
+ * @param[in]  Count  The in-flight counter to wait on, from mRamDiskAsyncInFlight.
+ *
+ * @retval EFI_SUCCESS  The counter dropped to zero.
+ * @retval EFI_TIMEOUT  Transfers were still running after RAM_DISK_ASYNC_TIMEOUT.
+ */
+static
+EFI_STATUS
+RamDiskAsyncDrain(IN UINTN VOLATILE *Count)
+{
+    for (UINTN Waited = 0; 0 != *Count; Waited += 10) {
+        if (Waited >= RAM_DISK_ASYNC_TIMEOUT) {
+            EFI_WARNINGLN(L"Ramdisk: '%u' transfer(s) still running on APs.", *Count);
+            return EFI_TIMEOUT;
+        }
+
+        uefi_call_wrapper(BS->Stall, 1, 10);
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * BSP-side completion of a queued BlockIo2 transfer. Signals the caller's
+ *  token and releases the request once the MP services report the AP is done.
+ *
+ * @param[in]  Thread  The finished thread, embedded in its RAMDISK_ASYNC_REQUEST.
+ */
+static
+VOID
+EFIAPI
+RamDiskAsyncComplete(IN MFTAH_THREAD *Thread)
+{
+    RAMDISK_ASYNC_REQUEST *Request = (RAMDISK_ASYNC_REQUEST *)(Thread->Context);
+
+    Request->Token->TransactionStatus = EFI_SUCCESS;
+    uefi_call_wrapper(BS->SignalEvent, 1, Request->Token->Event);
+
+    uefi_call_wrapper(BS->CloseEvent, 1, Thread->CompletionEvent);
+    FreePool(Request);
+}
+
+
+/**
+ * Try to hand a validated BlockIo2 transfer to an idle AP.
+ *
+ * @param[in]  PrivateData  Points to RAM disk private data.
+ * @param[in]  Token        The caller's token; its event is signaled on completion.
+ * @param[in]  IsWrite      Whether the transfer copies INTO the ramdisk.
+ * @param[in]  Offset       The ramdisk-side byte offset of the transfer.
+ * @param[in]  Buffer       The caller-side buffer of the transfer.
+ * @param[in]  Length       The length of the transfer in bytes.
+ *
+ * @retval EFI_SUCCESS           The transfer was started on an AP.
+ * @retval EFI_OUT_OF_RESOURCES  No AP was idle or the request could not be allocated.
+ *                               The caller should complete the transfer synchronously.
+ */
+static
+EFI_STATUS
+RamDiskQueueAsync(IN RAMDISK_PRIVATE_DATA *PrivateData,
+                  IN EFI_BLOCK_IO2_TOKEN *Token,
+                  IN BOOLEAN IsWrite,
+                  IN UINT64 Offset,
+                  IN VOID *Buffer,
+                  IN UINTN Length)
+{
+    EFI_STATUS Status;
+    RAMDISK_ASYNC_REQUEST *Request;
+    RAMDISK_ASYNC_IN_FLIGHT *InFlight = &mRamDiskAsyncInFlight[PrivateData->InstanceNumber];
+
+    if (!IsThreadingEnabled() || 0 == GetThreadLimit() || Length < RAM_DISK_ASYNC_MIN_SIZE) {
         return EFI_OUT_OF_RESOURCES;
     }
 
-    SpaRange = (EFI_ACPI_6_4_NFIT_SYSTEM_PHYSICAL_ADDRESS_RANGE_STRUCTURE *)
-               ((UINT8 *)Nfit + 40);
+    /* Overlay slots are handed out on the BSP only, so copy-on-write writes stay in-line. */
+    if (IsWrite && NULL != PrivateData->Overlay) {
+        return EFI_OUT_OF_RESOURCES;
+    }
 
-    UINT8 PcdAcpiDefaultOemId[6] = { 'S', 'O', 'L', 'S', ' ', ' ' };
+    /* The dedup store may be reallocated by any write, so its disks are never touched by APs.
+        The same goes for compressed disks, whose cache changes on every access. */
+    if (NULL != PrivateData->Dedup || NULL != PrivateData->Compressed) {
+        return EFI_OUT_OF_RESOURCES;
+    }
 
-    NfitHeader                  = (EFI_ACPI_DESCRIPTION_HEADER *)Nfit;
-    NfitHeader->Signature       = EFI_ACPI_NFIT_SIGNATURE;
-    NfitHeader->Length          = NfitLen;
-    NfitHeader->Revision        = EFI_ACPI_6_4_NVDIMM_FIRMWARE_INTERFACE_TABLE_REVISION;
-    NfitHeader->OemRevision     = MFTAH_RELEASE_DATE;   /* OEM Revision by some MFTAH release date. */
-    NfitHeader->CreatorId       = MFTAH_CREATOR_ID;
-    NfitHeader->CreatorRevision = 0x1;   /* Should always be 1. */
-    NfitHeader->OemTableId      = MFTAH_OEM_TABLE_ID;
-    CopyMem(NfitHeader->OemId, &PcdAcpiDefaultOemId[0], sizeof(NfitHeader->OemId));
+    Request = (RAMDISK_ASYNC_REQUEST *)AllocateZeroPool(sizeof(RAMDISK_ASYNC_REQUEST));
+    if (NULL == Request) {
+        return EFI_OUT_OF_RESOURCES;
+    }
 
-    /* Fill in the content of the SPA Range Structure. */
-    SpaRange->Type                             = EFI_ACPI_6_4_NFIT_SYSTEM_PHYSICAL_ADDRESS_RANGE_STRUCTURE_TYPE;
-    SpaRange->Length                           = sizeof(EFI_ACPI_6_4_NFIT_SYSTEM_PHYSICAL_ADDRESS_RANGE_STRUCTURE);
-    SpaRange->SystemPhysicalAddressRangeBase   = PrivateData->StartingAddr;
-    SpaRange->SystemPhysicalAddressRangeLength = PrivateData->Size;
-    CopyMem(&SpaRange->AddressRangeTypeGUID, &PrivateData->TypeGuid, sizeof(EFI_GUID));
+    Request->PrivateData = PrivateData;
+    Request->Token       = Token;
+    Request->IsWrite     = IsWrite;
+    Request->Offset      = Offset;
+    Request->Buffer      = Buffer;
+    Request->Length      = Length;
+
+    Status = CreateThreadEx(RamDiskAsyncWorker,
+                            (VOID *)Request,
+                            RamDiskAsyncComplete,
+                            &Request->Thread);
+    if (EFI_ERROR(Status)) {
+        FreePool(Request);
+        return EFI_OUT_OF_RESOURCES;
+    }
 
-    /* Finally, calculate the checksum of the NFIT table. */
-    NfitHeader->Checksum = CalculateCheckSum8((UINT8 *)Nfit, NfitHeader->Length);
+    if (IsWrite) {
+        __sync_fetch_and_add(&(InFlight->Writes), 1);
+    }
+    __sync_fetch_and_add(&(InFlight->Requests), 1);
 
-    /* Publish the NFIT to the ACPI table. */
-    Status = uefi_call_wrapper(
-        gAcpiTableProtocol->InstallAcpiTable,
-        4,
-        gAcpiTableProtocol,
-        Nfit,
-        NfitHeader->Length,
-        &TableKey
-    );
+    /* Never wait for an AP here: if they're all busy, the copy is done in-line instead. */
+    Status = StartThread(&Request->Thread, FALSE);
+    if (EFI_ERROR(Status)) {
+        if (IsWrite) {
+            __sync_fetch_and_sub(&(InFlight->Writes), 1);
+        }
+        __sync_fetch_and_sub(&(InFlight->Requests), 1);
 
-    FreePool(Nfit);
+        uefi_call_wrapper(BS->CloseEvent, 1, Request->Thread.CompletionEvent);
+        FreePool(Request);
+        return EFI_OUT_OF_RESOURCES;
+    }
 
-    return Status;
+    return EFI_SUCCESS;
 }
 
 
@@ -336,7 +2454,7 @@ RamDiskRegister(IN UINT64 RamDiskBase,
     RAMDISK_PRIVATE_DATA            *RegisteredPrivateData;
     MEDIA_RAMDISK_DEVICE_PATH       *RamDiskDevNode;
     UINTN                           DevicePathSizeInt;
-    LIST_ENTRY                      *Entry;
+    UINTN                           Instance;
 
     DPRINT(L"REGISTER ");
 
@@ -365,6 +2483,27 @@ RamDiskRegister(IN UINT64 RamDiskBase,
     }
 
     RamDiskDevNode = NULL;
+    Instance = RAM_DISK_MAX_INSTANCES;
+
+    /* The same memory can't be registered twice, and the lowest free instance number is used. */
+    for (UINTN i = 0; i < RAM_DISK_MAX_INSTANCES; ++i) {
+        RegisteredPrivateData = mRamDiskInstances[i];
+
+        if (NULL == RegisteredPrivateData) {
+            Instance = MIN(Instance, i);
+        } else if (
+            RamDiskBase == RegisteredPrivateData->StartingAddr
+            && RamDiskSize == RegisteredPrivateData->Size
+            && 0 == CompareMem(RamDiskType, &RegisteredPrivateData->TypeGuid, sizeof(EFI_GUID))
+        ) {
+            return EFI_ALREADY_STARTED;
+        }
+    }
+
+    if (Instance >= RAM_DISK_MAX_INSTANCES) {
+        PRINTLN(L"\r\nNo more than '%u' ramdisks can be registered.", RAM_DISK_MAX_INSTANCES);
+        return EFI_OUT_OF_RESOURCES;
+    }
 
     /* Initialize the loaded ramdisk's structure. */
     PrivateData = (RAMDISK_PRIVATE_DATA *)AllocateZeroPool(sizeof(RAMDISK_PRIVATE_DATA));
@@ -374,8 +2513,9 @@ RamDiskRegister(IN UINT64 RamDiskBase,
 
     CopyMem(PrivateData, &mRamDiskPrivateDataTemplate, sizeof(RAMDISK_PRIVATE_DATA));
     CopyMem(&PrivateData->TypeGuid, RamDiskType, sizeof(EFI_GUID));
-    PrivateData->StartingAddr = RamDiskBase;
-    PrivateData->Size         = RamDiskSize;
+    PrivateData->StartingAddr   = RamDiskBase;
+    PrivateData->Size           = RamDiskSize;
+    PrivateData->InstanceNumber = (UINT16)Instance;
 
     /* Generate device path information for the ramdisk. */
     DPRINT(L"ALLOC2 ");
@@ -414,6 +2554,35 @@ RamDiskRegister(IN UINT64 RamDiskBase,
     DPRINT(L"BLOCKIO ");
     RamDiskInitBlockIo(PrivateData);
 
+#if RAM_DISK_STATS == 1
+    DPRINT(L"STATS ");
+    RamDiskInitStats(PrivateData);
+#endif
+
+#if RAM_DISK_DEDUP == 1
+    DPRINT(L"DEDUP ");
+#if MFTAH_EARLY_HANDOFF == 1
+    /* Deduplication reads the whole image, so all of it must be plaintext first. */
+    HandoffFaultIn(PrivateData->StartingAddr, PrivateData->Size);
+#endif
+    Status = RamDiskInitDedup(PrivateData);
+    if (EFI_ERROR(Status)) {
+        goto ErrorExit;
+    }
+#elif RAM_DISK_COMPRESS == 1
+    DPRINT(L"COMPRESS ");
+    Status = RamDiskInitCompressed(PrivateData);
+    if (EFI_ERROR(Status)) {
+        goto ErrorExit;
+    }
+#elif RAM_DISK_COW_OVERLAY == 1
+    DPRINT(L"OVERLAY ");
+    Status = RamDiskInitOverlay(PrivateData);
+    if (EFI_ERROR(Status)) {
+        goto ErrorExit;
+    }
+#endif
+
     /* Install EFI_DEVICE_PATH_PROTOCOL & EFI_BLOCK_IO(2)_PROTOCOL on a new handle. */
     DPRINT(L"PROTOINST ");
     Status = uefi_call_wrapper(
@@ -432,6 +2601,9 @@ RamDiskRegister(IN UINT64 RamDiskBase,
         goto ErrorExit;
     }
 
+    /* From here on, the disk is visible to others and is only taken down through RamDiskUnregister. */
+    mRamDiskInstances[Instance] = PrivateData;
+
     DPRINT(L"CONNECTCONTROLLER(%016x) ", PrivateData->Handle);
     Status = uefi_call_wrapper(
         BS->ConnectController,
@@ -442,7 +2614,7 @@ RamDiskRegister(IN UINT64 RamDiskBase,
         TRUE
     );
     if (EFI_ERROR(Status)) {
-        goto ErrorExit;
+        goto UnregisterExit;
     }
 
     DPRINT(
@@ -454,15 +2626,51 @@ RamDiskRegister(IN UINT64 RamDiskBase,
     );
 
     FreePool(RamDiskDevNode);
+    RamDiskDevNode = NULL;
 
-    if (NULL != gAcpiTableProtocol) {
-        ERRCHECK(RamDiskPublishNfit(PrivateData));
+    if (NULL != PrivateData->Dedup) {
+        /* A deduplicated disk is not one contiguous range, so the NFIT can't describe it. */
+        Status = RamDiskPublishDedup();
+    } else if (NULL != PrivateData->Compressed) {
+        /* Neither is a compressed disk; the OS needs the store to read it. */
+        Status = RamDiskPublishCompressed(PrivateData);
+    } else if (NULL != gAcpiTableProtocol) {
+        Status = RamDiskPublishNfit(PrivateData);
     } else {
         PANIC(L"Cannot register ramdisk in ACPI NVDIMM Firmware Interface Table (NFIT).");
     }
+    if (EFI_ERROR(Status)) {
+        goto UnregisterExit;
+    }
+
+    if (NULL != PrivateData->Overlay) {
+        Status = RamDiskPublishOverlay(PrivateData);
+        if (EFI_ERROR(Status)) {
+            goto UnregisterExit;
+        }
+    }
+
+    /* The disk works fine without its statistics, so this is never fatal. */
+    if (NULL != PrivateData->Stats && EFI_ERROR(RamDiskPublishStats(PrivateData))) {
+        EFI_WARNINGLN(L"Could not publish the access statistics of ramdisk #%u.", PrivateData->InstanceNumber);
+    }
 
     return EFI_SUCCESS;
 
+UnregisterExit:
+    if (NULL != RamDiskDevNode) {
+        FreePool(RamDiskDevNode);
+    }
+
+    /* The protocols are installed, so the private data can only go once nothing uses them. */
+    if (EFI_ERROR(RamDiskUnregister(PrivateData->DevicePath))) {
+        EFI_WARNINGLN(L"Ramdisk #%u is in use and stays registered despite error '%r'.", Instance, Status);
+        return EFI_SUCCESS;
+    }
+
+    *DevicePath = NULL;
+    return Status;
+
 ErrorExit:
     if (NULL != RamDiskDevNode) {
         FreePool(RamDiskDevNode);
@@ -471,6 +2679,15 @@ ErrorExit:
     if (NULL != PrivateData) {
         if (PrivateData->DevicePath) {
             FreePool(PrivateData->DevicePath);
+            *DevicePath = NULL;
+        }
+        RamDiskFreeOverlay(PrivateData);
+        RamDiskFreeCompressed(PrivateData);
+        if (NULL != PrivateData->Dedup) {
+            RamDiskReleaseDedup(PrivateData);
+        }
+        if (NULL != PrivateData->Stats) {
+            FreePool(PrivateData->Stats);
         }
         FreePool(PrivateData);
     }
@@ -479,24 +2696,149 @@ ErrorExit:
 }
 
 
-/**
- * This functionality is left incomplete because it's not currently used.
- */
+RAMDISK_PRIVATE_DATA *
+EFIAPI
+RamDiskFindByInstance(IN UINT16 Instance)
+{
+    if (Instance >= RAM_DISK_MAX_INSTANCES) {
+        return NULL;
+    }
+
+    return mRamDiskInstances[Instance];
+}
+
+
+RAMDISK_PRIVATE_DATA *
+EFIAPI
+RamDiskFindByDevicePath(IN EFI_DEVICE_PATH_PROTOCOL *DevicePath)
+{
+    EFI_DEVICE_PATH_PROTOCOL *Node;
+    RAMDISK_PRIVATE_DATA *PrivateData;
+    UINTN PathSize;
+
+    if (NULL == DevicePath) {
+        return NULL;
+    }
+
+    /* The ramdisk node carries the instance number, which indexes the registry directly. */
+    for (Node = DevicePath; !IsDevicePathEnd(Node); Node = NextDevicePathNode(Node)) {
+        if (MEDIA_DEVICE_PATH == DevicePathType(Node) && MEDIA_RAM_DISK_DP == DevicePathSubType(Node)) {
+            break;
+        }
+    }
+
+    if (IsDevicePathEnd(Node)) {
+        return NULL;
+    }
+
+    PrivateData = RamDiskFindByInstance(((MEDIA_RAMDISK_DEVICE_PATH *)Node)->Instance);
+    if (NULL == PrivateData) {
+        return NULL;
+    }
+
+    /* Make sure this is the very same path and not a stale one from an unregistered disk. */
+    PathSize = DevicePathSize(DevicePath);
+    if (
+        PathSize != DevicePathSize(PrivateData->DevicePath)
+        || 0 != CompareMem(DevicePath, PrivateData->DevicePath, PathSize)
+    ) {
+        return NULL;
+    }
+
+    return PrivateData;
+}
+
+
 EFI_STATUS
 EFIAPI
 RamDiskUnregister(IN EFI_DEVICE_PATH_PROTOCOL *DevicePath)
 {
+    EFI_STATUS Status;
+    RAMDISK_PRIVATE_DATA *PrivateData;
+
     if (NULL == DevicePath) {
         return EFI_INVALID_PARAMETER;
     }
 
+    PrivateData = RamDiskFindByDevicePath(DevicePath);
+    if (NULL == PrivateData) {
+        return EFI_NOT_FOUND;
+    }
+
+    /* APs may still be copying to or from this disk on behalf of BlockIo2 callers. */
+    Status = RamDiskAsyncDrain(&(mRamDiskAsyncInFlight[PrivateData->InstanceNumber].Requests));
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    /* Other ramdisks may share blocks lying in this one's memory, which its owner gets back. */
+    if (PrivateData == mDedupSeed) {
+        Status = RamDiskDedupDetachSeed(PrivateData);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+    }
+
     uefi_call_wrapper(
-        BS->UninstallMultipleProtocolInterfaces,
+        BS->DisconnectController,
         3,
-        DevicePath,
-        &gEfiRamdiskGuid,
+        PrivateData->Handle,
+        NULL,
         NULL
-    );   
+    );
+
+    Status = uefi_call_wrapper(
+        BS->UninstallMultipleProtocolInterfaces,
+        8,
+        PrivateData->Handle,
+        &gEfiBlockIoProtocolGuid,
+        &PrivateData->BlockIo,
+        &gEfiBlockIo2ProtocolGuid,
+        &PrivateData->BlockIo2,
+        &gEfiDevicePathProtocolGuid,
+        PrivateData->DevicePath,
+        NULL
+    );
+    if (EFI_ERROR(Status)) {
+        /* Something still holds the disk open: leave it fully registered. */
+        uefi_call_wrapper(BS->ConnectController, 4, PrivateData->Handle, NULL, NULL, TRUE);
+        return Status;
+    }
+
+    mRamDiskInstances[PrivateData->InstanceNumber] = NULL;
+
+    if (PrivateData->InNfit) {
+        PrivateData->InNfit = FALSE;
+
+        Status = RamDiskRebuildNfit();
+        if (EFI_ERROR(Status)) {
+            EFI_WARNINGLN(L"Failed to drop ramdisk #%u from the NFIT (%r).", PrivateData->InstanceNumber, Status);
+        }
+    }
+
+    if (NULL != PrivateData->Overlay) {
+        RamDiskClearHint(L"__MFTAH_RDOVERLAY", PrivateData->InstanceNumber);
+        RamDiskFreeOverlay(PrivateData);
+    }
+
+    if (NULL != PrivateData->Compressed) {
+        RamDiskClearHint(L"__MFTAH_RDCOMPRESS", PrivateData->InstanceNumber);
+        RamDiskFreeCompressed(PrivateData);
+    }
+
+    if (NULL != PrivateData->Dedup) {
+        RamDiskReleaseDedup(PrivateData);
+    }
+
+    if (NULL != PrivateData->Stats) {
+        RamDiskClearHint(L"__MFTAH_RDSTATS", PrivateData->InstanceNumber);
+        FreePool(PrivateData->Stats);
+    }
+
+    DPRINTLN(L"-- Unregistered ramdisk #%u at '%p'.", PrivateData->InstanceNumber, PrivateData->StartingAddr);
+
+    FreePool(PrivateData->DevicePath);
+    FreePool(PrivateData);
 
     return EFI_SUCCESS;
 }
@@ -603,42 +2945,19 @@ RamDiskBlkIoReadBlocks(IN EFI_BLOCK_IO_PROTOCOL *This,
                        OUT VOID *Buffer)
 {
     RAMDISK_PRIVATE_DATA *PrivateData;
-    UINTN NumberOfBlocks;
+    EFI_STATUS Status;
 
     PrivateData = RAM_DISK_PRIVATE_FROM_BLKIO (This);
 
-    if (MediaId != PrivateData->Media.MediaId) {
-        return EFI_MEDIA_CHANGED;
-    }
-
-    if (NULL == Buffer) {
-        return EFI_INVALID_PARAMETER;
-    }
-
-    if (0 == BufferSize) {
-        return EFI_SUCCESS;
-    }
-
-    if ((BufferSize % PrivateData->Media.BlockSize) != 0) {
-        return EFI_BAD_BUFFER_SIZE;
-    }
-
-    if (Lba > PrivateData->Media.LastBlock) {
-        return EFI_INVALID_PARAMETER;
-    }
-
-    NumberOfBlocks = BufferSize / PrivateData->Media.BlockSize;
-    if ((Lba + NumberOfBlocks - 1) > PrivateData->Media.LastBlock) {
-        return EFI_INVALID_PARAMETER;
+    Status = RamDiskCheckRequest(PrivateData, MediaId, Lba, BufferSize, Buffer, FALSE);
+    if (EFI_ERROR(Status) || 0 == BufferSize) {
+        return Status;
     }
 
-    CopyMem(
-        Buffer,
-        (VOID *)(UINTN)(PrivateData->StartingAddr + MultU64x32(Lba, PrivateData->Media.BlockSize)),
-        BufferSize
-    );
+    RamDiskRecordAccess(PrivateData, FALSE, Lba, BufferSize, FALSE);
+    RamDiskFaultIn(PrivateData, Lba, BufferSize);
 
-    return EFI_SUCCESS;
+    return RamDiskReadRange(PrivateData, MultU64x32(Lba, PrivateData->Media.BlockSize), Buffer, BufferSize);
 }
 
 
@@ -651,53 +2970,43 @@ RamDiskBlkIoWriteBlocks(IN EFI_BLOCK_IO_PROTOCOL *This,
                         IN VOID *Buffer)
 {
     RAMDISK_PRIVATE_DATA *PrivateData;
-    UINTN NumberOfBlocks;
+    EFI_STATUS Status;
 
     PrivateData = RAM_DISK_PRIVATE_FROM_BLKIO (This);
 
-    if (MediaId != PrivateData->Media.MediaId) {
-        return EFI_MEDIA_CHANGED;
+    Status = RamDiskCheckRequest(PrivateData, MediaId, Lba, BufferSize, Buffer, TRUE);
+    if (EFI_ERROR(Status) || 0 == BufferSize) {
+        return Status;
     }
 
-    if (TRUE == PrivateData->Media.ReadOnly) {
-        return EFI_WRITE_PROTECTED;
-    }
+    RamDiskRecordAccess(PrivateData, TRUE, Lba, BufferSize, FALSE);
+    RamDiskFaultIn(PrivateData, Lba, BufferSize);
 
-    if (NULL == Buffer) {
-        return EFI_INVALID_PARAMETER;
-    }
+    return RamDiskWriteRange(PrivateData, MultU64x32(Lba, PrivateData->Media.BlockSize), Buffer, BufferSize);
+}
 
-    if (0 == BufferSize) {
-        return EFI_SUCCESS;
-    }
 
-    if ((BufferSize % PrivateData->Media.BlockSize) != 0) {
-        return EFI_BAD_BUFFER_SIZE;
-    }
+EFI_STATUS
+EFIAPI
+RamDiskBlkIoFlushBlocks(IN EFI_BLOCK_IO_PROTOCOL *This)
+{
+    RAMDISK_PRIVATE_DATA *PrivateData;
 
-    if (Lba > PrivateData->Media.LastBlock) {
-        return EFI_INVALID_PARAMETER;
-    }
+    PrivateData = RAM_DISK_PRIVATE_FROM_BLKIO (This);
 
-    NumberOfBlocks = BufferSize / PrivateData->Media.BlockSize;
-    if ((Lba + NumberOfBlocks - 1) > PrivateData->Media.LastBlock) {
-        return EFI_INVALID_PARAMETER;
+    if (NULL != PrivateData->Stats) {
+        PrivateData->Stats->FlushRequests++;
     }
 
-    CopyMem(
-        (VOID *)(UINTN)(PrivateData->StartingAddr + MultU64x32(Lba, PrivateData->Media.BlockSize)),
-        Buffer,
-        BufferSize
-    );
-
-    return EFI_SUCCESS;
-}
+    /* Writes queued through BlockIo2 are only durable once their APs are done copying. */
+    if (EFI_ERROR(RamDiskAsyncDrain(&(mRamDiskAsyncInFlight[PrivateData->InstanceNumber].Writes)))) {
+        return EFI_DEVICE_ERROR;
+    }
 
+    if (NULL != PrivateData->Compressed) {
+        return RamDiskCompressedFlush(PrivateData->Compressed);
+    }
 
-EFI_STATUS
-EFIAPI
-RamDiskBlkIoFlushBlocks(IN EFI_BLOCK_IO_PROTOCOL *This)
-{
     return EFI_SUCCESS;
 }
 
@@ -725,6 +3034,30 @@ RamDiskBlkIo2ReadBlocksEx(IN EFI_BLOCK_IO2_PROTOCOL *This,
 
     PrivateData = RAM_DISK_PRIVATE_FROM_BLKIO2(This);
 
+    /* Large, non-blocking requests are copied by an idle AP which completes the token. */
+    if ((Token != NULL) && (Token->Event != NULL)) {
+        Status = RamDiskCheckRequest(PrivateData, MediaId, Lba, BufferSize, Buffer, FALSE);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+
+        /* The AP copying the request can't decrypt anything itself. */
+        RamDiskFaultIn(PrivateData, Lba, BufferSize);
+
+        Status = RamDiskQueueAsync(
+            PrivateData,
+            Token,
+            FALSE,
+            MultU64x32(Lba, PrivateData->Media.BlockSize),
+            Buffer,
+            BufferSize
+        );
+        if (!EFI_ERROR(Status)) {
+            RamDiskRecordAccess(PrivateData, FALSE, Lba, BufferSize, TRUE);
+            return EFI_SUCCESS;
+        }
+    }
+
     Status = RamDiskBlkIoReadBlocks(
         &PrivateData->BlockIo,
         MediaId,
@@ -760,6 +3093,30 @@ RamDiskBlkIo2WriteBlocksEx(IN EFI_BLOCK_IO2_PROTOCOL *This,
 
     PrivateData = RAM_DISK_PRIVATE_FROM_BLKIO2(This);
 
+    /* Large, non-blocking requests are copied by an idle AP which completes the token. */
+    if ((Token != NULL) && (Token->Event != NULL)) {
+        Status = RamDiskCheckRequest(PrivateData, MediaId, Lba, BufferSize, Buffer, TRUE);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+
+        /* The AP copying the request can't decrypt anything itself. */
+        RamDiskFaultIn(PrivateData, Lba, BufferSize);
+
+        Status = RamDiskQueueAsync(
+            PrivateData,
+            Token,
+            TRUE,
+            MultU64x32(Lba, PrivateData->Media.BlockSize),
+            Buffer,
+            BufferSize
+        );
+        if (!EFI_ERROR(Status)) {
+            RamDiskRecordAccess(PrivateData, TRUE, Lba, BufferSize, TRUE);
+            return EFI_SUCCESS;
+        }
+    }
+
     Status = RamDiskBlkIoWriteBlocks(
         &PrivateData->BlockIo,
         MediaId,
@@ -787,6 +3144,7 @@ RamDiskBlkIo2FlushBlocksEx(IN EFI_BLOCK_IO2_PROTOCOL *This,
                            IN OUT EFI_BLOCK_IO2_TOKEN *Token)
 {
     RAMDISK_PRIVATE_DATA *PrivateData;
+    EFI_STATUS Status;
 
     PrivateData = RAM_DISK_PRIVATE_FROM_BLKIO2 (This);
 
@@ -794,6 +3152,22 @@ RamDiskBlkIo2FlushBlocksEx(IN EFI_BLOCK_IO2_PROTOCOL *This,
         return EFI_WRITE_PROTECTED;
     }
 
+    if (NULL != PrivateData->Stats) {
+        PrivateData->Stats->FlushRequests++;
+    }
+
+    /* Wait out any queued writes still being copied by APs. */
+    if (EFI_ERROR(RamDiskAsyncDrain(&(mRamDiskAsyncInFlight[PrivateData->InstanceNumber].Writes)))) {
+        return EFI_DEVICE_ERROR;
+    }
+
+    if (NULL != PrivateData->Compressed) {
+        Status = RamDiskCompressedFlush(PrivateData->Compressed);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+    }
+
     /* If the caller's event is given, signal it directly. */
     if ((Token != NULL) && (Token->Event != NULL)) {
         Token->TransactionStatus = EFI_SUCCESS;
@@ -0,0 +1,155 @@
+/*
+ * Known-answer tests of AES-256-GCM, built and run on the host with 'make test'.
+ *
+ * The vectors are the AES-256 cases (13 to 16) of 'The Galois/Counter Mode of
+ *  Operation (GCM)' by McGrew and Viega, as used by NIST's GCM validation. Each
+ *  is encrypted, decrypted, and then decrypted again with a corrupted tag, on
+ *  the portable path and, where this processor has them, on AES-NI and PCLMULQDQ.
+ */
+
+#include "crypto/gcm.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+
+typedef
+struct {
+    const char  *name;
+    const char  *key;
+    const char  *iv;
+    const char  *aad;
+    const char  *plaintext;
+    const char  *ciphertext;
+    const char  *tag;
+} GCM_VECTOR;
+
+
+static const GCM_VECTOR gcm_vectors[] = {
+    {
+        "Test Case 13",
+        "0000000000000000000000000000000000000000000000000000000000000000",
+        "000000000000000000000000",
+        "",
+        "",
+        "",
+        "530f8afbc74536b9a963b4f1c4cb738b",
+    },
+    {
+        "Test Case 14",
+        "0000000000000000000000000000000000000000000000000000000000000000",
+        "000000000000000000000000",
+        "",
+        "00000000000000000000000000000000",
+        "cea7403d4d606b6e074ec5d3baf39d18",
+        "d0d1c8a799996bf0265b98b5d48ab919",
+    },
+    {
+        "Test Case 15",
+        "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308",
+        "cafebabefacedbaddecaf888",
+        "",
+        "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+        "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+        "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+        "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662898015ad",
+        "b094dac5d93471bdec1a502270e3cc6c",
+    },
+    {
+        "Test Case 16",
+        "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308",
+        "cafebabefacedbaddecaf888",
+        "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+        "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+        "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+        "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+        "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+        "76fc6ece0f4e1768cddf8853bb2d551b",
+    },
+};
+
+
+
+static
+size_t
+unhex(const char *hex,
+      uint8_t *out)
+{
+    size_t length = strlen(hex) / 2;
+    unsigned int byte;
+
+    for (size_t i = 0; i < length; ++i) {
+        sscanf(hex + (2 * i), "%2x", &byte);
+        out[i] = (uint8_t)byte;
+    }
+
+    return length;
+}
+
+
+static
+int
+check(const GCM_VECTOR *vector,
+      int accelerated)
+{
+    struct AES_GCM_ctx ctx;
+    uint8_t key[32], iv[AES_GCM_IV_LEN], aad[64], plaintext[64], ciphertext[64], expected_tag[AES_GCM_TAG_LEN];
+    uint8_t buf[64], tag[AES_GCM_TAG_LEN];
+    size_t aad_len, length;
+    int failures = 0;
+
+    unhex(vector->key, key);
+    unhex(vector->iv, iv);
+    aad_len = unhex(vector->aad, aad);
+    length = unhex(vector->plaintext, plaintext);
+    unhex(vector->ciphertext, ciphertext);
+    unhex(vector->tag, expected_tag);
+
+    AES_GCM_init(&ctx, key, accelerated);
+
+    memcpy(buf, plaintext, length);
+    AES_GCM_encrypt(&ctx, iv, aad_len ? aad : NULL, aad_len, buf, length, tag);
+    if (0 != memcmp(buf, ciphertext, length) || 0 != memcmp(tag, expected_tag, AES_GCM_TAG_LEN)) {
+        printf("FAIL  %s (%s): encryption\n", vector->name, accelerated ? "AES-NI" : "portable");
+        ++failures;
+    }
+
+    memcpy(buf, ciphertext, length);
+    if (0 != AES_GCM_decrypt(&ctx, iv, aad_len ? aad : NULL, aad_len, buf, length, expected_tag)
+        || 0 != memcmp(buf, plaintext, length)
+    ) {
+        printf("FAIL  %s (%s): decryption\n", vector->name, accelerated ? "AES-NI" : "portable");
+        ++failures;
+    }
+
+    memcpy(buf, ciphertext, length);
+    expected_tag[AES_GCM_TAG_LEN - 1] ^= 0x01;
+    if (0 == AES_GCM_decrypt(&ctx, iv, aad_len ? aad : NULL, aad_len, buf, length, expected_tag)) {
+        printf("FAIL  %s (%s): a corrupted tag was accepted\n", vector->name, accelerated ? "AES-NI" : "portable");
+        ++failures;
+    }
+
+    if (0 == failures) {
+        printf("ok    %s (%s)\n", vector->name, accelerated ? "AES-NI" : "portable");
+    }
+
+    return failures;
+}
+
+
+int
+main(void)
+{
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(gcm_vectors) / sizeof(gcm_vectors[0]); ++i) {
+        failures += check(&gcm_vectors[i], 0);
+
+        if (AES_GCM_is_accelerated()) {
+            failures += check(&gcm_vectors[i], 1);
+        }
+    }
+
+    return 0 == failures ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+/**
+ * A host stand-in for the loader's 'core/util.h', so the crypto sources can be
+ *  built into the host-side tests without gnu-efi.
+ */
+
+#ifndef MFTAH_TEST_UTIL_H
+#define MFTAH_TEST_UTIL_H
+
+#include <stddef.h>
+
+
+static inline
+void
+CopyMem(void *Destination,
+        const void *Source,
+        size_t Length)
+{
+    __builtin_memcpy(Destination, Source, Length);
+}
+
+
+
+#endif   /* MFTAH_TEST_UTIL_H */
@@ -22,7 +22,9 @@ EFI_GUID
 mEfiMpServicesProtocolGuid = EFI_MP_SERVICES_PROTOCOL_GUID;
 
 
-/* Internal method to refresh MP states for mSystemMultiprocessingContext. */
+/* Internal method to refresh MP states for mSystemMultiprocessingContext.
+    The list is updated in place and 'IsWorking' is left alone, since FinishThread
+    clears it without taking ThreadMutex (possibly from an AP). */
 STATIC
 EFI_STATUS
 EFIAPI
@@ -35,14 +37,7 @@ RefreshMPs()
 
     EFI_STATUS Status = EFI_SUCCESS;
     EFI_PROCESSOR_INFORMATION CurrentProcessorInfo = {0};
-    MFTAH_SYSTEM_MP *OldMPsList = NULL;
-    
-    MFTAH_SYSTEM_MP *ListOfSystemMPs = (MFTAH_SYSTEM_MP *)
-        AllocateZeroPool(sizeof(MFTAH_SYSTEM_MP) * mSystemMultiprocessingContext.MpCount);
-    if (NULL == ListOfSystemMPs) {
-        MUTEX_UNLOCK(ThreadMutex);
-        return EFI_OUT_OF_RESOURCES;
-    }
+    MFTAH_SYSTEM_MP *ListOfSystemMPs = mSystemMultiprocessingContext.MpList;
 
     for (UINTN i = 0; i < mSystemMultiprocessingContext.MpCount; ++i) {
         Status = uefi_call_wrapper(
@@ -59,14 +54,8 @@ RefreshMPs()
         ListOfSystemMPs[i].IsBSP = !!(CurrentProcessorInfo.StatusFlag & PROCESSOR_AS_BSP_BIT);
         ListOfSystemMPs[i].IsEnabled = !!(CurrentProcessorInfo.StatusFlag & PROCESSOR_ENABLED_BIT);
         ListOfSystemMPs[i].IsHealthy = !!(CurrentProcessorInfo.StatusFlag & PROCESSOR_HEALTH_STATUS_BIT);
-        ListOfSystemMPs[i].IsWorking = mSystemMultiprocessingContext.MpList[i].IsWorking;
-        ListOfSystemMPs[i].ProcessorNumber = i;
     }
 
-    OldMPsList = mSystemMultiprocessingContext.MpList;
-    mSystemMultiprocessingContext.MpList = ListOfSystemMPs;
-    FreePool(OldMPsList);
-
     MUTEX_UNLOCK(ThreadMutex);
     return EFI_SUCCESS;
 }
@@ -234,7 +223,31 @@ BOOLEAN
 EFIAPI
 IsThreadingEnabled()
 {
-    return NULL != mEfiMpServicesProtocol || mSystemMultiprocessingContext.MpCount >= 1;
+    /* The protocol is located before the processors are counted, which may still fail. */
+    return NULL != mEfiMpServicesProtocol && mSystemMultiprocessingContext.MpCount >= 1;
+}
+
+
+BOOLEAN
+EFIAPI
+IsRunningOnBsp()
+{
+    UINTN ProcessorNumber = 0;
+
+    if (!IsThreadingEnabled()) {
+        return TRUE;
+    }
+
+    /* WhoAmI is one of the few MP services which APs may call. */
+    if (EFI_ERROR(uefi_call_wrapper(
+        mEfiMpServicesProtocol->WhoAmI, 2,
+        mEfiMpServicesProtocol,
+        &ProcessorNumber
+    ))) {
+        return FALSE;
+    }
+
+    return ProcessorNumber == mSystemMultiprocessingContext.BspProcessorNumber;
 }
 
 
@@ -254,6 +267,17 @@ EFIAPI
 CreateThread(IN EFI_AP_PROCEDURE Method,
              IN VOID             *Context,
              IN OUT MFTAH_THREAD  *NewThread)
+{
+    return CreateThreadEx(Method, Context, NULL, NewThread);
+}
+
+
+EFI_STATUS
+EFIAPI
+CreateThreadEx(IN EFI_AP_PROCEDURE          Method,
+               IN VOID                      *Context,
+               IN MFTAH_THREAD_FINISH_HOOK  OnFinish OPTIONAL,
+               IN OUT MFTAH_THREAD          *NewThread)
 {
     EFI_STATUS Status = EFI_SUCCESS;
 
@@ -268,7 +292,9 @@ CreateThread(IN EFI_AP_PROCEDURE Method,
     NewThread->Method = Method;
     NewThread->Context = Context;
     NewThread->Finished = FALSE;
+    NewThread->Finishing = FALSE;
     NewThread->Started = FALSE;
+    NewThread->OnFinish = OnFinish;
 
     Status = uefi_call_wrapper(
         BS->CreateEvent,
@@ -313,13 +339,18 @@ StartThread(IN MFTAH_THREAD *Thread,
                 // || !mSystemMultiprocessingContext.MpList[i].IsHealthy
             ) {
                 DPRINTLN(L"StartThread: MP #%u is not available.", i);
-                uefi_call_wrapper(BS->Stall, 1, 5*1000);   /* 5ms delay */
                 continue;
             }
 
-            /* Kick off the operation and mark the AP as working. */
+            /* Mark the AP as working before kicking off the operation: a short thread may
+                already be finishing (and clearing the mark) before StartupThisAP returns. */
             DPRINTLN(L"StartThread: MP #%u is available. Assigning thread task.", i);
-            ERRCHECK_UEFI(
+            mSystemMultiprocessingContext.MpList[i].IsWorking = TRUE;
+            Thread->AssignedProcessorNumber = i;
+            Thread->Started = TRUE;
+            __sync_synchronize();
+
+            Status = uefi_call_wrapper(
                 mEfiMpServicesProtocol->StartupThisAP,
                 7,
                 mEfiMpServicesProtocol,
@@ -330,18 +361,19 @@ StartThread(IN MFTAH_THREAD *Thread,
                 (VOID *)Thread->Context,
                 NULL
             );
+            if (EFI_ERROR(Status)) {
+                Thread->Started = FALSE;
+                mSystemMultiprocessingContext.MpList[i].IsWorking = FALSE;
+                return Status;
+            }
 
-            MUTEX_SYNC(ThreadMutex);
-            MUTEX_LOCK(ThreadMutex);
-
-            mSystemMultiprocessingContext.MpList[i].IsWorking = TRUE;
-
-            MUTEX_UNLOCK(ThreadMutex);
-
-            Thread->Started = TRUE;
-            Thread->AssignedProcessorNumber = i;
             break;
         }
+
+        /* Only back off once per full scan of the MPs, and never when the caller can't wait. */
+        if (!Thread->Started && Wait) {
+            uefi_call_wrapper(BS->Stall, 1, 5*1000);   /* 5ms delay */
+        }
     } while (!Thread->Started && Wait);
 
     if (!Thread->Started) {
@@ -357,29 +389,37 @@ EFIAPI
 FinishThread(IN EFI_EVENT EventSource,
              IN VOID *Thread)
 {
+    MFTAH_THREAD *Finishing = (MFTAH_THREAD *)Thread;
+    MFTAH_THREAD_FINISH_HOOK OnFinish = NULL;
     UINTN ProcNumber = 0;
 
-    if (NULL == Thread) {
+    if (NULL == Finishing) {
         EFI_WARNINGLN(L"FinishThread: The thread to close is NULL.");
         return;
-    } else if (TRUE == ((MFTAH_THREAD *)Thread)->Finished) {
+    }
+
+    /* The AP and the BSP's TPL_NOTIFY callback can both get here for the same thread, and the
+        latter may have interrupted the BSP while it holds ThreadMutex. So no lock is taken:
+        whoever flips 'Finishing' first completes the thread, and everyone else moves on. */
+    if (!__sync_bool_compare_and_swap(&(Finishing->Finishing), FALSE, TRUE)) {
         DPRINTLN(L"FinishThread: The thread is already finished. Moving on...");
         return;
     }
 
-    ProcNumber = ((MFTAH_THREAD *)Thread)->AssignedProcessorNumber;
-
-    MUTEX_SYNC(ThreadMutex);
-    MUTEX_LOCK(ThreadMutex);
+    /* Once 'Finished' is set, the owner may free the thread at any time. */
+    ProcNumber = Finishing->AssignedProcessorNumber;
+    OnFinish = Finishing->OnFinish;
 
     mSystemMultiprocessingContext.MpList[ProcNumber].IsWorking = FALSE;
+    __sync_synchronize();
+    Finishing->Finished = TRUE;
 
-    MUTEX_UNLOCK(ThreadMutex);
-
-    ((MFTAH_THREAD *)Thread)->Finished = TRUE;
     DPRINTLN(L"Finished thread on MP #%d.", ProcNumber);
 
-    RefreshMPs();
+    /* Only run the hook when the MP services signaled the event on the BSP. */
+    if (NULL != EventSource && NULL != OnFinish) {
+        OnFinish(Finishing);
+    }
 }
 
 
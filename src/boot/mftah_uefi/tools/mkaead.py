@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""
+Seal a raw ramdisk image as an authenticated (AES-256-GCM or ChaCha20-Poly1305) MFTAH payload.
+
+The image is split into segments which are each encrypted with their own IV and tag,
+ on every processor of this machine at once. The loader authenticates and decrypts
+ the segments the same way, in parallel, in a single pass. Pick ChaCha20-Poly1305
+ for targets without AES-NI. The layout matches 'MFTAH_AEAD_HEADER' in
+ 'src/include/boot/mftah_uefi/core/aead.h'.
+
+The loader derives the payload key with a single HMAC, so it only accepts authenticated
+ payloads on volumes with KDF parameters (see 'mkkdf.py'). Seal the payload with the
+ derived password which that tool prints, not with the typed one; anything else is
+ refused here. Needs the 'cryptography' module.
+"""
+
+import argparse
+import getpass
+import hashlib
+import hmac
+import multiprocessing
+import os
+import struct
+import sys
+
+
+SIGNATURE = struct.unpack('<I', b'MGCM')[0]
+VERSION = 1
+
+AES_BLOCK = 16
+TAG_LENGTH = 16
+SALT_LENGTH = 32
+NONCE_PREFIX_LENGTH = 4
+MIN_SEGMENT_SIZE = 4 << 10
+MAX_SEGMENT_SIZE = 1 << 30
+
+CIPHERS = {
+    'aes-256-gcm': 0,
+    'chacha20-poly1305': 1,
+}
+
+HEADER_INDEX = 0xFFFFFFFFFFFFFFFF
+KDF_TAG_LENGTH = 16
+KEY_LABEL = b'MFTAH-UEFI authenticated payload\0'
+
+# Everything up to the header tag is the AAD of the header and of every segment.
+HEADER_AAD = struct.Struct(f'<IIQII{SALT_LENGTH}s{NONCE_PREFIX_LENGTH}sI16x')
+
+
+def segment_iv(prefix, index):
+    return prefix + struct.pack('>Q', index)
+
+
+def aead(cipher, key):
+    from cryptography.hazmat.primitives.ciphers.aead import AESGCM, ChaCha20Poly1305
+    return ChaCha20Poly1305(key) if CIPHERS['chacha20-poly1305'] == cipher else AESGCM(key)
+
+
+def seal_segment(job):
+    cipher, key, prefix, aad, index, plaintext = job
+
+    sealed = aead(cipher, key).encrypt(segment_iv(prefix, index), plaintext, aad)
+    return index, sealed[:-TAG_LENGTH], sealed[-TAG_LENGTH:]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('image', help='the raw ramdisk image to seal')
+    parser.add_argument('output', help='the payload to write, e.g. BOOT.CROWS')
+    parser.add_argument('--segment-size', type=int, default=4 << 20,
+                        help='the size of each independently sealed segment (default: 4 MiB)')
+    parser.add_argument('--cipher', choices=sorted(CIPHERS), default='aes-256-gcm',
+                        help='the segment cipher; use chacha20-poly1305 for targets without AES-NI (default: aes-256-gcm)')
+    parser.add_argument('--jobs', type=int, default=os.cpu_count() or 1,
+                        help='how many segments to seal at once (default: one per processor)')
+    args = parser.parse_args()
+
+    try:
+        aead(0, bytes(32))
+    except ImportError:
+        sys.exit('mkaead: the \'cryptography\' module is needed to seal payloads')
+
+    size = os.path.getsize(args.image)
+    if 0 == size or 0 != size % AES_BLOCK:
+        sys.exit(f'mkaead: the image size must be a nonzero multiple of {AES_BLOCK} bytes')
+    if not MIN_SEGMENT_SIZE <= args.segment_size <= MAX_SEGMENT_SIZE or 0 != args.segment_size % AES_BLOCK:
+        sys.exit(f'mkaead: the segment size must be a multiple of {AES_BLOCK} '
+                 f'from {MIN_SEGMENT_SIZE} to {MAX_SEGMENT_SIZE} bytes')
+
+    # The loader only ever sees the low byte of each typed character.
+    password = getpass.getpass('Derived payload password: ').encode('latin-1')
+    if password != getpass.getpass('Again: ').encode('latin-1'):
+        sys.exit('mkaead: the passwords do not match')
+    if len(password) != 2 * KDF_TAG_LENGTH or password.strip(b'0123456789abcdef'):
+        sys.exit(f'mkaead: give the {2 * KDF_TAG_LENGTH} hex digits derived by \'mkkdf.py\', not the typed password')
+
+    count = (size + args.segment_size - 1) // args.segment_size
+    salt = os.urandom(SALT_LENGTH)
+    prefix = os.urandom(NONCE_PREFIX_LENGTH)
+    key = hmac.new(password, KEY_LABEL + salt, hashlib.sha256).digest()
+
+    cipher = CIPHERS[args.cipher]
+    aad = HEADER_AAD.pack(SIGNATURE, VERSION, size, args.segment_size, count, salt, prefix, cipher)
+    header_tag = aead(cipher, key).encrypt(segment_iv(prefix, HEADER_INDEX), b'', aad)
+    data_offset = len(aad) + TAG_LENGTH + (count * TAG_LENGTH)
+
+    def jobs(image):
+        for index in range(count):
+            yield cipher, key, prefix, aad, index, image.read(args.segment_size)
+
+    with open(args.image, 'rb') as image, open(args.output, 'wb') as output, \
+            multiprocessing.Pool(max(1, args.jobs)) as pool:
+        output.write(aad + header_tag)
+        output.truncate(data_offset + size)
+
+        for index, ciphertext, tag in pool.imap_unordered(seal_segment, jobs(image)):
+            output.seek(len(aad) + TAG_LENGTH + (index * TAG_LENGTH))
+            output.write(tag)
+            output.seek(data_offset + (index * args.segment_size))
+            output.write(ciphertext)
+
+    print(f'mkaead: sealed {size} bytes with {args.cipher} as {count} segments of {args.segment_size} bytes '
+          f'into {args.output}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+"""
+Build the 'CROWS.CATALOG' payload index for the root of an MFTAH boot volume.
+
+With a catalog in place, the loader discovers payloads with a single read rather
+ than scanning the root directory. The catalog must be rebuilt whenever payloads
+ are added, removed or replaced; the loader notices stale entries when a payload
+ is opened and falls back to scanning the directory.
+
+The layout matches 'MFTAH_CATALOG_HEADER' and 'MFTAH_CATALOG_ENTRY' in
+ 'src/include/boot/mftah_uefi/core/loader.h'.
+"""
+
+import argparse
+import hashlib
+import os
+import struct
+import sys
+import zlib
+
+
+CATALOG_FILE_NAME = 'CROWS.CATALOG'
+PAYLOAD_EXTENSION = '.CROWS'
+
+SIGNATURE = struct.unpack('<I', b'MCAT')[0]
+VERSION = 1
+MAX_PAYLOADS = 32
+MAX_FILENAME_LENGTH = 64
+MAX_DIGEST_LENGTH = 1 << 16
+
+HEADER = struct.Struct('<IIIIII')
+ENTRY = struct.Struct(f'<{(MAX_FILENAME_LENGTH + 1) * 2}sHQQ32s')
+
+
+def build_entry(path, name, digest_length):
+    size = os.path.getsize(path)
+    with open(path, 'rb') as handle:
+        header_digest = hashlib.sha256(handle.read(digest_length)).digest()
+
+    encoded_name = name.encode('utf-16-le').ljust((MAX_FILENAME_LENGTH + 1) * 2, b'\0')
+    return ENTRY.pack(encoded_name, 0, size, 0, header_digest)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('volume_root', help='the mounted root directory of the boot volume')
+    parser.add_argument('--digest-length', type=int, default=4096,
+                        help='how many leading bytes of each payload are digested')
+    args = parser.parse_args()
+
+    if not 0 < args.digest_length <= MAX_DIGEST_LENGTH:
+        sys.exit(f'mkcatalog: the digest length must be between 1 and {MAX_DIGEST_LENGTH}')
+
+    # The loader only looks at the root directory, in directory order.
+    names = [
+        name for name in os.listdir(args.volume_root)
+        if name.upper().endswith(PAYLOAD_EXTENSION)
+        and len(name) > len(PAYLOAD_EXTENSION)
+        and os.path.isfile(os.path.join(args.volume_root, name))
+    ]
+
+    for name in names:
+        if len(name) > MAX_FILENAME_LENGTH or not name.isascii():
+            sys.exit(f"mkcatalog: '{name}' can't be represented in the catalog")
+
+    if len(names) > MAX_PAYLOADS:
+        print(f'mkcatalog: only the first {MAX_PAYLOADS} of {len(names)} payloads are listed', file=sys.stderr)
+        names = names[:MAX_PAYLOADS]
+
+    entries = b''.join(
+        build_entry(os.path.join(args.volume_root, name), name, args.digest_length) for name in names
+    )
+    header = HEADER.pack(SIGNATURE, VERSION, len(names), args.digest_length, zlib.crc32(entries), 0)
+
+    catalog_path = os.path.join(args.volume_root, CATALOG_FILE_NAME)
+    with open(catalog_path, 'wb') as handle:
+        handle.write(header + entries)
+
+    for name in names:
+        print(f'mkcatalog: listed {name}')
+    print(f"mkcatalog: wrote {len(names)} entries to '{catalog_path}'")
+
+
+if __name__ == '__main__':
+    main()
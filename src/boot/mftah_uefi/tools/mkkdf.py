@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+"""
+Write the 'CROWS.KDF' password stretching parameters for the root of an MFTAH boot volume.
+
+With this file in place, the loader stretches the typed password with Argon2id and
+ unlocks the payloads with the tag, written as 32 lower-case hex digits. Payloads
+ must therefore be encrypted with that derived password. It is printed here when the
+ 'argon2-cffi' module is available; otherwise the equivalent 'argon2' command is.
+
+The salt is made of printable characters so the reference 'argon2' CLI can take it
+ as an argument. The layout matches 'MFTAH_KDF_PARAMETERS' in
+ 'src/include/boot/mftah_uefi/core/kdf.h'.
+"""
+
+import argparse
+import getpass
+import os
+import secrets
+import shlex
+import struct
+import sys
+
+
+KDF_FILE_NAME = 'CROWS.KDF'
+
+SIGNATURE = struct.unpack('<I', b'MKDF')[0]
+VERSION = 1
+ALGORITHM_ARGON2ID = 1
+MAX_SALT_LENGTH = 64
+TAG_LENGTH = 16
+
+PARAMETERS = struct.Struct(f'<IIIIIIII{MAX_SALT_LENGTH}s')
+
+
+def derive(password, salt, memory_kib, passes, lanes):
+    try:
+        from argon2.low_level import Type, hash_secret_raw
+    except ImportError:
+        return None
+
+    return hash_secret_raw(password.encode('latin-1'), salt, time_cost=passes, memory_cost=memory_kib,
+                           parallelism=lanes, hash_len=TAG_LENGTH, type=Type.ID, version=19).hex()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('volume_root', help='the mounted root directory of the boot volume')
+    parser.add_argument('--memory', type=int, default=256 * 1024,
+                        help='the memory cost in KiB (default: 256 MiB)')
+    parser.add_argument('--passes', type=int, default=3, help='the number of passes (default: 3)')
+    parser.add_argument('--lanes', type=int, default=os.cpu_count() or 4,
+                        help='the parallelism; match the processor count of the target (default: this one\'s)')
+    parser.add_argument('--salt', help='a printable salt of 8 to 64 characters (default: random)')
+    args = parser.parse_args()
+
+    salt = (args.salt if args.salt is not None else secrets.token_hex(16)).encode('ascii')
+    if not 8 <= len(salt) <= MAX_SALT_LENGTH:
+        sys.exit(f'mkkdf: the salt must be between 8 and {MAX_SALT_LENGTH} characters')
+    if not 1 <= args.lanes <= 0xFFFFFF or args.passes < 1:
+        sys.exit('mkkdf: the lane and pass counts must be positive')
+    if args.memory < 8 * args.lanes:
+        sys.exit('mkkdf: the memory cost must be at least 8 KiB per lane')
+
+    with open(os.path.join(args.volume_root, KDF_FILE_NAME), 'wb') as handle:
+        handle.write(PARAMETERS.pack(SIGNATURE, VERSION, ALGORITHM_ARGON2ID, args.memory,
+                                     args.passes, args.lanes, len(salt), 0, salt))
+
+    print(f'mkkdf: wrote {KDF_FILE_NAME} (Argon2id, m={args.memory} KiB, t={args.passes}, p={args.lanes})')
+
+    derived = None
+    if sys.stdin.isatty():
+        derived = derive(getpass.getpass('Payload password (to print the derived one): '),
+                         salt, args.memory, args.passes, args.lanes)
+
+    if derived is not None:
+        print(f'mkkdf: encrypt the payloads with the password {derived}')
+    else:
+        command = ['argon2', salt.decode('ascii'), '-id', '-t', str(args.passes), '-k', str(args.memory),
+                   '-p', str(args.lanes), '-l', str(TAG_LENGTH), '-r']
+        print('mkkdf: encrypt the payloads with the password printed by:')
+        print(f'    printf %s "$PASSWORD" | {shlex.join(command)}')
+
+
+if __name__ == '__main__':
+    main()
@@ -1,7 +1,21 @@
 #include "core/util.h"
+#include "core/arena.h"
+#include "core/handoff.h"
+#include "core/progress.h"
 #include "drivers/threading.h"
 
 
+/* Each decryption thread slot owns a small arena for its worker context. */
+STATIC ARENA mDecryptArenas[MFTAH_MAX_THREAD_COUNT] = {0};
+
+/* The batch which newly spawned workers are tagged with, and which UefiSpin waits on. */
+STATIC UINTN mDecryptBatch = 0;
+
+/* Work for the BSP to pick up between progress checks in UefiSpin. */
+STATIC DECRYPT_IDLE_HOOK mDecryptIdleHook = NULL;
+STATIC VOID *mDecryptIdleContext = NULL;
+
+
 
 UINT8
 EFIAPI
@@ -44,6 +58,129 @@ FileSize(IN CONST EFI_FILE_HANDLE *FileHandle)
 }
 
 
+/**
+ * One chunk of a streamed file hash.
+ */
+typedef
+struct {
+    struct Sha_256  *Sha256;
+    CONST UINT8     *Data;
+    UINTN           Length;
+} HASH_FILE_STEP;
+
+
+/**
+ * Add a chunk to a streamed hash. Runs on the BSP and on APs alike.
+ *
+ * @param[in]  Context  The HASH_FILE_STEP to add.
+ */
+STATIC
+VOID
+EFIAPI
+HashFileStep(IN VOID *Context)
+{
+    HASH_FILE_STEP *Step = (HASH_FILE_STEP *)Context;
+
+    sha_256_write(Step->Sha256, Step->Data, Step->Length);
+}
+
+
+EFI_STATUS
+EFIAPI
+HashFile(IN EFI_FILE_PROTOCOL *FileHandle,
+         OUT UINT8 *Hash,
+         OUT UINT64 *HashedLength OPTIONAL)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    EFI_PHYSICAL_ADDRESS BufferBase = 0;
+    UINTN BufferPages = EFI_SIZE_TO_PAGES(2 * MFTAH_HASH_FILE_CHUNK_SIZE);
+    UINT8 *Buffers[2] = {0};
+    UINTN Current = 0;
+    UINTN ReadLength = 0;
+    UINT64 Total = 0;
+    UINT64 Remaining = 0;
+    struct Sha_256 Sha256;
+    HASH_FILE_STEP Step = {0};
+    MFTAH_THREAD Helper = {0};
+    BOOLEAN HelperStarted = FALSE;
+
+    if (NULL == FileHandle || NULL == Hash) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Status = uefi_call_wrapper(BS->AllocatePages, 4,
+                               AllocateAnyPages, EfiLoaderData, BufferPages, &BufferBase);
+    if (EFI_ERROR(Status)) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    Buffers[0] = (UINT8 *)(UINTN)BufferBase;
+    Buffers[1] = Buffers[0] + MFTAH_HASH_FILE_CHUNK_SIZE;
+
+    Status = uefi_call_wrapper(FileHandle->SetPosition, 2, FileHandle, 0);
+    if (EFI_ERROR(Status)) {
+        goto Label__HashFile__Done;
+    }
+
+    Remaining = FileSize(&FileHandle);
+
+    sha_256_init(&Sha256, Hash);
+    Step.Sha256 = &Sha256;
+
+    /* Reads stop at the file length instead of waiting for an empty read. */
+    ReadLength = (UINTN)MIN((UINT64)MFTAH_HASH_FILE_CHUNK_SIZE, Remaining);
+    if (ReadLength > 0) {
+        Status = uefi_call_wrapper(FileHandle->Read, 3, FileHandle, &ReadLength, Buffers[Current]);
+    }
+
+    while (!EFI_ERROR(Status) && Remaining > 0) {
+        if (0 == ReadLength) {
+            Status = EFI_END_OF_FILE;
+            break;
+        }
+
+        Step.Data = Buffers[Current];
+        Step.Length = ReadLength;
+        Total += ReadLength;
+        Remaining -= ReadLength;
+
+        HelperStarted = FALSE;
+        if (Remaining > 0 && IsThreadingEnabled() && GetThreadLimit() > 0
+            && !EFI_ERROR(CreateThread(HashFileStep, (VOID *)&Step, &Helper))
+        ) {
+            HelperStarted = !EFI_ERROR(StartThread(&Helper, FALSE));
+            if (!HelperStarted) {
+                uefi_call_wrapper(BS->CloseEvent, 1, Helper.CompletionEvent);
+            }
+        }
+        if (!HelperStarted) {
+            HashFileStep((VOID *)&Step);
+        }
+
+        /* The next chunk is read while the helper hashes this one. */
+        Current ^= 1;
+        ReadLength = (UINTN)MIN((UINT64)MFTAH_HASH_FILE_CHUNK_SIZE, Remaining);
+        if (ReadLength > 0) {
+            Status = uefi_call_wrapper(FileHandle->Read, 3, FileHandle, &ReadLength, Buffers[Current]);
+        }
+
+        if (HelperStarted) {
+            JoinThread(&Helper);
+            uefi_call_wrapper(BS->CloseEvent, 1, Helper.CompletionEvent);
+        }
+    }
+
+    if (!EFI_ERROR(Status)) {
+        sha_256_close(&Sha256);
+        if (NULL != HashedLength) *HashedLength = Total;
+    }
+
+Label__HashFile__Done:
+    uefi_call_wrapper(BS->FreePages, 2, BufferBase, BufferPages);
+    return Status;
+}
+
+
 VOID
 EFIAPI
 Shutdown(IN CONST EFI_STATUS Reason)
@@ -62,20 +199,22 @@ PrintProgress(IN CONST UINT64 *CurrentValue,
               IN CONST UINT64 *OutOfValue,
               IN VOID *ExtraInfo OPTIONAL)
 {
-    UINT8 PercentDone, PercentByFive;
-    double PercentRaw;
-    
     if (NULL == CurrentValue || NULL == OutOfValue || 0 == *OutOfValue)
         return;
 
-    PercentRaw = (double)(*CurrentValue) / (double)(*OutOfValue);
-    PercentDone = MIN(100, (int)(PercentRaw * 100.0f));
-    PercentByFive = MIN(20, (PercentDone / 5));
+    ProgressUpdate(*CurrentValue, *OutOfValue);
+}
+
 
-    Print(L"\r  %3d%% [", PercentDone);
-    for (int i = 0; i < PercentByFive; ++i) Print(L"=");
-    for (int i = 0; i < (20 - PercentByFive); ++i) Print(L" ");
-    Print(L"] (%16x / %16x)   ", *CurrentValue, *OutOfValue);
+/**
+ * Whether a thread slot holds a worker which hasn't finished yet, started or not.
+ */
+STATIC
+BOOLEAN
+EFIAPI
+IsThreadSlotOccupied(IN UINTN Index)
+{
+    return NULL != Threads[Index].Context && !Threads[Index].Finished;
 }
 
 
@@ -135,6 +274,11 @@ SpawnDecryptionWorker(IN mftah_immutable_protocol_t MFTAH,
     mftah_progress_t ThreadProgress = {0};
     mftah_progress_t *ThreadProgressClone = NULL;
     mftah_work_order_t *WorkOrderClone = NULL;
+#if MFTAH_EARLY_HANDOFF == 1
+    mftah_work_order_t LocalWorkOrder = {0};
+#endif
+    ARENA *ThreadArena = NULL;
+    UINTN Slot = 0;
 
     if (
         NULL == MFTAH
@@ -165,44 +309,85 @@ SpawnDecryptionWorker(IN mftah_immutable_protocol_t MFTAH,
         ? NULL
         : (IsThreadingEnabled() ? SaveThreadProgress : PrintProgress);
 
+    /* Workers of another payload's decryption may still hold the slot the library chose.
+        Any free slot will do then; with none free, the work runs here on the BSP. */
+    Slot = WorkOrder->thread_index;
+    if (IsThreadingEnabled() && IsThreadSlotOccupied(Slot)
+        && mDecryptBatch != ((DECRYPT_THREAD_CTX *)(Threads[Slot].Context))->Batch
+    ) {
+        for (Slot = 0; Slot < MFTAH_MAX_THREAD_COUNT && IsThreadSlotOccupied(Slot); ++Slot);
+    }
+
+    /* When threading, the work order has everything necessary for the decryption worker. */
+    if (IsThreadingEnabled() && Slot < MFTAH_MAX_THREAD_COUNT
+        && Threads[Slot].Started && !Threads[Slot].Finished
+    ) {
+        return MFTAH_THREAD_BUSY;
+    }
+
+#if MFTAH_EARLY_HANDOFF == 1
+    /* Work beyond the early handoff prefix is left for the kernel. This happens only once the
+        work order is sure to run, since a busy slot makes the library offer it again. */
+    LocalWorkOrder = *WorkOrder;
+    LocalWorkOrder.length = HandoffDeferWork(mDecryptBatch, WorkOrder, Sha256Key, InitializationVector);
+    if (!LocalWorkOrder.length) return MFTAH_SUCCESS;
+    WorkOrder = &LocalWorkOrder;
+#endif
+
     /* This will synchronously run the operation. Each progress message is tracked individually. */
-    if (!IsThreadingEnabled()) {
+    if (!IsThreadingEnabled() || Slot >= MFTAH_MAX_THREAD_COUNT) {
         PRINTLN(L"\r\nDecrypting contiguous block at (%p) of (%llu) bytes.", WorkOrder->location, WorkOrder->length);
 
+        if (NULL != ThreadProgress.hook) ProgressBegin();
+
         MftahStatus = MFTAH_CRYPT_HOOK_DEFAULT(MFTAH,
                                              WorkOrder,
                                              Sha256Key,
                                              InitializationVector,
                                              &ThreadProgress);
 
+        if (NULL != ThreadProgress.hook) ProgressEnd();
+
         PRINT(L"   OK\r\n");
         return MftahStatus;
     }
 
-    /* When threading, the work order has everything necessary for the decryption worker. */
-    if (Threads[WorkOrder->thread_index].Started && !Threads[WorkOrder->thread_index].Finished) {
-        return MFTAH_THREAD_BUSY;
+    /* Whatever an earlier worker in this thread slot allocated is released here. */
+    ThreadArena = &(mDecryptArenas[Slot]);
+    if (NULL == ThreadArena->Slabs) {
+        Status = ArenaCreate(ThreadArena, MFTAH_ARENA_THREAD_SLAB_SIZE);
+        if (EFI_ERROR(Status)) {
+            PANIC(L"Unable to reserve memory for a decryption worker.");
+        }
+    } else {
+        ArenaReset(ThreadArena);
+    }
+
+    NewThreadContext = (DECRYPT_THREAD_CTX *)ArenaAllocateZero(ThreadArena, sizeof(DECRYPT_THREAD_CTX));
+    WorkOrderClone = (mftah_work_order_t *)ArenaAllocate(ThreadArena, sizeof(mftah_work_order_t));
+    ThreadProgressClone = (mftah_progress_t *)ArenaAllocate(ThreadArena, sizeof(mftah_progress_t));
+    if (NULL == NewThreadContext || NULL == WorkOrderClone || NULL == ThreadProgressClone) {
+        PANIC(L"Unable to allocate the context of a decryption worker.");
     }
 
-    NewThreadContext = (DECRYPT_THREAD_CTX *)AllocateZeroPool(sizeof(DECRYPT_THREAD_CTX));
     NewThreadContext->CurrentPlace = 0;
-    NewThreadContext->Thread = &(Threads[WorkOrder->thread_index]);
+    NewThreadContext->Batch = mDecryptBatch;
+    NewThreadContext->Thread = &(Threads[Slot]);
     CopyMem(NewThreadContext->InitializationVector, (VOID *)InitializationVector, AES_BLOCKLEN);
     CopyMem(NewThreadContext->Sha256Key, (VOID *)Sha256Key, SIZE_OF_SHA_256_HASH);
 
-    WorkOrderClone = (mftah_work_order_t *)AllocateZeroPool(sizeof(mftah_work_order_t));
     CopyMem(WorkOrderClone, WorkOrder, sizeof(mftah_work_order_t));
     NewThreadContext->WorkOrder = WorkOrderClone;
 
     ThreadProgress.context = (VOID *)&(NewThreadContext->CurrentPlace);
 
-    ThreadProgressClone = (mftah_progress_t *)AllocateZeroPool(sizeof(mftah_progress_t));
     CopyMem(ThreadProgressClone, &ThreadProgress, sizeof(mftah_progress_t));
     NewThreadContext->Progress = ThreadProgressClone;
 
     DPRINTLN(
-        L"Initializing decryption worker #%u (%p : 0x%08llx).",
+        L"Initializing decryption worker #%u in slot %u (%p : 0x%08llx).",
         WorkOrderClone->thread_index,
+        Slot,
         WorkOrderClone->location,
         WorkOrderClone->length
     );
@@ -233,6 +418,8 @@ UefiSpin(IN UINT64 *QueuedBytes)
     DECRYPT_THREAD_CTX *ThisThreadContext = NULL;
     BOOLEAN SuppressProgress = FALSE;
     BOOLEAN Completed = TRUE;
+    BOOLEAN DidIdleWork = FALSE;
+    UINTN Batch = mDecryptBatch;
     UINT64 Progress = 0;
     UINT64 TotalProgress = *QueuedBytes;
 
@@ -254,6 +441,10 @@ UefiSpin(IN UINT64 *QueuedBytes)
         }
     }
 
+    if (!SuppressProgress) {
+        ProgressBegin();
+    }
+
     do {
         Completed = TRUE;
         Progress = FALSE;
@@ -265,8 +456,14 @@ UefiSpin(IN UINT64 *QueuedBytes)
                 continue;
             }
 
+            /* Keep trying to start waiting threads, including those of other batches. */
             if (!Threads[i].Started && !Threads[i].Finished) {
-                StartThread((MFTAH_THREAD *)&Threads[i], FALSE);   /* Keep trying to start waiting threads. */
+                StartThread((MFTAH_THREAD *)&Threads[i], FALSE);
+            }
+
+            /* Only this batch's workers decide when this spin is done. */
+            if (Batch != ThisThreadContext->Batch) {
+                continue;
             }
 
             Completed &= Threads[i].Finished;
@@ -274,18 +471,61 @@ UefiSpin(IN UINT64 *QueuedBytes)
         }
 
         if (!SuppressProgress) {
-            PrintProgress(&Progress, &TotalProgress, NULL);
+            ProgressUpdate(Progress, TotalProgress);
         }
 
+        /* Don't sleep while the BSP has something better to do. */
+        DidIdleWork = (NULL != mDecryptIdleHook && !Completed)
+            ? mDecryptIdleHook(mDecryptIdleContext)
+            : FALSE;
+
         /* 50 ms sleep. */
-        uefi_call_wrapper(BS->Stall, 1, (50 * 1000));
+        if (!DidIdleWork) {
+            uefi_call_wrapper(BS->Stall, 1, (50 * 1000));
+        }
     } while (!Completed && Progress < TotalProgress);
 
     DPRINTLN(L"All done!");
 
     /* Be sure the 100% message always gets out. */
     if (!SuppressProgress) {
-        PrintProgress(&TotalProgress, &TotalProgress, NULL);
+        ProgressUpdate(TotalProgress, TotalProgress);
+        ProgressEnd();
         PRINT(L"\n    ~~~ OK ~~~\n\n");
     }
 }
+
+
+VOID
+EFIAPI
+ReleaseDecryptionArenas(VOID)
+{
+    for (UINTN i = 0; i < MFTAH_MAX_THREAD_COUNT; ++i) {
+        if (Threads[i].Started && !Threads[i].Finished) {
+            continue;
+        }
+
+        ArenaDestroy(&(mDecryptArenas[i]));
+    }
+}
+
+
+UINTN
+EFIAPI
+SwitchDecryptionBatch(IN UINTN Batch)
+{
+    UINTN Previous = mDecryptBatch;
+
+    mDecryptBatch = Batch;
+    return Previous;
+}
+
+
+VOID
+EFIAPI
+SetDecryptionIdleHook(IN DECRYPT_IDLE_HOOK Hook OPTIONAL,
+                      IN VOID *Context OPTIONAL)
+{
+    mDecryptIdleHook = Hook;
+    mDecryptIdleContext = Context;
+}
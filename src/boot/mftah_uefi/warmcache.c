@@ -0,0 +1,343 @@
+#include "core/warmcache.h"
+#include "core/memory.h"
+#include "core/profiler.h"
+#include "core/util.h"
+#include "drivers/threading.h"
+
+
+
+/* Binds the tag key to this use and to one payload, so it matches no other HMAC of the password. */
+STATIC CONST CHAR8 mWarmCacheKeyLabel[] = "MFTAH-UEFI warm cache";
+
+
+/**
+ * The leaves of one tag computation. The BSP and every AP helping it pull leaf
+ *  indices from 'NextLeaf' until none are left.
+ */
+typedef
+struct {
+    CONST UINT8     *Image;
+    UINT64          Length;
+    UINT64          LeafSize;
+    UINT64          LeafCount;
+    UINT8           *Digests;
+    UINT64 VOLATILE NextLeaf;
+} WARM_CACHE_HASH_JOB;
+
+
+
+/**
+ * Hash leaves of a job until none are left. Runs on the BSP and on APs alike,
+ *  so it must not use any boot services.
+ *
+ * @param[in]  Context  The WARM_CACHE_HASH_JOB to work on.
+ */
+STATIC
+VOID
+EFIAPI
+WarmCacheHashLeaves(IN VOID *Context)
+{
+    WARM_CACHE_HASH_JOB *Job = (WARM_CACHE_HASH_JOB *)Context;
+    UINT64 Leaf, Offset;
+
+    while ((Leaf = __sync_fetch_and_add(&(Job->NextLeaf), 1)) < Job->LeafCount) {
+        Offset = Leaf * Job->LeafSize;
+        calc_sha_256(Job->Digests + (Leaf * SIZE_OF_SHA_256_HASH),
+                     Job->Image + Offset,
+                     MIN(Job->LeafSize, Job->Length - Offset));
+    }
+}
+
+
+/**
+ * Compute the tag of a cache record and the ramdisk it describes.
+ *
+ * @param[in]   Record  The record. Its 'Tag' isn't read.
+ * @param[in]   Key     The tag key from WarmCacheDeriveKey.
+ * @param[out]  Tag     Set to the tag.
+ *
+ * @retval EFI_SUCCESS           The tag was computed.
+ * @retval EFI_OUT_OF_RESOURCES  The leaf digests couldn't be allocated.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+WarmCacheComputeTag(IN CONST MFTAH_WARM_CACHE_RECORD *Record,
+                    IN CONST UINT8 *Key,
+                    OUT UINT8 *Tag)
+{
+    WARM_CACHE_HASH_JOB Job = {0};
+    MFTAH_THREAD *Helpers = NULL;
+    UINTN HelperCount = 0, Started = 0;
+    UINT8 *Message = NULL;
+    UINTN Covered = __builtin_offsetof(MFTAH_WARM_CACHE_RECORD, Tag);
+
+    Job.Image = (CONST UINT8 *)(UINTN)Record->RamdiskBase;
+    Job.Length = Record->RamdiskLength;
+    Job.LeafSize = Record->LeafSize;
+    Job.LeafCount = (Record->RamdiskLength + Record->LeafSize - 1) / Record->LeafSize;
+
+    /* The message is the covered part of the record followed by every leaf digest. */
+    Message = (UINT8 *)AllocatePool(Covered + (Job.LeafCount * SIZE_OF_SHA_256_HASH));
+    if (NULL == Message) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    CopyMem(Message, (VOID *)Record, Covered);
+    Job.Digests = Message + Covered;
+
+    ProfilerBegin(ProfilePhaseHashPayload);
+
+    /* Idle APs each take leaves too. Helpers which can't be started are simply not waited on. */
+    if (IsThreadingEnabled() && Job.LeafCount > 1) {
+        HelperCount = MIN(MIN(GetThreadLimit(), (UINTN)(Job.LeafCount - 1)), MFTAH_MAX_THREAD_COUNT);
+        if (HelperCount > 0) {
+            Helpers = (MFTAH_THREAD *)AllocateZeroPool(HelperCount * sizeof(MFTAH_THREAD));
+            if (NULL == Helpers) HelperCount = 0;
+        }
+
+        for (Started = 0; Started < HelperCount; ++Started) {
+            if (EFI_ERROR(CreateThread(WarmCacheHashLeaves, (VOID *)&Job, &(Helpers[Started])))) break;
+
+            if (EFI_ERROR(StartThread(&(Helpers[Started]), FALSE))) {
+                uefi_call_wrapper(BS->CloseEvent, 1, Helpers[Started].CompletionEvent);
+                break;
+            }
+        }
+    }
+
+    WarmCacheHashLeaves((VOID *)&Job);
+
+    for (UINTN i = 0; i < Started; ++i) {
+        JoinThread(&(Helpers[i]));
+        uefi_call_wrapper(BS->CloseEvent, 1, Helpers[i].CompletionEvent);
+    }
+    if (NULL != Helpers) FreePool(Helpers);
+
+    ProfilerEnd(ProfilePhaseHashPayload, Record->RamdiskLength);
+
+    DPRINTLN(L"-- Hashed (%llu) leaves with (%u) helper processors.", Job.LeafCount, Started);
+
+    hmac_sha256(Key, SIZE_OF_SHA_256_HASH,
+                Message, Covered + (Job.LeafCount * SIZE_OF_SHA_256_HASH),
+                Tag);
+
+    FreePool(Message);
+    return EFI_SUCCESS;
+}
+
+
+/**
+ * Derive the tag key of a payload's cache record from its password.
+ */
+STATIC
+VOID
+EFIAPI
+WarmCacheDeriveKey(IN CONST UINT8 *Password,
+                   IN CONST UINT8 PasswordLength,
+                   IN CONST UINT8 *PayloadHeaderHash,
+                   OUT UINT8 *Key)
+{
+    UINT8 Message[sizeof(mWarmCacheKeyLabel) + SIZE_OF_SHA_256_HASH] = {0};
+
+    CopyMem(Message, (VOID *)mWarmCacheKeyLabel, sizeof(mWarmCacheKeyLabel));
+    CopyMem(Message + sizeof(mWarmCacheKeyLabel), (VOID *)PayloadHeaderHash, SIZE_OF_SHA_256_HASH);
+
+    hmac_sha256(Password, PasswordLength, Message, sizeof(Message), Key);
+}
+
+
+/**
+ * Hash the leading bytes of a payload file: its MFTAH header and first block. This
+ *  changes whenever the payload is rebuilt, without having to read all of it.
+ *
+ * @param[in]   FileHandle  The payload file, at any position. It is left at position 0.
+ * @param[out]  Hash        Set to the digest.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+WarmCacheHashPayloadHeader(IN EFI_FILE_PROTOCOL *FileHandle,
+                           OUT UINT8 *Hash)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    UINTN Length = mftah_payload_header__sizeof() + AES_BLOCKLEN;
+    UINTN ReadLength = Length;
+    UINT8 *Buffer = (UINT8 *)AllocatePool(Length);
+
+    if (NULL == Buffer) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    Status = uefi_call_wrapper(FileHandle->SetPosition, 2, FileHandle, 0);
+    if (!EFI_ERROR(Status)) {
+        Status = uefi_call_wrapper(FileHandle->Read, 3, FileHandle, &ReadLength, Buffer);
+    }
+    uefi_call_wrapper(FileHandle->SetPosition, 2, FileHandle, 0);
+
+    if (!EFI_ERROR(Status) && ReadLength != Length) {
+        Status = EFI_END_OF_FILE;
+    }
+    if (!EFI_ERROR(Status)) {
+        calc_sha_256(Hash, Buffer, Length);
+    }
+
+    FreePool(Buffer);
+    return Status;
+}
+
+
+/**
+ * Forget the kept ramdisk, so a stale record isn't checked again on every boot.
+ */
+STATIC
+VOID
+EFIAPI
+WarmCacheForget(VOID)
+{
+    uefi_call_wrapper(
+        ST->RuntimeServices->SetVariable,
+        5,
+        MFTAH_WARM_CACHE_VARIABLE,
+        &gXmitVendorGuid,
+        EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+        0,
+        NULL
+    );
+}
+
+
+EFI_STATUS
+EFIAPI
+WarmCacheRestore(IN OUT BATCH_PAYLOAD *Payload,
+                 IN CONST UINT8 *Password,
+                 IN CONST UINT8 PasswordLength)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    MFTAH_WARM_CACHE_RECORD Record = {0};
+    UINTN RecordSize = sizeof(MFTAH_WARM_CACHE_RECORD);
+    UINT8 HeaderHash[SIZE_OF_SHA_256_HASH] = {0};
+    UINT8 Key[SIZE_OF_SHA_256_HASH] = {0};
+    UINT8 Tag[SIZE_OF_SHA_256_HASH] = {0};
+    EFI_PHYSICAL_ADDRESS RegionBase = 0;
+
+    Status = uefi_call_wrapper(
+        ST->RuntimeServices->GetVariable,
+        5,
+        MFTAH_WARM_CACHE_VARIABLE,
+        &gXmitVendorGuid,
+        NULL,
+        &RecordSize,
+        &Record
+    );
+    if (
+        EFI_ERROR(Status)
+        || sizeof(MFTAH_WARM_CACHE_RECORD) != RecordSize
+        || MFTAH_WARM_CACHE_SIGNATURE != Record.Signature
+        || MFTAH_WARM_CACHE_VERSION != Record.Version
+        || 0 == Record.LeafSize
+        || 0 == Record.RamdiskLength
+    ) {
+        return EFI_NOT_FOUND;
+    }
+
+    /* Only the kept payload itself can be restored; anything else is a normal load. */
+    if (FileSize(&(Payload->FileHandle)) != Record.PayloadFileSize) {
+        return EFI_NOT_FOUND;
+    }
+
+    Status = WarmCacheHashPayloadHeader(Payload->FileHandle, HeaderHash);
+    if (EFI_ERROR(Status) || 0 != CompareMem(HeaderHash, Record.PayloadHeaderHash, SIZE_OF_SHA_256_HASH)) {
+        return EFI_NOT_FOUND;
+    }
+
+    PRINTLN(L"Checking the ramdisk kept from the last boot at '%llx'...", Record.RamdiskBase);
+
+    RegionBase = Record.RegionBase;
+    Status = uefi_call_wrapper(BS->AllocatePages, 4,
+                               AllocateAddress, EfiReservedMemoryType, Record.RegionPages, &RegionBase);
+    if (EFI_ERROR(Status)) {
+        EFI_WARNINGLN(L"-- The kept ramdisk's memory is in use (%r). Loading the payload instead.", Status);
+        WarmCacheForget();
+        return EFI_NO_MEDIA;
+    }
+
+    WarmCacheDeriveKey(Password, PasswordLength, HeaderHash, Key);
+    Status = WarmCacheComputeTag(&Record, Key, Tag);
+    SetMem(Key, sizeof(Key), 0x00);
+
+    if (EFI_ERROR(Status) || 0 != ConstantTimeCompareMem(Tag, Record.Tag, SIZE_OF_SHA_256_HASH)) {
+        EFI_WARNINGLN(L"-- The kept ramdisk didn't survive the reset. Loading the payload instead.");
+        uefi_call_wrapper(BS->FreePages, 2, RegionBase, Record.RegionPages);
+        WarmCacheForget();
+        return EFI_ERROR(Status) ? Status : EFI_CRC_ERROR;
+    }
+
+    Payload->FileSize = Record.PayloadFileSize;
+    Payload->BytesRead = Record.PayloadFileSize;
+    Payload->ReadBuffer = NULL;
+    Payload->Payload = NULL;
+    CopyMem(Payload->PayloadHash, Record.PayloadHash, SIZE_OF_SHA_256_HASH);
+    Payload->RamdiskImage = (UINT8 *)(UINTN)Record.RamdiskBase;
+    Payload->RamdiskLength = Record.RamdiskLength;
+    Payload->Status = EFI_SUCCESS;
+    Payload->State = BatchPayloadDecrypted;
+
+    PRINTLN(L"-- The kept ramdisk is intact; skipping payload decryption.");
+    return EFI_SUCCESS;
+}
+
+
+EFI_STATUS
+EFIAPI
+WarmCacheStore(IN CONST BATCH_PAYLOAD *Payload,
+               IN CONST UINT8 *Password,
+               IN CONST UINT8 PasswordLength)
+{
+    EFI_STATUS Status = EFI_SUCCESS;
+    MFTAH_WARM_CACHE_RECORD Record = {0};
+    UINT8 Key[SIZE_OF_SHA_256_HASH] = {0};
+    UINT64 RamdiskBase = (UINT64)(UINTN)Payload->RamdiskImage;
+
+    if (NULL == Payload->FileHandle || NULL == Payload->RamdiskImage || 0 == Payload->RamdiskLength) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    PRINTLN(L"Keeping the decrypted ramdisk for the next warm boot...");
+
+    Record.Signature = MFTAH_WARM_CACHE_SIGNATURE;
+    Record.Version = MFTAH_WARM_CACHE_VERSION;
+    Record.RegionBase = RamdiskBase & ~((UINT64)EFI_PAGE_MASK);
+    Record.RegionPages = EFI_SIZE_TO_PAGES(RamdiskBase + Payload->RamdiskLength - Record.RegionBase);
+    Record.RamdiskBase = RamdiskBase;
+    Record.RamdiskLength = Payload->RamdiskLength;
+    Record.LeafSize = MFTAH_WARM_CACHE_LEAF_SIZE;
+    Record.PayloadFileSize = Payload->FileSize;
+    CopyMem(Record.PayloadHash, (VOID *)Payload->PayloadHash, SIZE_OF_SHA_256_HASH);
+
+    /* The read buffer is decrypted in place by now, so the header is hashed from the file
+        again, exactly as WarmCacheRestore will do. */
+    Status = WarmCacheHashPayloadHeader(Payload->FileHandle, Record.PayloadHeaderHash);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    WarmCacheDeriveKey(Password, PasswordLength, Record.PayloadHeaderHash, Key);
+    Status = WarmCacheComputeTag(&Record, Key, Record.Tag);
+    SetMem(Key, sizeof(Key), 0x00);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    ERRCHECK_UEFI(
+        ST->RuntimeServices->SetVariable,
+        5,
+        MFTAH_WARM_CACHE_VARIABLE,
+        &gXmitVendorGuid,
+        EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+        sizeof(MFTAH_WARM_CACHE_RECORD),
+        &Record
+    );
+
+    DPRINTLN(L"-- Kept (%llu) bytes at '%llx'.", Record.RamdiskLength, Record.RamdiskBase);
+    return EFI_SUCCESS;
+}
@@ -3,27 +3,35 @@
  *   for the loaded MFTAH protocol.
  */
 
+#include "core/wrappers.h"
+#include "core/memory.h"
+#include "core/arena.h"
+
 
 
 VOID *
 MftahUefi__wrapper__AllocateZeroPool(__SIZE_TYPE__ Count,
                                     __SIZE_TYPE__ Length)
 {
-    return AllocateZeroPool(Count * Length);
+    if (0 != Length && Count > (((UINTN)-1) / Length)) {
+        return NULL;
+    }
+
+    return ArenaAllocateZero(&gLoaderArena, Count * Length);
 }
 
 
 VOID *
 MftahUefi__wrapper__AllocatePool(__SIZE_TYPE__ Length)
 {
-    return AllocatePool(Length);
+    return ArenaAllocate(&gLoaderArena, Length);
 }
 
 
 VOID
 MftahUefi__wrapper__FreePool(VOID *Pointer)
 {
-    FreePool(Pointer);
+    ArenaFree(&gLoaderArena, Pointer);
 }
 
 
@@ -32,15 +40,7 @@ MftahUefi__wrapper__MemMove(VOID *Destination,
                            CONST VOID *Source,
                            __SIZE_TYPE__ Length)
 {
-    UINT8 SourceCopy = 0;
-
-    /* Not the most performant operation but it works OK. */
-    for (UINTN i = 0; i < Length; ++i) {
-        SourceCopy = *((UINT8 *)Source++);
-        *((UINT8 *)Destination++) = SourceCopy;
-    }
-
-    return Destination;
+    return FastMoveMem(Destination, Source, Length);
 }
 
 
@@ -49,9 +49,7 @@ MftahUefi__wrapper__SetMem(VOID *Destination,
                           INT32 Value,
                           __SIZE_TYPE__ Size)
 {
-    SetMem(Destination, Size, (UINT8)Value);
-
-    return NULL;
+    return FastSetMem(Destination, Size, (UINT8)Value);
 }
 
 
@@ -60,9 +58,7 @@ MftahUefi__wrapper__CopyMem(VOID *Destination,
                            CONST VOID *Source,
                            __SIZE_TYPE__ Size)
 {
-    CopyMem(Destination, (VOID *)Source, Size);
-
-    return NULL;
+    return FastCopyMem(Destination, Source, Size);
 }
 
 
@@ -71,7 +67,8 @@ MftahUefi__wrapper__CompareMem(CONST VOID *Left,
                               CONST VOID *Right,
                               __SIZE_TYPE__ Length)
 {
-    return CompareMem(Left, Right, Length);
+    /* MFTAH only compares digests and MACs with this, so never leak where they differ. */
+    return (INT32)ConstantTimeCompareMem(Left, Right, Length);
 }
 
 
@@ -79,18 +76,7 @@ VOID *
 MftahUefi__wrapper__ReallocatePool(VOID *At,
                                   __SIZE_TYPE__ ToSize)
 {
-    /* UEFI isn't going to be bothered by simply READING (most) memory locations. */
-    /* It's up to the caller to be aware that any INFLATION of a memory pool 'At' will,
-        while preserving the previous data, also introduce GARBAGE DATA (not 0s) at its end. */
-    VOID *NewPool = AllocatePool(ToSize);
-    if (NULL == NewPool) {
-        return NULL;
-    }
-
-    CopyMem(NewPool, At, ToSize);
-    FreePool(At);
-
-    return NewPool;
+    return ArenaReallocate(&gLoaderArena, At, ToSize);
 }
 
 
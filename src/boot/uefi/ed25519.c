@@ -0,0 +1,1045 @@
+/*
+ * Ed25519 signature verification, as specified in RFC 8032.
+ *
+ * Field elements are held in five 51-bit limbs and multiplied with 128-bit products.
+ *  The group formulas are those of the 'ref10' implementation by Bernstein et al.
+ */
+
+#include "../../../include/boot/uefi/crypto/ed25519.h"
+#include "../../../include/boot/uefi/crypto/sha512.h"
+
+
+
+#define FE_MASK ((1ULL << 51) - 1)
+
+/* Sliding window digits of the base point scalar reach up to this, those of the key up to 15. */
+#define BASE_WINDOW_LIMIT   127
+#define KEY_WINDOW_LIMIT    15
+
+
+typedef unsigned __int128 uint128_t;
+
+/* An element of GF(2^255 - 19), not necessarily fully reduced. */
+typedef struct { uint64_t v[5]; } fe;
+
+/* Points in projective (X:Y:Z), extended (X:Y:Z:T) and completed ((X:Z), (Y:T)) coordinates. */
+typedef struct { fe X, Y, Z; } ge_p2;
+typedef struct { fe X, Y, Z, T; } ge_p3;
+typedef struct { fe X, Y, Z, T; } ge_p1p1;
+
+/* Summands ready for addition: (y + x, y - x, 2dxy) of an affine point, or (Y + X, Y - X, Z, 2dT). */
+typedef struct { fe yplusx, yminusx, xy2d; } ge_precomp;
+typedef struct { fe YplusX, YminusX, Z, T2d; } ge_cached;
+
+
+static const fe fe_d = {{
+    0x34DCA135978A3ULL, 0x1A8283B156EBDULL, 0x5E7A26001C029ULL, 0x739C663A03CBBULL, 0x52036CEE2B6FFULL
+}};
+
+static const fe fe_d2 = {{
+    0x69B9426B2F159ULL, 0x35050762ADD7AULL, 0x3CF44C0038052ULL, 0x6738CC7407977ULL, 0x2406D9DC56DFFULL
+}};
+
+static const fe fe_sqrtm1 = {{
+    0x61B274A0EA0B0ULL, 0x0D5A5FC8F189DULL, 0x7EF5E9CBD0C60ULL, 0x78595A6804C9EULL, 0x2B8324804FC1DULL
+}};
+
+/* The group order L = 2^252 + 27742317777372353535851937790883648493, in 64-bit limbs. */
+static const uint64_t sc_l[4] = {
+    0x5812631A5CF5D3EDULL, 0x14DEF9DEA2F79CD6ULL, 0x0000000000000000ULL, 0x1000000000000000ULL,
+};
+
+/* The odd multiples B, 3B, 5B, ..., 127B of the base point, precomputed from its affine coordinates. */
+static const ge_precomp ge_base_multiples[64] = {
+    {
+        {{ 0x493C6F58C3B85ULL, 0x0DF7181C325F7ULL, 0x0F50B0B3E4CB7ULL, 0x5329385A44C32ULL, 0x07CF9D3A33D4BULL }},
+        {{ 0x03905D740913EULL, 0x0BA2817D673A2ULL, 0x23E2827F4E67CULL, 0x133D2E0C21A34ULL, 0x44FD2F9298F81ULL }},
+        {{ 0x11205877AAA68ULL, 0x479955893D579ULL, 0x50D66309B67A0ULL, 0x2D42D0DBEE5EEULL, 0x6F117B689F0C6ULL }},
+    },
+    {
+        {{ 0x5B0A84CEE9730ULL, 0x61D10C97155E4ULL, 0x4059CC8096A10ULL, 0x47A608DA8014FULL, 0x7A164E1B9A80FULL }},
+        {{ 0x11FE8A4FCD265ULL, 0x7BCB8374FAACCULL, 0x52F5AF4EF4D4FULL, 0x5314098F98D10ULL, 0x2AB91587555BDULL }},
+        {{ 0x6933F0DD0D889ULL, 0x44386BB4C4295ULL, 0x3CB6D3162508CULL, 0x26368B872A2C6ULL, 0x5A2826AF12B9BULL }},
+    },
+    {
+        {{ 0x2BC4408A5BB33ULL, 0x078EBDDA05442ULL, 0x2FFB112354123ULL, 0x375EE8DF5862DULL, 0x2945CCF146E20ULL }},
+        {{ 0x182C3A447D6BAULL, 0x22964E536EFF2ULL, 0x192821F540053ULL, 0x2F9F19E788E5CULL, 0x154A7E73EB1B5ULL }},
+        {{ 0x3DBF1812A8285ULL, 0x0FA17BA3F9797ULL, 0x6F69CB49C3820ULL, 0x34D5A0DB3858DULL, 0x43AABE696B3BBULL }},
+    },
+    {
+        {{ 0x25CD0944EA3BFULL, 0x75673B81A4D63ULL, 0x150B925D1C0D4ULL, 0x13F38D9294114ULL, 0x461BEA69283C9ULL }},
+        {{ 0x72C9AAA3221B1ULL, 0x267774474F74DULL, 0x064B0E9B28085ULL, 0x3F04EF53B27C9ULL, 0x1D6EDD5D2E531ULL }},
+        {{ 0x36DC801B8B3A2ULL, 0x0E0A7D4935E30ULL, 0x1DEB7CECC0D7DULL, 0x053A94E20DD2CULL, 0x7A9FBB1C6A0F9ULL }},
+    },
+    {
+        {{ 0x6678AA6A8632FULL, 0x5EA3788D8B365ULL, 0x21BD6D6994279ULL, 0x7ACE75919E4E3ULL, 0x34B9ED338ADD7ULL }},
+        {{ 0x6217E039D8064ULL, 0x6DEA408337E6DULL, 0x57AC112628206ULL, 0x647CB65E30473ULL, 0x49C05A51FADC9ULL }},
+        {{ 0x4E8BF9045AF1BULL, 0x514E33A45E0D6ULL, 0x7533C5B8BFE0FULL, 0x583557B7E14C9ULL, 0x73C172021B008ULL }},
+    },
+    {
+        {{ 0x700848A802ADEULL, 0x1E04605C4E5F7ULL, 0x5C0D01B9767FBULL, 0x7D7889F42388BULL, 0x4275AAE2546D8ULL }},
+        {{ 0x75B0249864348ULL, 0x52EE11070262BULL, 0x237AE54FB5ACDULL, 0x3BFD1D03AAAB5ULL, 0x18AB598029D5CULL }},
+        {{ 0x32CC5FD6089E9ULL, 0x426505C949B05ULL, 0x46A18880C7AD2ULL, 0x4A4221888CCDAULL, 0x3DC65522B53DFULL }},
+    },
+    {
+        {{ 0x0C222A2007F6DULL, 0x356B79BDB77EEULL, 0x41EE81EFE12CEULL, 0x120A9BD07097DULL, 0x234FD7EEC346FULL }},
+        {{ 0x7013B327FBF93ULL, 0x1336EEDED6A0DULL, 0x2B565A2BBF3AFULL, 0x253CE89591955ULL, 0x0267882D17602ULL }},
+        {{ 0x0A119732EA378ULL, 0x63BF1BA8E2A6CULL, 0x69F94CC90DF9AULL, 0x431D1779BFC48ULL, 0x497BA6FDAA097ULL }},
+    },
+    {
+        {{ 0x6CC0313CFEAA0ULL, 0x1A313848DA499ULL, 0x7CB534219230AULL, 0x39596DEDEFD60ULL, 0x61E22917F12DEULL }},
+        {{ 0x3CD86468CCF0BULL, 0x48553221AC081ULL, 0x6C9464B4E0A6EULL, 0x75FBA84180403ULL, 0x43B5CD4218D05ULL }},
+        {{ 0x2762F9BD0B516ULL, 0x1C6E7FBDDCBB3ULL, 0x75909C3ACE2BDULL, 0x42101972D3EC9ULL, 0x511D61210AE4DULL }},
+    },
+    {
+        {{ 0x676EF950E9D81ULL, 0x1B81AE089F258ULL, 0x63C4922951883ULL, 0x2F1D54D9B3237ULL, 0x6D325924DDB85ULL }},
+        {{ 0x386484420DE87ULL, 0x2D6B25DB68102ULL, 0x650B4962873C0ULL, 0x4081CFD271394ULL, 0x71A7FE6FE2482ULL }},
+        {{ 0x182B8A5C8C854ULL, 0x73FCBE5406D8EULL, 0x5DE3430CFF451ULL, 0x554B967AC8C41ULL, 0x4746C4B6559EEULL }},
+    },
+    {
+        {{ 0x77B3C6DC69A2BULL, 0x4EDF13EC2FA6EULL, 0x4E85AD77BEAC8ULL, 0x7DBA2B28E7BDAULL, 0x5C9A51DE34FE9ULL }},
+        {{ 0x546C864741147ULL, 0x3A1DF99092690ULL, 0x1CA8CC9F4D6BBULL, 0x36B7FC9CD3B03ULL, 0x219663497DB5EULL }},
+        {{ 0x0F1CF79F10E67ULL, 0x43CCB0A2B7EA2ULL, 0x05089DFFF776AULL, 0x1DD84E1D38B88ULL, 0x4804503C60822ULL }},
+    },
+    {
+        {{ 0x49ED02CA37FC7ULL, 0x474C2B5957884ULL, 0x5B8388E816683ULL, 0x4B6C454B76BE4ULL, 0x553398A516506ULL }},
+        {{ 0x021D23A36D175ULL, 0x4FD3373C6476DULL, 0x20E291EEED02AULL, 0x62F2ECF2E7210ULL, 0x771E098858DE4ULL }},
+        {{ 0x2F5D278451EDFULL, 0x730B133997342ULL, 0x6965420EB6975ULL, 0x308A3BFA516CFULL, 0x5A5ED1D68FF5AULL }},
+    },
+    {
+        {{ 0x5122AFE150E83ULL, 0x4AFC966BB0232ULL, 0x1C478833C8268ULL, 0x17839C3FC148FULL, 0x44ACB897D8BF9ULL }},
+        {{ 0x5E0C558527359ULL, 0x3395B73AFD75CULL, 0x072AFA4E4B970ULL, 0x62214329E0F6DULL, 0x019B60135FEFDULL }},
+        {{ 0x068145E134B83ULL, 0x1E4860982C3CCULL, 0x068FB5F13D799ULL, 0x7C9283744547EULL, 0x150C49FDE6AD2ULL }},
+    },
+    {
+        {{ 0x3F29509471138ULL, 0x729EEB4CA31CFULL, 0x69C22B575BFBCULL, 0x4910857BCE212ULL, 0x6B2B5A075BB99ULL }},
+        {{ 0x1863C9CDCA868ULL, 0x3770E295A1709ULL, 0x0D85A3720FD13ULL, 0x5E0FF1F71AB06ULL, 0x78A6D7791E05FULL }},
+        {{ 0x7704B47A0B976ULL, 0x2AE82E91AAB17ULL, 0x50BD6429806CDULL, 0x68055158FD8EAULL, 0x725C7FFC4AD55ULL }},
+    },
+    {
+        {{ 0x26715D1CF99B2ULL, 0x2205441A69C88ULL, 0x448427DCD4B54ULL, 0x1D191E88ABDC5ULL, 0x794CC9277CB1FULL }},
+        {{ 0x02BF71CD098C0ULL, 0x49DABCC6CD230ULL, 0x40A6533F905B2ULL, 0x573EFAC2EB8A4ULL, 0x4CD54625F855FULL }},
+        {{ 0x6C426C2AC5053ULL, 0x5A65ECE4B095EULL, 0x0C44086F26BB6ULL, 0x7429568197885ULL, 0x7008357B6FCC8ULL }},
+    },
+    {
+        {{ 0x0672738773F01ULL, 0x752BF799F6171ULL, 0x6B4A6DAE33323ULL, 0x7B54696EAD1DCULL, 0x06EF7E9851AD0ULL }},
+        {{ 0x39FBB82584A34ULL, 0x47A568F257A03ULL, 0x14D88091EAD91ULL, 0x2145B18B1CE24ULL, 0x13A92A3669D6DULL }},
+        {{ 0x3771CC0577DE5ULL, 0x3CA06BB8B9952ULL, 0x00B81C5D50390ULL, 0x43512340780ECULL, 0x3C296DDF8A2AFULL }},
+    },
+    {
+        {{ 0x515F9D914A713ULL, 0x73191FF2255D5ULL, 0x54F5CC2A4BDEFULL, 0x3DD57FC118BCFULL, 0x7A99D393490C7ULL }},
+        {{ 0x34D2EBB1F2541ULL, 0x0E815B723FF9DULL, 0x286B416E25443ULL, 0x0BDFE38D1BEE8ULL, 0x0A892C7007477ULL }},
+        {{ 0x2ED2436BDA3E8ULL, 0x02AFD00F291EAULL, 0x0BE7381DEA321ULL, 0x3E952D4B2B193ULL, 0x286762D28302FULL }},
+    },
+    {
+        {{ 0x036093CE35B25ULL, 0x3B64D7552E9CFULL, 0x71EE0FE0B8460ULL, 0x69D0660C969E5ULL, 0x32F1DA046A9D9ULL }},
+        {{ 0x58E2BCE2EF5BDULL, 0x68CE8F78C6F8AULL, 0x6EE26E39261B2ULL, 0x33D0AA50BCF9DULL, 0x7686F2A3D6F17ULL }},
+        {{ 0x512A66D597C6AULL, 0x0609A70A57551ULL, 0x026C08A3C464CULL, 0x4531FC8EE39E1ULL, 0x561305F8A9AD2ULL }},
+    },
+    {
+        {{ 0x4978DEC92AED1ULL, 0x069ADAE7CA201ULL, 0x11EE923290F55ULL, 0x69641898D916CULL, 0x00AAEC53E35D4ULL }},
+        {{ 0x2CC28E7B0C0D5ULL, 0x77B60EB8A6CE4ULL, 0x4042985C277A6ULL, 0x636657B46D3EBULL, 0x030A1AEF2C57CULL }},
+        {{ 0x1F773003AD2AAULL, 0x005642CC10F76ULL, 0x03B48F82CFCA6ULL, 0x2403C10EE4329ULL, 0x20BE9C1C24065ULL }},
+    },
+    {
+        {{ 0x387D8249673A6ULL, 0x5BEA8DC927C2AULL, 0x5BD8ED5650EF0ULL, 0x0EF0E3FCD40E1ULL, 0x750AB3361F0ACULL }},
+        {{ 0x0E44AE2025E60ULL, 0x5F97B9727041CULL, 0x5683472C0ECECULL, 0x188882EB1CE7CULL, 0x69764C545067EULL }},
+        {{ 0x23283A2F81037ULL, 0x477AFF97E23D1ULL, 0x0B8958DBCBB68ULL, 0x0205B97E8ADD6ULL, 0x54F96B3FB7075ULL }},
+    },
+    {
+        {{ 0x5F20429669279ULL, 0x08FAFAE4941F5ULL, 0x15D83C4EB7688ULL, 0x1CF379ECA4146ULL, 0x3D7FE9C52BB75ULL }},
+        {{ 0x5AFC616B11ECDULL, 0x39F4AEC8F22EFULL, 0x3B39E1625D92EULL, 0x5F85BD4508873ULL, 0x78E6839FBE85DULL }},
+        {{ 0x32DF737B8856BULL, 0x0608342F14E06ULL, 0x3967889D74175ULL, 0x1211907FBA550ULL, 0x70F268F350088ULL }},
+    },
+    {
+        {{ 0x64583B1805F47ULL, 0x22C1BAF832CD0ULL, 0x132C01BD4D717ULL, 0x4ECF4C3A75B8FULL, 0x7C0D345CFAD88ULL }},
+        {{ 0x4112070DCF355ULL, 0x7DCFF9C22E464ULL, 0x54ADA60E03325ULL, 0x25CD98EEF769AULL, 0x404E56C039B8CULL }},
+        {{ 0x71F4B8C78338AULL, 0x62CFC16BC2B23ULL, 0x17CF51280D9AAULL, 0x3BBAE5E20A95AULL, 0x20D754762AAECULL }},
+    },
+    {
+        {{ 0x7C36FC73BB758ULL, 0x4A6C797734BD1ULL, 0x0EF248AB3950EULL, 0x63154C9A53EC8ULL, 0x2B8F1E46F3CEEULL }},
+        {{ 0x4FEB135B9F543ULL, 0x63BD192AD93AEULL, 0x44E2EA612CDF7ULL, 0x670F4991583ABULL, 0x38B8ADA8790B4ULL }},
+        {{ 0x04A9CDF51F95DULL, 0x5D963FBD596B8ULL, 0x22D9B68ACE54AULL, 0x4A98E8836C599ULL, 0x049AEB32CEBA1ULL }},
+    },
+    {
+        {{ 0x07D0B75FC7931ULL, 0x16F4CE4BA754AULL, 0x5ACE4C03FBE49ULL, 0x27E0EC12A159CULL, 0x795EE17530F67ULL }},
+        {{ 0x67D3C63DCFE7EULL, 0x112F0ADC81AEEULL, 0x53DF04C827165ULL, 0x2FE5B33B430F0ULL, 0x51C665E0C8D62ULL }},
+        {{ 0x25B0A52ECBD81ULL, 0x5DC0695FCE4A9ULL, 0x3B928C575047DULL, 0x23BF3512686E5ULL, 0x6CD19BF49DC54ULL }},
+    },
+    {
+        {{ 0x6612165AFC386ULL, 0x1171AA36203FFULL, 0x2642EA820A8AAULL, 0x1F3BB7B313F10ULL, 0x5E01B3A7429E4ULL }},
+        {{ 0x7619052179CA3ULL, 0x0C16593F0AFD0ULL, 0x265C4795C7428ULL, 0x31C40515D5442ULL, 0x7520F3DB40B2EULL }},
+        {{ 0x50BE3D39357A1ULL, 0x3AB33D294A7B6ULL, 0x4C479BA59EDB3ULL, 0x4C30D184D326FULL, 0x71092C9CCEF3CULL }},
+    },
+    {
+        {{ 0x3D8AC74051DCFULL, 0x10AB6F543D0ADULL, 0x5D0F3AC0FDA90ULL, 0x5EF1D2573E5E4ULL, 0x4173A5BB7137AULL }},
+        {{ 0x0523F0364918CULL, 0x687F56D638A7BULL, 0x20796928AD013ULL, 0x5D38405A54F33ULL, 0x0EA15B03D0257ULL }},
+        {{ 0x56E31F0F9218AULL, 0x5635F88E102F8ULL, 0x2CBC5D969A5B8ULL, 0x533FBC98B347AULL, 0x5FC565614A4E3ULL }},
+    },
+    {
+        {{ 0x2E1E67790988EULL, 0x1E38B9AE44912ULL, 0x648FBB4075654ULL, 0x28DF1D840CD72ULL, 0x3214C7409D466ULL }},
+        {{ 0x6570DC46D7AE5ULL, 0x18A9F1B91E26DULL, 0x436B6183F42ABULL, 0x550ACAA4F8198ULL, 0x62711C414C454ULL }},
+        {{ 0x1827406651770ULL, 0x4D144F286C265ULL, 0x17488F0EE9281ULL, 0x19E6CDB5C760CULL, 0x5BEA94073ECB8ULL }},
+    },
+    {
+        {{ 0x0CE63F343D2F8ULL, 0x1E0A87D1E368EULL, 0x045EDBC019EEAULL, 0x6979AED28D0D1ULL, 0x4AD0785944F1BULL }},
+        {{ 0x5BF0912C89BE4ULL, 0x62FADCAF38C83ULL, 0x25EC196B3CE2CULL, 0x77655FF4F017BULL, 0x3AACD5C148F61ULL }},
+        {{ 0x63B34C3318301ULL, 0x0E0E62D04D0B1ULL, 0x676A233726701ULL, 0x29E9A042D9769ULL, 0x3AFF0CB1D9028ULL }},
+    },
+    {
+        {{ 0x6430BF4C53505ULL, 0x264C3E4507244ULL, 0x74C9F19A39270ULL, 0x73F84F799BC47ULL, 0x2CCF9F732BD99ULL }},
+        {{ 0x5C7EB3A20405EULL, 0x5FDB5AAD930F8ULL, 0x4A757E63B8C47ULL, 0x28E9492972456ULL, 0x110E7E86F4CD2ULL }},
+        {{ 0x0D89ED603F5E4ULL, 0x51E1604018AF8ULL, 0x0B8EEDC4A2218ULL, 0x51BA98B9384D0ULL, 0x05C557E0B9693ULL }},
+    },
+    {
+        {{ 0x6BBB089C20EB0ULL, 0x6DF41FB0B9EEEULL, 0x51087ED87E16FULL, 0x102DB5C9FA731ULL, 0x289FEF0841861ULL }},
+        {{ 0x1CE311FC97E6FULL, 0x6023F3FB5DB1FULL, 0x7B49775E8FC98ULL, 0x3AD70ADBF5045ULL, 0x6E154C178FE98ULL }},
+        {{ 0x16336FED69ABFULL, 0x4F066B929F9ECULL, 0x4E9FF9E6C5B93ULL, 0x18C89BC4BB2BAULL, 0x6AFBF642A95CAULL }},
+    },
+    {
+        {{ 0x55070F913A8CCULL, 0x765619EAC2BBCULL, 0x3AB5225F47459ULL, 0x76CED14AB5B48ULL, 0x12C093CEDB801ULL }},
+        {{ 0x0DE0C62F5D2C1ULL, 0x49601CF734FB5ULL, 0x6B5C38263F0F6ULL, 0x4623EF5B56D06ULL, 0x0DB4B851B9503ULL }},
+        {{ 0x47F9308B8190FULL, 0x414235C621F82ULL, 0x31F5FF41A5A76ULL, 0x6736773AAB96DULL, 0x33AA8799C6635ULL }},
+    },
+    {
+        {{ 0x0F588FC156CB1ULL, 0x363414DA4F069ULL, 0x7296AD9B68AEAULL, 0x4D3711316AE43ULL, 0x212CD0C1C8D58ULL }},
+        {{ 0x7F51EBD085CF2ULL, 0x12CFA67E3F5E1ULL, 0x1800CF1E3D46AULL, 0x54337615FF0A8ULL, 0x233C6F29E8E21ULL }},
+        {{ 0x4D5107F18C781ULL, 0x64A4FD3A51A5EULL, 0x4F4CD0448BB37ULL, 0x671D38543151EULL, 0x1DB7778911914ULL }},
+    },
+    {
+        {{ 0x14769DD701AB6ULL, 0x28339F1B4B667ULL, 0x4AB214B8AE37BULL, 0x25F0AEFA0B0FEULL, 0x7AE2CA8A017D2ULL }},
+        {{ 0x352397C6BC26FULL, 0x18A7AA0227BBEULL, 0x5E68CC1EA5F8BULL, 0x6FE3E3A7A1D5FULL, 0x31AD97AD26E2AULL }},
+        {{ 0x017ED0920B962ULL, 0x187E33B53B6FDULL, 0x55829907A1463ULL, 0x641F248E0A792ULL, 0x1ED1FC53A6622ULL }},
+    },
+    {
+        {{ 0x642A61C092D2DULL, 0x31937E711D17FULL, 0x4DC4BEDCD4122ULL, 0x2569F0C8B3DDFULL, 0x503D664A57AA2ULL }},
+        {{ 0x1E98E4D89F26EULL, 0x510AE16FCFE97ULL, 0x2171172CE0B7CULL, 0x55191EDBF3682ULL, 0x5B12B36F28BC0ULL }},
+        {{ 0x3395B90A91537ULL, 0x6F9E6FCBE5943ULL, 0x23A2FEAE6EA0FULL, 0x4718C95011F06ULL, 0x36906685E9A1FULL }},
+    },
+    {
+        {{ 0x4BE3C4FD8781DULL, 0x242716AFC8A89ULL, 0x16CF4E4BF3C77ULL, 0x1D2F593F7325FULL, 0x355DCCF04805CULL }},
+        {{ 0x10DD8B8699E48ULL, 0x7463AEB8F8D63ULL, 0x760856E91C033ULL, 0x0CF2B008EE055ULL, 0x5B1112708474BULL }},
+        {{ 0x5984DCB3C75DBULL, 0x4EAFECACFF977ULL, 0x16606587ED97BULL, 0x7B2D89C5AC45BULL, 0x584587B225AE4ULL }},
+    },
+    {
+        {{ 0x5C10F66A67ED6ULL, 0x5997232F8890AULL, 0x2C8862E13AD85ULL, 0x62A45A7FFE9C0ULL, 0x05E27BA4B982AULL }},
+        {{ 0x3A363F12F57A6ULL, 0x36677857DC672ULL, 0x6016EDD50D745ULL, 0x777EDA40C0454ULL, 0x3D8918FB87D11ULL }},
+        {{ 0x6A67D1E5A864DULL, 0x61BC54210C7E0ULL, 0x5A0AB3F96BAB6ULL, 0x2ED35B0884775ULL, 0x7F8F3424D64A5ULL }},
+    },
+    {
+        {{ 0x24807B24886AFULL, 0x3D8885FBC4F63ULL, 0x115953E5523B4ULL, 0x132D7A918D23DULL, 0x7E755CBA0310FULL }},
+        {{ 0x6293624794ED1ULL, 0x0ED1E1ED161DAULL, 0x08EF30FB86FC3ULL, 0x362557EFF0B67ULL, 0x0CAA7059C3235ULL }},
+        {{ 0x44F52761A3023ULL, 0x104D2DECD135FULL, 0x791656699386AULL, 0x11871237A067EULL, 0x4536C2AEE70B3ULL }},
+    },
+    {
+        {{ 0x3EFF321CCB9C3ULL, 0x68CA42AF7119CULL, 0x58C5A2E68E2FDULL, 0x3D9EE302FF687ULL, 0x6A15D0F5CA449ULL }},
+        {{ 0x1A302599DB7FAULL, 0x6FE05F844DC03ULL, 0x1C40635BAD39CULL, 0x238FF0DFC297FULL, 0x7BBDF8041BA47ULL }},
+        {{ 0x5E1F109BFA8D5ULL, 0x73C44389E11C1ULL, 0x25E21637093ABULL, 0x5BD7D979CCD1BULL, 0x55C206D4035CDULL }},
+    },
+    {
+        {{ 0x7FAAD90DE7625ULL, 0x3C286391C6144ULL, 0x529672E089F46ULL, 0x61287CCEDAE10ULL, 0x5CD6B3922EE71ULL }},
+        {{ 0x38159B8443D37ULL, 0x55AD9EC9F2E2AULL, 0x47A7BF00ACF6DULL, 0x75C2CCE0A6006ULL, 0x278FC8BCD74E9ULL }},
+        {{ 0x4A994D633EBC7ULL, 0x5CF46F4F7DE07ULL, 0x33450AF844449ULL, 0x21429FA184F70ULL, 0x468615291AB88ULL }},
+    },
+    {
+        {{ 0x03851D54CEB6FULL, 0x559BFAD6CE588ULL, 0x389E4AFB488A7ULL, 0x242FA5690A98CULL, 0x5523E2F353889ULL }},
+        {{ 0x1099C54A5EFD2ULL, 0x41E0AF3F2EE34ULL, 0x753EF3FD7141AULL, 0x6E9EE0C59C789ULL, 0x636DB66A5894EULL }},
+        {{ 0x2536E7BD0D4DEULL, 0x56CB47E3C535FULL, 0x72130D43D8496ULL, 0x7CC447AD13E59ULL, 0x5288CF65559B0ULL }},
+    },
+    {
+        {{ 0x2B629F0D9881CULL, 0x27CAAE1CE21F2ULL, 0x12EEBEFF2C7ECULL, 0x0E92FF727C4A4ULL, 0x12C70C85F4524ULL }},
+        {{ 0x5C8C50A97289BULL, 0x75D502547F652ULL, 0x5DA24A563FAAEULL, 0x30A36EB796307ULL, 0x63F01B555A964ULL }},
+        {{ 0x5BDA5E538767FULL, 0x0FA612C198D48ULL, 0x354CD4580A64CULL, 0x4AA9E49CFB4EAULL, 0x437165416AB62ULL }},
+    },
+    {
+        {{ 0x5B1FBDDFDAD86ULL, 0x75C96CEF1BC3AULL, 0x603747EB606FEULL, 0x0DBB5BC0C8CCCULL, 0x46FE985F1B972ULL }},
+        {{ 0x00A2836E64B9AULL, 0x21E92A74E2C26ULL, 0x7CD91D540DA93ULL, 0x11E423291A7A3ULL, 0x3EA46DC72C2DDULL }},
+        {{ 0x5018588E2DFA7ULL, 0x03FA0EBDD53FEULL, 0x271D3959CE7D0ULL, 0x4A735072F4BECULL, 0x088B0CA7DF432ULL }},
+    },
+    {
+        {{ 0x70E54FEFE6CC0ULL, 0x2751CA3B2820CULL, 0x4D68F7C3AEE75ULL, 0x449FD4F8711FAULL, 0x3C755700AF5EEULL }},
+        {{ 0x445337C54AA9DULL, 0x7CFC86DF9A4C8ULL, 0x4466D61DB423AULL, 0x1BCF6C7D0EB4AULL, 0x7D5B0546110E1ULL }},
+        {{ 0x73A96D7C70596ULL, 0x7615F603E6F13ULL, 0x087035EABE3F9ULL, 0x556B20B23346AULL, 0x1AE5C564B3A77ULL }},
+    },
+    {
+        {{ 0x1AD4C0302594BULL, 0x28F8D4B709B41ULL, 0x2178A904FEF9BULL, 0x331A28073E004ULL, 0x201A641198D92ULL }},
+        {{ 0x0E6863E708D5BULL, 0x09914B654BFB1ULL, 0x1D176412796B7ULL, 0x3C307983E740FULL, 0x5D9CF1E818AF1ULL }},
+        {{ 0x21D3BE2A1592BULL, 0x54C571883EB7BULL, 0x109312CAF6EAAULL, 0x5932ABCA49E6EULL, 0x3AA0A0C361FE0ULL }},
+    },
+    {
+        {{ 0x45FE508DFF693ULL, 0x56CC1F071B283ULL, 0x1DE95131F404AULL, 0x1A0239374EEAEULL, 0x3E6190F708B20ULL }},
+        {{ 0x46E21E149EF2EULL, 0x04A00CE2D20CFULL, 0x1E2CCC2338304ULL, 0x094D8553AAE4FULL, 0x6EE309F230D1AULL }},
+        {{ 0x0AE32AC67B877ULL, 0x1EA8FD8412729ULL, 0x3A126B5E8888AULL, 0x3A5B0BA127BD8ULL, 0x64CDE98364F1DULL }},
+    },
+    {
+        {{ 0x6B982B66C4FFAULL, 0x218C3E0B9085FULL, 0x654EC3EE2D06CULL, 0x00396913CABC3ULL, 0x19767CC144203ULL }},
+        {{ 0x7D6E4071F6450ULL, 0x1F7C3EA3EE4E1ULL, 0x0A53ECDF4E3DAULL, 0x418C2797ED200ULL, 0x2C41A80E5B453ULL }},
+        {{ 0x60FE08E9DC54BULL, 0x6B2F1C309A0B7ULL, 0x3293B11CBBBBCULL, 0x1F4578658A7EDULL, 0x393BC7B77C81CULL }},
+    },
+    {
+        {{ 0x367A868CD8C15ULL, 0x74719ADD93627ULL, 0x4174AD15A144FULL, 0x34B3DF65CFB24ULL, 0x6EBB5599AC3D3ULL }},
+        {{ 0x38645B73F4755ULL, 0x1B10773615D37ULL, 0x70305EA7D72D4ULL, 0x731FBDC8A9DE2ULL, 0x7C0CEBBD0CA4EULL }},
+        {{ 0x4C5DA306059BDULL, 0x4ACEFCCBF4853ULL, 0x6B25A6C99B7AFULL, 0x6461833026867ULL, 0x7CEAD1176A994ULL }},
+    },
+    {
+        {{ 0x31E08C64DE622ULL, 0x7AF71922A0C43ULL, 0x6C048211CACECULL, 0x56E6E9B5B0E13ULL, 0x7B816374FE4D0ULL }},
+        {{ 0x64CDB68564783ULL, 0x03ACD825866DFULL, 0x4BB8F4C4CCA1DULL, 0x2A8BFE5C9F091ULL, 0x32E73D7C414D7ULL }},
+        {{ 0x71BC104113FCCULL, 0x1F1194E6B0A52ULL, 0x17E905170F1F4ULL, 0x0B1C793CE3AEBULL, 0x6F56AE3CE96F0ULL }},
+    },
+    {
+        {{ 0x2A3E186F6B4B9ULL, 0x41E64AF26A8EFULL, 0x134DAFE05997EULL, 0x074A2B9EDC733ULL, 0x2BCBC96FC92ABULL }},
+        {{ 0x096ED8C1E9273ULL, 0x068C2DACBABA7ULL, 0x3CBDC9B7E4DADULL, 0x68BCDC69BD16AULL, 0x6FF27A9FEAFB3ULL }},
+        {{ 0x1F73E611F6329ULL, 0x0D51039C82D81ULL, 0x1B8B0D7C0CEC5ULL, 0x466A870023AD2ULL, 0x72B5A5B6DE284ULL }},
+    },
+    {
+        {{ 0x12C4628A337C3ULL, 0x46C67F460E78EULL, 0x490E5DE68725EULL, 0x68435D2018C42ULL, 0x3485A7AA6FDE7ULL }},
+        {{ 0x69774ED68E720ULL, 0x3297DE2957E26ULL, 0x6450077E37426ULL, 0x0B3FE28B59CAEULL, 0x61AA1160D97B7ULL }},
+        {{ 0x48A7B7F55128EULL, 0x6BAB0C5B2E4A6ULL, 0x3822130DD2F2DULL, 0x0A159B9F678B4ULL, 0x2C6CE0503EE8DULL }},
+    },
+    {
+        {{ 0x717E676469B1AULL, 0x43C043C63D129ULL, 0x44A290CD033B3ULL, 0x1D3877054DC01ULL, 0x0F8C2B5378339ULL }},
+        {{ 0x2DFB19C632889ULL, 0x38525489E51B0ULL, 0x3DA48697A5B33ULL, 0x3D4F27772B64DULL, 0x0E77AD1D92649ULL }},
+        {{ 0x2301DF2DB5C75ULL, 0x21501A33BC5E3ULL, 0x276B53F750382ULL, 0x6FABC7001775CULL, 0x4CC1E54C7258DULL }},
+    },
+    {
+        {{ 0x3E1D86B3AE19CULL, 0x28F3017A71713ULL, 0x0D04FE40C7A9EULL, 0x73BC322E1CFFFULL, 0x7294F2237A32DULL }},
+        {{ 0x4C0667543638EULL, 0x70C89C91F7E7FULL, 0x2A6ED9BD0987DULL, 0x1727AE4D753A0ULL, 0x62EF3FDCE7514ULL }},
+        {{ 0x08017F77D3EFDULL, 0x3C70D3E486DCBULL, 0x409977A7B4776ULL, 0x1525ED4E71BA7ULL, 0x1928C87D15666ULL }},
+    },
+    {
+        {{ 0x047D566087229ULL, 0x156B2EB18C947ULL, 0x738A46CB6A68BULL, 0x54A2BAAD4303AULL, 0x4AE0EC1D4499FULL }},
+        {{ 0x4955AB57E2130ULL, 0x7B2C89EBEA361ULL, 0x2F4B265BFADFEULL, 0x31821023A7684ULL, 0x77DB41774458FULL }},
+        {{ 0x6CB9BA2BE7DA7ULL, 0x3019C0FBAB07AULL, 0x742FF1219AC76ULL, 0x387575FD24BC9ULL, 0x17F1B3461DA31ULL }},
+    },
+    {
+        {{ 0x16B3D036C2886ULL, 0x1DC7C9CF34134ULL, 0x105EC02EB1D75ULL, 0x126D5E3AC73CAULL, 0x78A82C43F443DULL }},
+        {{ 0x4199B3403CE52ULL, 0x34F6CE21CB1C9ULL, 0x5DA9CD4B28D84ULL, 0x31368BB16BDA2ULL, 0x3D9B99A13ADA9ULL }},
+        {{ 0x38112702675C4ULL, 0x5688D28E9C0ADULL, 0x712B1FFBF44E7ULL, 0x1C8229CD3AD7BULL, 0x0B49208BD81BBULL }},
+    },
+    {
+        {{ 0x550FB0A0D0782ULL, 0x62DD31DDAC07FULL, 0x4026023AB23B5ULL, 0x22460B1C9CC37ULL, 0x3E40A64DA2D51ULL }},
+        {{ 0x2DCB32D287241ULL, 0x6B892B09826B7ULL, 0x5A36039ECF45DULL, 0x290C3D6097E79ULL, 0x157EE7B2E1F28ULL }},
+        {{ 0x5A52E9DCA709FULL, 0x378E7FF97B2FEULL, 0x4B8FE54948B42ULL, 0x75A0FADD77B78ULL, 0x5A277115C55FBULL }},
+    },
+    {
+        {{ 0x0D921E5854C55ULL, 0x70DFBC6364F68ULL, 0x048B9B89CF1ECULL, 0x6B9F1B1B72827ULL, 0x0F4E191892DD3ULL }},
+        {{ 0x23015328300CCULL, 0x7FAB0F4F85562ULL, 0x1B6E3C321FB1DULL, 0x777279C16BEACULL, 0x4689B02AB17DFULL }},
+        {{ 0x51C12EC4132EDULL, 0x31B2456B7B877ULL, 0x5C21E5387D181ULL, 0x313C37A49CA2FULL, 0x3B2432EBC9EDDULL }},
+    },
+    {
+        {{ 0x0899781C7D8EFULL, 0x10DE7318502E0ULL, 0x0DB18BE90AD68ULL, 0x060DA1115B11CULL, 0x361FD1330328DULL }},
+        {{ 0x6CCC2B78C2E59ULL, 0x706382F92B777ULL, 0x70258F43764DCULL, 0x5DCC6FF9A04F6ULL, 0x6C55C1F2AB2DBULL }},
+        {{ 0x30C8165159986ULL, 0x22EF8A1E89A45ULL, 0x3E81112E25CE4ULL, 0x24358ACB40B6AULL, 0x3CD845A927B2CULL }},
+    },
+    {
+        {{ 0x506D72C1951DFULL, 0x4BD1F05FEA25EULL, 0x06E39D7EFA8CDULL, 0x156AAB5585124ULL, 0x45F998AC7247FULL }},
+        {{ 0x715ADDF6FD3B0ULL, 0x7CF1AEBD6E3A2ULL, 0x0391B7101C8A9ULL, 0x56887AB35AB69ULL, 0x36121E8A0DA91ULL }},
+        {{ 0x30728C55D3ECDULL, 0x188CD2A66F481ULL, 0x151333B5B850DULL, 0x18DFFA3616AB9ULL, 0x23B086CF066D5ULL }},
+    },
+    {
+        {{ 0x66080B4BDD58FULL, 0x130C6974631ACULL, 0x4B2F0E6F5F290ULL, 0x30AA27F229A80ULL, 0x16C5FA19014F1ULL }},
+        {{ 0x35118EA05195EULL, 0x046F82D20B86DULL, 0x34A3CCAC75145ULL, 0x53A7519C28496ULL, 0x01EBB5388C6E8ULL }},
+        {{ 0x5416EE772F53BULL, 0x0B9739D12A1E8ULL, 0x2581C43263FE3ULL, 0x02857FE94E1ABULL, 0x4864EF1818473ULL }},
+    },
+    {
+        {{ 0x5A83A0BD0B830ULL, 0x37723868519A1ULL, 0x054FBD2193BAEULL, 0x12873379F4D82ULL, 0x26C03AED7F6BCULL }},
+        {{ 0x7C33297639AB3ULL, 0x5640D1A71DF02ULL, 0x588F03CD11F1EULL, 0x7B62E6025C41DULL, 0x2A7ADC0C34DBAULL }},
+        {{ 0x67A2F581C7DCEULL, 0x40905352DB2C3ULL, 0x62690F0EA7A25ULL, 0x3AA486CA53DDCULL, 0x78B5169959E1DULL }},
+    },
+    {
+        {{ 0x4C85A5769CC40ULL, 0x74AE9BA657F2BULL, 0x61AA0DB9BFA54ULL, 0x0DA0EE5C50B2AULL, 0x457EC0224BCD2ULL }},
+        {{ 0x18254DF5D180DULL, 0x0FF9D3A8CA21FULL, 0x239C47DD41854ULL, 0x38493AB951AA4ULL, 0x02314BC90371EULL }},
+        {{ 0x0AEFE8F26908AULL, 0x3BF6AA75A6F3DULL, 0x2133BE85AEECCULL, 0x524DDC5BC9B75ULL, 0x79572C534FCF0ULL }},
+    },
+    {
+        {{ 0x34300E0749597ULL, 0x4720C80988687ULL, 0x22326917CDC98ULL, 0x50E0A49FB55CBULL, 0x7890C0B6E7F19ULL }},
+        {{ 0x5B23CA35B2D6FULL, 0x7572598372473ULL, 0x65BA812EC2836ULL, 0x79F82199BC406ULL, 0x70DDF8D98B60EULL }},
+        {{ 0x140B7FDD75DC4ULL, 0x30B5F02D37E92ULL, 0x2D212168ECC0EULL, 0x05515AC7118F6ULL, 0x45769691E89A7ULL }},
+    },
+    {
+        {{ 0x63DDC5BA643ADULL, 0x33D37236D6721ULL, 0x19E76422173FBULL, 0x63C45D73A082BULL, 0x2EC0F706B05C7ULL }},
+        {{ 0x3E305345B2DDBULL, 0x6BD805D736A9CULL, 0x55785F51EA730ULL, 0x6C10111AEF7EEULL, 0x10B74232F01C1ULL }},
+        {{ 0x21694608F59D8ULL, 0x3F7C7A18F9F87ULL, 0x13851C22537B8ULL, 0x353C8285B3715ULL, 0x5D6FA9D25A3F4ULL }},
+    },
+    {
+        {{ 0x45AFEB2A3A6DDULL, 0x0F3BE01CCB585ULL, 0x27E72B699B3B4ULL, 0x38E032665FB0CULL, 0x574FA41887C9EULL }},
+        {{ 0x74185E46E6CBBULL, 0x025E447CA48DBULL, 0x5F49918A9A730ULL, 0x4BD3CBFFAFBFAULL, 0x645E704F775F6ULL }},
+        {{ 0x529DADE891EFAULL, 0x5A245DCFB1925ULL, 0x53854443CE9CFULL, 0x499791AACC114ULL, 0x7420E574DCAABULL }},
+    },
+    {
+        {{ 0x66E3F94234B1CULL, 0x4D36843821F07ULL, 0x711529721ED87ULL, 0x03AA2A599D849ULL, 0x2BA60FA9C3CDCULL }},
+        {{ 0x6A138A034513CULL, 0x5E8DF3A73BEECULL, 0x51B92983F9880ULL, 0x1E994571C80C6ULL, 0x44EF4632B581BULL }},
+        {{ 0x6491C21D364C9ULL, 0x58CA44944B47AULL, 0x01C725D1768EEULL, 0x1E7AB7A88ECE0ULL, 0x7054899C44B5FULL }},
+    },
+};
+
+
+
+static inline
+uint64_t
+load64_le(const uint8_t *p)
+{
+    return ((uint64_t)p[0])       | ((uint64_t)p[1] << 8)
+         | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+         | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40)
+         | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+
+static inline
+void
+store64_le(uint8_t *p,
+           uint64_t value)
+{
+    for (int i = 0; i < 8; ++i) {
+        p[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+
+static inline
+void
+fe_0(fe *h)
+{
+    for (int i = 0; i < 5; ++i) h->v[i] = 0;
+}
+
+
+static inline
+void
+fe_1(fe *h)
+{
+    fe_0(h);
+    h->v[0] = 1;
+}
+
+
+/* Bring every limb back to at most 51 bits, plus a little in the lowest one. */
+static inline
+void
+fe_carry(fe *h)
+{
+    uint64_t c;
+
+    c = h->v[0] >> 51; h->v[0] &= FE_MASK; h->v[1] += c;
+    c = h->v[1] >> 51; h->v[1] &= FE_MASK; h->v[2] += c;
+    c = h->v[2] >> 51; h->v[2] &= FE_MASK; h->v[3] += c;
+    c = h->v[3] >> 51; h->v[3] &= FE_MASK; h->v[4] += c;
+    c = h->v[4] >> 51; h->v[4] &= FE_MASK; h->v[0] += c * 19;
+}
+
+
+static inline
+void
+fe_add(fe *h,
+       const fe *f,
+       const fe *g)
+{
+    for (int i = 0; i < 5; ++i) h->v[i] = f->v[i] + g->v[i];
+    fe_carry(h);
+}
+
+
+/* Subtract by adding 4p first, so no limb ever goes negative. */
+static inline
+void
+fe_sub(fe *h,
+       const fe *f,
+       const fe *g)
+{
+    h->v[0] = (f->v[0] + 0x1FFFFFFFFFFFB4ULL) - g->v[0];
+    for (int i = 1; i < 5; ++i) h->v[i] = (f->v[i] + 0x1FFFFFFFFFFFFCULL) - g->v[i];
+    fe_carry(h);
+}
+
+
+static inline
+void
+fe_neg(fe *h,
+       const fe *f)
+{
+    fe zero;
+
+    fe_0(&zero);
+    fe_sub(h, &zero, f);
+}
+
+
+static
+void
+fe_mul(fe *h,
+       const fe *f,
+       const fe *g)
+{
+    const uint64_t f0 = f->v[0], f1 = f->v[1], f2 = f->v[2], f3 = f->v[3], f4 = f->v[4];
+    const uint64_t g0 = g->v[0], g1 = g->v[1], g2 = g->v[2], g3 = g->v[3], g4 = g->v[4];
+    const uint64_t g1_19 = g1 * 19, g2_19 = g2 * 19, g3_19 = g3 * 19, g4_19 = g4 * 19;
+    uint128_t r0, r1, r2, r3, r4;
+    uint64_t c;
+
+    r0 = (uint128_t)f0 * g0 + (uint128_t)f1 * g4_19 + (uint128_t)f2 * g3_19 + (uint128_t)f3 * g2_19 + (uint128_t)f4 * g1_19;
+    r1 = (uint128_t)f0 * g1 + (uint128_t)f1 * g0    + (uint128_t)f2 * g4_19 + (uint128_t)f3 * g3_19 + (uint128_t)f4 * g2_19;
+    r2 = (uint128_t)f0 * g2 + (uint128_t)f1 * g1    + (uint128_t)f2 * g0    + (uint128_t)f3 * g4_19 + (uint128_t)f4 * g3_19;
+    r3 = (uint128_t)f0 * g3 + (uint128_t)f1 * g2    + (uint128_t)f2 * g1    + (uint128_t)f3 * g0    + (uint128_t)f4 * g4_19;
+    r4 = (uint128_t)f0 * g4 + (uint128_t)f1 * g3    + (uint128_t)f2 * g2    + (uint128_t)f3 * g1    + (uint128_t)f4 * g0;
+
+    r1 += (uint64_t)(r0 >> 51); h->v[0] = (uint64_t)r0 & FE_MASK;
+    r2 += (uint64_t)(r1 >> 51); h->v[1] = (uint64_t)r1 & FE_MASK;
+    r3 += (uint64_t)(r2 >> 51); h->v[2] = (uint64_t)r2 & FE_MASK;
+    r4 += (uint64_t)(r3 >> 51); h->v[3] = (uint64_t)r3 & FE_MASK;
+    c = (uint64_t)(r4 >> 51);   h->v[4] = (uint64_t)r4 & FE_MASK;
+
+    h->v[0] += c * 19;
+    h->v[1] += h->v[0] >> 51;
+    h->v[0] &= FE_MASK;
+}
+
+
+static
+void
+fe_sq(fe *h,
+      const fe *f)
+{
+    const uint64_t f0 = f->v[0], f1 = f->v[1], f2 = f->v[2], f3 = f->v[3], f4 = f->v[4];
+    const uint64_t f0_2 = f0 * 2, f1_2 = f1 * 2;
+    const uint64_t f1_38 = f1 * 38, f2_38 = f2 * 38, f3_38 = f3 * 38, f3_19 = f3 * 19, f4_19 = f4 * 19;
+    uint128_t r0, r1, r2, r3, r4;
+    uint64_t c;
+
+    r0 = (uint128_t)f0   * f0 + (uint128_t)f1_38 * f4 + (uint128_t)f2_38 * f3;
+    r1 = (uint128_t)f0_2 * f1 + (uint128_t)f2_38 * f4 + (uint128_t)f3_19 * f3;
+    r2 = (uint128_t)f0_2 * f2 + (uint128_t)f1    * f1 + (uint128_t)f3_38 * f4;
+    r3 = (uint128_t)f0_2 * f3 + (uint128_t)f1_2  * f2 + (uint128_t)f4_19 * f4;
+    r4 = (uint128_t)f0_2 * f4 + (uint128_t)f1_2  * f3 + (uint128_t)f2    * f2;
+
+    r1 += (uint64_t)(r0 >> 51); h->v[0] = (uint64_t)r0 & FE_MASK;
+    r2 += (uint64_t)(r1 >> 51); h->v[1] = (uint64_t)r1 & FE_MASK;
+    r3 += (uint64_t)(r2 >> 51); h->v[2] = (uint64_t)r2 & FE_MASK;
+    r4 += (uint64_t)(r3 >> 51); h->v[3] = (uint64_t)r3 & FE_MASK;
+    c = (uint64_t)(r4 >> 51);   h->v[4] = (uint64_t)r4 & FE_MASK;
+
+    h->v[0] += c * 19;
+    h->v[1] += h->v[0] >> 51;
+    h->v[0] &= FE_MASK;
+}
+
+
+/* Square 'count' times in a row. */
+static inline
+void
+fe_sqn(fe *h,
+       const fe *f,
+       int count)
+{
+    fe_sq(h, f);
+    while (--count > 0) fe_sq(h, h);
+}
+
+
+/* The top bit of the encoding is ignored; it holds the sign of x in points. */
+static
+void
+fe_frombytes(fe *h,
+             const uint8_t *s)
+{
+    h->v[0] =  load64_le(s)             & FE_MASK;
+    h->v[1] = (load64_le(s + 6)  >> 3)  & FE_MASK;
+    h->v[2] = (load64_le(s + 12) >> 6)  & FE_MASK;
+    h->v[3] = (load64_le(s + 19) >> 1)  & FE_MASK;
+    h->v[4] = (load64_le(s + 24) >> 12) & FE_MASK;
+}
+
+
+/* Encode the fully reduced value. */
+static
+void
+fe_tobytes(uint8_t *s,
+           const fe *f)
+{
+    fe t = *f;
+    uint64_t q;
+
+    fe_carry(&t);
+    fe_carry(&t);
+
+    /* Now t < 2^255 + a little; add 19 to find out whether it's at least p. */
+    q = (t.v[0] + 19) >> 51;
+    q = (t.v[1] + q) >> 51;
+    q = (t.v[2] + q) >> 51;
+    q = (t.v[3] + q) >> 51;
+    q = (t.v[4] + q) >> 51;
+
+    t.v[0] += 19 * q;
+    t.v[1] += t.v[0] >> 51; t.v[0] &= FE_MASK;
+    t.v[2] += t.v[1] >> 51; t.v[1] &= FE_MASK;
+    t.v[3] += t.v[2] >> 51; t.v[2] &= FE_MASK;
+    t.v[4] += t.v[3] >> 51; t.v[3] &= FE_MASK;
+    t.v[4] &= FE_MASK;
+
+    store64_le(s,      t.v[0]         | (t.v[1] << 51));
+    store64_le(s + 8,  (t.v[1] >> 13) | (t.v[2] << 38));
+    store64_le(s + 16, (t.v[2] >> 26) | (t.v[3] << 25));
+    store64_le(s + 24, (t.v[3] >> 39) | (t.v[4] << 12));
+}
+
+
+static inline
+int
+fe_isnonzero(const fe *f)
+{
+    uint8_t s[32];
+    uint8_t bits = 0;
+
+    fe_tobytes(s, f);
+    for (int i = 0; i < 32; ++i) bits |= s[i];
+
+    return 0 != bits;
+}
+
+
+static inline
+int
+fe_isnegative(const fe *f)
+{
+    uint8_t s[32];
+
+    fe_tobytes(s, f);
+    return s[0] & 1;
+}
+
+
+/* z^(2^250 - 1), with z^11 left in 'z11' for the callers' final steps. */
+static
+void
+fe_pow2_250_1(fe *h,
+              fe *z11,
+              const fe *z)
+{
+    fe t0, t1, t2;
+
+    fe_sq(&t0, z);                  /* z^2 */
+    fe_sqn(&t1, &t0, 2);            /* z^8 */
+    fe_mul(&t1, z, &t1);            /* z^9 */
+    fe_mul(z11, &t0, &t1);          /* z^11 */
+    fe_sq(&t0, z11);                /* z^22 */
+    fe_mul(&t1, &t1, &t0);          /* z^(2^5 - 1) */
+    fe_sqn(&t0, &t1, 5);
+    fe_mul(&t1, &t0, &t1);          /* z^(2^10 - 1) */
+    fe_sqn(&t0, &t1, 10);
+    fe_mul(&t0, &t0, &t1);          /* z^(2^20 - 1) */
+    fe_sqn(&t2, &t0, 20);
+    fe_mul(&t0, &t2, &t0);          /* z^(2^40 - 1) */
+    fe_sqn(&t0, &t0, 10);
+    fe_mul(&t1, &t0, &t1);          /* z^(2^50 - 1) */
+    fe_sqn(&t0, &t1, 50);
+    fe_mul(&t0, &t0, &t1);          /* z^(2^100 - 1) */
+    fe_sqn(&t2, &t0, 100);
+    fe_mul(&t0, &t2, &t0);          /* z^(2^200 - 1) */
+    fe_sqn(&t0, &t0, 50);
+    fe_mul(h, &t0, &t1);            /* z^(2^250 - 1) */
+}
+
+
+/* z^(p - 2) = 1 / z */
+static
+void
+fe_invert(fe *h,
+          const fe *z)
+{
+    fe t, z11;
+
+    fe_pow2_250_1(&t, &z11, z);
+    fe_sqn(&t, &t, 5);
+    fe_mul(h, &t, &z11);
+}
+
+
+/* z^((p - 5) / 8) = z^(2^252 - 3) */
+static
+void
+fe_pow22523(fe *h,
+            const fe *z)
+{
+    fe t, z11;
+
+    fe_pow2_250_1(&t, &z11, z);
+    fe_sqn(&t, &t, 2);
+    fe_mul(h, &t, z);
+}
+
+
+/*
+ * @brief Decode a point and negate it.
+ * @param h Set to the negated point.
+ * @param s The 32-byte encoding of the point.
+ * @return 0 on success, -1 if the encoding isn't a point on the curve.
+ */
+static
+int
+ge_frombytes_negate_vartime(ge_p3 *h,
+                            const uint8_t *s)
+{
+    fe u, v, v3, vxx, check;
+
+    fe_frombytes(&h->Y, s);
+    fe_1(&h->Z);
+
+    /* x^2 = (y^2 - 1) / (d y^2 + 1) = u / v */
+    fe_sq(&u, &h->Y);
+    fe_mul(&v, &u, &fe_d);
+    fe_sub(&u, &u, &h->Z);
+    fe_add(&v, &v, &h->Z);
+
+    /* x = u v^3 (u v^7)^((p - 5) / 8) */
+    fe_sq(&v3, &v);
+    fe_mul(&v3, &v3, &v);
+    fe_sq(&h->X, &v3);
+    fe_mul(&h->X, &h->X, &v);
+    fe_mul(&h->X, &h->X, &u);
+    fe_pow22523(&h->X, &h->X);
+    fe_mul(&h->X, &h->X, &v3);
+    fe_mul(&h->X, &h->X, &u);
+
+    /* That is a square root of x^2 or of -x^2; fix up the latter. */
+    fe_sq(&vxx, &h->X);
+    fe_mul(&vxx, &vxx, &v);
+    fe_sub(&check, &vxx, &u);
+    if (fe_isnonzero(&check)) {
+        fe_add(&check, &vxx, &u);
+        if (fe_isnonzero(&check)) return -1;
+
+        fe_mul(&h->X, &h->X, &fe_sqrtm1);
+    }
+
+    if (fe_isnegative(&h->X) == (s[31] >> 7)) fe_neg(&h->X, &h->X);
+
+    fe_mul(&h->T, &h->X, &h->Y);
+    return 0;
+}
+
+
+static
+void
+ge_p2_tobytes(uint8_t *s,
+              const ge_p2 *h)
+{
+    fe recip, x, y;
+
+    fe_invert(&recip, &h->Z);
+    fe_mul(&x, &h->X, &recip);
+    fe_mul(&y, &h->Y, &recip);
+
+    fe_tobytes(s, &y);
+    s[31] ^= (uint8_t)(fe_isnegative(&x) << 7);
+}
+
+
+static inline
+void
+ge_p1p1_to_p2(ge_p2 *r,
+              const ge_p1p1 *p)
+{
+    fe_mul(&r->X, &p->X, &p->T);
+    fe_mul(&r->Y, &p->Y, &p->Z);
+    fe_mul(&r->Z, &p->Z, &p->T);
+}
+
+
+static inline
+void
+ge_p1p1_to_p3(ge_p3 *r,
+              const ge_p1p1 *p)
+{
+    fe_mul(&r->X, &p->X, &p->T);
+    fe_mul(&r->Y, &p->Y, &p->Z);
+    fe_mul(&r->Z, &p->Z, &p->T);
+    fe_mul(&r->T, &p->X, &p->Y);
+}
+
+
+static inline
+void
+ge_p3_to_cached(ge_cached *r,
+                const ge_p3 *p)
+{
+    fe_add(&r->YplusX, &p->Y, &p->X);
+    fe_sub(&r->YminusX, &p->Y, &p->X);
+    r->Z = p->Z;
+    fe_mul(&r->T2d, &p->T, &fe_d2);
+}
+
+
+static
+void
+ge_p2_dbl(ge_p1p1 *r,
+          const ge_p2 *p)
+{
+    fe t0;
+
+    fe_sq(&r->X, &p->X);
+    fe_sq(&r->Z, &p->Y);
+    fe_sq(&r->T, &p->Z);
+    fe_add(&r->T, &r->T, &r->T);
+    fe_add(&r->Y, &p->X, &p->Y);
+    fe_sq(&t0, &r->Y);
+    fe_add(&r->Y, &r->Z, &r->X);
+    fe_sub(&r->Z, &r->Z, &r->X);
+    fe_sub(&r->X, &t0, &r->Y);
+    fe_sub(&r->T, &r->T, &r->Z);
+}
+
+
+static inline
+void
+ge_p3_dbl(ge_p1p1 *r,
+          const ge_p3 *p)
+{
+    ge_p2_dbl(r, (const ge_p2 *)p);
+}
+
+
+/* r = p + q when 'negate' is 0, else r = p - q. */
+static
+void
+ge_add_cached(ge_p1p1 *r,
+              const ge_p3 *p,
+              const ge_cached *q,
+              int negate)
+{
+    fe t0;
+
+    fe_add(&r->X, &p->Y, &p->X);
+    fe_sub(&r->Y, &p->Y, &p->X);
+    fe_mul(&r->Z, &r->X, negate ? &q->YminusX : &q->YplusX);
+    fe_mul(&r->Y, &r->Y, negate ? &q->YplusX : &q->YminusX);
+    fe_mul(&r->T, &q->T2d, &p->T);
+    fe_mul(&r->X, &p->Z, &q->Z);
+    fe_add(&t0, &r->X, &r->X);
+    fe_sub(&r->X, &r->Z, &r->Y);
+    fe_add(&r->Y, &r->Z, &r->Y);
+
+    if (negate) {
+        fe_sub(&r->Z, &t0, &r->T);
+        fe_add(&r->T, &t0, &r->T);
+    } else {
+        fe_add(&r->Z, &t0, &r->T);
+        fe_sub(&r->T, &t0, &r->T);
+    }
+}
+
+
+/* r = p + q when 'negate' is 0, else r = p - q. Precomputed summands save one multiplication. */
+static
+void
+ge_add_precomp(ge_p1p1 *r,
+               const ge_p3 *p,
+               const ge_precomp *q,
+               int negate)
+{
+    fe t0;
+
+    fe_add(&r->X, &p->Y, &p->X);
+    fe_sub(&r->Y, &p->Y, &p->X);
+    fe_mul(&r->Z, &r->X, negate ? &q->yminusx : &q->yplusx);
+    fe_mul(&r->Y, &r->Y, negate ? &q->yplusx : &q->yminusx);
+    fe_mul(&r->T, &q->xy2d, &p->T);
+    fe_add(&t0, &p->Z, &p->Z);
+    fe_sub(&r->X, &r->Z, &r->Y);
+    fe_add(&r->Y, &r->Z, &r->Y);
+
+    if (negate) {
+        fe_sub(&r->Z, &t0, &r->T);
+        fe_add(&r->T, &t0, &r->T);
+    } else {
+        fe_add(&r->Z, &t0, &r->T);
+        fe_sub(&r->T, &t0, &r->T);
+    }
+}
+
+
+/*
+ * @brief Recode a scalar into odd signed digits, most of them zero, no larger than 'limit'.
+ * @param r The 256 digits, least significant first.
+ * @param a The 32-byte little-endian scalar, below 2^253.
+ * @param limit The largest digit; (limit + 1) must be a power of two.
+ */
+static
+void
+slide(int8_t *r,
+      const uint8_t *a,
+      int limit)
+{
+    int window = 0;
+
+    while ((1 << window) <= limit) ++window;
+
+    for (int i = 0; i < 256; ++i) r[i] = 1 & (a[i >> 3] >> (i & 7));
+
+    for (int i = 0; i < 256; ++i) {
+        if (!r[i]) continue;
+
+        for (int b = 1; b <= window && (i + b) < 256; ++b) {
+            if (!r[i + b]) continue;
+
+            if ((r[i] + (r[i + b] << b)) <= limit) {
+                r[i] += r[i + b] << b;
+                r[i + b] = 0;
+            } else if ((r[i] - (r[i + b] << b)) >= -limit) {
+                r[i] -= r[i + b] << b;
+
+                for (int k = i + b; k < 256; ++k) {
+                    if (!r[k]) {
+                        r[k] = 1;
+                        break;
+                    }
+
+                    r[k] = 0;
+                }
+            } else {
+                break;
+            }
+        }
+    }
+}
+
+
+/*
+ * @brief Compute r = a * A + b * B, where B is the base point.
+ */
+static
+void
+ge_double_scalarmult_vartime(ge_p2 *r,
+                             const uint8_t *a,
+                             const ge_p3 *A,
+                             const uint8_t *b)
+{
+    int8_t aslide[256], bslide[256];
+    ge_cached Ai[(KEY_WINDOW_LIMIT + 1) / 2];   /* A, 3A, 5A, ..., 15A */
+    ge_p1p1 t;
+    ge_p3 u, A2;
+    int i;
+
+    slide(aslide, a, KEY_WINDOW_LIMIT);
+    slide(bslide, b, BASE_WINDOW_LIMIT);
+
+    ge_p3_to_cached(&Ai[0], A);
+    ge_p3_dbl(&t, A);
+    ge_p1p1_to_p3(&A2, &t);
+    for (i = 1; i < (int)(sizeof(Ai) / sizeof(Ai[0])); ++i) {
+        ge_add_cached(&t, &A2, &Ai[i - 1], 0);
+        ge_p1p1_to_p3(&u, &t);
+        ge_p3_to_cached(&Ai[i], &u);
+    }
+
+    fe_0(&r->X);
+    fe_1(&r->Y);
+    fe_1(&r->Z);
+
+    for (i = 255; i >= 0 && !aslide[i] && !bslide[i]; --i);
+
+    for (; i >= 0; --i) {
+        ge_p2_dbl(&t, r);
+
+        if (aslide[i]) {
+            ge_p1p1_to_p3(&u, &t);
+            ge_add_cached(&t, &u, &Ai[(aslide[i] < 0 ? -aslide[i] : aslide[i]) / 2], aslide[i] < 0);
+        }
+
+        if (bslide[i]) {
+            ge_p1p1_to_p3(&u, &t);
+            ge_add_precomp(&t, &u, &ge_base_multiples[(bslide[i] < 0 ? -bslide[i] : bslide[i]) / 2], bslide[i] < 0);
+        }
+
+        ge_p1p1_to_p2(r, &t);
+    }
+}
+
+
+/* Is the 32-byte little-endian scalar below the group order? */
+static
+int
+sc_is_canonical(const uint8_t *s)
+{
+    for (int i = 3; i >= 0; --i) {
+        uint64_t limb = load64_le(s + (i * 8));
+
+        if (limb != sc_l[i]) return limb < sc_l[i];
+    }
+
+    return 0;
+}
+
+
+/*
+ * @brief Reduce a 64-byte little-endian number modulo the group order, one bit at a time.
+ *  This only runs once per verification, so its few microseconds don't matter.
+ * @param out The 32-byte little-endian result.
+ * @param in The 64-byte number.
+ */
+static
+void
+sc_reduce(uint8_t *out,
+          const uint8_t *in)
+{
+    uint64_t r[5] = {0};
+    uint64_t t[5], borrow, carry;
+
+    for (int bit = 511; bit >= 0; --bit) {
+        /* r = 2r + bit; r < 2L < 2^254 before this, so five limbs never overflow. */
+        for (int i = 4; i > 0; --i) r[i] = (r[i] << 1) | (r[i - 1] >> 63);
+        r[0] = (r[0] << 1) | ((in[bit >> 3] >> (bit & 7)) & 1);
+
+        /* Subtract L when r >= L. */
+        borrow = 0;
+        for (int i = 0; i < 5; ++i) {
+            uint64_t l = (i < 4) ? sc_l[i] : 0;
+            uint64_t d = r[i] - l;
+
+            carry = (r[i] < l) | (d < borrow);
+            t[i] = d - borrow;
+            borrow = carry;
+        }
+
+        if (!borrow) {
+            for (int i = 0; i < 5; ++i) r[i] = t[i];
+        }
+    }
+
+    for (int i = 0; i < 4; ++i) store64_le(out + (i * 8), r[i]);
+}
+
+
+int
+ed25519_verify(const uint8_t *signature,
+               const uint8_t *message,
+               size_t message_len,
+               const uint8_t *public_key)
+{
+    struct Sha512 ctx;
+    uint8_t digest[SHA512_DIGEST_SIZE];
+    uint8_t h[32], check[32];
+    uint8_t diff = 0;
+    ge_p3 A;
+    ge_p2 R;
+
+    /* A non-canonical S would make signatures malleable. */
+    if (!sc_is_canonical(signature + 32)) return -1;
+
+    if (0 != ge_frombytes_negate_vartime(&A, public_key)) return -1;
+
+    sha512_init(&ctx);
+    sha512_update(&ctx, signature, 32);
+    sha512_update(&ctx, public_key, ED25519_PUBLIC_KEY_SIZE);
+    sha512_update(&ctx, message, message_len);
+    sha512_final(&ctx, digest);
+    sc_reduce(h, digest);
+
+    /* [S]B = R + [h]A  <=>  R = [S]B - [h]A */
+    ge_double_scalarmult_vartime(&R, h, &A, signature + 32);
+    ge_p2_tobytes(check, &R);
+
+    for (int i = 0; i < 32; ++i) diff |= check[i] ^ signature[i];
+
+    return (0 == diff) ? 0 : -1;
+}
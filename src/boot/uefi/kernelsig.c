@@ -0,0 +1,290 @@
+#include "../../../include/boot/uefi/kernelsig.h"
+
+
+
+/* Domain separation of the two tree levels, so a leaf can never pass for a root. */
+#define KERNEL_SIG_LEAF_PREFIX  0x00
+#define KERNEL_SIG_ROOT_PREFIX  0x01
+
+
+/**
+ * The state of one hash tree calculation, shared by every processor working on it.
+ */
+typedef
+struct {
+    CONST UINT8     *Image;
+    UINT64          ImageSize;
+    UINT32          ChunkSize;
+    UINT64          ChunkCount;
+    UINT8           *Leaves;
+    UINT64 VOLATILE NextChunk;
+} KERNEL_SIG_TREE;
+
+
+/* The firmware's MP services, if there are any. Looked up once. */
+STATIC EFI_MP_SERVICES_PROTOCOL *mMpServices = NULL;
+STATIC BOOLEAN mMpServicesLocated = FALSE;
+
+STATIC EFI_GUID mMpServicesGuid = EFI_MP_SERVICES_PROTOCOL_GUID;
+
+
+
+/**
+ * Hash chunks into their leaves until none are left. Runs on the BSP and on APs
+ *  alike, so it must not use any boot services.
+ *
+ * @param[in]  Context  The KERNEL_SIG_TREE to work on.
+ */
+STATIC
+VOID
+EFIAPI
+KernelSigHashChunks(IN VOID *Context)
+{
+    KERNEL_SIG_TREE *Tree = (KERNEL_SIG_TREE *)Context;
+    CONST UINT8 Prefix = KERNEL_SIG_LEAF_PREFIX;
+    struct Sha512 Leaf;
+    UINT64 Index, Offset;
+
+    while ((Index = __sync_fetch_and_add(&(Tree->NextChunk), 1)) < Tree->ChunkCount) {
+        Offset = Index * Tree->ChunkSize;
+
+        sha512_init(&Leaf);
+        sha512_update(&Leaf, &Prefix, sizeof(Prefix));
+        sha512_update(&Leaf, Tree->Image + Offset, MIN(Tree->ChunkSize, Tree->ImageSize - Offset));
+        sha512_final(&Leaf, Tree->Leaves + (Index * SHA512_DIGEST_SIZE));
+    }
+}
+
+
+/**
+ * Start KernelSigHashChunks on every enabled AP without waiting for them.
+ *
+ * @param[in]  Tree      The tree to work on.
+ * @param[out] Finished  Set to an event which is signaled once all APs are done.
+ *
+ * @retval EFI_SUCCESS  The APs are working. The caller must wait for and close the event.
+ * @retval Other        No AP is working; the BSP has to hash everything on its own.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+KernelSigStartHelpers(IN KERNEL_SIG_TREE *Tree,
+                      OUT EFI_EVENT *Finished)
+{
+    EFI_STATUS Status;
+
+    if (!mMpServicesLocated) {
+        mMpServicesLocated = TRUE;
+
+        Status = uefi_call_wrapper(BS->LocateProtocol, 3, &mMpServicesGuid, NULL, (VOID **)&mMpServices);
+        if (EFI_ERROR(Status)) {
+            mMpServices = NULL;
+        }
+    }
+
+    if (NULL == mMpServices) {
+        return EFI_UNSUPPORTED;
+    }
+
+    Status = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL, Finished);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    /* EFI_NOT_STARTED just means that there are no enabled APs. */
+    Status = uefi_call_wrapper(
+        mMpServices->StartupAllAPs, 7,
+        mMpServices,
+        (EFI_AP_PROCEDURE)KernelSigHashChunks,
+        FALSE,
+        *Finished,
+        0,
+        (VOID *)Tree,
+        NULL
+    );
+    if (EFI_ERROR(Status)) {
+        uefi_call_wrapper(BS->CloseEvent, 1, *Finished);
+    }
+
+    return Status;
+}
+
+
+EFI_STATUS
+EFIAPI
+KernelSigHashTree(IN CONST UINT8 *Image,
+                  IN UINT64 ImageSize,
+                  IN UINT32 ChunkSize,
+                  IN BOOLEAN Parallel,
+                  OUT UINT8 *Root)
+{
+    KERNEL_SIG_TREE Tree = {0};
+    EFI_EVENT Finished = NULL;
+    BOOLEAN HelpersStarted = FALSE;
+    struct Sha512 RootHash;
+    UINT8 Header[1 + sizeof(UINT64) + sizeof(UINT32)];
+    UINTN Index;
+
+    if (ChunkSize < CROWS_KERNEL_SIG_MIN_CHUNK_SIZE || ChunkSize > CROWS_KERNEL_SIG_MAX_CHUNK_SIZE) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Tree.Image = Image;
+    Tree.ImageSize = ImageSize;
+    Tree.ChunkSize = ChunkSize;
+    Tree.ChunkCount = MAX(1, (ImageSize + ChunkSize - 1) / ChunkSize);
+    Tree.NextChunk = 0;
+
+    Tree.Leaves = (UINT8 *)AllocatePool(Tree.ChunkCount * SHA512_DIGEST_SIZE);
+    if (NULL == Tree.Leaves) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    /* The BSP hashes chunks too, and a single chunk isn't worth waking the APs for. */
+    if (Parallel && Tree.ChunkCount > 1) {
+        HelpersStarted = !EFI_ERROR(KernelSigStartHelpers(&Tree, &Finished));
+    }
+
+    KernelSigHashChunks(&Tree);
+
+    if (HelpersStarted) {
+        uefi_call_wrapper(BS->WaitForEvent, 3, 1, &Finished, &Index);
+        uefi_call_wrapper(BS->CloseEvent, 1, Finished);
+    }
+
+    Header[0] = KERNEL_SIG_ROOT_PREFIX;
+    for (UINTN i = 0; i < sizeof(UINT64); ++i) Header[1 + i] = (UINT8)(ImageSize >> (8 * i));
+    for (UINTN i = 0; i < sizeof(UINT32); ++i) Header[1 + sizeof(UINT64) + i] = (UINT8)(ChunkSize >> (8 * i));
+
+    sha512_init(&RootHash);
+    sha512_update(&RootHash, Header, sizeof(Header));
+    sha512_update(&RootHash, Tree.Leaves, Tree.ChunkCount * SHA512_DIGEST_SIZE);
+    sha512_final(&RootHash, Root);
+
+    FreePool(Tree.Leaves);
+    return EFI_SUCCESS;
+}
+
+
+EFI_STATUS
+EFIAPI
+KernelSigVerify(IN CONST UINT8 *Image,
+                IN UINT64 ImageSize,
+                IN CONST CROWS_KERNEL_SIGNATURE *Signature,
+                IN UINTN SignatureSize,
+                IN CONST UINT8 *PublicKey)
+{
+    EFI_STATUS Status;
+    UINT8 Root[SHA512_DIGEST_SIZE];
+
+    if (
+        sizeof(CROWS_KERNEL_SIGNATURE) != SignatureSize
+        || CROWS_KERNEL_SIGNATURE_SIGNATURE != Signature->Signature
+        || CROWS_KERNEL_SIGNATURE_VERSION != Signature->Version
+        || ImageSize != Signature->ImageSize
+    ) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    Status = KernelSigHashTree(Image, ImageSize, Signature->ChunkSize, TRUE, Root);
+    if (EFI_INVALID_PARAMETER == Status) {
+        return EFI_VOLUME_CORRUPTED;
+    } else if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    if (0 != ed25519_verify(Signature->RootSignature, Root, sizeof(Root), PublicKey)) {
+        return EFI_SECURITY_VIOLATION;
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+#if CROWS_SHIM_BENCH == 1
+STATIC
+UINT64
+ReadTsc(VOID)
+{
+    UINT32 Low, High;
+
+    __asm__ __volatile__ ("rdtsc" : "=a"(Low), "=d"(High));
+    return ((UINT64)High << 32) | Low;
+}
+
+
+/**
+ * Print the fastest and the mean of a set of timings.
+ */
+STATIC
+VOID
+EFIAPI
+KernelSigPrintTimings(IN CONST CHAR16 *Name,
+                      IN UINT64 *Ticks,
+                      IN UINT64 TicksPerMicrosecond,
+                      IN UINT64 Bytes)
+{
+    UINT64 Fastest = Ticks[0], Total = 0;
+
+    for (UINTN i = 0; i < CROWS_SHIM_BENCH_ROUNDS; ++i) {
+        Fastest = MIN(Fastest, Ticks[i]);
+        Total += Ticks[i];
+    }
+
+    Fastest = MAX(1, Fastest / TicksPerMicrosecond);
+    Print(
+        L"  %-22s best %8llu us   mean %8llu us",
+        Name,
+        Fastest,
+        (Total / CROWS_SHIM_BENCH_ROUNDS) / TicksPerMicrosecond
+    );
+
+    if (Bytes > 0) {
+        Print(L"   %6llu MiB/s", ((Bytes * 1000000) / Fastest) >> 20);
+    }
+
+    Print(L"\r\n");
+}
+
+
+VOID
+EFIAPI
+KernelSigBenchmark(IN CONST UINT8 *Image,
+                   IN UINT64 ImageSize,
+                   IN CONST CROWS_KERNEL_SIGNATURE *Signature,
+                   IN CONST UINT8 *PublicKey)
+{
+    UINT64 Serial[CROWS_SHIM_BENCH_ROUNDS], Parallel[CROWS_SHIM_BENCH_ROUNDS], Verify[CROWS_SHIM_BENCH_ROUNDS];
+    UINT64 Before, TicksPerMicrosecond;
+    UINT8 Root[SHA512_DIGEST_SIZE];
+
+    Before = ReadTsc();
+    uefi_call_wrapper(BS->Stall, 1, 10000);
+    TicksPerMicrosecond = MAX(1, (ReadTsc() - Before) / 10000);
+
+    for (UINTN i = 0; i < CROWS_SHIM_BENCH_ROUNDS; ++i) {
+        Before = ReadTsc();
+        KernelSigHashTree(Image, ImageSize, Signature->ChunkSize, FALSE, Root);
+        Serial[i] = ReadTsc() - Before;
+
+        Before = ReadTsc();
+        KernelSigHashTree(Image, ImageSize, Signature->ChunkSize, TRUE, Root);
+        Parallel[i] = ReadTsc() - Before;
+
+        Before = ReadTsc();
+        ed25519_verify(Signature->RootSignature, Root, sizeof(Root), PublicKey);
+        Verify[i] = ReadTsc() - Before;
+    }
+
+    Print(
+        L"Kernel check: %llu bytes in %llu chunks of %u bytes, %u rounds.\r\n",
+        ImageSize,
+        MAX(1, (ImageSize + Signature->ChunkSize - 1) / Signature->ChunkSize),
+        Signature->ChunkSize,
+        CROWS_SHIM_BENCH_ROUNDS
+    );
+    KernelSigPrintTimings(L"Hash tree, BSP only", Serial, TicksPerMicrosecond, ImageSize);
+    KernelSigPrintTimings(L"Hash tree, all CPUs", Parallel, TicksPerMicrosecond, ImageSize);
+    KernelSigPrintTimings(L"Ed25519 verify", Verify, TicksPerMicrosecond, 0);
+}
+#endif
@@ -17,11 +17,100 @@
  *  the kernel securely wipes it shortly hereafter).
  * 
  * The CrOwS kernel image is signed with an asymmetric key at compile-time, whose
- *  public-key component is also contained within the ramdisk FAT filesystem.
+ *  public-key component is compiled into this shim (see 'kernelkey.h'). Nothing on
+ *  the boot volume can change which key is trusted.
  */
 
 #include "../../../include/boot/uefi/uefi.h"
+#include "../../../include/boot/uefi/kernelsig.h"
 
+/* Generated from the signing key by 'tools/mksig.py' at build time. */
+#include "kernelkey.h"
+
+
+
+/**
+ * Give up on booting: show why for a while, then reset the machine.
+ *
+ * @param[in]  Reason  What failed.
+ * @param[in]  Status  The status it failed with.
+ */
+STATIC
+VOID
+EFIAPI
+ShimFail(IN CONST CHAR16 *Reason,
+         IN EFI_STATUS Status)
+{
+    Print(L"%s (%r).\n", Reason, Status);
+    BS->Stall(10000000);
+
+    Print(L"Resetting...");
+    RT->ResetSystem(EfiResetCold, Status, 0, NULL);
+    while (TRUE);   /* should not be reached, but hang just in case */
+}
+
+
+/**
+ * Read a whole file into a new pool allocation.
+ *
+ * @param[in]  Volume  The root of the volume holding the file.
+ * @param[in]  Path    The path of the file on the volume.
+ * @param[out] Buffer  Set to the contents of the file. The caller frees it.
+ * @param[out] Length  Set to the length of the file.
+ *
+ * @retval EFI_SUCCESS           The file was read.
+ * @retval EFI_OUT_OF_RESOURCES  The file doesn't fit into memory.
+ * @retval Other                 The file couldn't be opened or read.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+ShimReadFile(IN EFI_FILE_HANDLE Volume,
+             IN CHAR16 *Path,
+             OUT UINT8 **Buffer,
+             OUT UINTN *Length)
+{
+    EFI_STATUS Status;
+    EFI_FILE_HANDLE File = NULL;
+    EFI_FILE_INFO *Info = NULL;
+
+    *Buffer = NULL;
+    *Length = 0;
+
+    Status = Volume->Open(Volume, &File, Path, EFI_FILE_MODE_READ, 0);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    Info = LibFileInfo(File);
+    if (NULL == Info) {
+        Status = EFI_DEVICE_ERROR;
+        goto Label__ShimReadFile__End;
+    }
+
+    *Buffer = (UINT8 *)AllocatePool(MAX(1, Info->FileSize));
+    if (NULL == *Buffer) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto Label__ShimReadFile__End;
+    }
+
+    *Length = Info->FileSize;
+    Status = File->Read(File, Length, *Buffer);
+    if (!EFI_ERROR(Status) && *Length != Info->FileSize) {
+        Status = EFI_END_OF_FILE;
+    }
+
+Label__ShimReadFile__End:
+    if (EFI_ERROR(Status) && NULL != *Buffer) {
+        FreePool(*Buffer);
+        *Buffer = NULL;
+    }
+
+    if (NULL != Info) FreePool(Info);
+    File->Close(File);
+
+    return Status;
+}
 
 
 EFI_STATUS
@@ -30,28 +119,61 @@ efi_main(EFI_HANDLE ImageHandle,
          EFI_SYSTEM_TABLE *SystemTable)
 {
     EFI_STATUS Status = EFI_SUCCESS;
+    EFI_LOADED_IMAGE_PROTOCOL *LIP = NULL;
+    EFI_FILE_HANDLE Volume = NULL;
+    UINT8 *Kernel = NULL, *Signature = NULL;
+    UINTN KernelSize = 0, SignatureSize = 0;
 
     /* Initialize the loader. */
     InitializeLib(ImageHandle, SystemTable);
 
-    /* For now just print some dummy text and vibe for like 60 seconds.
-        This is until there is confirmation that the first-stage MFTAH
-        loader will successfully chain-boot this executable. */
     Print(L"Chainload success!\n\n");
-    BS->Stall(60000000);
 
-    EFI_LOADED_IMAGE_PROTOCOL *LIP = NULL;
-    Status = BS->HandleProtocol(ImageHandle, &gEfiLoadedImageProtocolGuid, &LIP);
+    Status = BS->HandleProtocol(ImageHandle, &gEfiLoadedImageProtocolGuid, (VOID **)&LIP);
+    if (EFI_ERROR(Status)) {
+        ShimFail(L"Failed to get the LIP handle", Status);
+    }
+
+    Volume = LibOpenRoot(LIP->DeviceHandle);
+    if (NULL == Volume) {
+        ShimFail(L"Failed to open the boot volume", EFI_NOT_FOUND);
+    }
+
+    /* The kernel has to be read in to boot it anyway, so checking it only costs the hashing. */
+    Status = ShimReadFile(Volume, CROWS_KERNEL_IMAGE_PATH, &Kernel, &KernelSize);
+    if (EFI_ERROR(Status)) {
+        ShimFail(L"Failed to read the kernel image", Status);
+    }
+
+    Status = ShimReadFile(Volume, CROWS_KERNEL_SIGNATURE_PATH, &Signature, &SignatureSize);
     if (EFI_ERROR(Status)) {
-        Print(L"Failed to get the LIP handle.\n");
-        BS->Stall(10000000);
+        ShimFail(L"Failed to read the kernel signature", Status);
+    }
 
-        Print(L"Resetting...");
-        RT->ResetSystem(EfiResetCold, Status, 0, NULL);
-        while (TRUE);   /* should not be reached, but hang just in case */
+    Volume->Close(Volume);
+
+    Status = KernelSigVerify(
+        Kernel,
+        KernelSize,
+        (CONST CROWS_KERNEL_SIGNATURE *)Signature,
+        SignatureSize,
+        CrowsKernelPublicKey
+    );
+    if (EFI_ERROR(Status)) {
+        ShimFail(L"The kernel image is not correctly signed", Status);
     }
 
-    LIP->
+#if CROWS_SHIM_BENCH == 1
+    KernelSigBenchmark(Kernel, KernelSize, (CONST CROWS_KERNEL_SIGNATURE *)Signature, CrowsKernelPublicKey);
+#endif
+
+    Print(L"Kernel signature verified.\n");
+
+    /* Booting the kernel is not implemented yet, so just vibe for like 60 seconds. */
+    BS->Stall(60000000);
+
+    FreePool(Kernel);
+    FreePool(Signature);
 
     return EFI_SUCCESS;
 }
@@ -0,0 +1,199 @@
+/*
+ * SHA-512, as specified in FIPS 180-4.
+ */
+
+#include "../../../include/boot/uefi/crypto/sha512.h"
+
+
+
+static const uint64_t sha512_k[80] = {
+    0x428A2F98D728AE22ULL, 0x7137449123EF65CDULL, 0xB5C0FBCFEC4D3B2FULL, 0xE9B5DBA58189DBBCULL,
+    0x3956C25BF348B538ULL, 0x59F111F1B605D019ULL, 0x923F82A4AF194F9BULL, 0xAB1C5ED5DA6D8118ULL,
+    0xD807AA98A3030242ULL, 0x12835B0145706FBEULL, 0x243185BE4EE4B28CULL, 0x550C7DC3D5FFB4E2ULL,
+    0x72BE5D74F27B896FULL, 0x80DEB1FE3B1696B1ULL, 0x9BDC06A725C71235ULL, 0xC19BF174CF692694ULL,
+    0xE49B69C19EF14AD2ULL, 0xEFBE4786384F25E3ULL, 0x0FC19DC68B8CD5B5ULL, 0x240CA1CC77AC9C65ULL,
+    0x2DE92C6F592B0275ULL, 0x4A7484AA6EA6E483ULL, 0x5CB0A9DCBD41FBD4ULL, 0x76F988DA831153B5ULL,
+    0x983E5152EE66DFABULL, 0xA831C66D2DB43210ULL, 0xB00327C898FB213FULL, 0xBF597FC7BEEF0EE4ULL,
+    0xC6E00BF33DA88FC2ULL, 0xD5A79147930AA725ULL, 0x06CA6351E003826FULL, 0x142929670A0E6E70ULL,
+    0x27B70A8546D22FFCULL, 0x2E1B21385C26C926ULL, 0x4D2C6DFC5AC42AEDULL, 0x53380D139D95B3DFULL,
+    0x650A73548BAF63DEULL, 0x766A0ABB3C77B2A8ULL, 0x81C2C92E47EDAEE6ULL, 0x92722C851482353BULL,
+    0xA2BFE8A14CF10364ULL, 0xA81A664BBC423001ULL, 0xC24B8B70D0F89791ULL, 0xC76C51A30654BE30ULL,
+    0xD192E819D6EF5218ULL, 0xD69906245565A910ULL, 0xF40E35855771202AULL, 0x106AA07032BBD1B8ULL,
+    0x19A4C116B8D2D0C8ULL, 0x1E376C085141AB53ULL, 0x2748774CDF8EEB99ULL, 0x34B0BCB5E19B48A8ULL,
+    0x391C0CB3C5C95A63ULL, 0x4ED8AA4AE3418ACBULL, 0x5B9CCA4F7763E373ULL, 0x682E6FF3D6B2B8A3ULL,
+    0x748F82EE5DEFB2FCULL, 0x78A5636F43172F60ULL, 0x84C87814A1F0AB72ULL, 0x8CC702081A6439ECULL,
+    0x90BEFFFA23631E28ULL, 0xA4506CEBDE82BDE9ULL, 0xBEF9A3F7B2C67915ULL, 0xC67178F2E372532BULL,
+    0xCA273ECEEA26619CULL, 0xD186B8C721C0C207ULL, 0xEADA7DD6CDE0EB1EULL, 0xF57D4F7FEE6ED178ULL,
+    0x06F067AA72176FBAULL, 0x0A637DC5A2C898A6ULL, 0x113F9804BEF90DAEULL, 0x1B710B35131C471BULL,
+    0x28DB77F523047D84ULL, 0x32CAAB7B40C72493ULL, 0x3C9EBE0A15C9BEBCULL, 0x431D67C49C100D4CULL,
+    0x4CC5D4BECB3E42B6ULL, 0x597F299CFC657E2AULL, 0x5FCB6FAB3AD6FAECULL, 0x6C44198C4A475817ULL,
+};
+
+static const uint64_t sha512_iv[8] = {
+    0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL,
+    0x3C6EF372FE94F82BULL, 0xA54FF53A5F1D36F1ULL,
+    0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL,
+    0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL,
+};
+
+
+
+static inline
+uint64_t
+rotr64(uint64_t value,
+       unsigned int count)
+{
+    return (value >> count) | (value << (64 - count));
+}
+
+
+static inline
+uint64_t
+load64_be(const uint8_t *p)
+{
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48)
+         | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32)
+         | ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16)
+         | ((uint64_t)p[6] << 8)  |  (uint64_t)p[7];
+}
+
+
+static inline
+void
+store64_be(uint8_t *p,
+           uint64_t value)
+{
+    for (int i = 7; i >= 0; --i) {
+        p[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+
+/*
+ * @brief Hash consecutive blocks into the state.
+ * @param ctx The SHA-512 structure.
+ * @param blocks The blocks to hash.
+ * @param count How many SHA512_BLOCK_SIZE blocks there are.
+ */
+static
+void
+sha512_compress(struct Sha512 *ctx,
+                const uint8_t *blocks,
+                size_t count)
+{
+    uint64_t w[80];
+    uint64_t a, b, c, d, e, f, g, h, t1, t2;
+
+    for (; count > 0; --count, blocks += SHA512_BLOCK_SIZE) {
+        for (int i = 0; i < 16; ++i) w[i] = load64_be(blocks + (i * 8));
+
+        for (int i = 16; i < 80; ++i) {
+            uint64_t s0 = rotr64(w[i - 15], 1) ^ rotr64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+            uint64_t s1 = rotr64(w[i - 2], 19) ^ rotr64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        a = ctx->h[0]; b = ctx->h[1]; c = ctx->h[2]; d = ctx->h[3];
+        e = ctx->h[4]; f = ctx->h[5]; g = ctx->h[6]; h = ctx->h[7];
+
+        for (int i = 0; i < 80; ++i) {
+            t1 = h + (rotr64(e, 14) ^ rotr64(e, 18) ^ rotr64(e, 41))
+                   + ((e & f) ^ (~e & g)) + sha512_k[i] + w[i];
+            t2 = (rotr64(a, 28) ^ rotr64(a, 34) ^ rotr64(a, 39))
+                   + ((a & b) ^ (a & c) ^ (b & c));
+
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        ctx->h[0] += a; ctx->h[1] += b; ctx->h[2] += c; ctx->h[3] += d;
+        ctx->h[4] += e; ctx->h[5] += f; ctx->h[6] += g; ctx->h[7] += h;
+    }
+}
+
+
+void
+sha512_init(struct Sha512 *ctx)
+{
+    for (int i = 0; i < 8; ++i) ctx->h[i] = sha512_iv[i];
+
+    ctx->total_len = 0;
+    ctx->buffer_len = 0;
+}
+
+
+void
+sha512_update(struct Sha512 *ctx,
+              const void *data,
+              size_t len)
+{
+    const uint8_t *in = (const uint8_t *)data;
+    size_t blocks;
+
+    ctx->total_len += len;
+
+    /* Top up a partial block first. */
+    if (ctx->buffer_len > 0) {
+        while (len > 0 && ctx->buffer_len < SHA512_BLOCK_SIZE) {
+            ctx->buffer[ctx->buffer_len++] = *in++;
+            --len;
+        }
+
+        if (SHA512_BLOCK_SIZE != ctx->buffer_len) return;
+
+        sha512_compress(ctx, ctx->buffer, 1);
+        ctx->buffer_len = 0;
+    }
+
+    blocks = len / SHA512_BLOCK_SIZE;
+    sha512_compress(ctx, in, blocks);
+    in += blocks * SHA512_BLOCK_SIZE;
+    len -= blocks * SHA512_BLOCK_SIZE;
+
+    while (len > 0) {
+        ctx->buffer[ctx->buffer_len++] = *in++;
+        --len;
+    }
+}
+
+
+void
+sha512_final(struct Sha512 *ctx,
+             uint8_t *out)
+{
+    ctx->buffer[ctx->buffer_len++] = 0x80;
+
+    /* The 128-bit length must fit behind the padding, else it goes into one more block. */
+    if (ctx->buffer_len > (SHA512_BLOCK_SIZE - 16)) {
+        while (ctx->buffer_len < SHA512_BLOCK_SIZE) ctx->buffer[ctx->buffer_len++] = 0;
+
+        sha512_compress(ctx, ctx->buffer, 1);
+        ctx->buffer_len = 0;
+    }
+
+    while (ctx->buffer_len < (SHA512_BLOCK_SIZE - 16)) ctx->buffer[ctx->buffer_len++] = 0;
+
+    store64_be(ctx->buffer + SHA512_BLOCK_SIZE - 16, ctx->total_len >> 61);
+    store64_be(ctx->buffer + SHA512_BLOCK_SIZE - 8, ctx->total_len << 3);
+    sha512_compress(ctx, ctx->buffer, 1);
+
+    for (int i = 0; i < 8; ++i) store64_be(out + (i * 8), ctx->h[i]);
+
+    /* Nothing of the state is needed anymore. */
+    for (int i = 0; i < 8; ++i) ctx->h[i] = 0;
+    for (int i = 0; i < SHA512_BLOCK_SIZE; ++i) ctx->buffer[i] = 0;
+}
+
+
+void
+sha512(uint8_t *out,
+       const void *data,
+       size_t len)
+{
+    struct Sha512 ctx;
+
+    sha512_init(&ctx);
+    sha512_update(&ctx, data, len);
+    sha512_final(&ctx, out);
+}
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""
+Sign a CrOwS kernel image for the UEFI shim with an Ed25519 key.
+
+The signature covers the root of a SHA-512 hash tree over chunks of the image, which
+ the shim hashes on every processor at once. The layout matches 'CROWS_KERNEL_SIGNATURE'
+ in 'src/include/boot/uefi/kernelsig.h'.
+
+The shim trusts only the public key it was built with. '--key-header' writes that key
+ as the C header the shim's build includes ('kernelkey.h'); without a kernel to sign,
+ only the header is written.
+
+Make a key with 'openssl genpkey -algorithm ed25519 -out kernel.pem' and keep it off
+ the boot volume. Needs the 'cryptography' module.
+"""
+
+import argparse
+import hashlib
+import multiprocessing
+import os
+import struct
+import sys
+
+
+SIGNATURE = struct.unpack('<I', b'KSIG')[0]
+VERSION = 1
+
+MIN_CHUNK_SIZE = 64 << 10
+MAX_CHUNK_SIZE = 1 << 30
+
+LEAF_PREFIX = b'\x00'
+ROOT_PREFIX = b'\x01'
+
+HEADER = struct.Struct('<IIQII64s')
+
+KEY_HEADER_TEMPLATE = '''/* Generated by 'tools/mksig.py'. Do not edit. */
+
+#ifndef CROWS_KERNEL_KEY_H
+#define CROWS_KERNEL_KEY_H
+
+/* The Ed25519 key every kernel has to be signed with. */
+STATIC CONST UINT8 CrowsKernelPublicKey[ED25519_PUBLIC_KEY_SIZE] = {{
+{rows}
+}};
+
+#endif   /* CROWS_KERNEL_KEY_H */
+'''
+
+
+def hash_leaf(chunk):
+    return hashlib.sha512(LEAF_PREFIX + chunk).digest()
+
+
+def tree_root(image, chunk_size, jobs):
+    chunks = [image[offset:offset + chunk_size] for offset in range(0, len(image), chunk_size)] or [b'']
+
+    with multiprocessing.Pool(max(1, jobs)) as pool:
+        leaves = pool.map(hash_leaf, chunks)
+
+    return hashlib.sha512(ROOT_PREFIX + struct.pack('<QI', len(image), chunk_size) + b''.join(leaves)).digest()
+
+
+def key_header(public_key):
+    rows = (public_key[offset:offset + 8] for offset in range(0, len(public_key), 8))
+    return KEY_HEADER_TEMPLATE.format(rows='\n'.join('    ' + ' '.join(f'0x{b:02x},' for b in row) for row in rows))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('key', help='the PEM-encoded Ed25519 private key')
+    parser.add_argument('kernel', nargs='?', help='the kernel image to sign')
+    parser.add_argument('--signature', help='the signature file to write (default: the kernel path plus \'.SIG\')')
+    parser.add_argument('--key-header', help='the C header holding the public key to write for the shim\'s build')
+    parser.add_argument('--chunk-size', type=int, default=1 << 20,
+                        help='the size of each hash tree leaf\'s chunk (default: 1 MiB)')
+    parser.add_argument('--jobs', type=int, default=os.cpu_count() or 1,
+                        help='how many chunks to hash at once (default: one per processor)')
+    args = parser.parse_args()
+
+    if args.kernel is None and args.key_header is None:
+        parser.error('give a kernel to sign, a --key-header to write, or both')
+
+    try:
+        from cryptography.hazmat.primitives import serialization
+        from cryptography.hazmat.primitives.asymmetric.ed25519 import Ed25519PrivateKey
+    except ImportError:
+        sys.exit('mksig: the \'cryptography\' module is needed to sign kernels')
+
+    if not MIN_CHUNK_SIZE <= args.chunk_size <= MAX_CHUNK_SIZE:
+        sys.exit(f'mksig: the chunk size must be from {MIN_CHUNK_SIZE} to {MAX_CHUNK_SIZE} bytes')
+
+    with open(args.key, 'rb') as key_file:
+        key = serialization.load_pem_private_key(key_file.read(), password=None)
+    if not isinstance(key, Ed25519PrivateKey):
+        sys.exit('mksig: the key is not an Ed25519 private key')
+
+    public_key = key.public_key().public_bytes(serialization.Encoding.Raw, serialization.PublicFormat.Raw)
+
+    if args.key_header is not None:
+        with open(args.key_header, 'w') as output:
+            output.write(key_header(public_key))
+
+    if args.kernel is None:
+        return
+
+    with open(args.kernel, 'rb') as kernel:
+        image = kernel.read()
+
+    root = tree_root(image, args.chunk_size, args.jobs)
+
+    with open(args.signature or (args.kernel + '.SIG'), 'wb') as output:
+        output.write(HEADER.pack(SIGNATURE, VERSION, len(image), args.chunk_size, 0, key.sign(root)))
+
+    print(f'mksig: signed {len(image)} bytes as {max(1, -(-len(image) // args.chunk_size))} chunks '
+          f'of {args.chunk_size} bytes with key {public_key.hex()}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,159 @@
+/**
+ * Authenticated payloads: AES-256-GCM or ChaCha20-Poly1305 in independently sealed segments.
+ *
+ * An authenticated payload is a '.CROWS' file which the loader handles itself instead
+ *  of through MFTAH. Its ramdisk is split into segments (4 MiB by default), each sealed
+ *  with the cipher named in the header under its own IV and carrying its own tag. A segment is therefore
+ *  authenticated in the same pass over memory which decrypts it, there's no separate
+ *  whole-image hash, and the segments are processed on the BSP and all idle APs at once.
+ *  Any tampered, reordered or truncated segment fails the whole load.
+ *
+ * AES-256-GCM is the choice for processors with AES-NI. Without it, ChaCha20-Poly1305
+ *  (with its AVX2 or SSE2 keystream kernels) is several times faster than software AES.
+ *
+ * The file is laid out as the header, the tag table (one tag per segment), then the
+ *  ciphertext. It is decrypted in place, so the ramdisk starts right after the tag table.
+ *
+ * The key is an HMAC-SHA256 of the header's salt keyed by the password, which does
+ *  nothing to slow down guessing. So the password must be the one derived by the
+ *  volume's KDF (see 'kdf.h'): authenticated payloads are refused on volumes without
+ *  KDF parameters, and 'tools/mkaead.py' only takes derived passwords. The header is sealed under the key with an
+ *  empty message, which is what checks the password without touching any segment.
+ *  Segment 'i' uses the IV (or nonce) 'NoncePrefix || BE64(i)' and the header as its AAD, so a
+ *  segment can't be moved to another position or another payload. Payloads are built
+ *  with 'tools/mkaead.py'.
+ */
+
+#ifndef MFTAH_AEAD_H
+#define MFTAH_AEAD_H
+
+#include "core/mftah_uefi.h"
+#include "core/util.h"
+#include "core/kdf.h"
+#include "crypto/gcm.h"
+#include "crypto/chacha20poly1305.h"
+
+
+/* When set to 1, authenticated payloads are recognized and loaded. */
+#ifndef MFTAH_AEAD_PAYLOADS
+    #define MFTAH_AEAD_PAYLOADS 1
+#endif
+
+#if MFTAH_AEAD_PAYLOADS == 1 && MFTAH_PASSWORD_KDF != 1
+    #error "Authenticated payloads need MFTAH_PASSWORD_KDF to stretch their password."
+#endif
+
+#define MFTAH_AEAD_SIGNATURE \
+    EFI_SIGNATURE_32 ('M', 'G', 'C', 'M')
+#define MFTAH_AEAD_VERSION 1
+
+/* Segments are whole AES blocks, and small enough that a 32-bit block counter can't wrap. */
+#define MFTAH_AEAD_MIN_SEGMENT_SIZE     (4 << 10)
+#define MFTAH_AEAD_MAX_SEGMENT_SIZE     (1 << 30)
+
+#define MFTAH_AEAD_SALT_LENGTH          32
+#define MFTAH_AEAD_NONCE_PREFIX_LENGTH  4
+
+#define MFTAH_AEAD_CIPHER_AES_256_GCM           0
+#define MFTAH_AEAD_CIPHER_CHACHA20_POLY1305     1
+
+/* Both ciphers take 96-bit IVs and produce 128-bit tags. */
+#define MFTAH_AEAD_IV_LENGTH    AES_GCM_IV_LEN
+#define MFTAH_AEAD_TAG_LENGTH   AES_GCM_TAG_LEN
+
+/* The segment index whose IV seals the header. No payload has that many segments. */
+#define MFTAH_AEAD_HEADER_INDEX         0xFFFFFFFFFFFFFFFFULL
+
+
+/**
+ * The header of an authenticated payload. Everything but 'HeaderTag' is the AAD of
+ *  the header and of every segment.
+ */
+typedef
+struct {
+    UINT32      Signature;
+    UINT32      Version;
+    UINT64      PlaintextLength;    /* The ramdisk length; a multiple of AES_BLOCKLEN. */
+    UINT32      SegmentSize;
+    UINT32      SegmentCount;       /* The last segment may be shorter than 'SegmentSize'. */
+    UINT8       Salt[MFTAH_AEAD_SALT_LENGTH];
+    UINT8       NoncePrefix[MFTAH_AEAD_NONCE_PREFIX_LENGTH];
+    UINT32      Cipher;             /* One of the MFTAH_AEAD_CIPHER_* values. */
+    UINT8       Reserved[16];
+    UINT8       HeaderTag[MFTAH_AEAD_TAG_LENGTH];
+} __attribute__((packed)) MFTAH_AEAD_HEADER;
+
+#define MFTAH_AEAD_AAD_LENGTH   __builtin_offsetof(MFTAH_AEAD_HEADER, HeaderTag)
+
+
+/**
+ * Whether a buffer starts with the header of an authenticated payload.
+ *
+ * @param[in] Buffer  The leading bytes of a payload file.
+ * @param[in] Length  How many bytes of the file are in the buffer.
+ *
+ * @returns TRUE if the payload should be given to this module rather than MFTAH.
+ */
+BOOLEAN
+EFIAPI
+AeadIsPayload(
+    IN CONST VOID   *Buffer,
+    IN UINT64       Length
+);
+
+
+/**
+ * Check a password against the header of an authenticated payload.
+ *
+ * @param[in] Header          The payload header.
+ * @param[in] FileSize        The size of the whole payload file.
+ * @param[in] Password        The password.
+ * @param[in] PasswordLength  The length of the password.
+ *
+ * @retval EFI_SUCCESS           The password unlocks the payload.
+ * @retval EFI_INVALID_PASSWORD  It doesn't, or the header was tampered with.
+ * @retval EFI_ABORTED           The header is malformed, names an unknown cipher or doesn't match the file size.
+ */
+EFI_STATUS
+EFIAPI
+AeadCheckPassword(
+    IN CONST MFTAH_AEAD_HEADER  *Header,
+    IN UINT64                   FileSize,
+    IN CONST UINT8              *Password,
+    IN UINT8                    PasswordLength
+);
+
+
+/**
+ * Authenticate and decrypt a fully loaded authenticated payload in place, on the
+ *  BSP and every idle AP.
+ *
+ * @param[in,out] Buffer          The whole payload file.
+ * @param[in]     FileSize        The size of the file.
+ * @param[in]     Password        The (already checked) password.
+ * @param[in]     PasswordLength  The length of the password.
+ * @param[in]     Idle            Called on the BSP instead of taking a segment while APs are busy. Optional.
+ * @param[in]     IdleContext     Passed to 'Idle'.
+ * @param[out]    RamdiskImage    Set to the decrypted ramdisk, inside 'Buffer'.
+ * @param[out]    RamdiskLength   Set to the length of the ramdisk.
+ *
+ * @retval EFI_SUCCESS               Every segment was authenticated and decrypted.
+ * @retval EFI_SECURITY_VIOLATION    A segment failed authentication. The buffer must not be used.
+ * @retval EFI_ABORTED               The header is malformed.
+ */
+EFI_STATUS
+EFIAPI
+AeadDecryptPayload(
+    IN OUT UINT8            *Buffer,
+    IN UINT64               FileSize,
+    IN CONST UINT8          *Password,
+    IN UINT8                PasswordLength,
+    IN DECRYPT_IDLE_HOOK    Idle            OPTIONAL,
+    IN VOID                 *IdleContext    OPTIONAL,
+    OUT UINT8               **RamdiskImage,
+    OUT UINT64              *RamdiskLength
+);
+
+
+
+#endif   /* MFTAH_AEAD_H */
@@ -0,0 +1,178 @@
+/**
+ * A bump ('arena') allocator for short-lived loader allocations.
+ *
+ * Memory is carved out of page-granular slabs. Every block carries a small size
+ *  header, so blocks can be reallocated, and the most recent block of a slab can
+ *  be freed or grown in place. Everything else is only reclaimed in bulk with
+ *  ArenaReset or ArenaDestroy, which is what the loader's allocation pattern wants:
+ *  a burst of small allocations which all become garbage at the same time.
+ */
+
+#ifndef MFTAH_ARENA_H
+#define MFTAH_ARENA_H
+
+#include "core/mftah_uefi.h"
+
+
+/* The size of each regular slab of the shared loader arena. */
+#ifndef MFTAH_ARENA_SLAB_SIZE
+    #define MFTAH_ARENA_SLAB_SIZE (1ULL << 20)
+#endif
+
+/* The size of the slab pre-reserved for each decryption thread. */
+#ifndef MFTAH_ARENA_THREAD_SLAB_SIZE
+    #define MFTAH_ARENA_THREAD_SLAB_SIZE (16ULL << 10)
+#endif
+
+/* Block payloads are always aligned to this. */
+#define MFTAH_ARENA_ALIGNMENT 16
+
+
+/* The block sits in a dedicated slab of its own and is returned to the firmware on free. */
+#define ARENA_BLOCK_LARGE   (1 << 0)
+
+
+typedef
+struct S_ARENA_SLAB {
+    struct S_ARENA_SLAB     *Next;
+    UINTN                   Size;
+    UINTN                   Used;
+    UINTN                   Reserved;
+} ARENA_SLAB;
+
+typedef
+struct {
+    UINTN                   Size;
+    UINTN                   Flags;
+} ARENA_BLOCK;
+
+typedef
+struct {
+    ARENA_SLAB              *Slabs;     /* The head of this list is the slab being bumped. */
+    ARENA_SLAB              *Large;
+    UINTN                   SlabSize;
+    UINTN VOLATILE          Lock;
+} ARENA;
+
+
+/* The arena backing the MFTAH library's allocation hooks. */
+extern ARENA gLoaderArena;
+
+
+/**
+ * Prepare an arena and reserve its first slab up front.
+ *
+ * Only the initial slab is reserved here. Allocations which overflow it
+ *  need boot services, so arenas which are used on APs must be sized such
+ *  that they never need to grow there: on an AP, such allocations fail.
+ *
+ * @param[out] Arena     The arena to initialize.
+ * @param[in]  SlabSize  The size of each regular slab, including its header.
+ *
+ * @retval EFI_SUCCESS           The arena is ready.
+ * @retval EFI_OUT_OF_RESOURCES  The first slab could not be reserved.
+ */
+EFI_STATUS
+EFIAPI
+ArenaCreate(
+    OUT ARENA   *Arena,
+    IN UINTN    SlabSize
+);
+
+
+/**
+ * Allocate a block from an arena. Blocks of at least a quarter slab are
+ *  placed in their own pages so they can be returned to the firmware.
+ *  Off the BSP, only the current slab is used and nothing is reserved.
+ *
+ * @param[in]  Arena  The arena to allocate from.
+ * @param[in]  Size   The requested size of the block.
+ *
+ * @returns The new block, or NULL if the arena can't grow (or is used on an AP).
+ */
+VOID *
+EFIAPI
+ArenaAllocate(
+    IN ARENA    *Arena,
+    IN UINTN    Size
+);
+
+
+/**
+ * Allocate a zeroed block from an arena.
+ *
+ * @param[in]  Arena  The arena to allocate from.
+ * @param[in]  Size   The requested size of the block.
+ *
+ * @returns The new block, or NULL if the arena can't grow.
+ */
+VOID *
+EFIAPI
+ArenaAllocateZero(
+    IN ARENA    *Arena,
+    IN UINTN    Size
+);
+
+
+/**
+ * Resize a block. Shrinking never moves the block, and the most recent block
+ *  of the current slab grows in place while the slab has room. Otherwise the
+ *  contents are moved to a new block and the old block is freed.
+ *
+ * @param[in]  Arena    The arena which owns the block.
+ * @param[in]  Pointer  The block to resize, or NULL to allocate a new block.
+ * @param[in]  NewSize  The requested size of the block.
+ *
+ * @returns The resized block, or NULL (leaving the original intact) if the arena can't grow.
+ */
+VOID *
+EFIAPI
+ArenaReallocate(
+    IN ARENA    *Arena,
+    IN VOID     *Pointer    OPTIONAL,
+    IN UINTN    NewSize
+);
+
+
+/**
+ * Free a block. Large blocks go back to the firmware and the most recent block
+ *  of the current slab is reclaimed immediately. Anything else waits for a reset.
+ *
+ * @param[in]  Arena    The arena which owns the block.
+ * @param[in]  Pointer  The block to free. May be NULL.
+ */
+VOID
+EFIAPI
+ArenaFree(
+    IN ARENA    *Arena,
+    IN VOID     *Pointer    OPTIONAL
+);
+
+
+/**
+ * Free every block of an arena at once, keeping a single slab for reuse.
+ *
+ * @param[in]  Arena  The arena to reset.
+ */
+VOID
+EFIAPI
+ArenaReset(
+    IN ARENA    *Arena
+);
+
+
+/**
+ * Return all memory of an arena to the firmware. The arena may be used again
+ *  afterwards, in which case it reserves a new slab on demand.
+ *
+ * @param[in]  Arena  The arena to destroy.
+ */
+VOID
+EFIAPI
+ArenaDestroy(
+    IN ARENA    *Arena
+);
+
+
+
+#endif   /* MFTAH_ARENA_H */
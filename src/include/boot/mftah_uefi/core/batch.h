@@ -0,0 +1,103 @@
+/**
+ * Loading and decrypting a set of payloads which share one password.
+ *
+ * Payloads are read smallest-first. While the APs decrypt one payload, the BSP
+ *  reads the next one from the boot volume and starts its decryption too, so the
+ *  whole set takes about as long as its largest payload would on its own.
+ */
+
+#ifndef MFTAH_BATCH_H
+#define MFTAH_BATCH_H
+
+#include "core/mftah_uefi.h"
+
+
+/* How much of a payload is read each time the BSP is idle during decryption.
+    Smaller slices keep the decryption workers fed more evenly. */
+#ifndef MFTAH_BATCH_READ_SLICE_SIZE
+    #define MFTAH_BATCH_READ_SLICE_SIZE (4 << 20)
+#endif
+
+/* Each ramdisk is decrypted in place onto a boundary of this many bytes, and its pages
+    are reserved up to the next boundary after it, so the OS can map it with large pages.
+    Set to EFI_PAGE_SIZE to only page-align it and save up to this much memory per payload. */
+#ifndef MFTAH_RAMDISK_ALIGNMENT
+    #define MFTAH_RAMDISK_ALIGNMENT (2ULL << 20)
+#endif
+
+#if MFTAH_RAMDISK_ALIGNMENT < EFI_PAGE_SIZE || 0 != (MFTAH_RAMDISK_ALIGNMENT & (MFTAH_RAMDISK_ALIGNMENT - 1))
+    #error "MFTAH_RAMDISK_ALIGNMENT must be a power of two of at least EFI_PAGE_SIZE."
+#endif
+
+
+typedef
+enum {
+    BatchPayloadQueued = 0,
+    BatchPayloadReading,
+    BatchPayloadLoaded,
+    BatchPayloadDecrypting,
+    BatchPayloadDecrypted,
+    BatchPayloadFailed,
+} BATCH_PAYLOAD_STATE;
+
+/**
+ * One payload of a batch. Callers fill in 'Name' and 'FileHandle'; the rest is
+ *  filled in by LoadAndDecryptBatch.
+ */
+typedef
+struct {
+    CHAR16                  *Name;
+    EFI_FILE_PROTOCOL       *FileHandle;
+    BATCH_PAYLOAD_STATE     State;
+    EFI_STATUS              Status;
+    UINT64                  FileSize;
+    UINT64                  BytesRead;
+    UINT8                   *ReadBuffer;
+    EFI_PHYSICAL_ADDRESS    BufferBase;         /* The pages 'ReadBuffer' lies in. See BatchFreePayloadBuffer. */
+    UINTN                   BufferPages;
+    mftah_payload_t         *Payload;           /* Only set while the payload is being decrypted. */
+    UINT8                   PayloadHash[SIZE_OF_SHA_256_HASH];
+    UINT8                   *RamdiskImage;      /* The decrypted ramdisk, inside 'ReadBuffer'. */
+    UINT64                  RamdiskLength;
+} BATCH_PAYLOAD;
+
+
+
+/**
+ * Read, hash and decrypt every payload of a batch with the same password,
+ *  overlapping the reads of later payloads with the decryption of earlier ones.
+ *
+ * @param[in,out] Payloads        The payloads to load. Their file handles must be at position 0.
+ * @param[in]     Count           The number of payloads.
+ * @param[in]     Password        The (already checked) password shared by all payloads.
+ * @param[in]     PasswordLength  The length of the password.
+ *
+ * @retval EFI_SUCCESS           Every payload was decrypted; see each 'RamdiskImage'.
+ * @retval EFI_OUT_OF_RESOURCES  A payload buffer could not be allocated.
+ * @retval EFI_ABORTED           A payload was malformed or failed to decrypt.
+ * @retval Other                 Reading a payload failed.
+ */
+EFI_STATUS
+EFIAPI
+LoadAndDecryptBatch(
+    IN OUT BATCH_PAYLOAD    *Payloads,
+    IN UINTN                Count,
+    IN CONST UINT8          *Password,
+    IN CONST UINT8          PasswordLength
+);
+
+
+/**
+ * Release the pages holding a payload's buffer, and with it the ramdisk decrypted into it.
+ *
+ * @param[in,out] Payload  The payload. Its 'ReadBuffer' is cleared.
+ */
+VOID
+EFIAPI
+BatchFreePayloadBuffer(
+    IN OUT BATCH_PAYLOAD    *Payload
+);
+
+
+
+#endif   /* MFTAH_BATCH_H */
@@ -0,0 +1,68 @@
+/**
+ * The MFTAH boot information table, which describes the loaded ramdisks and
+ *  everything else the loader leaves behind in one place for the booted OS.
+ *
+ * See 'mftah_bootinfo.h' for the layout shared with the kernel.
+ */
+
+#ifndef MFTAH_BOOTINFO_H
+#define MFTAH_BOOTINFO_H
+
+#include "core/mftah_uefi.h"
+#include "core/batch.h"
+
+/* Shared with the kernel, so both sides agree on the table layout. */
+#include "../../../kernel/mftah_bootinfo.h"
+
+
+/* When set to 1, the '__MFTAH_RDBASE', '__MFTAH_RDSIZE' and hash hint EFI variables
+    are still set alongside the boot information table, for OSes which read those. */
+#ifndef MFTAH_LEGACY_EFI_HINTS
+    #define MFTAH_LEGACY_EFI_HINTS 1
+#endif
+
+
+extern EFI_GUID gMftahBootInfoGuid;
+
+
+/**
+ * Build the boot information table and install it as an EFI configuration table.
+ *  This must come after the decryption handoff was published, if there is one.
+ *
+ * @param[in]  Payloads          The loaded payloads. The first one is booted from.
+ * @param[in]  PayloadCount      The number of payloads.
+ * @param[in]  LoadedLoaderHash  The SHA-256 hash of this loader.
+ *
+ * @retval EFI_SUCCESS           The table was installed.
+ * @retval EFI_OUT_OF_RESOURCES  The table couldn't be allocated.
+ * @retval Other                 Installing the configuration table failed.
+ */
+EFI_STATUS
+EFIAPI
+BootInfoPublish(
+    IN BATCH_PAYLOAD    *Payloads,
+    IN UINTN            PayloadCount,
+    IN UINT8            *LoadedLoaderHash
+);
+
+
+/**
+ * Copy the final boot profile into the table. Call this after ProfilerPublish, right
+ *  before control leaves the loader. This never allocates, so it's safe to call
+ *  between taking the memory map and exiting boot services.
+ */
+VOID
+EFIAPI
+BootInfoFinalize(VOID);
+
+
+/**
+ * @returns The physical address of the installed table, or 0 if there is none.
+ */
+UINT64
+EFIAPI
+BootInfoTableAddress(VOID);
+
+
+
+#endif   /* MFTAH_BOOTINFO_H */
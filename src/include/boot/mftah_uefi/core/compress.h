@@ -0,0 +1,68 @@
+/**
+ * Block compression for the compressed ramdisk backing (see RAM_DISK_COMPRESS).
+ *
+ * Blocks are compressed in the LZ4 block format: a greedy single-probe match finder
+ *  over a hash table of 4-byte sequences, which trades some ratio for speed. Decoding
+ *  is a plain copy loop and checks every length against both buffers, so a damaged
+ *  block fails to decode instead of writing outside of its destination.
+ */
+
+#ifndef MFTAH_COMPRESS_H
+#define MFTAH_COMPRESS_H
+
+#include "core/mftah_uefi.h"
+
+
+/* The match finder's table holds this many positions. */
+#define COMPRESS_HASH_LOG       12
+#define COMPRESS_HASH_ENTRIES   (1 << COMPRESS_HASH_LOG)
+
+/* The largest block which can be compressed; matches reach back at most 64 KiB anyway. */
+#define COMPRESS_MAX_BLOCK_SIZE (1 << 24)
+
+
+/**
+ * Compress a block.
+ *
+ * @param[in]  Source          The data to compress.
+ * @param[in]  SourceLength    The length of the data. At most COMPRESS_MAX_BLOCK_SIZE.
+ * @param[out] Destination     Where the compressed block is written.
+ * @param[in]  DestinationSize The size of the destination. Compression stops as soon as it overflows.
+ * @param[in]  HashTable       Scratch space of COMPRESS_HASH_ENTRIES entries. Each processor needs its own.
+ *
+ * @returns The length of the compressed block, or 0 if it wouldn't fit into the destination.
+ */
+UINTN
+EFIAPI
+CompressBlock(
+    IN CONST UINT8  *Source,
+    IN UINTN        SourceLength,
+    OUT UINT8       *Destination,
+    IN UINTN        DestinationSize,
+    IN UINT32       *HashTable
+);
+
+
+/**
+ * Decompress a block. This uses no boot services and may run on any processor.
+ *
+ * @param[in]  Source             The compressed block.
+ * @param[in]  SourceLength       The length of the compressed block.
+ * @param[out] Destination        Where the data is written.
+ * @param[in]  DestinationLength  The exact length of the data the block holds.
+ *
+ * @retval EFI_SUCCESS           The block was decompressed.
+ * @retval EFI_VOLUME_CORRUPTED  The block is malformed or doesn't hold exactly DestinationLength bytes.
+ */
+EFI_STATUS
+EFIAPI
+DecompressBlock(
+    IN CONST UINT8  *Source,
+    IN UINTN        SourceLength,
+    OUT UINT8       *Destination,
+    IN UINTN        DestinationLength
+);
+
+
+
+#endif   /* MFTAH_COMPRESS_H */
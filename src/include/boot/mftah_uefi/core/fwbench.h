@@ -0,0 +1,96 @@
+/**
+ * An in-firmware benchmark of the loader's hot paths.
+ *
+ * Typing the hidden MFTAH_FIRMWARE_BENCHMARK_ENTRY at the payload selection prompt
+ *  (shown even for a single payload when a key is pressed while booting)
+ *  measures AES-CBC decryption, SHA-256 hashing and memory copies over a synthetic
+ *  buffer: first on the BSP alone, then split across 1..N APs through the threading
+ *  driver. The results are printed as a throughput and scaling table and saved in
+ *  the MFTAH_FIRMWARE_BENCHMARK_VARIABLE, so the real firmware and memory of a machine
+ *  can be characterized without booting anything.
+ */
+
+#ifndef MFTAH_FWBENCH_H
+#define MFTAH_FWBENCH_H
+
+#include "core/mftah_uefi.h"
+
+
+/* When set to 1, the benchmark can be started from the payload selection prompt. */
+#ifndef MFTAH_FIRMWARE_BENCHMARK
+    #define MFTAH_FIRMWARE_BENCHMARK 1
+#endif
+
+/* The size of the synthetic buffer each measurement works through. Must be a multiple
+    of AES_BLOCKLEN. Twice this much memory is allocated, for the copy destination. */
+#ifndef MFTAH_FIRMWARE_BENCHMARK_SIZE
+    #define MFTAH_FIRMWARE_BENCHMARK_SIZE (64ULL << 20)
+#endif
+
+/* How many empty AP dispatches are averaged to find the threading overhead. */
+#ifndef MFTAH_FIRMWARE_BENCHMARK_DISPATCHES
+    #define MFTAH_FIRMWARE_BENCHMARK_DISPATCHES 32
+#endif
+
+/* The selection which starts the benchmark. It is compared after upper-casing the input. */
+#define MFTAH_FIRMWARE_BENCHMARK_ENTRY      L"!BENCH"
+
+#define MFTAH_FIRMWARE_BENCHMARK_VARIABLE   L"__MFTAH_FW_BENCHMARK"
+
+#define MFTAH_FIRMWARE_BENCHMARK_SIGNATURE \
+    EFI_SIGNATURE_32 ('M', 'F', 'W', 'B')
+#define MFTAH_FIRMWARE_BENCHMARK_VERSION 1
+
+
+/* The measured operations. New ones may only be appended. */
+typedef
+enum {
+    FwBenchDecrypt = 0,
+    FwBenchHash,
+    FwBenchCopy,
+    FwBenchWorkloadMax
+} MFTAH_FWBENCH_WORKLOAD;
+
+
+/**
+ * One row of results: the whole buffer processed by a number of processors at once.
+ */
+typedef
+struct {
+    UINT32      Processors;     /* 0 for the BSP alone, otherwise how many APs shared the buffer. */
+    UINT32      Reserved;
+    UINT64      Ticks[FwBenchWorkloadMax];  /* TSC ticks per workload, including AP dispatch. */
+} __attribute__((packed)) MFTAH_FWBENCH_ROW;
+
+
+/**
+ * The record kept in the MFTAH_FIRMWARE_BENCHMARK_VARIABLE.
+ */
+typedef
+struct {
+    UINT32              Signature;
+    UINT32              Version;
+    UINT64              TscFrequency;       /* Ticks per second; 0 if calibration failed. */
+    UINT64              BufferSize;
+    UINT64              DispatchTicks;      /* The average round trip of an empty AP dispatch, or 0. */
+    UINT32              WorkloadCount;
+    UINT32              RowCount;
+    MFTAH_FWBENCH_ROW   Rows[MFTAH_MAX_THREAD_COUNT + 1];
+} __attribute__((packed)) MFTAH_FWBENCH_RECORD;
+
+
+/**
+ * Run the benchmark, print its results and save them in the benchmark variable.
+ *  Every processor is left idle again afterwards.
+ *
+ * @retval EFI_SUCCESS           The benchmark ran and its results were saved.
+ * @retval EFI_OUT_OF_RESOURCES  The synthetic buffers couldn't be allocated.
+ * @retval Other                 Setting the EFI variable failed.
+ */
+EFI_STATUS
+EFIAPI
+RunFirmwareBenchmark(VOID);
+
+
+
+#endif   /* MFTAH_FWBENCH_H */
@@ -0,0 +1,122 @@
+/**
+ * Early handoff of the boot payload's decryption to the kernel.
+ *
+ * Only the first MFTAH_EARLY_HANDOFF_PREFIX_SIZE bytes of the primary payload are
+ *  decrypted by the loader. The decryption work beyond that point is collected instead
+ *  of being run, then described to the kernel in a reserved-memory record (see
+ *  'mftah_handoff.h') so it can be finished once the kernel owns every CPU.
+ *
+ * Reads and writes through the ramdisk's BlockIo decrypt the chunks they touch on
+ *  demand, so the FAT metadata and the chainloaded EFI application may lie anywhere.
+ *  Whatever is read from memory directly -- the payload header, or the kernel of a
+ *  direct multiboot boot -- must still lie in the prefix. The MFTAH library must also
+ *  not check the plaintext of the whole payload after its work orders finish, since
+ *  most of it is still ciphertext at that point.
+ *
+ * With a hot profile (see 'hotprofile.h'), the chunks a previous boot touched are
+ *  decrypted right before the handoff, so the boot rarely waits on demand decryption.
+ */
+
+#ifndef MFTAH_HANDOFF_H
+#define MFTAH_HANDOFF_H
+
+#include "core/mftah_uefi.h"
+
+/* Shared with the kernel, so both sides agree on the record layout. */
+#include "../../../kernel/mftah_handoff.h"
+
+
+/* When set to 1, decryption of the primary payload beyond the prefix is left to the kernel. */
+#ifndef MFTAH_EARLY_HANDOFF
+    #define MFTAH_EARLY_HANDOFF 0
+#endif
+
+/* How much of the primary payload, from the start of its file, is decrypted by the loader. */
+#ifndef MFTAH_EARLY_HANDOFF_PREFIX_SIZE
+    #define MFTAH_EARLY_HANDOFF_PREFIX_SIZE (32ULL << 20)
+#endif
+
+
+/**
+ * Start deferring the decryption work of one payload beyond the prefix.
+ *
+ * @param[in]  Batch          The decryption batch (see SwitchDecryptionBatch) of the payload.
+ * @param[in]  PayloadBase    The loaded payload file.
+ * @param[in]  PayloadLength  The size of the loaded payload file.
+ */
+VOID
+EFIAPI
+HandoffArm(
+    IN UINTN    Batch,
+    IN UINT8    *PayloadBase,
+    IN UINT64   PayloadLength
+);
+
+
+/**
+ * Split off the part of a work order which lies beyond the prefix and keep it for the
+ *  kernel. This must be called before any of the work order is decrypted, because the
+ *  ciphertext right before the split point becomes the deferred part's IV.
+ *
+ * @param[in]  Batch                 The decryption batch the work order belongs to.
+ * @param[in]  WorkOrder             The work order from the MFTAH library.
+ * @param[in]  Sha256Key             The AES key of the work order.
+ * @param[in]  InitializationVector  The IV of the work order.
+ *
+ * @returns How many leading bytes of the work order the loader should still decrypt.
+ */
+UINT64
+EFIAPI
+HandoffDeferWork(
+    IN UINTN                        Batch,
+    IN CONST mftah_work_order_t     *WorkOrder,
+    IN immutable_ref_t              Sha256Key,
+    IN immutable_ref_t              InitializationVector
+);
+
+
+/**
+ * Build the handoff record for the deferred work and publish its address in the
+ *  '__MFTAH_HANDOFF' EFI variable. Does nothing if no work was deferred.
+ *
+ * @param[in]  RamdiskImage   The base of the (partially) decrypted ramdisk.
+ * @param[in]  RamdiskLength  The size of the ramdisk.
+ *
+ * @retval EFI_SUCCESS           The record was published, or there was nothing to hand off.
+ * @retval EFI_OUT_OF_RESOURCES  The record couldn't be allocated.
+ * @retval Other                 Setting the EFI variable failed.
+ */
+EFI_STATUS
+EFIAPI
+HandoffPublish(
+    IN UINT8    *RamdiskImage,
+    IN UINT64   RamdiskLength
+);
+
+
+/**
+ * Decrypt every chunk of the handoff record which overlaps a range of memory and isn't
+ *  plaintext yet, and mark it done for the kernel. Does nothing before the record is
+ *  published. This must only be called on the BSP.
+ *
+ * @param[in]  Address  The start of the range.
+ * @param[in]  Length   The length of the range.
+ */
+VOID
+EFIAPI
+HandoffFaultIn(
+    IN UINT64   Address,
+    IN UINT64   Length
+);
+
+
+/**
+ * @returns The physical address of the published handoff record, or 0 if there is none.
+ */
+UINT64
+EFIAPI
+HandoffRecordAddress(VOID);
+
+
+
+#endif   /* MFTAH_HANDOFF_H */
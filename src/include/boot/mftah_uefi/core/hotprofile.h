@@ -0,0 +1,166 @@
+/**
+ * Profile-guided decryption order for the early handoff.
+ *
+ * While a payload boots, the order in which its ramdisk is first touched through
+ *  BlockIo is recorded in units of MFTAH_HOT_PROFILE_UNIT_SIZE. Right before the
+ *  chainloaded image starts, the recording is saved next to the payloads as a
+ *  profile file (see 'HotProfileFileName'), unless it adds nothing to the profile
+ *  which was already there.
+ *
+ * On later boots, the early handoff (see 'handoff.h') decrypts the recorded hot
+ *  units first, in the recorded order and on every idle processor, and hands the
+ *  rest of the payload to the kernel. Boot latency then follows what the boot
+ *  actually reads instead of where its files happen to sit in the image.
+ *
+ * The live recording is also published in reserved memory as '__MFTAH_HOTPROFILE'.
+ *  It keeps filling until ExitBootServices, so an OS can write it (with 'RunsCrc32'
+ *  filled in) over the profile file to include the reads of the chainloaded image
+ *  too. A profile only applies to the payload it was recorded for; delete the file
+ *  to start over.
+ */
+
+#ifndef MFTAH_HOTPROFILE_H
+#define MFTAH_HOTPROFILE_H
+
+#include "core/mftah_uefi.h"
+#include "core/handoff.h"
+
+
+/* When set to 1, ramdisk accesses are profiled and steer the early handoff. */
+#ifndef MFTAH_HOT_PROFILE
+    #define MFTAH_HOT_PROFILE 0
+#endif
+
+#if MFTAH_HOT_PROFILE == 1 && MFTAH_EARLY_HANDOFF != 1
+    #error "The hot profile orders the early handoff; it needs MFTAH_EARLY_HANDOFF."
+#endif
+
+/* The granularity of the profile. Hot units are decrypted as whole handoff chunks anyway. */
+#define MFTAH_HOT_PROFILE_UNIT_SIZE     MFTAH_HANDOFF_CHUNK_SIZE
+
+/* The most runs of consecutive units one profile holds. Later accesses are dropped. */
+#ifndef MFTAH_HOT_PROFILE_MAX_RUNS
+    #define MFTAH_HOT_PROFILE_MAX_RUNS 1024
+#endif
+
+#define MFTAH_HOT_PROFILE_SIGNATURE \
+    EFI_SIGNATURE_32 ('M', 'H', 'O', 'T')
+#define MFTAH_HOT_PROFILE_VERSION 1
+
+
+/**
+ * Units 'FirstUnit' up to 'FirstUnit + UnitCount - 1' of the ramdisk, first touched in this order.
+ */
+typedef
+struct {
+    UINT32      FirstUnit;
+    UINT32      UnitCount;
+} __attribute__((packed)) MFTAH_HOT_PROFILE_RUN;
+
+/**
+ * A profile. The file holds this header and only the first 'RunCount' runs; the CRC32
+ *  covers those runs.
+ */
+typedef
+struct {
+    UINT32                  Signature;
+    UINT32                  Version;
+    UINT32                  UnitSize;
+    UINT32                  RunCount;
+    UINT64                  PayloadFileSize;
+    UINT8                   PayloadHash[SIZE_OF_SHA_256_HASH];     /* The payload the profile was recorded for. */
+    UINT32                  RunsCrc32;
+    UINT32                  Reserved;
+    MFTAH_HOT_PROFILE_RUN   Runs[MFTAH_HOT_PROFILE_MAX_RUNS];
+} __attribute__((packed)) MFTAH_HOT_PROFILE;
+
+#define MFTAH_HOT_PROFILE_HEADER_SIZE   __builtin_offsetof(MFTAH_HOT_PROFILE, Runs)
+
+
+/**
+ * Read the profile of a payload from the boot volume, if it has one. The payload
+ *  is also remembered for the recording of this boot.
+ *
+ * @param[in]  VolumeHandle     The root of the boot volume.
+ * @param[in]  PayloadHash      The hash of the whole payload file.
+ * @param[in]  PayloadFileSize  The size of the payload file.
+ *
+ * @retval EFI_SUCCESS           The profile was loaded.
+ * @retval EFI_NOT_FOUND         There is no profile, or it belongs to another payload.
+ * @retval EFI_VOLUME_CORRUPTED  The profile file is malformed.
+ * @retval EFI_OUT_OF_RESOURCES  The profile couldn't be allocated.
+ */
+EFI_STATUS
+EFIAPI
+HotProfileLoad(
+    IN EFI_FILE_PROTOCOL    *VolumeHandle,
+    IN CONST UINT8          *PayloadHash,
+    IN UINT64               PayloadFileSize
+);
+
+
+/**
+ * @param[out] RunCount  Set to the number of runs in the loaded profile.
+ *
+ * @returns The runs of the loaded profile in the order they were touched, or NULL without one.
+ */
+CONST MFTAH_HOT_PROFILE_RUN *
+EFIAPI
+HotProfileRuns(
+    OUT UINT32  *RunCount
+);
+
+
+/**
+ * Start recording the accesses to the boot ramdisk and publish the recording's
+ *  address in the '__MFTAH_HOTPROFILE' EFI variable.
+ *
+ * @param[in]  RamdiskImage   The base of the boot ramdisk.
+ * @param[in]  RamdiskLength  The size of the ramdisk.
+ *
+ * @retval EFI_SUCCESS           Accesses are being recorded.
+ * @retval EFI_OUT_OF_RESOURCES  The recording couldn't be allocated.
+ * @retval Other                 Setting the EFI variable failed. Accesses are still recorded.
+ */
+EFI_STATUS
+EFIAPI
+HotProfileStartRecording(
+    IN UINT8    *RamdiskImage,
+    IN UINT64   RamdiskLength
+);
+
+
+/**
+ * Record an access to memory. Accesses outside of the boot ramdisk are ignored.
+ *  This uses no boot services, but must only be called on the BSP.
+ *
+ * @param[in]  Address  The start of the accessed memory.
+ * @param[in]  Length   The length of the access.
+ */
+VOID
+EFIAPI
+HotProfileRecord(
+    IN UINT64   Address,
+    IN UINT64   Length
+);
+
+
+/**
+ * Save the recording as the profile of the boot payload. Units of the loaded profile
+ *  which weren't touched yet are kept after the recorded ones. Nothing is written
+ *  when the recording adds nothing to the loaded profile.
+ *
+ * @param[in]  VolumeHandle  The root of the boot volume.
+ *
+ * @retval EFI_SUCCESS  The profile was saved, or didn't change.
+ * @retval Other        Writing the profile file failed.
+ */
+EFI_STATUS
+EFIAPI
+HotProfileSave(
+    IN EFI_FILE_PROTOCOL    *VolumeHandle
+);
+
+
+
+#endif   /* MFTAH_HOTPROFILE_H */
@@ -0,0 +1,88 @@
+/**
+ * Memory-hard password hardening with Argon2id.
+ *
+ * When the boot volume's root holds a KDF parameter file (see 'PasswordKdfFileName'),
+ *  the typed password isn't given to MFTAH directly. It is first stretched with
+ *  Argon2id, and the tag is handed on as a password of lower-case hex digits, so
+ *  payloads are encrypted with the derived password instead (e.g. from the output
+ *  of 'argon2 <salt> -id -t <passes> -k <KiB> -p <lanes> -l 16 -r'). The parameter
+ *  file applies to every payload on the volume, since they all share one password.
+ *  Authenticated payloads (see 'aead.h') can't be loaded without it.
+ *
+ * The lanes of every slice are filled in parallel on the BSP and any idle APs, so
+ *  raising the lane count with the processor count keeps the unlock time fixed while
+ *  the memory cost grows. The memory cost is checked against the free memory in the
+ *  boot-time memory map before anything is allocated.
+ */
+
+#ifndef MFTAH_KDF_H
+#define MFTAH_KDF_H
+
+#include "core/mftah_uefi.h"
+#include "crypto/argon2.h"
+
+
+/* When set to 1, a KDF parameter file on the boot volume is honored. */
+#ifndef MFTAH_PASSWORD_KDF
+    #define MFTAH_PASSWORD_KDF 1
+#endif
+
+/* The largest share of the free conventional memory in the memory map, in percent,
+    which the KDF may use. Parameter files asking for more are refused. */
+#ifndef MFTAH_KDF_MAX_MEMORY_PERCENT
+    #define MFTAH_KDF_MAX_MEMORY_PERCENT 50
+#endif
+
+/* The derived password is this many bytes of tag, as twice as many hex digits. */
+#define MFTAH_KDF_TAG_LENGTH (MFTAH_MAX_PW_LEN / 2)
+
+#define MFTAH_KDF_SIGNATURE \
+    EFI_SIGNATURE_32 ('M', 'K', 'D', 'F')
+#define MFTAH_KDF_VERSION 1
+
+#define MFTAH_KDF_ALGORITHM_ARGON2ID    1
+
+#define MFTAH_KDF_MAX_SALT_LENGTH       64
+
+
+/**
+ * The KDF parameter file.
+ */
+typedef
+struct {
+    UINT32      Signature;
+    UINT32      Version;
+    UINT32      Algorithm;
+    UINT32      MemoryKiB;      /* The Argon2 memory cost 'm'. */
+    UINT32      Passes;         /* The Argon2 time cost 't'. */
+    UINT32      Lanes;          /* The Argon2 parallelism 'p'. */
+    UINT32      SaltLength;
+    UINT32      Reserved;
+    UINT8       Salt[MFTAH_KDF_MAX_SALT_LENGTH];
+} __attribute__((packed)) MFTAH_KDF_PARAMETERS;
+
+
+/**
+ * Replace a typed password with the one derived by the volume's KDF, if it has one.
+ *
+ * @param[in]     VolumeHandle    The root of the boot volume.
+ * @param[in,out] Password        The password as UCS-2, with room for MFTAH_MAX_PW_LEN characters.
+ * @param[in,out] PasswordLength  The length of the password, in bytes.
+ *
+ * @retval EFI_SUCCESS           The password was replaced by the derived one.
+ * @retval EFI_NOT_FOUND         The volume has no KDF parameter file; the password is unchanged.
+ * @retval EFI_UNSUPPORTED       The parameter file is malformed, names an unknown algorithm,
+ *                               or its parameters were rejected by Argon2id; the password is unchanged.
+ * @retval EFI_OUT_OF_RESOURCES  The memory cost is above what this machine allows.
+ */
+EFI_STATUS
+EFIAPI
+KdfDerivePassword(
+    IN EFI_FILE_PROTOCOL    *VolumeHandle,
+    IN OUT UINT8            *Password,
+    IN OUT UINT8            *PasswordLength
+);
+
+
+
+#endif   /* MFTAH_KDF_H */
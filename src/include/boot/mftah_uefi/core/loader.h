@@ -4,19 +4,90 @@
 #include "core/mftah_uefi.h"
 
 
+/* When set to 1, payload discovery first tries to read the payload catalog
+    (see 'PayloadCatalogFileName') before scanning the root directory. */
+#ifndef MFTAH_USE_PAYLOAD_CATALOG
+    #define MFTAH_USE_PAYLOAD_CATALOG 1
+#endif
+
+#define MFTAH_CATALOG_SIGNATURE \
+    EFI_SIGNATURE_32 ('M', 'C', 'A', 'T')
+#define MFTAH_CATALOG_VERSION 1
+
+/* How many payloads can be chosen together at the selection menu. All of them
+    are unlocked with the same password and each becomes its own ramdisk. */
+#ifndef MFTAH_MAX_SELECTED_PAYLOADS
+    #define MFTAH_MAX_SELECTED_PAYLOADS 4
+#endif
+
+/* The longest selection line accepted; names in it are separated by commas. */
+#define MFTAH_MAX_SELECTION_LENGTH 120
+
+/* The catalog can never describe more bytes of header than this. */
+#define MFTAH_CATALOG_MAX_DIGEST_LENGTH (1 << 16)
+
+/* How often a stale catalog entry may send the selection back to discovery. A stale
+    catalog is skipped by every later discovery, so a single rescan should suffice. */
+#define MFTAH_CATALOG_MAX_REDISCOVERIES 1
+
+
+/**
+ * One payload described by the catalog. Names are NUL-padded UCS-2.
+ */
+typedef
+struct {
+    CHAR16      Name[MFTAH_MAX_FILENAME_LENGTH + 1];
+    UINT16      Reserved;
+    UINT64      Size;           /* The size of the payload file, in bytes. */
+    UINT64      Offset;         /* Where the payload starts in its file. Must be 0 for now. */
+    UINT8       HeaderDigest[SIZE_OF_SHA_256_HASH];
+} __attribute__((packed)) MFTAH_CATALOG_ENTRY;
+
+/**
+ * The catalog file layout: this header, followed immediately by 'EntryCount' entries.
+ *  The CRC32 covers all entries.
+ */
+typedef
+struct {
+    UINT32      Signature;
+    UINT32      Version;
+    UINT32      EntryCount;
+    UINT32      DigestLength;   /* How many leading bytes of each payload the header digests cover. */
+    UINT32      EntriesCrc32;
+    UINT32      Reserved;
+} __attribute__((packed)) MFTAH_CATALOG_HEADER;
+
+
+/**
+ * A payload found on the boot volume. Payloads aren't opened until one is chosen.
+ */
+typedef
+struct {
+    CHAR16      Name[MFTAH_MAX_FILENAME_LENGTH + 1];
+    UINT64      Size;
+    UINT64      Offset;
+    BOOLEAN     FromCatalog;    /* The entry is unverified until opened by OpenDiscoveredPayload. */
+    UINT32      DigestLength;
+    UINT8       HeaderDigest[SIZE_OF_SHA_256_HASH];
+} DISCOVERED_PAYLOAD;
+
+
 
 /**
  * Discover the set of payloads located relative to the given
  *  Image Handle. This is usually from the UEFI entry point, and
  *  thus payloads are searched on the boot drive itself. All valid
- *  payloads are suffixed by the .GDEI blob extension.
- * 
+ *  payloads are suffixed by the .CROWS blob extension.
+ *
+ * A valid payload catalog in the volume root is used instead of
+ *  scanning the directory, unless it was found to be stale earlier.
+ *
  * @param[in]  BaseImageHandle      The relative image handle to use for discovery.
- * @param[out] LoadedPayloadHandles Returned pointer to an allocated array of open payload handles.
+ * @param[out] DiscoveredPayloads   Returned pointer to an allocated array of payload descriptors.
  *                                  NULL on error or EFI_NO_PAYLOAD_FOUND.
- * @param[out] LoadedHandlesCount   Returned handle count in the allocated pool. 0 on error or none.
+ * @param[out] DiscoveredCount      Returned descriptor count in the allocated pool. 0 on error or none.
  * @param[out] LoadedLoaderHash     An optional input buffer where the hash of the MFTAH loader is stored.
- * 
+ *
  * @retval EFI_NO_PAYLOAD_FOUND     There was no payload discovered. Error.
  * @retval EFI_SINGLE_PAYLOAD_FOUND There was only one payload discovered.
  * @retval EFI_MULTI_PAYLOAD_FOUND  Multiple payloads were found. Choose.
@@ -26,16 +97,48 @@ EFI_STATUS
 EFIAPI
 DiscoverPayloads(
     IN  EFI_HANDLE              BaseImageHandle,
-    OUT EFI_FILE_PROTOCOL       ***LoadedPayloadHandles,
-    OUT UINTN                   *LoadedHandlesCount,
+    OUT DISCOVERED_PAYLOAD      **DiscoveredPayloads,
+    OUT UINTN                   *DiscoveredCount,
     OUT UINT8                   *LoadedLoaderHash               OPTIONAL
 );
 
+
+/**
+ * Open a discovered payload from the boot volume. Catalog entries are checked
+ *  against the file's real size and header digest first; a mismatch marks the
+ *  whole catalog as stale so the next discovery falls back to a directory scan.
+ *
+ * @param[in]  Payload            The payload to open.
+ * @param[out] PayloadFileHandle  The opened file handle, positioned at the payload's start.
+ *
+ * @retval EFI_SUCCESS            The payload was opened.
+ * @retval EFI_VOLUME_CORRUPTED   The catalog entry doesn't match the file on disk, or the file is gone.
+ * @retval Other                  The file could not be opened or read.
+ */
+EFI_STATUS
+EFIAPI
+OpenDiscoveredPayload(
+    IN  CONST DISCOVERED_PAYLOAD    *Payload,
+    OUT EFI_FILE_PROTOCOL           **PayloadFileHandle
+);
+
+
+/**
+ * Discover the available payloads and have the user choose one or more of them.
+ *  When several payloads exist, the user may type a comma-separated list of
+ *  (partial) names. 'gOperatingPayload.Name' describes the whole selection.
+ *
+ * @param[out] PayloadFileHandles  Space for MFTAH_MAX_SELECTED_PAYLOADS opened file handles.
+ * @param[out] PayloadNames        Space for MFTAH_MAX_SELECTED_PAYLOADS allocated names.
+ * @param[out] SelectedCount       How many payloads were selected, in the order they were typed.
+ * @param[out] LoadedLoaderHash    An optional input buffer where the hash of the MFTAH loader is stored.
+ */
 VOID
 EFIAPI
-SelectPayload(
-    IN OUT EFI_FILE_PROTOCOL    **PayloadFileHandle,
-    OUT UINT64                  *PayloadFileStartingPosition,
+SelectPayloads(
+    OUT EFI_FILE_PROTOCOL       **PayloadFileHandles,
+    OUT CHAR16                  **PayloadNames,
+    OUT UINTN                   *SelectedCount,
     OUT UINT8                   *LoadedLoaderHash               OPTIONAL
 );
 
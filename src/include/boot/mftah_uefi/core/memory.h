@@ -0,0 +1,147 @@
+/**
+ * Vectorized memory primitives for the loader and the MFTAH hooks.
+ *
+ * SSE2 is always available on x86_64, so it is the baseline. AVX2 is used for
+ *  bulk work when the CPU reports it AND the executing core has the YMM state
+ *  enabled (UEFI firmware does not always set CR4.OSXSAVE/XCR0 on every core).
+ *  Mid-sized copies use 'rep movsb' on CPUs with Enhanced REP MOVSB (ERMS), and
+ *  very large copies bypass the cache with non-temporal stores.
+ */
+
+#ifndef MFTAH_MEMORY_H
+#define MFTAH_MEMORY_H
+
+#include "core/mftah_uefi.h"
+
+
+/* Non-overlapping copies and fills at or above this size use non-temporal stores.
+    These are for buffers which won't be read again soon, like a decrypted ramdisk. */
+#ifndef MFTAH_MEMORY_NT_THRESHOLD
+    #define MFTAH_MEMORY_NT_THRESHOLD (4ULL << 20)
+#endif
+
+/* Non-overlapping copies and fills at or above this size use 'rep movsb/stosb' on ERMS CPUs. */
+#ifndef MFTAH_MEMORY_ERMS_THRESHOLD
+    #define MFTAH_MEMORY_ERMS_THRESHOLD 2048
+#endif
+
+/* Set to 0 to never use AVX2, even when the CPU and firmware allow it. */
+#ifndef MFTAH_MEMORY_USE_AVX2
+    #define MFTAH_MEMORY_USE_AVX2 1
+#endif
+
+
+/**
+ * Detect which of the optional instruction set extensions can be used. Until this
+ *  is called, all primitives fall back to their SSE2 implementations.
+ */
+VOID
+EFIAPI
+MemoryInitialize(VOID);
+
+
+/**
+ * Check whether AVX2 can be used on the calling core. The firmware is responsible for
+ *  enabling the YMM state, and nothing guarantees it did so on the APs as well.
+ *
+ * @returns TRUE if 256-bit instructions can be executed right now.
+ */
+BOOLEAN
+EFIAPI
+MemoryAvx2Usable(VOID);
+
+
+/**
+ * Copy memory. Like the gnu-efi CopyMem, the regions may overlap.
+ *
+ * @param[out] Destination  Where to copy the data to.
+ * @param[in]  Source       Where to copy the data from.
+ * @param[in]  Length       The amount of bytes to copy.
+ *
+ * @returns The Destination pointer.
+ */
+VOID *
+EFIAPI
+FastCopyMem(
+    OUT VOID        *Destination,
+    IN CONST VOID   *Source,
+    IN UINTN        Length
+);
+
+
+/**
+ * Copy memory between regions which may overlap.
+ *
+ * @param[out] Destination  Where to copy the data to.
+ * @param[in]  Source       Where to copy the data from.
+ * @param[in]  Length       The amount of bytes to copy.
+ *
+ * @returns The Destination pointer.
+ */
+VOID *
+EFIAPI
+FastMoveMem(
+    OUT VOID        *Destination,
+    IN CONST VOID   *Source,
+    IN UINTN        Length
+);
+
+
+/**
+ * Fill memory with a byte value.
+ *
+ * @param[out] Destination  The memory to fill.
+ * @param[in]  Length       The amount of bytes to fill.
+ * @param[in]  Value        The byte value to fill with.
+ *
+ * @returns The Destination pointer.
+ */
+VOID *
+EFIAPI
+FastSetMem(
+    OUT VOID        *Destination,
+    IN UINTN        Length,
+    IN UINT8        Value
+);
+
+
+/**
+ * Compare two memory regions, stopping at the first difference. Never use this on
+ *  secrets: use ConstantTimeCompareMem instead.
+ *
+ * @param[in]  Left    The first region.
+ * @param[in]  Right   The second region.
+ * @param[in]  Length  The amount of bytes to compare.
+ *
+ * @returns 0 if the regions are equal, otherwise the difference of the first mismatched bytes.
+ */
+INTN
+EFIAPI
+FastCompareMem(
+    IN CONST VOID   *Left,
+    IN CONST VOID   *Right,
+    IN UINTN        Length
+);
+
+
+/**
+ * Compare two memory regions in time that only depends on Length. The result has
+ *  the same sign as a regular memcmp, so this can stand in for it anywhere.
+ *
+ * @param[in]  Left    The first region.
+ * @param[in]  Right   The second region.
+ * @param[in]  Length  The amount of bytes to compare.
+ *
+ * @returns 0 if the regions are equal, otherwise the difference of the first mismatched bytes.
+ */
+INTN
+EFIAPI
+ConstantTimeCompareMem(
+    IN CONST VOID   *Left,
+    IN CONST VOID   *Right,
+    IN UINTN        Length
+);
+
+
+
+#endif   /* MFTAH_MEMORY_H */
@@ -169,6 +169,15 @@ struct {
     UINT8 VOLATILE          SharedMutex;
 } __attribute__((packed)) PAYLOAD;
 
+/**
+ * An optional BSP-side callback run once a thread's completion event is signaled.
+ */
+typedef
+VOID
+(EFIAPI *MFTAH_THREAD_FINISH_HOOK)(
+    IN struct S_MFTAH_THREAD *Thread
+);
+
 /**
  * A meta-container for thread objects. These get dynamically assigned to available MPS when started.
  */
@@ -177,10 +186,12 @@ struct S_MFTAH_THREAD {
     UINTN VOLATILE          AssignedProcessorNumber;
     EFI_EVENT VOLATILE      CompletionEvent;
     BOOLEAN VOLATILE        Started;
+    BOOLEAN VOLATILE        Finishing;
     BOOLEAN VOLATILE        Finished;
     EFI_STATUS VOLATILE     ExitStatus;
     EFI_AP_PROCEDURE        Method;
     VOID VOLATILE *VOLATILE Context;
+    MFTAH_THREAD_FINISH_HOOK OnFinish;
 } MFTAH_THREAD;
 
 /**
@@ -189,6 +200,7 @@ struct S_MFTAH_THREAD {
 typedef
 struct {
     MFTAH_THREAD VOLATILE   *Thread;
+    UINTN                   Batch;          /* Which payload's decryption this worker belongs to. */
     UINT64                  CurrentPlace;
     mftah_work_order_t      *WorkOrder;
     mftah_progress_t        *Progress;
@@ -205,6 +217,15 @@ static const CHAR16 *CanaryFileName = L"CROWS.CANARY";
 /*   This must remain upper-cased. */
 static const CHAR16 *BootPayloadExtensionPattern = L".CROWS";
 
+/* An optional index of the payloads in the boot volume's root. See 'core/loader.h'. */
+static const CHAR16 *PayloadCatalogFileName = L"CROWS.CATALOG";
+
+/* Optional Argon2id parameters which all payloads' passwords are stretched with. See 'core/kdf.h'. */
+static const CHAR16 *PasswordKdfFileName = L"CROWS.KDF";
+
+/* The recorded order of ramdisk accesses, which the early handoff decrypts first. See 'core/hotprofile.h'. */
+static const CHAR16 *HotProfileFileName = L"CROWS.HOT";
+
 
 /* The Image Handle from EFI_MAIN, in case it's ever used in other modules. */
 extern EFI_HANDLE gImageHandle;
@@ -0,0 +1,101 @@
+/**
+ * Direct Multiboot2 handoff from the decrypted ramdisk.
+ *
+ * Rather than registering the ramdisk with the firmware and chainloading another
+ *  EFI application from it, the FAT filesystem inside the ramdisk is parsed in
+ *  memory, the kernel ELF is loaded from it, and control is passed to the kernel
+ *  with a Multiboot2 information block built by the loader.
+ */
+
+#ifndef MFTAH_MULTIBOOT_H
+#define MFTAH_MULTIBOOT_H
+
+#include "core/mftah_uefi.h"
+
+/* Shared with the kernel, so both sides agree on every tag layout. */
+#include "../../../kernel/multiboot.h"
+
+
+/* When set to 1, the loader tries to boot the ramdisk's kernel directly before
+    falling back to registering the ramdisk and chainloading its boot EFI. */
+#ifndef MFTAH_MULTIBOOT_DIRECT
+    #define MFTAH_MULTIBOOT_DIRECT 0
+#endif
+
+/* The path of the kernel in the ramdisk's FAT filesystem. Every component must
+    be a short (8.3) name; components are separated by backslashes. */
+#ifndef MFTAH_MULTIBOOT_KERNEL_PATH
+    #define MFTAH_MULTIBOOT_KERNEL_PATH "CROWS.ELF"
+#endif
+
+/* The command line handed to the kernel. */
+#ifndef MFTAH_MULTIBOOT_CMDLINE
+    #define MFTAH_MULTIBOOT_CMDLINE ""
+#endif
+
+#define MFTAH_MULTIBOOT_LOADER_NAME "MFTAH-UEFI"
+
+/* The size of the stack the kernel is entered with. */
+#ifndef MFTAH_MULTIBOOT_STACK_SIZE
+    #define MFTAH_MULTIBOOT_STACK_SIZE (64 << 10)
+#endif
+
+
+/**
+ * A FAT12/16/32 filesystem found inside the ramdisk image.
+ */
+typedef
+struct {
+    UINT8       *Base;              /* The first byte of the volume (its boot sector). */
+    UINT64      Length;             /* The size of the volume, clamped to the image. */
+    UINT8       FatType;            /* 12, 16 or 32. */
+    UINT32      BytesPerSector;
+    UINT32      BytesPerCluster;
+    UINT64      FatOffset;          /* The byte offset of the first FAT. */
+    UINT64      RootDirOffset;      /* FAT12/16: the byte offset of the fixed root directory. */
+    UINT32      RootDirEntries;     /* FAT12/16: the capacity of the fixed root directory. */
+    UINT32      RootCluster;        /* FAT32: the first cluster of the root directory. */
+    UINT64      DataOffset;         /* The byte offset of cluster 2. */
+    UINT32      ClusterCount;
+} MULTIBOOT_FAT_VOLUME;
+
+/**
+ * An open file in a MULTIBOOT_FAT_VOLUME. Reads walk the cluster chain
+ *  forward from the last visited cluster, so sequential reads stay linear.
+ */
+typedef
+struct {
+    MULTIBOOT_FAT_VOLUME    *Volume;
+    UINT32                  FirstCluster;
+    UINT32                  Size;
+    UINT32                  CursorIndex;    /* The index of 'CursorCluster' in the chain. */
+    UINT32                  CursorCluster;
+} MULTIBOOT_FAT_FILE;
+
+
+/**
+ * Boot the kernel inside a decrypted ramdisk image directly. This only returns
+ *  when the kernel couldn't be placed, in which case nothing has been handed
+ *  off, nothing was torn down and boot services are still available. Failures
+ *  after the loader starts tearing itself down don't return: they PANIC, or
+ *  halt once ExitBootServices was called.
+ *
+ * @param[in]  RamdiskImage   The base of the decrypted ramdisk.
+ * @param[in]  RamdiskLength  The size of the decrypted ramdisk.
+ *
+ * @retval EFI_NOT_FOUND         No FAT filesystem or kernel was found in the ramdisk.
+ * @retval EFI_LOAD_ERROR        The kernel isn't a loadable Multiboot2 ELF64 image.
+ * @retval EFI_UNSUPPORTED       The kernel requires information this loader can't provide.
+ * @retval EFI_OUT_OF_RESOURCES  The kernel's segments or the boot information couldn't be placed.
+ * @retval Other                 Reading the kernel or the memory map failed.
+ */
+EFI_STATUS
+EFIAPI
+MultibootBootRamdisk(
+    IN UINT8    *RamdiskImage,
+    IN UINT64   RamdiskLength
+);
+
+
+
+#endif   /* MFTAH_MULTIBOOT_H */
@@ -0,0 +1,165 @@
+/**
+ * A lightweight, TSC-based profiler for the phases of the MFTAH boot flow.
+ *
+ * The raw record is published as the '__MFTAH_BOOT_PROFILE' EFI variable right
+ *  before control is handed to the ramdisk, so the booted OS can log the breakdown.
+ */
+
+#ifndef MFTAH_PROFILER_H
+#define MFTAH_PROFILER_H
+
+#include "core/mftah_uefi.h"
+
+
+/* When set to 1, a summary of the boot phases is printed before chainloading.
+    Debug builds always print it. */
+#ifndef MFTAH_PRINT_PROFILE
+    #define MFTAH_PRINT_PROFILE 0
+#endif
+
+/* How long the TSC is measured against BS->Stall to find its frequency. */
+#ifndef MFTAH_PROFILE_CALIBRATION_US
+    #define MFTAH_PROFILE_CALIBRATION_US 10000
+#endif
+
+#define MFTAH_BOOT_PROFILE_SIGNATURE \
+    EFI_SIGNATURE_32 ('M', 'P', 'R', 'F')
+#define MFTAH_BOOT_PROFILE_VERSION 1
+
+
+/**
+ * The profiled phases of the boot flow. The numbering is part of the published
+ *  record, so new phases must only ever be appended.
+ */
+typedef
+enum {
+    ProfilePhaseEnvironment = 0,
+    ProfilePhaseDiscoverPayloads,
+    ProfilePhaseLoaderHash,         /* Nested in ProfilePhaseDiscoverPayloads. */
+    ProfilePhasePasswordEntry,      /* Time spent waiting on the user. */
+    ProfilePhaseCheckPassword,
+    ProfilePhaseReadPayload,
+    ProfilePhaseHashPayload,
+    ProfilePhaseDecrypt,
+    ProfilePhaseRegisterRamdisk,    /* Includes NFIT publishing. */
+    ProfilePhaseChainload,
+    ProfilePhasePasswordKdf,        /* Stretching the password, before ProfilePhaseCheckPassword. */
+    ProfilePhaseMax
+} MFTAH_PROFILE_PHASE;
+
+/**
+ * The accumulated measurements of one phase. A phase which runs more than once
+ *  (e.g. password retries) sums its ticks and bytes and counts its runs.
+ */
+typedef
+struct {
+    UINT64      FirstStart;     /* TSC value when the phase was first entered. */
+    UINT64      Ticks;          /* Total TSC ticks spent in the phase. */
+    UINT64      Bytes;          /* Total bytes processed by the phase, if applicable. */
+    UINT32      Count;          /* How many times the phase ran to completion. */
+    UINT32      Reserved;
+} __attribute__((packed)) MFTAH_PROFILE_PHASE_RECORD;
+
+/**
+ * The raw boot profile record, as published to the OS.
+ */
+typedef
+struct {
+    UINT32                      Signature;
+    UINT32                      Version;
+    UINT64                      TscFrequency;   /* Ticks per second; 0 if calibration failed. */
+    UINT64                      EntryTsc;       /* TSC value at loader entry. */
+    UINT64                      PublishTsc;     /* TSC value when this record was published. */
+    UINT32                      PhaseCount;
+    UINT32                      Reserved;
+    MFTAH_PROFILE_PHASE_RECORD  Phases[ProfilePhaseMax];
+} __attribute__((packed)) MFTAH_BOOT_PROFILE;
+
+
+/**
+ * Start the profiler: take the entry timestamp and calibrate the TSC.
+ *  This should be the very first thing the loader does.
+ */
+VOID
+EFIAPI
+ProfilerInitialize(VOID);
+
+
+/**
+ * Mark the start of a phase.
+ *
+ * @param[in]  Phase  The phase being entered.
+ */
+VOID
+EFIAPI
+ProfilerBegin(
+    IN MFTAH_PROFILE_PHASE Phase
+);
+
+
+/**
+ * Mark the end of a phase which was started with ProfilerBegin.
+ *
+ * @param[in]  Phase  The phase being left.
+ * @param[in]  Bytes  The amount of bytes the phase processed, or 0.
+ */
+VOID
+EFIAPI
+ProfilerEnd(
+    IN MFTAH_PROFILE_PHASE Phase,
+    IN UINT64 Bytes
+);
+
+
+/**
+ * Print a table of all recorded phases with their durations and throughput.
+ */
+VOID
+EFIAPI
+ProfilerPrintSummary(VOID);
+
+
+/**
+ * Publish the raw profile record as the '__MFTAH_BOOT_PROFILE' EFI variable.
+ *  When printing is enabled by MFTAH_PRINT_PROFILE or a debug build, the
+ *  summary is printed as well.
+ *
+ * @returns Whether the variable could be set.
+ */
+EFI_STATUS
+EFIAPI
+ProfilerPublish(VOID);
+
+
+/**
+ * @returns The raw profile record, as it would be published right now.
+ */
+CONST MFTAH_BOOT_PROFILE *
+EFIAPI
+ProfilerGetRecord(VOID);
+
+
+/**
+ * @returns The current value of the time-stamp counter the profiler measures with.
+ */
+UINT64
+EFIAPI
+ProfilerReadTicks(VOID);
+
+
+/**
+ * Convert a span of time-stamp counter ticks to microseconds.
+ *
+ * @param[in]  Ticks  The amount of ticks.
+ *
+ * @returns The duration in microseconds, or 0 if the counter couldn't be calibrated.
+ */
+UINT64
+EFIAPI
+ProfilerTicksToMicroseconds(
+    IN UINT64 Ticks
+);
+
+
+
+#endif   /* MFTAH_PROFILER_H */
@@ -0,0 +1,80 @@
+/**
+ * Progress display for long operations.
+ *
+ * Hot loops only record how far they got with ProgressUpdate, which is a pair of
+ *  stores. A periodic timer event on the BSP draws the progress at most every
+ *  MFTAH_PROGRESS_INTERVAL_MS, and only when it changed: as a bar in the GOP
+ *  framebuffer when there is one, otherwise as a line of ConOut text. A slow
+ *  (e.g. serial) console then costs the same no matter how fast the data moves.
+ */
+
+#ifndef MFTAH_PROGRESS_H
+#define MFTAH_PROGRESS_H
+
+#include "core/mftah_uefi.h"
+
+
+/* The shortest time between two redraws, in milliseconds. */
+#ifndef MFTAH_PROGRESS_INTERVAL_MS
+    #define MFTAH_PROGRESS_INTERVAL_MS 100
+#endif
+
+/* When set to 1, progress is drawn as a bar in the GOP framebuffer when one exists. */
+#ifndef MFTAH_PROGRESS_FRAMEBUFFER
+    #define MFTAH_PROGRESS_FRAMEBUFFER 1
+#endif
+
+/* The framebuffer bar's height and distance from the bottom of the screen, in pixels. */
+#define MFTAH_PROGRESS_BAR_HEIGHT   8
+#define MFTAH_PROGRESS_BAR_MARGIN   24
+
+/* How many characters wide the text bar is. */
+#define MFTAH_PROGRESS_TEXT_WIDTH   20
+
+
+/**
+ * Create the renderer's timer event and look for a framebuffer. Without this,
+ *  progress is still recorded but only drawn by ProgressEnd.
+ *
+ * @retval EFI_SUCCESS  The renderer is ready.
+ * @retval Other        The timer event couldn't be created.
+ */
+EFI_STATUS
+EFIAPI
+ProgressInitialize(VOID);
+
+
+/**
+ * Start showing the progress of a new operation. Any previous one is forgotten.
+ */
+VOID
+EFIAPI
+ProgressBegin(VOID);
+
+
+/**
+ * Record how far the current operation got. This never draws anything, so it is
+ *  cheap enough for any loop, and safe to call from APs.
+ *
+ * @param[in]  Current  The amount of work done.
+ * @param[in]  Total    The amount of work there is.
+ */
+VOID
+EFIAPI
+ProgressUpdate(
+    IN UINT64 Current,
+    IN UINT64 Total
+);
+
+
+/**
+ * Stop the periodic redraws and draw the last recorded progress once more, as text,
+ *  so the final state also reaches consoles which never saw the framebuffer bar.
+ */
+VOID
+EFIAPI
+ProgressEnd(VOID);
+
+
+
+#endif   /* MFTAH_PROGRESS_H */
@@ -10,9 +10,15 @@
 #define MIN(x,y) \
     (((x) <= (y)) ? (x) : (y))
 
+/* HashFile reads files in chunks of this size, into two page-aligned buffers. */
+#ifndef MFTAH_HASH_FILE_CHUNK_SIZE
+    #define MFTAH_HASH_FILE_CHUNK_SIZE (1 << 20)
+#endif
+
 
 /**
- * Print out a progress message. Updates the current cursor line.
+ * Record progress for the progress renderer (see 'core/progress.h'). Nothing is
+ *  drawn here, so this is cheap enough to call from any loop.
  * 
  * @param[in] CurrentValue    A pointer to the current value.
  * @param[in] OutOfValue      A pointer to the maximum value.
@@ -27,6 +33,21 @@ PrintProgress(
 );
 
 
+/**
+ * Called by UefiSpin on the BSP while decryption workers run, so the BSP can do other
+ *  useful work (like reading the next payload) instead of stalling.
+ *
+ * @param[in] Context  The context registered with SetDecryptionIdleHook.
+ *
+ * @returns TRUE if any work was done; the spin then skips its next stall.
+ */
+typedef
+BOOLEAN
+(EFIAPI *DECRYPT_IDLE_HOOK)(
+    IN VOID *Context
+);
+
+
 /**
  * Calculate the 8-bit checksum of a buffer.
  * 
@@ -116,6 +137,28 @@ FileSize(
 );
 
 
+/**
+ * Compute the SHA-256 hash of a whole file without holding all of it in memory.
+ *  While one chunk is hashed (on an idle AP, when there is one), the next chunk
+ *  is already being read into the other buffer.
+ *
+ * @param[in]   FileHandle    A valid file handle. It is left positioned at the end of the file.
+ * @param[out]  Hash          Set to the digest of the file.
+ * @param[out]  HashedLength  Set to how many bytes were hashed. Optional.
+ *
+ * @retval EFI_SUCCESS           The file was hashed.
+ * @retval EFI_OUT_OF_RESOURCES  The read buffers couldn't be allocated.
+ * @retval Other                 Reading the file failed; the hash isn't valid.
+ */
+EFI_STATUS
+EFIAPI
+HashFile(
+    IN EFI_FILE_PROTOCOL    *FileHandle,
+    OUT UINT8               *Hash,
+    OUT UINT64              *HashedLength   OPTIONAL
+);
+
+
 /**
  * Generic shutdown function. Panics if a shutdown could not be completed.
  * 
@@ -130,5 +173,43 @@ Shutdown(
 );
 
 
+/**
+ * Select which batch newly spawned decryption workers belong to. UefiSpin only waits
+ *  on the workers of the current batch, so several payloads can be decrypted at once.
+ *
+ * @param[in] Batch  The new batch number. Batch 0 is used when nothing else is set.
+ *
+ * @returns The previous batch number, to be restored when the caller is done.
+ */
+UINTN
+EFIAPI
+SwitchDecryptionBatch(
+    IN UINTN Batch
+);
+
+
+/**
+ * Register a hook to run while the BSP waits on decryption workers.
+ *
+ * @param[in] Hook     The hook to call, or NULL to stall between progress checks again.
+ * @param[in] Context  Passed through to the hook.
+ */
+VOID
+EFIAPI
+SetDecryptionIdleHook(
+    IN DECRYPT_IDLE_HOOK    Hook        OPTIONAL,
+    IN VOID                 *Context    OPTIONAL
+);
+
+
+/**
+ * Return the memory of every idle decryption thread slot to the firmware.
+ *  Worker contexts of those slots must not be used afterwards.
+ */
+VOID
+EFIAPI
+ReleaseDecryptionArenas(VOID);
+
+
 
 #endif   /* MFTAH_UTIL_H */
\ No newline at end of file
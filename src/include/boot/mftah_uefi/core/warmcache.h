@@ -0,0 +1,107 @@
+/**
+ * Keeping a decrypted ramdisk in memory across warm resets.
+ *
+ * After a full load, the location of the decrypted ramdisk is recorded in a
+ *  non-volatile EFI variable along with an HMAC over its contents, keyed by the
+ *  password. On the next boot, once the password is confirmed, the same physical
+ *  pages are claimed again and the tag is checked; if it matches, reading and
+ *  decrypting the payload is skipped entirely.
+ *
+ * This is meant for development and fast restarts only. Firmware is free to scrub
+ *  or reuse memory across a reset, in which case the tag won't match and the payload
+ *  is loaded normally. Any write into the ramdisk by the booted OS has the same effect,
+ *  unless the copy-on-write overlay is enabled (see RAM_DISK_COW_OVERLAY).
+ */
+
+#ifndef MFTAH_WARMCACHE_H
+#define MFTAH_WARMCACHE_H
+
+#include "core/mftah_uefi.h"
+#include "core/batch.h"
+#include "core/handoff.h"
+
+
+/* When set to 1, the booted ramdisk is kept for the next warm boot. */
+#ifndef MFTAH_WARM_CACHE
+    #define MFTAH_WARM_CACHE 0
+#endif
+
+/* The tag is an HMAC over the SHA-256 digests of leaves of this size, so the leaves
+    can be hashed on every available processor at once. */
+#ifndef MFTAH_WARM_CACHE_LEAF_SIZE
+    #define MFTAH_WARM_CACHE_LEAF_SIZE (16ULL << 20)
+#endif
+
+#if MFTAH_WARM_CACHE == 1 && MFTAH_EARLY_HANDOFF == 1
+    #error "The warm cache needs a fully-decrypted ramdisk; it can't be used with MFTAH_EARLY_HANDOFF."
+#endif
+
+#define MFTAH_WARM_CACHE_VARIABLE   L"__MFTAH_WARM_CACHE"
+
+#define MFTAH_WARM_CACHE_SIGNATURE \
+    EFI_SIGNATURE_32 ('M', 'W', 'R', 'M')
+#define MFTAH_WARM_CACHE_VERSION 1
+
+
+/**
+ * The record kept in the MFTAH_WARM_CACHE_VARIABLE. Everything but 'Tag' is covered by the tag.
+ */
+typedef
+struct {
+    UINT32      Signature;
+    UINT32      Version;
+    UINT64      RegionBase;         /* The reserved pages holding the ramdisk. */
+    UINT64      RegionPages;
+    UINT64      RamdiskBase;
+    UINT64      RamdiskLength;
+    UINT64      LeafSize;
+    UINT64      PayloadFileSize;
+    UINT8       PayloadHeaderHash[SIZE_OF_SHA_256_HASH];    /* Identifies the payload cheaply. */
+    UINT8       PayloadHash[SIZE_OF_SHA_256_HASH];          /* The full payload hash, for the OS hints. */
+    UINT8       Tag[SIZE_OF_SHA_256_HASH];
+} __attribute__((packed)) MFTAH_WARM_CACHE_RECORD;
+
+
+/**
+ * Try to reuse the ramdisk kept by a previous boot for a payload.
+ *
+ * @param[in,out] Payload         The selected payload. Its file handle must be at position 0,
+ *                                 and is left there.
+ * @param[in]     Password        The (already checked) password of the payload.
+ * @param[in]     PasswordLength  The length of the password.
+ *
+ * @retval EFI_SUCCESS       The kept ramdisk is intact; the payload is filled in as if decrypted.
+ * @retval EFI_NOT_FOUND     Nothing was kept for this payload.
+ * @retval EFI_NO_MEDIA      The kept pages aren't available to claim anymore.
+ * @retval EFI_CRC_ERROR     The kept ramdisk doesn't match its tag.
+ */
+EFI_STATUS
+EFIAPI
+WarmCacheRestore(
+    IN OUT BATCH_PAYLOAD    *Payload,
+    IN CONST UINT8          *Password,
+    IN CONST UINT8          PasswordLength
+);
+
+
+/**
+ * Record a freshly decrypted payload so the next warm boot can reuse it.
+ *
+ * @param[in]  Payload         The decrypted payload.
+ * @param[in]  Password        The password of the payload.
+ * @param[in]  PasswordLength  The length of the password.
+ *
+ * @retval EFI_SUCCESS  The record was saved.
+ * @retval Other        Reading the payload header or setting the EFI variable failed.
+ */
+EFI_STATUS
+EFIAPI
+WarmCacheStore(
+    IN CONST BATCH_PAYLOAD  *Payload,
+    IN CONST UINT8          *Password,
+    IN CONST UINT8          PasswordLength
+);
+
+
+
+#endif   /* MFTAH_WARMCACHE_H */
@@ -28,7 +28,8 @@
  *
  */
 
-/* NOTE: AES-256-CBC DECRYPT is explicitly used. Any other implementation is trimmed. */
+/* NOTE: AES-256-CBC DECRYPT is explicitly used, and the single-block ENCRYPT is kept for
+    the counter mode of authenticated payloads. Any other implementation is trimmed. */
 
 
 #ifndef AES_H
@@ -65,6 +66,16 @@ AES_ctx_set_iv(
 );
 
 
+/*
+ * Encrypt one AES_BLOCKLEN block in place with the expanded key. The IV is not used.
+ */
+void
+AES_ECB_encrypt(
+    const struct AES_ctx *ctx,
+    uint8_t              *buf
+);
+
+
 /*
  * The buffer size MUST be a mutiple of AES_BLOCKLEN.
  * NOTES:
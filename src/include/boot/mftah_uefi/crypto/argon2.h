@@ -0,0 +1,123 @@
+/*
+ * Argon2id (version 0x13), as specified in RFC 9106.
+ *
+ * The computation is split so that the caller controls the parallelism: after
+ *  argon2id_init, every pass is made of ARGON2_SYNC_POINTS slices, and within a
+ *  slice the segments of all lanes are independent and can be filled at once,
+ *  on different processors. All segments of a slice must be done before any
+ *  segment of the next slice starts. argon2_final then produces the tag.
+ */
+
+#ifndef ARGON2_H
+#define ARGON2_H
+
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+#define ARGON2_VERSION      0x13
+#define ARGON2_TYPE_ID      2
+
+#define ARGON2_BLOCK_SIZE   1024
+#define ARGON2_QWORDS_IN_BLOCK (ARGON2_BLOCK_SIZE / 8)
+#define ARGON2_SYNC_POINTS  4
+
+#define ARGON2_MIN_LANES    1
+#define ARGON2_MAX_LANES    0xFFFFFF
+#define ARGON2_MIN_TAG      4
+
+
+typedef struct {
+    uint64_t v[ARGON2_QWORDS_IN_BLOCK];
+} argon2_block;
+
+
+/*
+ * @brief The state of one Argon2id computation.
+ */
+struct Argon2 {
+    argon2_block *memory;
+    uint32_t     passes;
+    uint32_t     lanes;
+    uint32_t     memory_blocks;     /* m' in the RFC: the memory cost rounded down to 4 blocks per lane. */
+    uint32_t     lane_length;
+    uint32_t     segment_length;
+    uint32_t     tag_length;
+};
+
+
+/*
+ * @brief How many blocks of memory a computation will use.
+ * @param m_cost The memory cost, in KiB.
+ * @param lanes The degree of parallelism.
+ * @return The number of ARGON2_BLOCK_SIZE blocks to provide to argon2id_init, or 0 if the parameters are invalid.
+ */
+uint32_t
+argon2_memory_blocks(
+    uint32_t m_cost,
+    uint32_t lanes
+);
+
+
+/*
+ * @brief Start an Argon2id computation: derive H0 and fill the first two blocks of every lane.
+ * @param ctx The state to set up.
+ * @param memory At least 'argon2_memory_blocks' blocks of memory, 8-byte aligned.
+ * @param m_cost The memory cost, in KiB.
+ * @param t_cost The number of passes.
+ * @param lanes The degree of parallelism.
+ * @param tag_length The length of the tag to produce, in bytes.
+ * @param pwd The password. The key K and associated data X of the RFC are always empty.
+ * @param pwd_len The length of the password.
+ * @param salt The salt.
+ * @param salt_len The length of the salt; at least 8 bytes.
+ * @return 0 on success, -1 if a parameter is invalid.
+ */
+int
+argon2id_init(
+    struct Argon2 *ctx,
+    void *memory,
+    uint32_t m_cost,
+    uint32_t t_cost,
+    uint32_t lanes,
+    uint32_t tag_length,
+    const void *pwd,
+    size_t pwd_len,
+    const void *salt,
+    size_t salt_len
+);
+
+
+/*
+ * @brief Fill one segment. Uses no global state, so segments of the same slice may run concurrently.
+ * @param ctx The state from argon2id_init.
+ * @param pass The current pass, from 0 to t_cost - 1.
+ * @param slice The current slice, from 0 to ARGON2_SYNC_POINTS - 1.
+ * @param lane The lane whose segment to fill.
+ */
+void
+argon2_fill_segment(
+    const struct Argon2 *ctx,
+    uint32_t pass,
+    uint32_t slice,
+    uint32_t lane
+);
+
+
+/*
+ * @brief Produce the tag once every segment of every pass was filled.
+ * @param ctx The state of the finished computation.
+ * @param tag Where the 'tag_length' bytes of the tag are written.
+ */
+void
+argon2_final(
+    const struct Argon2 *ctx,
+    uint8_t *tag
+);
+
+
+
+#endif   /* ARGON2_H */
@@ -0,0 +1,89 @@
+/*
+ * BLAKE2b, as specified in RFC 7693. Only unkeyed hashing is implemented,
+ *  since it is only used as the hash function of Argon2 (see 'argon2.h').
+ */
+
+#ifndef BLAKE2B_H
+#define BLAKE2B_H
+
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+#define BLAKE2B_BLOCK_SIZE 128
+#define BLAKE2B_MAX_OUTPUT 64
+
+
+/*
+ * @brief The state of a streaming BLAKE2b calculation.
+ */
+struct Blake2b {
+    uint64_t h[8];
+    uint64_t t[2];
+    uint8_t  buffer[BLAKE2B_BLOCK_SIZE];
+    size_t   buffer_len;
+    size_t   out_len;
+};
+
+
+/*
+ * @brief Initialize a streaming BLAKE2b calculation.
+ * @param ctx A pointer to a BLAKE2b structure.
+ * @param out_len The length of the digest, from 1 to BLAKE2B_MAX_OUTPUT bytes.
+ * @return 0 on success, -1 if the digest length is out of range.
+ */
+int
+blake2b_init(
+    struct Blake2b *ctx,
+    size_t out_len
+);
+
+
+/*
+ * @brief Add more input to a streaming BLAKE2b calculation.
+ * @param ctx A pointer to a previously initialized BLAKE2b structure.
+ * @param data The data to add.
+ * @param len The length of the data, in bytes. May be 0.
+ */
+void
+blake2b_update(
+    struct Blake2b *ctx,
+    const void *data,
+    size_t len
+);
+
+
+/*
+ * @brief Finish a streaming BLAKE2b calculation. The structure must be initialized again before reuse.
+ * @param ctx A pointer to the BLAKE2b structure.
+ * @param out Where the 'out_len' bytes of the digest are written.
+ */
+void
+blake2b_final(
+    struct Blake2b *ctx,
+    uint8_t *out
+);
+
+
+/*
+ * @brief Compute a BLAKE2b digest of a contiguous buffer.
+ * @param out Where the digest is written.
+ * @param out_len The length of the digest, from 1 to BLAKE2B_MAX_OUTPUT bytes.
+ * @param data The data to hash.
+ * @param len The length of the data, in bytes.
+ * @return 0 on success, -1 if the digest length is out of range.
+ */
+int
+blake2b(
+    uint8_t *out,
+    size_t out_len,
+    const void *data,
+    size_t len
+);
+
+
+
+#endif   /* BLAKE2B_H */
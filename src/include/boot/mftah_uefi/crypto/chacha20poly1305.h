@@ -0,0 +1,111 @@
+/*
+ * ChaCha20-Poly1305, as specified in RFC 8439, with 96-bit nonces and 128-bit tags.
+ *
+ * Decryption authenticates and decrypts in a single pass: each chunk of keystream
+ *  blocks is computed eight at a time with AVX2 or four at a time with SSE2, and the
+ *  ciphertext under it is fed to Poly1305 just before it is replaced. A context is
+ *  read-only after chacha20_poly1305_init, so one key can serve many processors at
+ *  once, each with its own nonce.
+ */
+
+#ifndef CHACHA20POLY1305_H
+#define CHACHA20POLY1305_H
+
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+#define CHACHA20_KEY_LEN        32
+#define CHACHA20_NONCE_LEN      12
+#define CHACHA20_BLOCK_LEN      64
+#define POLY1305_TAG_LEN        16
+
+/* The widest keystream kernel a context may use. SSE2 is always there on x86_64. */
+#define CHACHA20_SIMD_SSE2      1
+#define CHACHA20_SIMD_AVX2      2
+
+
+/*
+ * @brief A ChaCha20-Poly1305 key.
+ */
+struct ChaCha20Poly1305 {
+    uint32_t key[8];
+    int      simd;
+};
+
+
+/*
+ * @brief The widest keystream kernel this processor supports.
+ * @return CHACHA20_SIMD_AVX2 or CHACHA20_SIMD_SSE2.
+ *
+ * @note The CPUID bits don't say whether the YMM state is enabled on every core. Callers
+ * running on cores other than the one which checked must lower 'simd' themselves if not.
+ */
+int
+chacha20_poly1305_simd_level(void);
+
+
+/*
+ * @brief Set up a key.
+ * @param ctx The context to set up.
+ * @param key The CHACHA20_KEY_LEN-byte key.
+ * @param simd The widest keystream kernel to use.
+ */
+void
+chacha20_poly1305_init(
+    struct ChaCha20Poly1305 *ctx,
+    const uint8_t           *key,
+    int                     simd
+);
+
+
+/*
+ * @brief Encrypt a buffer in place and produce its tag.
+ * @param ctx The key.
+ * @param nonce The CHACHA20_NONCE_LEN-byte nonce. It must never be reused with the same key.
+ * @param aad The additional authenticated data, or NULL if 'aad_len' is 0.
+ * @param aad_len The length of the additional authenticated data.
+ * @param buf The plaintext, replaced by the ciphertext.
+ * @param length The length of the buffer.
+ * @param tag Where the POLY1305_TAG_LEN-byte tag is written.
+ */
+void
+chacha20_poly1305_encrypt(
+    const struct ChaCha20Poly1305 *ctx,
+    const uint8_t                 *nonce,
+    const uint8_t                 *aad,
+    size_t                        aad_len,
+    uint8_t                       *buf,
+    size_t                        length,
+    uint8_t                       *tag
+);
+
+
+/*
+ * @brief Authenticate and decrypt a buffer in place, in one pass.
+ * @param ctx The key.
+ * @param nonce The CHACHA20_NONCE_LEN-byte nonce.
+ * @param aad The additional authenticated data, or NULL if 'aad_len' is 0.
+ * @param aad_len The length of the additional authenticated data.
+ * @param buf The ciphertext, replaced by the plaintext.
+ * @param length The length of the buffer.
+ * @param tag The expected POLY1305_TAG_LEN-byte tag.
+ * @return 0 if the tag matches. Otherwise -1, and the contents of 'buf' must not be used.
+ */
+int
+chacha20_poly1305_decrypt(
+    const struct ChaCha20Poly1305 *ctx,
+    const uint8_t                 *nonce,
+    const uint8_t                 *aad,
+    size_t                        aad_len,
+    uint8_t                       *buf,
+    size_t                        length,
+    const uint8_t                 *tag
+);
+
+
+
+#endif   /* CHACHA20POLY1305_H */
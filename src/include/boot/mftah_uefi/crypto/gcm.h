@@ -0,0 +1,107 @@
+/*
+ * AES-256-GCM, as specified in NIST SP 800-38D, with 96-bit IVs and 128-bit tags.
+ *
+ * Decryption authenticates and decrypts in a single pass over the buffer. When the
+ *  processor has AES-NI and PCLMULQDQ, the counter mode and GHASH run on them, four
+ *  blocks at a time; otherwise the portable AES and a 4-bit table GHASH are used.
+ *  A context is read-only after AES_GCM_init, so one key can serve many processors
+ *  at once, each with its own IV.
+ */
+
+#ifndef GCM_H
+#define GCM_H
+
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "crypto/aes.h"
+
+
+
+#define AES_GCM_IV_LEN  12
+#define AES_GCM_TAG_LEN 16
+
+
+/*
+ * @brief An AES-256-GCM key.
+ */
+struct AES_GCM_ctx {
+    struct AES_ctx aes;         /* Only the round keys are used. */
+    uint64_t       hh[16];      /* Multiples of H for the portable GHASH. */
+    uint64_t       hl[16];
+    uint8_t        hpow[4][16]; /* H to H^4, byte-reflected, for the PCLMULQDQ GHASH. */
+    int            accelerated;
+};
+
+
+/*
+ * @brief Whether this processor can run the AES-NI and PCLMULQDQ paths.
+ * @return 1 if it can, 0 otherwise.
+ */
+int
+AES_GCM_is_accelerated(void);
+
+
+/*
+ * @brief Expand a key and derive its hash subkey.
+ * @param ctx The context to set up.
+ * @param key The AES_KEYLEN-byte key.
+ * @param accelerated Nonzero to use the AES-NI and PCLMULQDQ paths. Only pass what AES_GCM_is_accelerated returned.
+ */
+void
+AES_GCM_init(
+    struct AES_GCM_ctx *ctx,
+    const uint8_t      *key,
+    int                accelerated
+);
+
+
+/*
+ * @brief Encrypt a buffer in place and produce its tag.
+ * @param ctx The key.
+ * @param iv The AES_GCM_IV_LEN-byte IV. It must never be reused with the same key.
+ * @param aad The additional authenticated data, or NULL if 'aad_len' is 0.
+ * @param aad_len The length of the additional authenticated data.
+ * @param buf The plaintext, replaced by the ciphertext.
+ * @param length The length of the buffer. It doesn't need to be a multiple of AES_BLOCKLEN.
+ * @param tag Where the AES_GCM_TAG_LEN-byte tag is written.
+ */
+void
+AES_GCM_encrypt(
+    const struct AES_GCM_ctx *ctx,
+    const uint8_t            *iv,
+    const uint8_t            *aad,
+    size_t                   aad_len,
+    uint8_t                  *buf,
+    size_t                   length,
+    uint8_t                  *tag
+);
+
+
+/*
+ * @brief Authenticate and decrypt a buffer in place, in one pass.
+ * @param ctx The key.
+ * @param iv The AES_GCM_IV_LEN-byte IV.
+ * @param aad The additional authenticated data, or NULL if 'aad_len' is 0.
+ * @param aad_len The length of the additional authenticated data.
+ * @param buf The ciphertext, replaced by the plaintext.
+ * @param length The length of the buffer.
+ * @param tag The expected AES_GCM_TAG_LEN-byte tag.
+ * @return 0 if the tag matches. Otherwise -1, and the contents of 'buf' must not be used.
+ */
+int
+AES_GCM_decrypt(
+    const struct AES_GCM_ctx *ctx,
+    const uint8_t            *iv,
+    const uint8_t            *aad,
+    size_t                   aad_len,
+    uint8_t                  *buf,
+    size_t                   length,
+    const uint8_t            *tag
+);
+
+
+
+#endif   /* GCM_H */
@@ -10,6 +10,8 @@
 
 #include "core/mftah_uefi.h"
 #include "core/util.h"
+#include "core/memory.h"
+#include "core/compress.h"
 #include "drivers/acpi.h"
 
 
@@ -19,6 +21,115 @@
 
 #define MEDIA_RAM_DISK_DP 0x09
 
+/* BlockIo2 requests at or above this size are handed to an idle AP when a token
+    event is given. Smaller copies finish faster than an AP can be dispatched. */
+#ifndef RAM_DISK_ASYNC_MIN_SIZE
+    #define RAM_DISK_ASYNC_MIN_SIZE (1 << 20)
+#endif
+
+/* How long (in microseconds) flushes and unregistration wait for APs to finish the
+    BlockIo2 transfers they were handed before giving up with an error. */
+#ifndef RAM_DISK_ASYNC_TIMEOUT
+    #define RAM_DISK_ASYNC_TIMEOUT (5 * 1000 * 1000)
+#endif
+
+/* When set to 1, registered ramdisks keep the loaded image pristine and redirect
+    all writes into a copy-on-write overlay which is tracked by a dirty bitmap. */
+#ifndef RAM_DISK_COW_OVERLAY
+    #define RAM_DISK_COW_OVERLAY 0
+#endif
+
+/* The granularity of the copy-on-write overlay. Must be a multiple of the block size. */
+#ifndef RAM_DISK_COW_CHUNK_SIZE
+    #define RAM_DISK_COW_CHUNK_SIZE 4096
+#endif
+
+/* The maximum amount of memory reserved for overlay chunks, per ramdisk. */
+#ifndef RAM_DISK_COW_POOL_SIZE
+    #define RAM_DISK_COW_POOL_SIZE (64ULL << 20)
+#endif
+
+/* When set to 1, identical blocks are stored only once across every registered
+    ramdisk. This takes precedence over the copy-on-write overlay. */
+#ifndef RAM_DISK_DEDUP
+    #define RAM_DISK_DEDUP 0
+#endif
+
+/* The content-addressed block size of the deduplicating store. */
+#ifndef RAM_DISK_DEDUP_BLOCK_SIZE
+    #define RAM_DISK_DEDUP_BLOCK_SIZE 4096
+#endif
+
+/* Unique blocks of later ramdisks are copied into slabs of this size. */
+#ifndef RAM_DISK_DEDUP_SLAB_SIZE
+    #define RAM_DISK_DEDUP_SLAB_SIZE (16ULL << 20)
+#endif
+
+/* When set to 1, registered ramdisks are held as compressed fixed-size blocks in a
+    reserved pool, with a small cache of decompressed blocks serving reads and writes.
+    The loaded image is no longer needed once registered. This can't be combined with
+    the dedup store, and takes precedence over the copy-on-write overlay. */
+#ifndef RAM_DISK_COMPRESS
+    #define RAM_DISK_COMPRESS 0
+#endif
+
+/* The size of each independently compressed block. Must be a multiple of the block size. */
+#ifndef RAM_DISK_COMPRESS_BLOCK_SIZE
+    #define RAM_DISK_COMPRESS_BLOCK_SIZE (64 << 10)
+#endif
+
+/* How many decompressed blocks each compressed ramdisk keeps cached. */
+#ifndef RAM_DISK_COMPRESS_CACHE_BLOCKS
+    #define RAM_DISK_COMPRESS_CACHE_BLOCKS 32
+#endif
+
+/* Compressed blocks are packed into slabs of this size. */
+#ifndef RAM_DISK_COMPRESS_SLAB_SIZE
+    #define RAM_DISK_COMPRESS_SLAB_SIZE (16ULL << 20)
+#endif
+
+/* When set to 1, every ramdisk counts its BlockIo traffic into a bucketed heat map
+    which is published to the OS (see '__MFTAH_RDSTATS'). */
+#ifndef RAM_DISK_STATS
+    #define RAM_DISK_STATS 1
+#endif
+
+/* The most regions the heat map splits a ramdisk into. Regions are a power-of-two
+    amount of blocks, so a ramdisk may use as few as half of these. */
+#ifndef RAM_DISK_STATS_REGIONS
+    #define RAM_DISK_STATS_REGIONS 1024
+#endif
+
+/* Request sizes are counted in power-of-two buckets of blocks; the last one takes the rest. */
+#define RAM_DISK_STATS_SIZE_BUCKETS 24
+
+/* The maximum amount of ramdisks which can be registered at the same time. */
+#ifndef RAM_DISK_MAX_INSTANCES
+    #define RAM_DISK_MAX_INSTANCES MFTAH_MAX_PAYLOADS
+#endif
+
+/* The maximum amount of ramdisks which can share the deduplicating store. */
+#define RAM_DISK_DEDUP_MAX_DISKS RAM_DISK_MAX_INSTANCES
+
+/* Marks the end of a hash bucket chain in the deduplicating store. */
+#define RAM_DISK_DEDUP_NONE 0xFFFFFFFF
+
+/* Marks a free entry of a compressed ramdisk's cache. */
+#define RAM_DISK_COMPRESS_NONE 0xFFFFFFFFFFFFFFFFULL
+
+#if RAM_DISK_DEDUP == 1 && RAM_DISK_COMPRESS == 1
+    #error "The dedup store references the first loaded image, which RAM_DISK_COMPRESS releases; enable only one of them."
+#endif
+
+/* Whether the loaded image of the Index-th registered ramdisk is released once it's
+    registered, because nothing references it anymore. See RamDiskRegister. */
+#define RAM_DISK_RELEASES_IMAGE(Index) \
+    (1 == RAM_DISK_COMPRESS || (1 == RAM_DISK_DEDUP && 0 != (Index)))
+
+#if RAM_DISK_COMPRESS_BLOCK_SIZE > COMPRESS_MAX_BLOCK_SIZE || (RAM_DISK_COMPRESS_BLOCK_SIZE % RAM_DISK_BLOCK_SIZE) != 0
+    #error "RAM_DISK_COMPRESS_BLOCK_SIZE must be a multiple of RAM_DISK_BLOCK_SIZE, up to COMPRESS_MAX_BLOCK_SIZE."
+#endif
+
 
 /* Taken from UEFI spec: https://uefi.org/specs/UEFI/2.10/13_Protocols_Media_Access.html#ram-disk-protocol */
 #define EFI_RAM_DISK_PROTOCOL_GUID \
@@ -45,6 +156,22 @@
 #define RAMDISK_PRIVATE_DATA_SIGNATURE \
     EFI_SIGNATURE_32 ('R', 'D', 'S', 'K')
 
+#define RAMDISK_OVERLAY_SIGNATURE \
+    EFI_SIGNATURE_32 ('R', 'D', 'C', 'W')
+#define RAMDISK_OVERLAY_VERSION 1
+
+#define RAMDISK_DEDUP_STORE_SIGNATURE \
+    EFI_SIGNATURE_32 ('R', 'D', 'D', 'P')
+#define RAMDISK_DEDUP_STORE_VERSION 1
+
+#define RAMDISK_COMPRESSED_STORE_SIGNATURE \
+    EFI_SIGNATURE_32 ('R', 'D', 'C', 'Z')
+#define RAMDISK_COMPRESSED_STORE_VERSION 1
+
+#define RAMDISK_STATS_SIGNATURE \
+    EFI_SIGNATURE_32 ('R', 'D', 'S', 'T')
+#define RAMDISK_STATS_VERSION 1
+
 #define RAM_DISK_PRIVATE_FROM_BLKIO(a) \
     CR(a, RAMDISK_PRIVATE_DATA, BlockIo, RAMDISK_PRIVATE_DATA_SIGNATURE)
 #define RAM_DISK_PRIVATE_FROM_BLKIO2(a) \
@@ -82,6 +209,165 @@ struct {
     UINT16 Instance;
 } __attribute__((packed)) MEDIA_RAMDISK_DEVICE_PATH;
 
+/**
+ * Copy-on-write overlay state of a ramdisk. This lives in reserved memory and is
+ *  published to the OS (see '__MFTAH_RDOVERLAY') so a snapshot can export only the
+ *  chunks which changed since boot. All addresses are physical.
+ *
+ * A chunk whose bit is set in DirtyBitmap is read from the overlay slot given by
+ *  ChunkMap[chunk]; all other chunks are still pristine in the loaded image.
+ */
+typedef
+struct {
+    UINT32                          Signature;
+    UINT32                          Version;
+    UINT64                          ImageBase;
+    UINT64                          ImageSize;
+    UINT32                          ChunkSize;
+    UINT32                          Reserved;
+    UINT64                          ChunkCount;
+    UINT64                          DirtyBitmap;
+    UINT64                          ChunkMap;
+    UINT64                          OverlayBase;
+    UINT64                          OverlayCapacity;
+    UINT64 VOLATILE                 OverlayUsed;
+} __attribute__((packed)) RAMDISK_OVERLAY;
+
+/**
+ * A single content-addressed block of the deduplicating store.
+ */
+typedef
+struct {
+    UINT64                          Hash;
+    UINT64                          Data;
+    UINT32                          RefCount;
+    UINT32                          Next;
+} __attribute__((packed)) RAMDISK_DEDUP_BLOCK;
+
+/**
+ * The per-ramdisk view of the deduplicating store: one block ID per disk block.
+ */
+typedef
+struct {
+    UINT64                          Size;
+    UINT64                          BlockCount;
+    UINT64                          BlockMap;
+} __attribute__((packed)) RAMDISK_DEDUP_DISK;
+
+/**
+ * The deduplicating block store shared by all registered ramdisks. This lives in
+ *  reserved memory and is published to the OS (see '__MFTAH_RDDEDUP'). A disk's
+ *  byte offset X lives at Blocks[BlockMap[X / BlockSize]].Data + (X % BlockSize).
+ *  Entries of Disks[] below DiskCount whose BlockMap is 0 are free, left behind by
+ *  unregistered ramdisks, and are reused by the next ramdisk registered. Likewise,
+ *  blocks below BlockCount whose RefCount is 0 are free, with a Data of 0, and are
+ *  reused (along with their slab memory) by the next blocks written or registered.
+ */
+typedef
+struct {
+    UINT32                          Signature;
+    UINT32                          Version;
+    UINT32                          BlockSize;
+    UINT32                          DiskCount;
+    UINT64                          BlockCount;
+    UINT64                          BlockCapacity;
+    UINT64                          Blocks;
+    UINT64                          BucketCount;
+    UINT64                          Buckets;
+    RAMDISK_DEDUP_DISK              Disks[RAM_DISK_DEDUP_MAX_DISKS];
+} __attribute__((packed)) RAMDISK_DEDUP_STORE;
+
+/**
+ * Where one block of a compressed ramdisk lives in its pool. A block of length 0
+ *  is all zeroes, and one whose length is the full block length is stored as-is.
+ */
+typedef
+struct {
+    UINT64                          Data;
+    UINT32                          Length;
+    UINT32                          Capacity;   /* A rewritten block stays in place while it fits. */
+} __attribute__((packed)) RAMDISK_COMPRESSED_BLOCK;
+
+/**
+ * A decompressed block in the cache of a compressed ramdisk. A dirty entry is newer
+ *  than the block's compressed copy, which is only brought up to date on eviction
+ *  or when the disk is flushed.
+ */
+typedef
+struct {
+    UINT64                          Block;      /* RAM_DISK_COMPRESS_NONE when the entry is free. */
+    UINT64                          Data;
+    UINT64                          LastUse;
+    UINT32                          Dirty;
+    UINT32                          Reserved;
+} __attribute__((packed)) RAMDISK_COMPRESSED_CACHE_ENTRY;
+
+/**
+ * The compressed store backing a ramdisk. This lives in reserved memory and is
+ *  published to the OS (see '__MFTAH_RDCOMPRESS'). A disk's byte offset X is in
+ *  block X / BlockSize: in the cache if an entry holds that block, otherwise in
+ *  Blocks[X / BlockSize], compressed in the LZ4 block format (see 'compress.h').
+ *
+ * Each pool slab starts with the address of the slab before it and its own size.
+ */
+typedef
+struct {
+    UINT32                          Signature;
+    UINT32                          Version;
+    UINT64                          Size;
+    UINT32                          BlockSize;
+    UINT32                          CacheCount;
+    UINT64                          BlockCount;
+    UINT64                          Blocks;
+    UINT64                          Cache;
+    UINT64                          Slabs;      /* The newest slab, which blocks are placed into. */
+    UINT64                          SlabSize;
+    UINT64                          SlabUsed;
+    UINT64                          PoolBytes;  /* The size of every slab, including space stranded by grown blocks. */
+    UINT64                          StoredBytes;    /* The total length of every compressed block. */
+    UINT64                          Tick;
+} __attribute__((packed)) RAMDISK_COMPRESSED_STORE;
+
+/**
+ * How many blocks were read from and written to one region of a ramdisk.
+ *  The counts stop at their maximum instead of wrapping.
+ */
+typedef
+struct {
+    UINT32                          BlocksRead;
+    UINT32                          BlocksWritten;
+} __attribute__((packed)) RAMDISK_STATS_REGION;
+
+/**
+ * The BlockIo traffic of a ramdisk since it was registered. This lives in reserved
+ *  memory and is published to the OS (see '__MFTAH_RDSTATS'), so it holds whatever
+ *  the chainloaded loaders did until ExitBootServices. Region 'r' covers the blocks
+ *  from 'r << RegionShift' up to the next region.
+ *
+ * ReadSizes[i] and WriteSizes[i] count requests of 2^i up to 2^(i+1) - 1 blocks.
+ */
+typedef
+struct {
+    UINT32                          Signature;
+    UINT32                          Version;
+    UINT64                          Size;
+    UINT32                          BlockSize;
+    UINT32                          RegionCount;
+    UINT32                          RegionShift;
+    UINT32                          Reserved;
+    UINT64                          ReadRequests;
+    UINT64                          WriteRequests;
+    UINT64                          FlushRequests;
+    UINT64                          AsyncRequests;      /* Reads and writes which were handed to an AP. */
+    UINT64                          SequentialReads;    /* Reads which started where the one before ended. */
+    UINT64                          NextReadLba;
+    UINT64                          BlocksRead;
+    UINT64                          BlocksWritten;
+    UINT64                          ReadSizes[RAM_DISK_STATS_SIZE_BUCKETS];
+    UINT64                          WriteSizes[RAM_DISK_STATS_SIZE_BUCKETS];
+    RAMDISK_STATS_REGION            Regions[RAM_DISK_STATS_REGIONS];
+} __attribute__((packed)) RAMDISK_STATS;
+
 typedef
 struct {
     UINTN                           Signature;
@@ -97,8 +383,39 @@ struct {
     UINT64                          Size;
     EFI_GUID                        TypeGuid;
     UINT16                          InstanceNumber;
+    BOOLEAN                         InNfit;
+
+    RAMDISK_OVERLAY                 *Overlay;
+    RAMDISK_DEDUP_DISK              *Dedup;
+    RAMDISK_COMPRESSED_STORE        *Compressed;
+    RAMDISK_STATS                   *Stats;
 } __attribute__((packed)) RAMDISK_PRIVATE_DATA;
 
+/**
+ * The BlockIo2 transfers of one ramdisk which APs are still copying. APs drop these
+ *  atomically, so they're kept naturally aligned outside of RAMDISK_PRIVATE_DATA.
+ */
+typedef
+struct {
+    UINTN VOLATILE                  Writes;
+    UINTN VOLATILE                  Requests;
+} RAMDISK_ASYNC_IN_FLIGHT;
+
+/**
+ * A BlockIo2 transfer which has been queued to run on an AP. The
+ *  copy itself happens on the AP; the token is completed on the BSP.
+ */
+typedef
+struct {
+    MFTAH_THREAD                    Thread;
+    RAMDISK_PRIVATE_DATA            *PrivateData;
+    EFI_BLOCK_IO2_TOKEN             *Token;
+    BOOLEAN                         IsWrite;
+    UINT64                          Offset;
+    VOID                            *Buffer;
+    UINTN                           Length;
+} RAMDISK_ASYNC_REQUEST;
+
 
 extern EFI_GUID gEfiRamdiskGuid;
 extern EFI_GUID gEfiRamdiskVirtualDiskGuid;
@@ -148,6 +465,18 @@ RDEntryPoint(
  *                            responsible for allocating the buffer DevicePath
  *                            with the boot service AllocatePool().
  *
+ * When RAM_DISK_DEDUP is enabled, the first registered ramdisk's memory seeds the
+ *  shared block store and must stay in place. Every later ramdisk has its unique
+ *  blocks copied into the store, so its source memory is no longer referenced once
+ *  this returns successfully and the caller may release it. Unregistering the first
+ *  ramdisk moves the blocks other ramdisks still share out of its memory.
+ *
+ * When RAM_DISK_COMPRESS is enabled, the ramdisk is compressed into its own store
+ *  here, and the caller may release its source memory once this returns successfully.
+ *
+ * Nothing of the RAM disk stays registered when an error is returned. If it fails
+ *  to publish after another driver already opened it, it stays and this succeeds.
+ *
  * @retval EFI_SUCCESS             The RAM disk is registered successfully.
  * @retval EFI_INVALID_PARAMETER   DevicePath or RamDiskType is NULL.
  *                                 RamDiskSize is 0.
@@ -169,7 +498,19 @@ RamDiskRegister(
 
 
 /**
- * This functionality is left incomplete because it's not currently used.
+ * Unregister a RAM disk specified by DevicePath. The ramdisk's protocols are
+ *  uninstalled from its handle, it is dropped from the NFIT, and all memory the
+ *  driver allocated for it is released. The ramdisk image memory itself still
+ *  belongs to the caller of RamDiskRegister.
+ *
+ * @param[in] DevicePath      A pointer to the device path that describes a RAM
+ *                            disk device.
+ *
+ * @retval EFI_SUCCESS             The RAM disk is unregistered successfully.
+ * @retval EFI_INVALID_PARAMETER   DevicePath is NULL.
+ * @retval EFI_NOT_FOUND           The given DevicePath is not a registered RAM disk.
+ * @retval EFI_TIMEOUT             APs were still copying to or from the RAM disk after
+ *                                 RAM_DISK_ASYNC_TIMEOUT. It stays registered.
  */
 EFI_STATUS
 EFIAPI
@@ -178,6 +519,34 @@ RamDiskUnregister(
 );
 
 
+/**
+ * Look up a registered ramdisk by its instance number.
+ *
+ * @param[in] Instance        The instance number from the ramdisk's device path node.
+ *
+ * @returns The ramdisk's private data, or NULL if no such ramdisk is registered.
+ */
+RAMDISK_PRIVATE_DATA *
+EFIAPI
+RamDiskFindByInstance(
+    IN UINT16 Instance
+);
+
+
+/**
+ * Look up a registered ramdisk by the device path which RamDiskRegister returned.
+ *
+ * @param[in] DevicePath      The full device path of the ramdisk.
+ *
+ * @returns The ramdisk's private data, or NULL if no such ramdisk is registered.
+ */
+RAMDISK_PRIVATE_DATA *
+EFIAPI
+RamDiskFindByDevicePath(
+    IN EFI_DEVICE_PATH_PROTOCOL *DevicePath
+);
+
+
 /**
  * Initialize the BlockIO protocol of a RAM disk device.
  *
@@ -5,6 +5,14 @@
 
 INTERFACE_DECL(S_MFTAH_THREAD);
 
+/* When set to 1, the loader starts the firmware's MP services at boot so that batchable
+    work (decryption, hashing, compression) is spread across the application processors.
+    Without it, every such path runs on the BSP alone. The AP paths have not been boot-tested
+    on real firmware yet, so they stay opt-in. */
+#ifndef MFTAH_THREADING
+    #define MFTAH_THREADING 0
+#endif
+
 /* Mutex operations for threading. */
 #define MUTEX_SYNC(x) \
     while (TRUE == (x)) { \
@@ -67,6 +75,15 @@ EFIAPI
 IsThreadingEnabled();
 
 
+/**
+ * Gets whether the caller runs on the BSP, which is the only processor allowed to use
+ *  boot services. This is always the case while threading is disabled.
+ */
+BOOLEAN
+EFIAPI
+IsRunningOnBsp();
+
+
 /**
  * Return the maximum amount of simultaneous threads runnable on the current host.
  */
@@ -97,6 +114,29 @@ CreateThread(
 );
 
 
+/**
+ * Same as CreateThread, but also registers a hook which is run on the BSP once the
+ *  thread's completion event is signaled by the MP services. Threads which complete
+ *  themselves manually from the AP side (i.e. FinishThread(NULL, ...)) never run it.
+ * 
+ * @param[in]       Method  The method to call when executing the thread.
+ * @param[in]       Context  The parameters structure to provide to the Method when called.
+ * @param[in]       OnFinish  The hook to call on the BSP when the thread completes.
+ * @param[in,out]   NewThread  Set to the newly allocated thread structure.
+ * 
+ * @retval  EFI_SUCCESS  The thread structure was initialized.
+ * @retval  EFI_INVALID_PARAMETER  The Method, Context, or NewThread pointer is NULL.
+ */
+EFI_STATUS
+EFIAPI
+CreateThreadEx(
+    IN EFI_AP_PROCEDURE         Method,
+    IN VOID                     *Context,
+    IN MFTAH_THREAD_FINISH_HOOK OnFinish    OPTIONAL,
+    IN OUT MFTAH_THREAD         *NewThread
+);
+
+
 /**
  * Dynamically assigns the thread to an available processor. This is a blocking
  *  call, and unavailability of system MPs will cause this method to wait until
@@ -120,6 +160,8 @@ StartThread(
 /**
  * Called by UEFI event services once a thread is finished executing and is signaled.
  *  This needs to be appropriately registered via the Boot Services CreateEvent hook for thread contexts.
+ *  Threads may also call it themselves from their AP, so it never blocks and only the first
+ *  of those calls completes the thread.
  * 
  * @param[in]  EventSource  The UEFI event causing the thread to finish.
  * @param[in]  Thread  The MFTAH_THREAD object to complete once the completion/finish event is signaled.
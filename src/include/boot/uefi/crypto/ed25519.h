@@ -0,0 +1,42 @@
+/*
+ * Ed25519 signature verification, as specified in RFC 8032. Only verification is
+ *  implemented; kernels are signed at compile-time by 'tools/mksig.py'.
+ *
+ * Verification runs in variable time, which is fine since everything it handles is
+ *  public. The fixed base point is added from a precomputed table of its odd
+ *  multiples, so only the public key's multiples are computed per verification.
+ */
+
+#ifndef CROWS_ED25519_H
+#define CROWS_ED25519_H
+
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+#define ED25519_PUBLIC_KEY_SIZE 32
+#define ED25519_SIGNATURE_SIZE  64
+
+
+/*
+ * @brief Verify an Ed25519 signature.
+ * @param signature The ED25519_SIGNATURE_SIZE bytes of the signature.
+ * @param message The signed message.
+ * @param message_len The length of the message, in bytes.
+ * @param public_key The ED25519_PUBLIC_KEY_SIZE bytes of the signer's public key.
+ * @return 0 if the signature is valid, -1 if it isn't or the key is malformed.
+ */
+int
+ed25519_verify(
+    const uint8_t *signature,
+    const uint8_t *message,
+    size_t message_len,
+    const uint8_t *public_key
+);
+
+
+
+#endif   /* CROWS_ED25519_H */
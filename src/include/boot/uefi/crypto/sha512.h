@@ -0,0 +1,83 @@
+/*
+ * SHA-512, as specified in FIPS 180-4. Used for the kernel image hash tree and
+ *  inside of Ed25519 (see 'ed25519.h').
+ */
+
+#ifndef CROWS_SHA512_H
+#define CROWS_SHA512_H
+
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+#define SHA512_BLOCK_SIZE  128
+#define SHA512_DIGEST_SIZE 64
+
+
+/*
+ * @brief The state of a streaming SHA-512 calculation.
+ */
+struct Sha512 {
+    uint64_t h[8];
+    uint64_t total_len;
+    uint8_t  buffer[SHA512_BLOCK_SIZE];
+    size_t   buffer_len;
+};
+
+
+/*
+ * @brief Initialize a streaming SHA-512 calculation.
+ * @param ctx A pointer to a SHA-512 structure.
+ */
+void
+sha512_init(
+    struct Sha512 *ctx
+);
+
+
+/*
+ * @brief Add more input to a streaming SHA-512 calculation. Whole blocks are hashed
+ *  straight from the input, so large updates cost no copies.
+ * @param ctx A pointer to a previously initialized SHA-512 structure.
+ * @param data The data to add.
+ * @param len The length of the data, in bytes. May be 0.
+ */
+void
+sha512_update(
+    struct Sha512 *ctx,
+    const void *data,
+    size_t len
+);
+
+
+/*
+ * @brief Finish a streaming SHA-512 calculation. The structure must be initialized again before reuse.
+ * @param ctx A pointer to the SHA-512 structure.
+ * @param out Where the SHA512_DIGEST_SIZE bytes of the digest are written.
+ */
+void
+sha512_final(
+    struct Sha512 *ctx,
+    uint8_t *out
+);
+
+
+/*
+ * @brief Compute the SHA-512 digest of a contiguous buffer.
+ * @param out Where the SHA512_DIGEST_SIZE bytes of the digest are written.
+ * @param data The data to hash.
+ * @param len The length of the data, in bytes.
+ */
+void
+sha512(
+    uint8_t *out,
+    const void *data,
+    size_t len
+);
+
+
+
+#endif   /* CROWS_SHA512_H */
@@ -0,0 +1,141 @@
+/**
+ * Kernel image signatures.
+ *
+ * The CrOwS kernel is signed at compile-time by 'tools/mksig.py'. The Ed25519 signature
+ *  doesn't cover the image directly, but the root of a two-level SHA-512 hash tree over
+ *  it. The image is cut into chunks of 'ChunkSize' bytes and each chunk is hashed on its
+ *  own, so a large kernel is hashed on every processor at once:
+ *
+ *    Leaf[i] = SHA-512( 0x00 || Chunk[i] )
+ *    Root    = SHA-512( 0x01 || LE64(ImageSize) || LE32(ChunkSize) || Leaf[0] || ... || Leaf[n-1] )
+ *
+ * A kernel no larger than one chunk is a tree with a single leaf. The signature is
+ *  stored in a small file next to the kernel (see 'CROWS_KERNEL_SIGNATURE'). The public
+ *  key is never read from the boot volume: it is compiled into the shim as the
+ *  'CrowsKernelPublicKey' array of the generated 'kernelkey.h'.
+ */
+
+#ifndef CROWS_KERNELSIG_H
+#define CROWS_KERNELSIG_H
+
+#include "uefi.h"
+#include "crypto/ed25519.h"
+#include "crypto/sha512.h"
+
+
+/* Where the kernel and its signature are found on the boot volume. */
+#ifndef CROWS_KERNEL_IMAGE_PATH
+    #define CROWS_KERNEL_IMAGE_PATH         L"\\CROWS\\KERNEL"
+#endif
+
+#ifndef CROWS_KERNEL_SIGNATURE_PATH
+    #define CROWS_KERNEL_SIGNATURE_PATH     L"\\CROWS\\KERNEL.SIG"
+#endif
+
+/* Limits on the chunk size a signature may declare. Smaller chunks spread better over the
+    processors, but every chunk adds a leaf to the root hash. */
+#define CROWS_KERNEL_SIG_MIN_CHUNK_SIZE     (64 << 10)
+#define CROWS_KERNEL_SIG_MAX_CHUNK_SIZE     (1 << 30)
+
+/* When set to 1, the shim times the kernel check before booting and prints the results. */
+#ifndef CROWS_SHIM_BENCH
+    #define CROWS_SHIM_BENCH 0
+#endif
+
+#ifndef CROWS_SHIM_BENCH_ROUNDS
+    #define CROWS_SHIM_BENCH_ROUNDS 16
+#endif
+
+#define CROWS_KERNEL_SIGNATURE_SIGNATURE \
+    EFI_SIGNATURE_32 ('K', 'S', 'I', 'G')
+#define CROWS_KERNEL_SIGNATURE_VERSION 1
+
+
+/**
+ * The signature file of a kernel image.
+ */
+typedef
+struct {
+    UINT32  Signature;
+    UINT32  Version;
+    UINT64  ImageSize;
+    UINT32  ChunkSize;
+    UINT32  Reserved;
+    UINT8   RootSignature[ED25519_SIGNATURE_SIZE];     /* Ed25519, over the 64-byte root hash. */
+} __attribute__((packed)) CROWS_KERNEL_SIGNATURE;
+
+
+/**
+ * Compute the root of the hash tree over an image. Chunks are hashed on every
+ *  processor which the firmware's MP services can start, the BSP included.
+ *
+ * @param[in]  Image      The image.
+ * @param[in]  ImageSize  The length of the image.
+ * @param[in]  ChunkSize  The size of each leaf's chunk.
+ * @param[in]  Parallel   Whether the APs may help. Only the benchmark turns this off.
+ * @param[out] Root       Where the SHA512_DIGEST_SIZE bytes of the root hash are written.
+ *
+ * @retval EFI_SUCCESS            The root hash was computed.
+ * @retval EFI_INVALID_PARAMETER  The chunk size is out of range.
+ * @retval EFI_OUT_OF_RESOURCES   The leaves couldn't be allocated.
+ */
+EFI_STATUS
+EFIAPI
+KernelSigHashTree(
+    IN CONST UINT8  *Image,
+    IN UINT64       ImageSize,
+    IN UINT32       ChunkSize,
+    IN BOOLEAN      Parallel,
+    OUT UINT8       *Root
+);
+
+
+/**
+ * Check a kernel image against its signature.
+ *
+ * @param[in]  Image          The kernel image.
+ * @param[in]  ImageSize      The length of the image.
+ * @param[in]  Signature      The contents of the signature file.
+ * @param[in]  SignatureSize  The length of the signature file.
+ * @param[in]  PublicKey      The ED25519_PUBLIC_KEY_SIZE bytes of the signing key.
+ *
+ * @retval EFI_SUCCESS             The image is signed by the key.
+ * @retval EFI_SECURITY_VIOLATION  The image or its signature was tampered with, or the key is wrong.
+ * @retval EFI_VOLUME_CORRUPTED    The signature file is malformed or belongs to an image of another size.
+ * @retval EFI_OUT_OF_RESOURCES    The hash tree couldn't be computed.
+ */
+EFI_STATUS
+EFIAPI
+KernelSigVerify(
+    IN CONST UINT8                      *Image,
+    IN UINT64                           ImageSize,
+    IN CONST CROWS_KERNEL_SIGNATURE     *Signature,
+    IN UINTN                            SignatureSize,
+    IN CONST UINT8                      *PublicKey
+);
+
+
+#if CROWS_SHIM_BENCH == 1
+/**
+ * Time the hash tree, with and without the APs, and the Ed25519 check over
+ *  CROWS_SHIM_BENCH_ROUNDS rounds each, and print the results. The image must
+ *  have passed KernelSigVerify already.
+ *
+ * @param[in]  Image      The kernel image.
+ * @param[in]  ImageSize  The length of the image.
+ * @param[in]  Signature  The verified signature of the image.
+ * @param[in]  PublicKey  The signing key.
+ */
+VOID
+EFIAPI
+KernelSigBenchmark(
+    IN CONST UINT8                      *Image,
+    IN UINT64                           ImageSize,
+    IN CONST CROWS_KERNEL_SIGNATURE     *Signature,
+    IN CONST UINT8                      *PublicKey
+);
+#endif
+
+
+
+#endif   /* CROWS_KERNELSIG_H */
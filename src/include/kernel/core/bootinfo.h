@@ -0,0 +1,27 @@
+#ifndef CROWS_BOOTINFO_H
+#define CROWS_BOOTINFO_H
+
+#include "multiboot.h"
+#include "mftah_bootinfo.h"
+
+
+
+/* Find the MFTAH boot information table through its Multiboot2 tag. Returns NULL
+    if there is none, or if it isn't a valid table this kernel understands. */
+const mftah_bootinfo_header *
+bootinfo_find(
+    multiboot_info_header *info
+);
+
+/* Get the next entry of a type after 'after', or the first one if 'after' is NULL.
+    Returns NULL once there are no more. */
+const mftah_bootinfo_entry *
+bootinfo_next(
+    const mftah_bootinfo_header *table,
+    const mftah_bootinfo_entry *after,
+    uint32_t type
+);
+
+
+
+#endif   /* CROWS_BOOTINFO_H */
@@ -0,0 +1,45 @@
+#ifndef CROWS_HANDOFF_H
+#define CROWS_HANDOFF_H
+
+#include "multiboot.h"
+#include "mftah_handoff.h"
+
+
+
+/* Find the early decryption handoff record passed on the kernel command line.
+    Returns NULL if there is none, or if it isn't a record this kernel understands. */
+mftah_handoff_record *
+handoff_find(
+    multiboot_info_header *info
+);
+
+/* Take the payload key out of the record and wipe every copy the loader left behind.
+    This must run once, on one CPU, before any CPU calls 'handoff_work'. */
+int
+handoff_begin(
+    mftah_handoff_record *record
+);
+
+/* Claim and decrypt chunks until none are left unclaimed. Any number of CPUs may call
+    this at the same time; each chunk is decrypted exactly once. Returns the number of
+    chunks decrypted by the calling CPU. */
+int
+handoff_work(
+    mftah_handoff_record *record
+);
+
+/* Whether every chunk of the record has been decrypted. */
+int
+handoff_complete(
+    mftah_handoff_record *record
+);
+
+/* Wipe the kernel's copy of the payload key. Only call this once the record is complete. */
+void
+handoff_end(
+    mftah_handoff_record *record
+);
+
+
+
+#endif   /* CROWS_HANDOFF_H */
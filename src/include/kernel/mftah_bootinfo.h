@@ -0,0 +1,112 @@
+#ifndef MFTAH_BOOTINFO_TABLE_H
+#define MFTAH_BOOTINFO_TABLE_H
+
+/* The MFTAH boot information table. MFTAH-UEFI describes everything it leaves behind
+    for the OS in this one table: the ramdisks, their hashes, the decryption handoff,
+    the boot profile and the memory it reserved. It is installed as an EFI configuration
+    table, and a Multiboot2 kernel also receives its address in a dedicated info tag,
+    so it can be read without any firmware calls.
+
+   The table starts with a header, followed by entries which each start with a type and
+    a size. Entries are padded to 8 bytes; the size excludes the padding. Readers must
+    skip entry types they don't know. All bytes of the table (up to 'total_size') sum to 0. */
+
+#include <stdint.h>
+
+
+
+#define MFTAH_BOOTINFO_SIGNATURE        0x4942464D      /* "MFBI" */
+#define MFTAH_BOOTINFO_VERSION          1
+
+/* {92794063-c834-47d5-b83a-3eaba1979ec3}, the vendor GUID of the EFI configuration table. */
+#define MFTAH_BOOTINFO_GUID \
+    { 0x92794063, 0xc834, 0x47d5, \
+    { 0xb8, 0x3a, 0x3e, 0xab, 0xa1, 0x97, 0x9e, 0xc3 }}
+
+/* The Multiboot2 info tag type carrying the physical address of the table. */
+#define MFTAH_BOOTINFO_MULTIBOOT_TAG    MFTAH_BOOTINFO_SIGNATURE
+
+#define MFTAH_BOOTINFO_ALIGN(x) \
+    (((x) + 7) & ~((uint64_t)7))
+
+
+typedef
+enum {
+    MFTAH_BOOTINFO_END              = 0,
+    MFTAH_BOOTINFO_RAMDISK,             /* mftah_bootinfo_ramdisk */
+    MFTAH_BOOTINFO_LOADER_HASH,         /* mftah_bootinfo_hash */
+    MFTAH_BOOTINFO_BOOT_PROFILE,        /* The raw MFTAH_BOOT_PROFILE record of the loader's profiler. */
+    MFTAH_BOOTINFO_HANDOFF,             /* mftah_bootinfo_pointer to an mftah_handoff_record. */
+    MFTAH_BOOTINFO_RESERVATION,         /* mftah_bootinfo_reservation */
+} mftah_bootinfo_entry_type;
+
+typedef
+enum {
+    MFTAH_RESERVATION_RAMDISK       = 1,    /* A payload buffer, which holds a ramdisk. */
+    MFTAH_RESERVATION_HANDOFF,              /* The decryption handoff record and its key page. */
+    MFTAH_RESERVATION_BOOTINFO,             /* This table. */
+} mftah_bootinfo_reservation_kind;
+
+#define MFTAH_BOOTINFO_RAMDISK_BOOT     (1 << 0)    /* The ramdisk the OS was booted from. */
+#define MFTAH_BOOTINFO_RAMDISK_PARTIAL  (1 << 1)    /* Part of it still awaits decryption (see the handoff). */
+#define MFTAH_BOOTINFO_RAMDISK_COMPRESSED (1 << 2)  /* 'base' was released; read it through '__MFTAH_RDCOMPRESS'. */
+#define MFTAH_BOOTINFO_RAMDISK_ALIGNED  (1 << 3)    /* 'base' is 2 MiB aligned and its pages are reserved up to the next
+                                                        2 MiB boundary after 'length', so it maps with large pages. */
+#define MFTAH_BOOTINFO_RAMDISK_DEDUP    (1 << 4)    /* 'base' was released; read it through '__MFTAH_RDDEDUP'. */
+
+
+#pragma pack(push, 1)
+typedef
+struct {
+    uint32_t    signature;
+    uint32_t    version;
+    uint32_t    header_size;
+    uint32_t    total_size;
+    uint32_t    entry_count;
+    uint8_t     checksum;
+    uint8_t     reserved[3];
+} mftah_bootinfo_header;
+
+typedef
+struct {
+    uint32_t    type;
+    uint32_t    size;       /* Including this header. */
+} mftah_bootinfo_entry;
+
+typedef
+struct {
+    mftah_bootinfo_entry    header;
+    uint32_t                index;      /* The order the payload was selected in. */
+    uint32_t                flags;
+    uint64_t                base;
+    uint64_t                length;
+    uint8_t                 payload_hash[32];   /* SHA-256 of the encrypted payload file. For an
+                                                    authenticated payload, only of its header and
+                                                    tag table, which commit to the whole file. */
+} mftah_bootinfo_ramdisk;
+
+typedef
+struct {
+    mftah_bootinfo_entry    header;
+    uint8_t                 hash[32];
+} mftah_bootinfo_hash;
+
+typedef
+struct {
+    mftah_bootinfo_entry    header;
+    uint64_t                address;
+} mftah_bootinfo_pointer;
+
+typedef
+struct {
+    mftah_bootinfo_entry    header;
+    uint64_t                base;
+    uint64_t                length;
+    uint32_t                kind;
+    uint32_t                reserved;
+} mftah_bootinfo_reservation;
+#pragma pack(pop)
+
+
+
+#endif   /* MFTAH_BOOTINFO_TABLE_H */
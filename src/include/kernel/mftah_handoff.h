@@ -0,0 +1,66 @@
+#ifndef MFTAH_HANDOFF_RECORD_H
+#define MFTAH_HANDOFF_RECORD_H
+
+/* The early decryption handoff record. MFTAH-UEFI decrypts only the start of the
+    boot payload, enough to start the kernel, and describes the rest with this record
+    in reserved memory. The kernel then finishes decryption on its own CPUs.
+
+   The record is shared verbatim between the loader and the kernel, so it only uses
+    fixed-width types. It is laid out as:
+        [header][chunk table][claimed bitmap][done bitmap]
+    with every offset relative to the start of the record. */
+
+#include <stdint.h>
+
+
+
+#define MFTAH_HANDOFF_SIGNATURE         0x46444F48      /* "HODF" */
+#define MFTAH_HANDOFF_VERSION           1
+
+/* The unit of work claimed by one CPU at a time. Every chunk is a whole number of AES blocks. */
+#define MFTAH_HANDOFF_CHUNK_SIZE        (1 << 20)
+
+#define MFTAH_HANDOFF_KEY_LENGTH        32
+#define MFTAH_HANDOFF_IV_LENGTH         16
+
+/* The kernel command line parameter carrying the physical address of the record. */
+#define MFTAH_HANDOFF_CMDLINE_PARAM     "mftah.handoff="
+
+
+#pragma pack(push, 1)
+/* A run of AES-256-CBC ciphertext which is decrypted in place. Chunks are independent
+    of each other: 'iv' is the ciphertext block which preceded the chunk originally. */
+typedef
+struct {
+    uint64_t    base;
+    uint64_t    length;
+    uint8_t     iv[MFTAH_HANDOFF_IV_LENGTH];
+} mftah_handoff_chunk;
+
+typedef
+struct {
+    uint32_t    signature;
+    uint32_t    version;
+    uint64_t    record_size;
+    uint64_t    ramdisk_base;
+    uint64_t    ramdisk_length;
+    uint64_t    chunk_count;
+    uint64_t    chunk_table_offset;
+    uint64_t    claimed_bitmap_offset;     /* A bit is set once a CPU owns the chunk. */
+    uint64_t    done_bitmap_offset;        /* A bit is set once the chunk is plaintext. */
+    uint64_t    chunks_done;
+    /* The AES key XORed with the key-encryption key stored at 'kek_address'. Both
+        are wiped by the kernel once it holds the key. This only keeps the key out of
+        the record itself; it is not a protection against code running on the machine. */
+    uint64_t    kek_address;
+    uint8_t     wrapped_key[MFTAH_HANDOFF_KEY_LENGTH];
+} mftah_handoff_record;
+#pragma pack(pop)
+
+
+#define MFTAH_HANDOFF_BITMAP_SIZE(chunk_count) \
+    ((((chunk_count) + 63) / 64) * sizeof(uint64_t))
+
+
+
+#endif   /* MFTAH_HANDOFF_RECORD_H */
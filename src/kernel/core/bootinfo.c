@@ -0,0 +1,56 @@
+#include "core/bootinfo.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+const mftah_bootinfo_header *
+bootinfo_find(multiboot_info_header *info)
+{
+    multiboot_info_tag_pointer_64 *tag = (multiboot_info_tag_pointer_64 *)
+        multiboot2_seek_tag((multiboot_info_tag_type)MFTAH_BOOTINFO_MULTIBOOT_TAG, info);
+    if (NULL == tag) return NULL;
+
+    const mftah_bootinfo_header *table = (const mftah_bootinfo_header *)tag->physical_address;
+    if (
+        NULL == table
+        || MFTAH_BOOTINFO_SIGNATURE != table->signature
+        || MFTAH_BOOTINFO_VERSION != table->version
+        || table->header_size < sizeof(mftah_bootinfo_header)
+        || table->total_size < table->header_size
+    ) {
+        return NULL;
+    }
+
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < table->total_size; ++i) sum += ((const uint8_t *)table)[i];
+    if (0 != sum) return NULL;
+
+    return table;
+}
+
+
+const mftah_bootinfo_entry *
+bootinfo_next(const mftah_bootinfo_header *table,
+              const mftah_bootinfo_entry *after,
+              uint32_t type)
+{
+    const uint8_t *end = (const uint8_t *)table + table->total_size;
+    const uint8_t *p = (NULL == after)
+        ? ((const uint8_t *)table + table->header_size)
+        : ((const uint8_t *)after + MFTAH_BOOTINFO_ALIGN(after->size));
+
+    while ((p + sizeof(mftah_bootinfo_entry)) <= end) {
+        const mftah_bootinfo_entry *entry = (const mftah_bootinfo_entry *)p;
+
+        /* A malformed size would otherwise loop forever or run off the table. */
+        if (MFTAH_BOOTINFO_END == entry->type || entry->size < sizeof(mftah_bootinfo_entry)) return NULL;
+        if ((p + entry->size) > end) return NULL;
+
+        if (type == entry->type) return entry;
+        p += MFTAH_BOOTINFO_ALIGN(entry->size);
+    }
+
+    return NULL;
+}
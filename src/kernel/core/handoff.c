@@ -0,0 +1,213 @@
+#include "core/handoff.h"
+#include "core/bootinfo.h"
+#include "crypto/aes.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+/* The payload key, expanded once and shared read-only by every CPU doing handoff work. */
+static struct AES_ctx handoff_key_ctx;
+static volatile int handoff_key_ready = 0;
+
+
+/* Wiping through a volatile pointer keeps the compiler from dropping the stores. */
+static
+void
+handoff_wipe(void *buffer,
+             uint64_t length)
+{
+    volatile uint8_t *p = (volatile uint8_t *)buffer;
+    for (uint64_t i = 0; i < length; ++i) p[i] = 0x00;
+}
+
+
+/* Structures are copied byte by byte: an assignment lowers to a call to 'memcpy', which the kernel doesn't have. */
+static
+void
+handoff_copy(void *destination,
+             const void *source,
+             uint64_t length)
+{
+    volatile uint8_t *d = (volatile uint8_t *)destination;
+    const uint8_t *s = (const uint8_t *)source;
+    for (uint64_t i = 0; i < length; ++i) d[i] = s[i];
+}
+
+
+static
+mftah_handoff_chunk *
+handoff_chunks(mftah_handoff_record *record)
+{
+    return (mftah_handoff_chunk *)((uint8_t *)record + record->chunk_table_offset);
+}
+
+
+static
+uint64_t *
+handoff_bitmap(mftah_handoff_record *record,
+               uint64_t offset)
+{
+    return (uint64_t *)((uint8_t *)record + offset);
+}
+
+
+/* Find the next chunk nobody owns yet and take it. Returns -1 once every chunk is owned. */
+static
+int64_t
+handoff_claim(mftah_handoff_record *record)
+{
+    uint64_t *claimed = handoff_bitmap(record, record->claimed_bitmap_offset);
+
+    for (uint64_t i = 0; i < record->chunk_count; ++i) {
+        uint64_t bit = (1ULL << (i % 64));
+
+        /* A plain load first keeps CPUs from bouncing the line on chunks already taken. */
+        if (__atomic_load_n(&claimed[i / 64], __ATOMIC_RELAXED) & bit) continue;
+
+        if (0 == (__atomic_fetch_or(&claimed[i / 64], bit, __ATOMIC_ACQ_REL) & bit)) {
+            return (int64_t)i;
+        }
+    }
+
+    return -1;
+}
+
+
+static
+mftah_handoff_record *
+handoff_validate(uint64_t address)
+{
+    mftah_handoff_record *record = (mftah_handoff_record *)address;
+
+    if (
+        NULL == record
+        || MFTAH_HANDOFF_SIGNATURE != record->signature
+        || MFTAH_HANDOFF_VERSION != record->version
+    ) {
+        return NULL;
+    }
+
+    return record;
+}
+
+
+mftah_handoff_record *
+handoff_find(multiboot_info_header *info)
+{
+    static const char param[] = MFTAH_HANDOFF_CMDLINE_PARAM;
+
+    /* The boot information table is preferred; the command line works without it. */
+    const mftah_bootinfo_header *bootinfo = bootinfo_find(info);
+    if (NULL != bootinfo) {
+        const mftah_bootinfo_pointer *entry = (const mftah_bootinfo_pointer *)
+            bootinfo_next(bootinfo, NULL, MFTAH_BOOTINFO_HANDOFF);
+        if (NULL != entry && entry->header.size >= sizeof(mftah_bootinfo_pointer)) {
+            return handoff_validate(entry->address);
+        }
+    }
+
+    multiboot_info_tag_cmdline *cmdline = (multiboot_info_tag_cmdline *)
+        multiboot2_seek_tag(MBI_CMD_LINE, info);
+    if (NULL == cmdline) return NULL;
+
+    const char *s = (const char *)cmdline->command_line_string_data;
+    const char *end = (const char *)cmdline + cmdline->header.size;
+
+    for (; s < end && *s; ++s) {
+        /* Parameters start at the beginning of the line or after a space. */
+        if (s != (const char *)cmdline->command_line_string_data && ' ' != *(s - 1)) continue;
+
+        int i = 0;
+        for (; param[i] && (s + i) < end && s[i] == param[i]; ++i);
+        if (param[i]) continue;
+
+        s += i;
+        if ((s + 2) > end || '0' != s[0] || ('x' != s[1] && 'X' != s[1])) return NULL;
+        s += 2;
+
+        uint64_t address = 0;
+        for (; s < end && *s && ' ' != *s; ++s) {
+            char c = *s;
+            if (c >= '0' && c <= '9') address = (address << 4) | (uint64_t)(c - '0');
+            else if (c >= 'a' && c <= 'f') address = (address << 4) | (uint64_t)(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') address = (address << 4) | (uint64_t)(c - 'A' + 10);
+            else return NULL;
+        }
+
+        return handoff_validate(address);
+    }
+
+    return NULL;
+}
+
+
+int
+handoff_begin(mftah_handoff_record *record)
+{
+    uint8_t key[MFTAH_HANDOFF_KEY_LENGTH];
+    uint8_t zero_iv[MFTAH_HANDOFF_IV_LENGTH] = {0};
+    uint8_t *kek;
+
+    if (NULL == record || 0 == record->kek_address) return -1;
+    kek = (uint8_t *)record->kek_address;
+
+    for (int i = 0; i < MFTAH_HANDOFF_KEY_LENGTH; ++i) {
+        key[i] = record->wrapped_key[i] ^ kek[i];
+    }
+
+    /* Nothing but the expanded key below should hold key material from here on. */
+    handoff_wipe(kek, MFTAH_HANDOFF_KEY_LENGTH);
+    handoff_wipe(record->wrapped_key, MFTAH_HANDOFF_KEY_LENGTH);
+    record->kek_address = 0;
+
+    AES_init_ctx_iv(&handoff_key_ctx, key, zero_iv);
+    handoff_wipe(key, MFTAH_HANDOFF_KEY_LENGTH);
+
+    __atomic_store_n(&handoff_key_ready, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+int
+handoff_work(mftah_handoff_record *record)
+{
+    mftah_handoff_chunk *chunks = handoff_chunks(record);
+    uint64_t *done = handoff_bitmap(record, record->done_bitmap_offset);
+    struct AES_ctx ctx;
+    int decrypted = 0;
+    int64_t i;
+
+    if (!__atomic_load_n(&handoff_key_ready, __ATOMIC_ACQUIRE)) return 0;
+
+    while ((i = handoff_claim(record)) >= 0) {
+        handoff_copy(&ctx, &handoff_key_ctx, sizeof(struct AES_ctx));
+        AES_ctx_set_iv(&ctx, chunks[i].iv);
+        AES_CBC_decrypt_buffer(&ctx, (uint8_t *)chunks[i].base, chunks[i].length, NULL, NULL);
+
+        __atomic_fetch_or(&done[i / 64], (1ULL << (i % 64)), __ATOMIC_RELEASE);
+        __atomic_add_fetch(&record->chunks_done, 1, __ATOMIC_RELEASE);
+        ++decrypted;
+    }
+
+    handoff_wipe(&ctx, sizeof(struct AES_ctx));
+    return decrypted;
+}
+
+
+int
+handoff_complete(mftah_handoff_record *record)
+{
+    return __atomic_load_n(&record->chunks_done, __ATOMIC_ACQUIRE) == record->chunk_count;
+}
+
+
+void
+handoff_end(mftah_handoff_record *record)
+{
+    (void)record;
+
+    __atomic_store_n(&handoff_key_ready, 0, __ATOMIC_RELEASE);
+    handoff_wipe(&handoff_key_ctx, sizeof(struct AES_ctx));
+}
@@ -1,5 +1,7 @@
 #include "core/port_io.h"
 #include "core/str.h"
+#include "core/handoff.h"
+#include "core/bootinfo.h"
 
 #include "drivers/uart.h"
 
@@ -204,5 +206,46 @@ kinit(struct crows_context *kernel_ctx,
         for (unsigned long long i = 0; i < kernel_ctx->kmem_len; ++i) into[i] = 0x00;
     }
 
+    /* Everything MFTAH-UEFI left behind for the kernel is described by one table. */
+    const mftah_bootinfo_header *bootinfo = bootinfo_find(info_tag);
+    if (NULL != bootinfo) {
+        for (
+            const mftah_bootinfo_entry *entry = bootinfo_next(bootinfo, NULL, MFTAH_BOOTINFO_RAMDISK);
+            NULL != entry;
+            entry = bootinfo_next(bootinfo, entry, MFTAH_BOOTINFO_RAMDISK)
+        ) {
+            const mftah_bootinfo_ramdisk *ramdisk = (const mftah_bootinfo_ramdisk *)entry;
+
+            snprintf(memmap_line, 256, "MFTAH ramdisk #%u at 0x%X (0x%X bytes)%s.\r\n",
+                ramdisk->index, ramdisk->base, ramdisk->length,
+                (ramdisk->flags & MFTAH_BOOTINFO_RAMDISK_BOOT) ? " -- boot device" : "");
+            uart_puts(memmap_line); for (int i = 0; i < strlen(memmap_line); ++i) memmap_line[i] = 0x00;
+        }
+    }
+
+    /* MFTAH-UEFI may have left most of the boot ramdisk encrypted to start the kernel sooner.
+        Until the APs are brought up, the BSP finishes all of it here; once they are, each one
+        can join in through handoff_work while the BSP carries on with initialization. */
+    mftah_handoff_record *handoff = handoff_find(info_tag);
+    if (NULL != handoff) {
+        snprintf(memmap_line, 256, "Finishing ramdisk decryption (%u chunks) from handoff record 0x%X.\r\n",
+            (unsigned int)handoff->chunk_count, (uint64_t)handoff);
+        uart_puts(memmap_line); for (int i = 0; i < strlen(memmap_line); ++i) memmap_line[i] = 0x00;
+
+        if (handoff_begin(handoff) < 0) {
+            uart_puts("Invalid MFTAH handoff record.\r\n");
+            return -1;
+        }
+
+        handoff_work(handoff);
+        if (!handoff_complete(handoff)) {
+            uart_puts("Ramdisk decryption did not complete.\r\n");
+            return -1;
+        }
+        handoff_end(handoff);
+
+        uart_puts("Ramdisk decryption complete.\r\n");
+    }
+
     return 0;
 }
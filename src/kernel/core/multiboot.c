@@ -16,7 +16,8 @@ multiboot2_seek_tag(multiboot_info_tag_type of_type,
         p < (void *)((uint64_t)head + head->total_size);
     ) {
         if (of_type != ((multiboot_info_tag_header *)p)->type) {
-            p = (void *)((uint64_t)p + ((multiboot_info_tag_header *)p)->size);
+            /* Tags start on 8-byte boundaries, but their sizes don't include the padding. */
+            p = (void *)((uint64_t)p + ((((multiboot_info_tag_header *)p)->size + 7) & ~7ULL));
             continue;
         }
 